@@ -2,6 +2,7 @@
 
 #include <json/json.h>
 #include <algorithm>
+#include <cstdio>
 #include <cstring>
 #include <fstream>
 #include <iostream>
@@ -34,11 +35,31 @@ IItem::Pointer auth_item(const std::string& url) {
       IItem::UnknownTimeStamp, IItem::FileType::Unknown);
 }
 
-std::string id(std::shared_ptr<ICloudProvider> p, IItem::Pointer i) {
-  Json::Value json;
-  if (p) json["p"] = p->name();
-  json["i"] = i->filename() + i->id();
-  return util::json::to_string(json);
+// name of the write-back journal of a mount of given providers; FNV-1a is
+// used, as the name has to stay the same between runs
+std::string journal_name(std::vector<IFileSystem::ProviderEntry> provider) {
+  std::sort(provider.begin(), provider.end(),
+            [](const IFileSystem::ProviderEntry& a,
+               const IFileSystem::ProviderEntry& b) {
+              return a.label_ < b.label_;
+            });
+  uint64_t hash = 14695981039346656037ULL;
+  for (auto&& entry : provider)
+    for (char c : entry.provider_->name() + "/" + entry.label_ + '\0') {
+      hash ^= static_cast<unsigned char>(c);
+      hash *= 1099511628211ULL;
+    }
+  std::stringstream stream;
+  stream << "cloudstorage-journal-" << std::hex << hash << ".json";
+  return stream.str();
+}
+
+std::string store_filename(const std::string& directory,
+                           IFileSystem::FileId inode) {
+  return util::join_path(directory, "cloudstorage-") +
+         std::to_string(
+             std::chrono::system_clock::now().time_since_epoch().count()) +
+         "-" + std::to_string(inode);
 }
 
 }  // namespace
@@ -50,7 +71,7 @@ FileSystem::Node::Node(std::shared_ptr<ICloudProvider> p, IItem::Pointer item,
     : provider_(p), item_(item), parent_(parent), inode_(inode), size_(size) {}
 
 FileSystem::Node::~Node() {
-  if (store_) (void)std::remove(cache_filename_.c_str());
+  if (store_ && !journaled_) (void)std::remove(cache_filename_.c_str());
 }
 
 FileSystem::FileId FileSystem::Node::inode() const { return inode_; }
@@ -83,21 +104,32 @@ void FileSystem::Node::set_upload_request(std::shared_ptr<IGenericRequest> r) {
 
 FileSystem::FileSystem(const std::vector<ProviderEntry>& provider,
                        IHttp::Pointer http,
-                       const std::string& temporary_directory)
+                       const std::string& temporary_directory,
+                       const std::string& cache_directory, Options options)
     : next_(1),
       running_(true),
       http_(std::move(http)),
+      options_(options),
       temporary_directory_(temporary_directory),
+      journal_filename_(util::join_path(
+          cache_directory.empty() ? temporary_directory : cache_directory,
+          journal_name(provider))),
+      metadata_(MetadataCache::create(cache_directory)),
       cancelled_request_thread_(std::async(
           std::launch::async, std::bind(&FileSystem::cancelled, this))),
       cleanup_(std::async(std::launch::async,
-                          std::bind(&FileSystem::cleanup, this))) {
+                          std::bind(&FileSystem::cleanup, this))),
+      write_back_thread_(std::async(std::launch::async,
+                                    std::bind(&FileSystem::write_back, this))),
+      watch_thread_(std::async(std::launch::async,
+                               std::bind(&FileSystem::watch, this, provider))) {
   add(nullptr, 0,
       util::make_unique<cloudstorage::Item>("/", "root", IItem::UnknownSize,
                                             IItem::UnknownTimeStamp,
                                             IItem::FileType::Directory));
   std::unordered_set<FileId> root_directory;
   for (auto&& entry : provider) {
+    provider_label_[entry.provider_.get()] = entry.label_;
     IItem::Pointer item = util::make_unique<cloudstorage::Item>(
         entry.label_, entry.provider_->rootDirectory()->id(),
         IItem::UnknownSize, IItem::UnknownTimeStamp,
@@ -108,15 +140,28 @@ FileSystem::FileSystem(const std::vector<ProviderEntry>& provider,
         add(entry.provider_, provider_id, auth_item(entry.provider_->name()))
             ->inode();
   }
-  node_directory_[1] = root_directory;
+  set_children(1, root_directory);
+  load_journal();
 }
 
 FileSystem::~FileSystem() {
-  running_ = false;
+  {
+    std::lock_guard<mutex> lock(write_back_mutex_);
+    running_ = false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(watch_mutex_);
+    if (watch_request_) watch_request_->cancel();
+  }
+  watch_condition_.notify_one();
+  write_back_condition_.notify_one();
   request_data_condition_.notify_one();
   cancelled_request_condition_.notify_one();
+  watch_thread_.wait();
+  write_back_thread_.wait();
   cancelled_request_thread_.wait();
   cleanup_.wait();
+  save_journal();
 }
 
 void FileSystem::cleanup() {
@@ -169,6 +214,17 @@ void FileSystem::add(RequestData r) {
   request_data_condition_.notify_one();
 }
 
+std::string FileSystem::id(std::shared_ptr<ICloudProvider> p,
+                           IItem::Pointer i) const {
+  Json::Value json;
+  if (p) {
+    json["p"] = p->name();
+    json["l"] = provider_label_.at(p.get());
+  }
+  json["i"] = i->filename() + i->id();
+  return util::json::to_string(json);
+}
+
 FileSystem::Node::Pointer FileSystem::add(std::shared_ptr<ICloudProvider> p,
                                           FileId parent, IItem::Pointer i) {
   std::lock_guard<mutex> lock(node_data_mutex_);
@@ -176,10 +232,11 @@ FileSystem::Node::Pointer FileSystem::add(std::shared_ptr<ICloudProvider> p,
   if (it == std::end(node_id_map_)) {
     auto idx = next_++;
     auto node = std::make_shared<Node>(p, i, parent, idx, i->size());
-    node_map_[idx] = node;
+    insert_node(idx, node);
     node_id_map_[id(p, i)] = node;
+    index_node(node);
     if (parent > 0) {
-      auto parent_node = node_map_[parent];
+      auto parent_node = get(parent);
       node->path_ = parent_node->path_ + "/" + sanitize(i->filename());
       node_path_to_id_[node->path_] = idx;
     } else {
@@ -193,30 +250,80 @@ FileSystem::Node::Pointer FileSystem::add(std::shared_ptr<ICloudProvider> p,
 void FileSystem::set(FileId idx, Node::Pointer node) {
   std::lock_guard<mutex> lock(node_data_mutex_);
   if (node->item()) {
-    node_map_[idx] = node;
+    auto previous = find_node(idx);
+    if (previous && previous != node) {
+      auto& old = *previous;
+      std::lock_guard<mutex> node_lock(old.mutex_);
+      if (old.store_ && !node->store_) {
+        node->cache_filename_ = old.cache_filename_;
+        node->store_ = std::move(old.store_);
+        node->written_ = std::move(old.written_);
+        node->base_ = old.base_;
+        node->remote_size_ = old.remote_size_;
+        node->journaled_ = old.journaled_;
+        node->resumable_ = old.resumable_;
+        node->generation_ = old.generation_;
+        node->unflushed_size_ = old.unflushed_size_;
+        node->size_ = old.size_;
+        old.written_.clear();
+      }
+    }
+    if (previous != node) {
+      if (previous) unindex_node(previous);
+      index_node(node);
+    }
+    insert_node(idx, node);
     node_id_map_[id(node->provider(), node->item())] = node;
     if (node->parent_ > 0) {
       node->path_ =
-          node_map_[node->parent_]->path_ + "/" + sanitize(node->filename());
+          get(node->parent_)->path_ + "/" + sanitize(node->filename());
       node_path_to_id_[node->path_] = idx;
     } else {
       node_path_to_id_[""] = idx;
     }
   } else {
-    auto it1 = node_map_.find(idx);
-    if (it1 != std::end(node_map_)) {
+    if (auto previous = find_node(idx)) {
       auto it2 =
-          node_id_map_.find(id(it1->second->provider(), it1->second->item()));
-      if (it2 != std::end(node_id_map_)) node_id_map_.erase(it2);
-      node_map_.erase(it1);
+          node_id_map_.find(id(previous->provider(), previous->item()));
+      if (it2 != std::end(node_id_map_) && it2->second == previous)
+        node_id_map_.erase(it2);
+      auto it4 = node_path_to_id_.find(previous->path_);
+      if (it4 != node_path_to_id_.end() && it4->second == idx)
+        node_path_to_id_.erase(it4);
+      unindex_node(previous);
+      erase_node(idx);
     }
-    auto it3 = node_directory_.find(idx);
-    if (it3 != std::end(node_directory_)) node_directory_.erase(it3);
-    auto it4 = node_path_to_id_.find(node->path_);
-    if (it4 != node_path_to_id_.end()) node_path_to_id_.erase(it4);
+    node_directory_.erase(idx);
+    node_name_.erase(idx);
+    node_missing_.erase(idx);
+    node_timestamp_.erase(idx);
+    node_changed_.erase(idx);
   }
 }
 
+FileSystem::NodeShard& FileSystem::shard(FileId node) {
+  return node_shard_[node % NODE_SHARD_COUNT];
+}
+
+FileSystem::Node::Pointer FileSystem::find_node(FileId node) {
+  auto& shard = this->shard(node);
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+  auto it = shard.node_.find(node);
+  return it == shard.node_.end() ? nullptr : it->second;
+}
+
+void FileSystem::insert_node(FileId idx, Node::Pointer node) {
+  auto& shard = this->shard(idx);
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+  shard.node_[idx] = node;
+}
+
+void FileSystem::erase_node(FileId node) {
+  auto& shard = this->shard(node);
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+  shard.node_.erase(node);
+}
+
 IFileSystem::FileId FileSystem::mknod(FileId parent, const char* name) {
   std::lock_guard<mutex> lock(node_data_mutex_);
   auto p = get(parent);
@@ -224,35 +331,138 @@ IFileSystem::FileId FileSystem::mknod(FileId parent, const char* name) {
   auto node = add(p->provider(), parent,
                   std::make_shared<Item>(name, "", 0, IItem::UnknownTimeStamp,
                                          IItem::FileType::Unknown));
-  node->cache_filename_ =
-      temporary_directory_ + "cloudstorage" + std::to_string(node->inode());
-  node->store_ = util::make_unique<std::fstream>(
-      node->cache_filename_,
-      std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
   {
-    std::lock_guard<mutex> lock(node_data_mutex_);
-    auto it = node_directory_.find(node->parent_);
-    if (it != node_directory_.end()) it->second.insert(node->inode());
+    std::lock_guard<mutex> lock(node->mutex_);
+    node->open_store(store_filename(temporary_directory_, node->inode()), true);
+    node->base_ = false;
   }
+  add_child(node->parent_, node);
+  modified(node);
   return node->inode();
 }
 
+void FileSystem::add_child(FileId parent, Node::Pointer node) {
+  std::lock_guard<mutex> lock(node_data_mutex_);
+  auto it = node_directory_.find(parent);
+  if (it == node_directory_.end() || !it->second.insert(node->inode()).second)
+    return;
+  auto name = sanitize(node->filename());
+  node_name_[parent].insert({name, node->inode()});
+  auto missing = node_missing_.find(parent);
+  if (missing != node_missing_.end()) missing->second.erase(name);
+}
+
+void FileSystem::remove_child(FileId parent, Node::Pointer node) {
+  std::lock_guard<mutex> lock(node_data_mutex_);
+  auto it = node_directory_.find(parent);
+  if (it == node_directory_.end() || it->second.erase(node->inode()) == 0)
+    return;
+  auto& names = node_name_[parent];
+  auto range = names.equal_range(sanitize(node->filename()));
+  for (auto name = range.first; name != range.second; ++name)
+    if (name->second == node->inode()) {
+      names.erase(name);
+      break;
+    }
+}
+
+void FileSystem::set_children(FileId parent,
+                              const std::unordered_set<FileId>& children) {
+  std::lock_guard<mutex> lock(node_data_mutex_);
+  node_directory_[parent] = children;
+  auto& names = node_name_[parent];
+  names.clear();
+  names.reserve(children.size());
+  for (auto&& child : children)
+    if (auto node = find_node(child))
+      names.insert({sanitize(node->filename()), child});
+  node_missing_.erase(parent);
+}
+
+void FileSystem::restore_children(FileId parent) {
+  if (!metadata_) return;
+  {
+    std::lock_guard<mutex> lock(node_data_mutex_);
+    if (node_directory_.find(parent) != node_directory_.end()) return;
+  }
+  auto nd = get(parent);
+  if (!nd->provider() || nd->type() != IItem::FileType::Directory) return;
+  MetadataCache::Listing listing;
+  if (!metadata_->get(id(nd->provider(), nd->item()), listing)) return;
+  std::lock_guard<mutex> lock(node_data_mutex_);
+  if (node_directory_.find(parent) != node_directory_.end()) return;
+  std::unordered_set<FileId> children;
+  for (auto&& i : listing.items_)
+    children.insert(add(nd->provider(), parent, i)->inode());
+  set_children(parent, children);
+  node_timestamp_[parent] = listing.timestamp_;
+}
+
+FileSystem::Node::Pointer FileSystem::find_child(FileId parent,
+                                                 const std::string& name) {
+  std::lock_guard<mutex> lock(node_data_mutex_);
+  auto names = node_name_.find(parent);
+  if (names == node_name_.end()) return nullptr;
+  auto it = names->second.find(name);
+  if (it == names->second.end()) return nullptr;
+  return get(it->second);
+}
+
+bool FileSystem::known_missing(FileId parent, const std::string& name) {
+  std::lock_guard<mutex> lock(node_data_mutex_);
+  auto missing = node_missing_.find(parent);
+  if (missing == node_missing_.end()) return false;
+  auto it = missing->second.find(name);
+  if (it == missing->second.end()) return false;
+  if (std::chrono::system_clock::now() - it->second <= NEGATIVE_LOOKUP_DURATION)
+    return true;
+  missing->second.erase(it);
+  return false;
+}
+
+void FileSystem::set_missing(FileId parent, const std::string& name) {
+  std::lock_guard<mutex> lock(node_data_mutex_);
+  auto& missing = node_missing_[parent];
+  auto now = std::chrono::system_clock::now();
+  if (missing.size() >= MAX_NEGATIVE_LOOKUP_COUNT) {
+    for (auto it = missing.begin(); it != missing.end();)
+      if (now - it->second > NEGATIVE_LOOKUP_DURATION)
+        it = missing.erase(it);
+      else
+        ++it;
+    if (missing.size() >= MAX_NEGATIVE_LOOKUP_COUNT) missing.clear();
+  }
+  missing[name] = now;
+}
+
 FileSystem::Node::Pointer FileSystem::get(FileId node) {
-  std::unique_lock<mutex> lock(node_data_mutex_);
-  auto it = node_map_.find(node);
-  if (it == node_map_.end())
-    return std::make_shared<Node>();
-  else
-    return it->second;
+  if (auto result = find_node(node)) return result;
+  return std::make_shared<Node>();
 }
 
 void FileSystem::lookup(FileId parent_node, const std::string& name,
                         GetItemCallback cb) {
+  if (auto node = find_child(parent_node, name))
+    return cb(std::static_pointer_cast<INode>(node));
+  if (known_missing(parent_node, name))
+    return cb(Error{IHttpRequest::NotFound, "not found"});
   readdir(parent_node, [=](EitherError<INode::List> e) {
     if (auto lst = e.right()) {
-      for (auto&& i : *lst)
-        if (this->sanitize(i->filename()) == name) return cb(i);
-      cb(Error{IHttpRequest::Bad, "not found"});
+      if (auto node = this->find_child(parent_node, name))
+        return cb(std::static_pointer_cast<INode>(node));
+      bool listed;
+      {
+        std::lock_guard<mutex> lock(node_data_mutex_);
+        listed = node_name_.find(parent_node) != node_name_.end();
+      }
+      if (!listed) {
+        for (auto&& i : *lst)
+          if (this->sanitize(i->filename()) == name) return cb(i);
+        return cb(Error{IHttpRequest::ServiceUnavailable,
+                        "couldn't list directory"});
+      }
+      this->set_missing(parent_node, name);
+      cb(Error{IHttpRequest::NotFound, "not found"});
     } else {
       cb(e.left());
     }
@@ -337,27 +547,40 @@ void FileSystem::write(FileId inode, const char* data, uint32_t size,
                        uint64_t offset, WriteDataCallback callback) {
   getattr(inode, [=](EitherError<INode> e) {
     if (e.left()) return callback(0);
-    auto n = static_cast<Node*>(e.right().get());
-    std::lock_guard<mutex> lock(n->mutex_);
-    if (!n->store_) {
-      n->cache_filename_ =
-          temporary_directory_ + "cloudstorage" + std::to_string(n->inode());
-      n->store_ = util::make_unique<std::fstream>(
-          n->cache_filename_,
-          std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
-    }
-    util::log("writing", e.right()->filename(), offset, "-", offset + size - 1);
-    n->store_->seekp(offset);
-    n->store_->write(data, size);
-    if (!n->store_)
-      return callback(0);
-    else
-      return callback(size);
+    auto n = std::static_pointer_cast<Node>(e.right());
+    uint64_t unflushed;
+    {
+      std::lock_guard<mutex> lock(n->mutex_);
+      if (!n->store_) {
+        n->open_store(store_filename(temporary_directory_, n->inode()), true);
+        n->remote_size_ = n->size_;
+      }
+      util::log("writing", e.right()->filename(), offset, "-",
+                offset + size - 1);
+      n->store_->seekp(offset);
+      n->store_->write(data, size);
+      if (!*n->store_) {
+        n->store_->clear();
+        return callback(0);
+      }
+      n->mark_written({offset, size});
+      n->size_ = std::max<uint64_t>(n->size_, offset + size);
+      n->generation_++;
+      n->resumable_ = false;
+      unflushed = n->unflushed_size_ += size;
+    }
+    modified(n);
+    if (unflushed >= FLUSH_THRESHOLD)
+      schedule_flush(inode, std::chrono::seconds(0));
+    callback(size);
   });
 }
 
 void FileSystem::readdir(FileId node, ListDirectoryCallback cb) {
   bool reported = false;
+  bool up_to_date = false;
+  restore_children(node);
+  auto nd = get(node);
   {
     std::unique_lock<mutex> lock(node_data_mutex_);
     auto it = node_directory_.find(node);
@@ -365,37 +588,38 @@ void FileSystem::readdir(FileId node, ListDirectoryCallback cb) {
       INode::List ret;
       for (auto&& r : it->second) ret.push_back(get(r));
       reported = true;
+      auto timestamp = node_timestamp_.find(node);
+      up_to_date = timestamp != node_timestamp_.end() &&
+                   fresh(nd, timestamp->second);
       lock.unlock();
       cb(ret);
     }
   }
-  auto nd = get(node);
   if (nd->provider() == nullptr && !reported)
     return cb(Error{IHttpRequest::Bad, ""});
   std::unique_lock<std::recursive_mutex> lock(nd->mutex_);
-  if (reported) {
-    if (nd->list_directory_pending_) return;
-    auto it = node_timestamp_.find(node);
-    if (it != node_timestamp_.end() &&
-        std::chrono::system_clock::now() - it->second <=
-            CACHE_DIRECTORY_DURATION) {
-      return;
-    }
-  }
+  if (reported && (nd->list_directory_pending_ || up_to_date)) return;
   nd->list_directory_pending_ = true;
   lock.unlock();
+  auto requested = std::chrono::system_clock::now();
   list_directory_async(
       nd->provider(), nd->item(), [=](EitherError<IItem::List> e) {
         if (auto lst = e.right()) {
           std::unordered_set<FileId> ret;
+          MetadataCache::Listing listing;
+          listing.timestamp_ = requested;
           for (auto&& i : *lst)
             if (i->type() == IItem::FileType::Directory ||
-                i->size() != IItem::UnknownSize || !IGNORE_UNKNOWN_SIZE)
+                i->size() != IItem::UnknownSize || !IGNORE_UNKNOWN_SIZE) {
               ret.insert(this->add(nd->provider(), node, i)->inode());
+              listing.items_.push_back(i);
+            }
+          if (metadata_)
+            metadata_->put(id(nd->provider(), nd->item()), listing);
           {
             std::lock_guard<mutex> lock(node_data_mutex_);
-            node_directory_[node] = ret;
-            node_timestamp_[node] = std::chrono::system_clock::now();
+            set_children(node, ret);
+            node_timestamp_[node] = requested;
           }
           if (!reported) {
             INode::List nodes;
@@ -407,7 +631,7 @@ void FileSystem::readdir(FileId node, ListDirectoryCallback cb) {
             auto item = auth_item(nd->provider()->authorizeLibraryUrl());
             cb(INode::List(
                 1, std::make_shared<Node>(nd->provider(), item, node,
-                                          auth_node_[nd->provider()->name()],
+                                          auth_node_[provider_label_.at(nd->provider().get())],
                                           item->size())));
           }
         }
@@ -420,79 +644,259 @@ void FileSystem::readdir(FileId node, ListDirectoryCallback cb) {
 
 void FileSystem::read(FileId node, size_t offset, size_t sz,
                       DownloadItemCallback cb) {
+  read_buffers(node, offset, sz, [=](EitherError<BufferList> e) {
+    if (e.left()) return cb(e.left());
+    std::string data;
+    for (auto&& buffer : *e.right())
+      data.append(*buffer.data_, buffer.offset_, buffer.size_);
+    cb(data);
+  });
+}
+
+void FileSystem::read_buffers(FileId node, size_t offset, size_t sz,
+                              ReadBuffersCallback cb) {
   getattr(node, [=](EitherError<INode> e) {
     if (e.left()) return cb(e.left());
     auto nd = std::static_pointer_cast<Node>(e.right());
     if (nd->size() == IItem::UnknownSize || nd->size() == 0 || !nd->provider())
-      return cb(std::string());
+      return cb(BufferList());
     if (nd->item()->id() == AUTH_ITEM_ID) {
-      auto data = authorize_file(nd->provider()->authorizeLibraryUrl());
-      auto start = std::min<size_t>(offset, data.size() - 1);
-      auto size = std::min<size_t>(data.size() - start, sz);
-      auto d = data.substr(start, size);
-      return cb(d);
-    }
-    auto fit = [=](Range r) {
-      r.start_ =
-          std::min<size_t>(r.start_, static_cast<size_t>(nd->size() - 1));
-      r.size_ =
-          std::min<size_t>(r.size_, static_cast<size_t>(nd->size() - r.start_));
-      return r;
-    };
-    Range range = fit({offset, sz});
-    std::unique_lock<mutex> lock(nd->mutex_);
-    auto inside = [=](Range r1, Range r2) {
-      r1 = fit(r1);
-      r2 = fit(r2);
-      return r1.start_ >= r2.start_ &&
-             r1.start_ + r1.size_ <= r2.start_ + r2.size_;
-    };
-    auto download = [=](Range range) {
-      for (auto&& download_range : nd->pending_download_)
-        if (inside(range, download_range)) return;
-      range = fit({range.start_, std::max<size_t>(range.size_, READ_AHEAD)});
-      nd->pending_download_.push_back(range);
-      download_item_async(
-          nd->provider(), nd->item(), range, [=](EitherError<std::string> e) {
-            std::unique_lock<mutex> lock(nd->mutex_);
-            auto requests = nd->read_request_;
-            for (auto&& read : requests)
-              if (inside(read.range_, range)) {
-                if (e.left())
-                  read.callback_(e.left());
-                else
-                  read.callback_(e.right()->substr(
-                      read.range_.start_ - range.start_, read.range_.size_));
-                auto it = std::find(nd->read_request_.begin(),
-                                    nd->read_request_.end(), read);
-                if (it != nd->read_request_.end()) nd->read_request_.erase(it);
-              }
-            auto it = std::find(nd->pending_download_.begin(),
-                                nd->pending_download_.end(), range);
-            if (it != nd->pending_download_.end())
-              nd->pending_download_.erase(it);
-            if (e.right()) {
-              nd->chunk_.push_back({range, std::move(*e.right())});
-              if (nd->chunk_.size() >= CACHED_CHUNK_COUNT)
-                nd->chunk_.pop_front();
-            }
-          });
-    };
-    bool read_ahead = true;
-    for (auto&& chunk : nd->chunk_)
-      if (inside(Range{range.start_ + READ_AHEAD / 2, READ_AHEAD / 2},
-                 chunk.range_))
-        read_ahead = false;
-    if (read_ahead) download(Range{range.start_ + READ_AHEAD / 2, range.size_});
-    for (auto&& chunk : nd->chunk_)
-      if (inside(range, chunk.range_))
-        return cb(chunk.data_.substr(range.start_ - chunk.range_.start_,
-                                     range.size_));
-    nd->read_request_.push_back({range, cb});
-    download(range);
+      auto data = std::make_shared<const std::string>(
+          authorize_file(nd->provider()->authorizeLibraryUrl()));
+      auto start = std::min<size_t>(offset, data->size() - 1);
+      auto size = std::min<size_t>(data->size() - start, sz);
+      return cb(BufferList{{data, start, size}});
+    }
+    std::lock_guard<mutex> lock(nd->mutex_);
+    if (offset >= nd->size()) return cb(BufferList());
+    Range range = {offset, std::min<uint64_t>(sz, nd->size() - offset)};
+    if (nd->store_)
+      read_written(nd, range, cb);
+    else
+      read_chunks(nd, range, cb);
   });
 }
 
+void FileSystem::read_written(Node::Pointer nd, Range range,
+                              ReadBuffersCallback cb) {
+  std::lock_guard<mutex> lock(nd->mutex_);
+  auto end = range.start_ + range.size_;
+  auto remote_end = std::min(end, nd->remote_size_);
+  if (!nd->base_ || range.start_ >= remote_end || nd->written(range)) {
+    auto data = std::make_shared<const std::string>(nd->read_store(range));
+    return cb(BufferList{{data, 0, range.size_}});
+  }
+  read_chunks(
+      nd, {range.start_, remote_end - range.start_},
+      [=](EitherError<BufferList> e) {
+        if (e.left()) return cb(e.left());
+        auto data = std::make_shared<std::string>();
+        data->reserve(range.size_);
+        for (auto&& buffer : *e.right())
+          data->append(*buffer.data_, buffer.offset_, buffer.size_);
+        data->resize(range.size_);
+        std::lock_guard<mutex> lock(nd->mutex_);
+        auto it = nd->written_.upper_bound(range.start_);
+        if (it != nd->written_.begin()) --it;
+        for (; it != nd->written_.end() && it->first < end; ++it) {
+          auto start = std::max(it->first, range.start_);
+          auto stop = std::min(it->second, end);
+          if (start >= stop) continue;
+          auto written = nd->read_store({start, stop - start});
+          data->replace(start - range.start_, written.size(), written);
+        }
+        cb(BufferList{{data, 0, range.size_}});
+      });
+}
+
+void FileSystem::read_chunks(Node::Pointer nd, Range range,
+                             ReadBuffersCallback cb) {
+  std::lock_guard<mutex> lock(nd->mutex_);
+  auto read_ahead = nd->read_ahead(range);
+  auto window =
+      std::max<uint64_t>(MIN_READ_WINDOW, read_ahead / READ_WINDOW_COUNT);
+  BufferList data;
+  bool cached = nd->slice(range, data);
+  if (!cached) nd->read_request_.push_back({range, cb});
+  fetch(nd, range.start_, range.start_ + range.size_ + read_ahead, window);
+  if (cached) cb(data);
+}
+
+uint64_t FileSystem::Node::read_ahead(Range range) {
+  bool sequential =
+      range.start_ + SEQUENTIAL_READ_DISTANCE >= read_end_ &&
+      range.start_ <= read_end_ + SEQUENTIAL_READ_DISTANCE;
+  if (sequential)
+    read_ahead_ = std::min(MAX_READ_AHEAD,
+                           std::max(MIN_READ_AHEAD, 2 * read_ahead_));
+  else if ((read_ahead_ /= 4) < MIN_READ_AHEAD)
+    read_ahead_ = 0;
+  read_end_ = range.start_ + range.size_;
+  return read_ahead_;
+}
+
+bool FileSystem::Node::slice(Range range, BufferList& output) {
+  output.clear();
+  auto it = chunk_.upper_bound(range.start_);
+  if (it == chunk_.begin()) return false;
+  --it;
+  auto position = range.start_;
+  auto end = range.start_ + range.size_;
+  for (; position < end; ++it) {
+    if (it == chunk_.end() || !it->second.ready_ || it->first > position ||
+        it->first + it->second.range_.size_ <= position)
+      return false;
+    auto& chunk = it->second;
+    auto start = position - it->first;
+    auto length =
+        std::min<uint64_t>(end - position, chunk.data_->size() - start);
+    output.push_back({chunk.data_, start, length});
+    chunk.last_access_ = ++access_count_;
+    position += length;
+  }
+  return true;
+}
+
+bool FileSystem::Node::pending(Range range) const {
+  auto it = chunk_.upper_bound(range.start_);
+  if (it != chunk_.begin()) --it;
+  for (; it != chunk_.end() && it->first < range.start_ + range.size_; ++it)
+    if (!it->second.ready_ &&
+        it->first + it->second.range_.size_ > range.start_)
+      return true;
+  return false;
+}
+
+void FileSystem::Node::evict() {
+  auto wanted = [=](const Chunk& chunk) {
+    for (auto&& read : read_request_)
+      if (read.range_.start_ < chunk.range_.start_ + chunk.range_.size_ &&
+          chunk.range_.start_ < read.range_.start_ + read.range_.size_)
+        return true;
+    return false;
+  };
+  while (cached_size_ > MAX_CACHED_READ_SIZE) {
+    auto victim = chunk_.end();
+    for (auto it = chunk_.begin(); it != chunk_.end(); ++it)
+      if (it->second.ready_ && !wanted(it->second) &&
+          (victim == chunk_.end() ||
+           it->second.last_access_ < victim->second.last_access_))
+        victim = it;
+    if (victim == chunk_.end()) return;
+    cached_size_ -= victim->second.data_->size();
+    chunk_.erase(victim);
+  }
+}
+
+Range FileSystem::Node::clean(uint64_t start, uint64_t end) const {
+  auto it = written_.upper_bound(start);
+  if (it != written_.begin()) start = std::max(start, std::prev(it)->second);
+  if (start >= end) return {end, 0};
+  auto limit = it == written_.end() ? end : std::min(end, it->first);
+  return {start, limit - start};
+}
+
+bool FileSystem::Node::written(Range range) const {
+  return clean(range.start_, range.start_ + range.size_).size_ == 0;
+}
+
+void FileSystem::Node::mark_written(Range range) {
+  auto start = range.start_;
+  auto end = range.start_ + range.size_;
+  auto it = written_.upper_bound(start);
+  if (it != written_.begin() && std::prev(it)->second >= start) {
+    --it;
+    start = it->first;
+  }
+  while (it != written_.end() && it->first <= end) {
+    end = std::max(end, it->second);
+    it = written_.erase(it);
+  }
+  written_[start] = end;
+}
+
+void FileSystem::Node::open_store(const std::string& filename,
+                                  bool truncate) {
+  auto mode = std::ios::in | std::ios::out | std::ios::binary;
+  if (truncate) mode |= std::ios::trunc;
+  cache_filename_ = filename;
+  store_ = util::make_unique<std::fstream>(filename, mode);
+}
+
+std::string FileSystem::Node::read_store(Range range) {
+  std::string data(range.size_, 0);
+  store_->seekg(range.start_);
+  store_->read(&data[0], range.size_);
+  store_->clear();
+  return data;
+}
+
+void FileSystem::Node::discard_store() {
+  if (!store_) return;
+  store_ = nullptr;
+  written_.clear();
+  (void)std::remove(cache_filename_.c_str());
+}
+
+void FileSystem::fetch(Node::Pointer nd, uint64_t start, uint64_t end,
+                       uint64_t window) {
+  auto size = nd->store_ ? nd->remote_size_ : nd->size();
+  end = std::min(end, size);
+  std::vector<Range> missing;
+  auto it = nd->chunk_.upper_bound(start);
+  if (it != nd->chunk_.begin()) {
+    auto previous = std::prev(it);
+    start = std::max(start, previous->first + previous->second.range_.size_);
+  }
+  while (start < end) {
+    auto limit = it == nd->chunk_.end() ? size : it->first;
+    for (; start < std::min(end, limit); start += missing.back().size_)
+      missing.push_back({start, std::min(window, limit - start)});
+    if (it == nd->chunk_.end()) break;
+    start = std::max(start, it->first + it->second.range_.size_);
+    ++it;
+  }
+  for (auto&& range : missing) {
+    nd->chunk_[range.start_] = {range, nullptr, false, 0};
+    download_item_async(
+        nd->provider(), nd->item(), range, [=](EitherError<std::string> e) {
+          std::lock_guard<mutex> lock(nd->mutex_);
+          auto it = nd->chunk_.find(range.start_);
+          if (it != nd->chunk_.end() && !it->second.ready_) {
+            if (e.right() && !e.right()->empty()) {
+              auto& chunk = it->second;
+              chunk.data_ = e.right();
+              chunk.range_.size_ = chunk.data_->size();
+              chunk.ready_ = true;
+              chunk.last_access_ = ++nd->access_count_;
+              nd->cached_size_ += chunk.data_->size();
+            } else {
+              nd->chunk_.erase(it);
+            }
+          }
+          complete_reads(nd, e);
+          nd->evict();
+        });
+  }
+}
+
+void FileSystem::complete_reads(Node::Pointer nd,
+                                EitherError<std::string> e) {
+  auto requests = std::move(nd->read_request_);
+  nd->read_request_.clear();
+  for (auto&& read : requests) {
+    BufferList data;
+    if (nd->slice(read.range_, data))
+      read.callback_(data);
+    else if (nd->pending(read.range_))
+      nd->read_request_.push_back(std::move(read));
+    else if (e.left())
+      read.callback_(e.left());
+    else
+      read.callback_(data);
+  }
+}
+
 void FileSystem::invalidate(FileId root) {
   std::lock_guard<mutex> lock(node_data_mutex_);
   auto it = node_directory_.find(root);
@@ -502,6 +906,8 @@ void FileSystem::invalidate(FileId root) {
       set(n, std::make_shared<Node>());
     }
     node_directory_.erase(it);
+    node_name_.erase(root);
+    node_missing_.erase(root);
   }
 }
 
@@ -531,15 +937,11 @@ void FileSystem::rename(FileId parent, const char* name, FileId newparent,
           if (e.right()) {
             std::lock_guard<mutex> lock(node_data_mutex_);
             this->invalidate(node->inode());
-            auto& old_lst = node_directory_[parent];
-            auto it = std::find(old_lst.begin(), old_lst.end(), node->inode());
-            if (it != std::end(old_lst)) old_lst.erase(it);
-            auto nit = node_directory_.find(newparent);
-            if (nit != std::end(node_directory_))
-              nit->second.insert(node->inode());
-            this->set(node->inode(),
-                      std::make_shared<Node>(p, e.right(), node->parent_,
-                                             node->inode(), node->size()));
+            this->remove_child(parent, node);
+            auto renamed = std::make_shared<Node>(
+                p, e.right(), node->parent_, node->inode(), node->size());
+            this->set(node->inode(), renamed);
+            this->add_child(newparent, renamed);
           }
           callback(e);
         });
@@ -550,17 +952,18 @@ void FileSystem::remove(FileId parent, const char* name,
                         DeleteItemCallback callback) {
   util::log("removing", name);
   auto update_lists = [=](Node::Pointer node) {
-    std::lock_guard<mutex> lock(node_data_mutex_);
-    auto it = node_directory_.find(parent);
-    if (it != node_directory_.end()) {
-      auto d = it->second.find(node->inode());
-      if (d != it->second.end()) it->second.erase(d);
-    }
+    this->remove_child(parent, node);
   };
   auto remove_file = [=](Node::Pointer node) {
     std::lock_guard<mutex> lock(node_data_mutex_);
-    if (node->upload_request()) {
-      this->cancel(node->upload_request());
+    bool local;
+    {
+      std::lock_guard<mutex> lock(node->mutex_);
+      local = node->store_ && !node->base_;
+    }
+    this->discard(node);
+    if (node->upload_request()) this->cancel(node->upload_request());
+    if (local) {
       update_lists(node);
       return callback(nullptr);
     }
@@ -591,64 +994,571 @@ void FileSystem::remove(FileId parent, const char* name,
 
 void FileSystem::fsync(FileId inode, DataSynchronizedCallback cb) {
   auto node = get(inode);
-  auto parent_node = get(node->parent_);
-  auto p = parent_node->provider();
-  if (!p) return cb(Error{IHttpRequest::ServiceUnavailable, ""});
+  if (!get(node->parent_)->provider())
+    return cb(Error{IHttpRequest::ServiceUnavailable, ""});
+  uint64_t unflushed;
   {
     std::lock_guard<mutex> lock(node->mutex_);
     if (!node->store_) return cb(nullptr);
+    unflushed = node->unflushed_size_;
   }
+  save_journal();
+  schedule_flush(inode, unflushed >= FLUSH_THRESHOLD
+                            ? std::chrono::system_clock::duration(0)
+                            : options_.flush_delay_);
+  cb(nullptr);
+}
+
+void FileSystem::modified(Node::Pointer node) {
+  std::lock_guard<mutex> lock(write_back_mutex_);
+  modified_.insert(node->inode());
+}
+
+void FileSystem::discard(Node::Pointer node) {
+  {
+    std::lock_guard<mutex> lock(node->mutex_);
+    if (!node->store_) return;
+    node->discard_store();
+    std::lock_guard<mutex> write_back_lock(write_back_mutex_);
+    modified_.erase(node->inode());
+    flush_time_.erase(node->inode());
+  }
+  save_journal();
+}
+
+void FileSystem::schedule_flush(FileId inode,
+                                std::chrono::system_clock::duration delay) {
+  {
+    std::lock_guard<mutex> lock(write_back_mutex_);
+    if (modified_.find(inode) == modified_.end()) return;
+    auto time = std::chrono::system_clock::now() + delay;
+    auto it = flush_time_.find(inode);
+    if (it == flush_time_.end())
+      flush_time_[inode] = time;
+    else
+      it->second = std::min(it->second, time);
+  }
+  write_back_condition_.notify_one();
+}
+
+void FileSystem::flushed(FileId inode) {
+  {
+    std::lock_guard<mutex> lock(write_back_mutex_);
+    flushing_.erase(inode);
+  }
+  write_back_condition_.notify_one();
+}
+
+void FileSystem::write_back() {
+  util::set_thread_name("fs-write-back");
+  std::unique_lock<mutex> lock(write_back_mutex_);
+  while (running_) {
+    auto now = std::chrono::system_clock::now();
+    auto next = std::chrono::system_clock::time_point::max();
+    std::vector<FileId> ready;
+    for (auto&& entry : flush_time_)
+      if (flushing_.find(entry.first) != flushing_.end())
+        continue;
+      else if (entry.second <= now)
+        ready.push_back(entry.first);
+      else
+        next = std::min(next, entry.second);
+    for (auto&& inode : ready) {
+      flush_time_.erase(inode);
+      flushing_.insert(inode);
+    }
+    std::vector<Json::Value> recovered;
+    if (!recover_queue_.empty()) {
+      if (recover_time_ <= now)
+        recovered.swap(recover_queue_);
+      else
+        next = std::min(next, recover_time_);
+    }
+    if (!ready.empty() || !recovered.empty()) {
+      lock.unlock();
+      for (auto&& inode : ready) flush(get(inode));
+      for (auto&& entry : recovered) recover(entry);
+      lock.lock();
+    } else if (next == std::chrono::system_clock::time_point::max()) {
+      write_back_condition_.wait(lock);
+    } else {
+      write_back_condition_.wait_until(lock, next);
+    }
+  }
+}
+
+void FileSystem::flush(Node::Pointer node) {
+  log("flushing", node->filename());
+  fill(node, 0, [=](EitherError<void> e) {
+    if (e.left()) {
+      log("couldn't fetch", node->filename(), e.left()->code_,
+          e.left()->description_);
+      this->schedule_flush(node->inode(), options_.flush_retry_delay_);
+      return this->flushed(node->inode());
+    }
+    this->upload(node);
+  });
+}
+
+void FileSystem::fill(Node::Pointer node, uint64_t start,
+                      GenericCallback<EitherError<void>> cb) {
+  Range range;
+  {
+    std::lock_guard<mutex> lock(node->mutex_);
+    if (!node->store_ || !running_)
+      return cb(Error{IHttpRequest::Aborted, "file discarded"});
+    if (!node->base_) return cb(nullptr);
+    range = node->clean(start, node->remote_size_);
+  }
+  if (range.size_ == 0) return cb(nullptr);
+  range.size_ = std::min(range.size_, FLUSH_FILL_WINDOW);
+  download_item_async(
+      node->provider(), node->item(), range, [=](EitherError<std::string> e) {
+        if (e.left()) return cb(e.left());
+        {
+          std::lock_guard<mutex> lock(node->mutex_);
+          if (!node->store_)
+            return cb(Error{IHttpRequest::Aborted, "file discarded"});
+          const auto& data = *e.right();
+          if (data.empty())
+            return cb(Error{IHttpRequest::Failure, "file shrunk"});
+          auto end = range.start_ + data.size();
+          if (data.size() < range.size_)
+            node->remote_size_ = std::min(node->remote_size_, end);
+          for (auto position = range.start_; position < end;) {
+            auto gap = node->clean(position, end);
+            if (gap.size_ == 0) break;
+            node->store_->seekp(gap.start_);
+            node->store_->write(data.data() + gap.start_ - range.start_,
+                                gap.size_);
+            if (!*node->store_) {
+              node->store_->clear();
+              return cb(Error{IHttpRequest::Failure, "couldn't write store"});
+            }
+            node->mark_written(gap);
+            position = gap.start_ + gap.size_;
+          }
+        }
+        this->fill(node, range.start_ + range.size_, cb);
+      });
+}
+
+void FileSystem::upload(Node::Pointer node) {
   class UploadCallback : public IUploadFileCallback {
    public:
     UploadCallback(FileSystem* ctx, std::shared_ptr<ICloudProvider> provider,
-                   Node::Pointer node, DeleteItemCallback cb)
-        : fuse_(ctx), provider_(provider), node_(node), callback_(cb) {
-      node_->store_->seekg(0, std::ios::end);
-      size_ = node_->store_->tellg();
-      node_->store_->seekg(std::ios::beg);
+                   Node::Pointer node)
+        : fuse_(ctx), provider_(provider), node_(node) {
+      std::lock_guard<mutex> lock(node_->mutex_);
+      size_ = node_->size_;
+      generation_ = node_->generation_;
+      node_->unflushed_size_ = 0;
+      node_->store_->flush();
     }
 
     uint32_t putData(char* data, uint32_t maxlength, uint64_t offset) override {
+      std::lock_guard<mutex> lock(node_->mutex_);
+      if (!node_->store_ || offset >= size_) return 0;
+      auto length = std::min<uint64_t>(maxlength, size_ - offset);
       node_->store_->seekg(offset);
-      node_->store_->read(data, maxlength);
-      return static_cast<uint32_t>(node_->store_->gcount());
+      node_->store_->read(data, length);
+      auto read = node_->store_->gcount();
+      node_->store_->clear();
+      std::fill(data + read, data + length, 0);
+      return static_cast<uint32_t>(length);
     }
 
     uint64_t size() override { return size_; }
 
     void done(EitherError<IItem> e) override {
-      if (e.left()) return callback_(e.left());
-      std::lock_guard<mutex> lock(fuse_->node_data_mutex_);
-      fuse_->set(node_->inode_,
-                 std::make_shared<Node>(provider_, e.right(), node_->parent_,
-                                        node_->inode_, e.right()->size()));
-      log("fsynced", node_->filename());
-      callback_(nullptr);
+      auto inode = node_->inode_;
+      if (e.left()) {
+        log("upload failed", node_->filename(), e.left()->code_,
+            e.left()->description_);
+        fuse_->schedule_flush(inode, fuse_->options_.flush_retry_delay_);
+        return fuse_->flushed(inode);
+      }
+      bool unchanged;
+      {
+        std::lock_guard<mutex> lock(node_->mutex_);
+        if (!node_->store_) return fuse_->flushed(inode);
+        unchanged = node_->generation_ == generation_;
+        if (unchanged) {
+          node_->discard_store();
+          std::lock_guard<mutex> write_back_lock(fuse_->write_back_mutex_);
+          fuse_->modified_.erase(inode);
+          fuse_->flush_time_.erase(inode);
+        }
+      }
+      auto uploaded = std::make_shared<Node>(provider_, e.right(),
+                                             node_->parent_, inode, size_);
+      fuse_->set(inode, uploaded);
+      if (!unchanged)
+        fuse_->schedule_flush(inode, fuse_->options_.flush_delay_);
+      fuse_->save_journal();
+      log("uploaded", node_->filename());
+      fuse_->flushed(inode);
     }
 
-    void progress(uint64_t, uint64_t now) override {
-      std::lock_guard<mutex> lock(fuse_->node_data_mutex_);
-      auto node = fuse_->get(node_->inode_);
-      node->set_size(now);
-      fuse_->set(node_->inode_, node);
-    }
+    void progress(uint64_t, uint64_t) override {}
 
    private:
     FileSystem* fuse_;
     std::shared_ptr<ICloudProvider> provider_;
     Node::Pointer node_;
-    DeleteItemCallback callback_;
     uint64_t size_;
+    uint64_t generation_;
   };
+  auto parent_node = get(node->parent_);
+  auto p = parent_node->provider();
+  {
+    std::lock_guard<mutex> lock(node->mutex_);
+    if (!node->store_ || !running_) return flushed(node->inode());
+  }
+  if (!p) {
+    schedule_flush(node->inode(), options_.flush_retry_delay_);
+    return flushed(node->inode());
+  }
   auto filename = node->filename();
-  log("fsync", filename);
-  std::shared_ptr<IGenericRequest> upload_request = p->uploadFileAsync(
-      parent_node->item(), filename,
-      util::make_unique<UploadCallback>(this, p, std::move(node), cb));
-  get(inode)->set_upload_request(upload_request);
+  bool resume;
+  {
+    std::lock_guard<mutex> lock(node->mutex_);
+    resume = util::exchange(node->resumable_, true);
+  }
+  // the journal has to know that the provider may hold a part of the file,
+  // an upload interrupted by a restart is continued then
+  if (!resume) save_journal();
+  log(resume ? "resuming upload of" : "uploading", filename);
+  auto callback = util::make_unique<UploadCallback>(this, p, node);
+  std::shared_ptr<IGenericRequest> upload_request =
+      resume ? p->resumeUploadFileAsync(parent_node->item(), filename,
+                                        std::move(callback))
+             : p->uploadFileAsync(parent_node->item(), filename,
+                                  std::move(callback));
+  node->set_upload_request(upload_request);
   add({p, upload_request});
 }
 
+void FileSystem::save_journal() {
+  std::vector<FileId> nodes;
+  Json::Value files(Json::arrayValue);
+  {
+    std::lock_guard<mutex> lock(write_back_mutex_);
+    nodes.assign(modified_.begin(), modified_.end());
+    for (auto&& entry : unrecovered_) files.append(entry);
+  }
+  for (auto&& inode : nodes) {
+    auto node = get(inode);
+    std::lock_guard<mutex> lock(node->mutex_);
+    if (!node->store_) continue;
+    node->store_->flush();
+    node->journaled_ = true;
+    Json::Value written(Json::arrayValue);
+    for (auto&& range : node->written_) {
+      Json::Value value(Json::arrayValue);
+      value.append(Json::UInt64(range.first));
+      value.append(Json::UInt64(range.second));
+      written.append(value);
+    }
+    Json::Value entry;
+    entry["path"] = node->path_;
+    entry["store"] = node->cache_filename_;
+    entry["size"] = Json::UInt64(node->size_);
+    entry["remote_size"] = Json::UInt64(node->remote_size_);
+    entry["base"] = node->base_;
+    entry["resumable"] = node->resumable_;
+    entry["written"] = written;
+    files.append(entry);
+  }
+  Json::Value json;
+  json["files"] = files;
+  std::lock_guard<mutex> lock(journal_mutex_);
+  const auto& filename = journal_filename_;
+  {
+    std::ofstream file(filename + ".tmp",
+                       std::ios::binary | std::ios::trunc);
+    file << util::json::to_string(json);
+    if (!file) return log("couldn't save journal", filename);
+  }
+  if (std::rename((filename + ".tmp").c_str(), filename.c_str()) != 0) {
+    (void)std::remove(filename.c_str());
+    if (std::rename((filename + ".tmp").c_str(), filename.c_str()) != 0)
+      log("couldn't save journal", filename);
+  }
+}
+
+void FileSystem::load_journal() {
+  std::ifstream file(journal_filename_, std::ios::binary);
+  if (!file) return;
+  Json::Value json;
+  try {
+    json = util::json::from_stream(file);
+  } catch (const Json::Exception&) {
+    return log("invalid journal", journal_filename_);
+  }
+  {
+    std::lock_guard<mutex> lock(write_back_mutex_);
+    for (auto&& entry : json["files"]) unrecovered_.push_back(entry);
+  }
+  for (auto&& entry : json["files"]) recover(entry);
+}
+
+void FileSystem::recover(Json::Value entry) {
+  auto path = entry["path"].asString();
+  auto separator = path.find_last_of('/');
+  if (separator == std::string::npos) return;
+  auto name = path.substr(separator + 1);
+  auto forget = [=] {
+    std::lock_guard<mutex> lock(write_back_mutex_);
+    auto it = std::find(unrecovered_.begin(), unrecovered_.end(), entry);
+    if (it != unrecovered_.end()) unrecovered_.erase(it);
+  };
+  auto retry = [=](const std::string& description) {
+    log("couldn't recover", path, description, "will retry");
+    {
+      std::lock_guard<mutex> lock(write_back_mutex_);
+      recover_queue_.push_back(entry);
+      recover_time_ =
+          std::chrono::system_clock::now() + options_.recover_retry_delay_;
+    }
+    write_back_condition_.notify_one();
+  };
+  get_path(1, path.substr(0, separator), [=](EitherError<INode> e) {
+    if (e.left()) {
+      if (e.left()->code_ != IHttpRequest::NotFound)
+        return retry(e.left()->description_);
+      // directory of the file is gone, so is the file
+      log("couldn't recover", path, e.left()->description_);
+      (void)std::remove(entry["store"].asString().c_str());
+      return forget();
+    }
+    auto parent = e.right()->inode();
+    this->lookup(parent, name, [=](EitherError<INode> e) {
+      // only a file which surely doesn't exist remotely is created anew,
+      // otherwise its remote part would be lost
+      if (e.left() && e.left()->code_ != IHttpRequest::NotFound)
+        return retry(e.left()->description_);
+      Node::Pointer node;
+      if (e.right()) {
+        node = std::static_pointer_cast<Node>(e.right());
+      } else {
+        auto parent_node = this->get(parent);
+        if (!parent_node->provider()) return;
+        node = this->add(
+            parent_node->provider(), parent,
+            std::make_shared<Item>(name, "", 0, IItem::UnknownTimeStamp,
+                                   IItem::FileType::Unknown));
+        this->add_child(parent, node);
+      }
+      {
+        std::lock_guard<mutex> lock(node->mutex_);
+        if (node->store_) return forget();
+        node->open_store(entry["store"].asString(), false);
+        if (!*node->store_) {
+          node->store_ = nullptr;
+          log("couldn't recover", path, "store missing");
+          return forget();
+        }
+        node->base_ = e.right() && entry["base"].asBool();
+        node->remote_size_ =
+            node->base_ ? entry["remote_size"].asUInt64() : 0;
+        node->size_ = entry["size"].asUInt64();
+        node->journaled_ = true;
+        node->resumable_ = entry["resumable"].asBool();
+        node->generation_++;
+        for (auto&& range : entry["written"])
+          node->written_[range[0].asUInt64()] = range[1].asUInt64();
+      }
+      forget();
+      this->modified(node);
+      this->schedule_flush(node->inode(), std::chrono::seconds(0));
+      log("recovered", path);
+    });
+  });
+}
+
+bool FileSystem::fresh(Node::Pointer node,
+                       std::chrono::system_clock::time_point timestamp) {
+  auto changed = node_changed_.find(node->inode());
+  if (changed != node_changed_.end() && changed->second >= timestamp)
+    return false;
+  auto age = std::chrono::system_clock::now() - timestamp;
+  std::lock_guard<std::mutex> lock(watch_mutex_);
+  auto watched = watched_since_.find(node->provider().get());
+  if (watched != watched_since_.end() && timestamp >= watched->second)
+    return age <= CACHE_WATCHED_DIRECTORY_DURATION;
+  return age <= CACHE_DIRECTORY_DURATION;
+}
+
+template <class T>
+EitherError<T> FileSystem::wait(std::unique_ptr<IRequest<EitherError<T>>> r) {
+  std::shared_ptr<IRequest<EitherError<T>>> request = std::move(r);
+  {
+    std::lock_guard<std::mutex> lock(watch_mutex_);
+    if (running_)
+      watch_request_ = request;
+    else
+      request->cancel();
+  }
+  auto result = request->result();
+  std::lock_guard<std::mutex> lock(watch_mutex_);
+  watch_request_ = nullptr;
+  return result;
+}
+
+void FileSystem::watch(std::vector<ProviderEntry> provider) {
+  util::set_thread_name("fs-watch");
+  std::vector<ChangeFeed> feed;
+  for (auto&& entry : provider) feed.push_back({entry.provider_, "", ""});
+  std::unique_lock<std::mutex> lock(watch_mutex_);
+  while (running_ && !feed.empty()) {
+    lock.unlock();
+    for (auto it = feed.begin(); it != feed.end() && running_;)
+      if (poll(*it))
+        ++it;
+      else
+        it = feed.erase(it);
+    lock.lock();
+    watch_condition_.wait_for(lock, WATCH_CHANGES_INTERVAL,
+                              [=] { return !running_; });
+  }
+}
+
+bool FileSystem::poll(ChangeFeed& feed) {
+  auto p = feed.provider_;
+  if (feed.cursor_.empty()) {
+    auto since = std::chrono::system_clock::now();
+    auto e = wait(p->listChangesAsync(""));
+    if (e.left())
+      return e.left()->code_ != IHttpRequest::ServiceUnavailable ||
+             e.left()->description_ != util::Error::UNIMPLEMENTED;
+    if (feed.root_id_.empty()) {
+      auto root = wait(p->getItemDataAsync(p->rootDirectory()->id()));
+      if (root.right()) feed.root_id_ = root.right()->id();
+    }
+    feed.cursor_ = e.right()->cursor_;
+    std::lock_guard<std::mutex> lock(watch_mutex_);
+    watched_since_[p.get()] = since;
+    return true;
+  }
+  while (running_) {
+    auto e = wait(p->listChangesAsync(feed.cursor_));
+    if (e.left()) {
+      if (!running_) break;
+      log("[FILESYSTEM] couldn't list changes of", p->name(), e.left()->code_,
+          e.left()->description_);
+      feed.cursor_.clear();
+      std::lock_guard<std::mutex> lock(watch_mutex_);
+      watched_since_.erase(p.get());
+      break;
+    }
+    apply(feed, *e.right());
+    feed.cursor_ = e.right()->cursor_;
+    if (!e.right()->has_more_) break;
+  }
+  return true;
+}
+
+void FileSystem::apply(const ChangeFeed& feed, const ChangeData& data) {
+  auto now = std::chrono::system_clock::now();
+  auto root_id = feed.provider_->rootDirectory()->id();
+  std::lock_guard<mutex> lock(node_data_mutex_);
+  auto& items = node_item_[feed.provider_.get()];
+  auto changed = [&](FileId directory) {
+    if (node_directory_.find(directory) == node_directory_.end()) return;
+    node_changed_[directory] = now;
+    node_missing_.erase(directory);
+  };
+  for (auto&& change : data.changes_) {
+    auto it = items.find(change.id_);
+    if (it != items.end())
+      for (auto&& inode : it->second)
+        if (auto node = find_node(inode)) {
+          changed(node->parent_);
+          changed(inode);
+        }
+    for (auto&& parent : change.parents_) {
+      auto it = items.find(parent == feed.root_id_ ? root_id : parent);
+      if (it != items.end())
+        for (auto&& inode : it->second) changed(inode);
+    }
+  }
+}
+
+void FileSystem::reference(FileId node) {
+  auto& shard = this->shard(node);
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+  shard.reference_count_[node]++;
+}
+
+void FileSystem::forget(FileId inode, uint64_t count) {
+  {
+    auto& shard = this->shard(inode);
+    std::lock_guard<std::mutex> lock(shard.mutex_);
+    auto it = shard.reference_count_.find(inode);
+    if (it == shard.reference_count_.end()) return;
+    if (it->second > count) {
+      it->second -= count;
+      return;
+    }
+    shard.reference_count_.erase(it);
+  }
+  std::lock_guard<mutex> lock(node_data_mutex_);
+  auto node = find_node(inode);
+  if (!node || pinned(node) || !evict_children(inode)) return;
+  auto parent = node_directory_.find(node->parent_);
+  if (parent != node_directory_.end() && parent->second.count(inode) > 0)
+    return;
+  set(inode, std::make_shared<Node>());
+}
+
+bool FileSystem::pinned(Node::Pointer node) {
+  if (node->parent_ <= 1 || node->item()->id() == AUTH_ITEM_ID) return true;
+  {
+    auto& shard = this->shard(node->inode());
+    std::lock_guard<std::mutex> lock(shard.mutex_);
+    if (shard.reference_count_.count(node->inode()) > 0) return true;
+  }
+  std::lock_guard<mutex> lock(write_back_mutex_);
+  return modified_.count(node->inode()) > 0 ||
+         flushing_.count(node->inode()) > 0;
+}
+
+void FileSystem::index_node(Node::Pointer node) {
+  if (!node->provider()) return;
+  node_item_[node->provider().get()][node->item()->id()].insert(node->inode());
+}
+
+void FileSystem::unindex_node(Node::Pointer node) {
+  if (!node->provider()) return;
+  auto& items = node_item_[node->provider().get()];
+  auto it = items.find(node->item()->id());
+  if (it == items.end()) return;
+  it->second.erase(node->inode());
+  if (it->second.empty()) items.erase(it);
+}
+
+bool FileSystem::evict_children(FileId parent) {
+  auto it = node_directory_.find(parent);
+  if (it == node_directory_.end()) return true;
+  auto children = std::move(it->second);
+  node_directory_.erase(it);
+  node_name_.erase(parent);
+  node_missing_.erase(parent);
+  node_timestamp_.erase(parent);
+  node_changed_.erase(parent);
+  bool evicted = true;
+  for (auto&& child : children) {
+    auto node = find_node(child);
+    if (!node) continue;
+    if (pinned(node) || !evict_children(child))
+      evicted = false;
+    else
+      set(child, std::make_shared<Node>());
+  }
+  return evicted;
+}
+
 void FileSystem::mkdir(FileId parent, const char* name,
                        GetItemCallback callback) {
   auto node = get(parent);
@@ -659,8 +1569,7 @@ void FileSystem::mkdir(FileId parent, const char* name,
          if (e.left()) return callback(e.left());
          std::lock_guard<mutex> lock(node_data_mutex_);
          auto node = this->add(p, parent, e.right());
-         auto it = node_directory_.find(parent);
-         if (it != node_directory_.end()) it->second.insert(node->inode());
+         this->add_child(parent, node);
          callback(std::static_pointer_cast<INode>(node));
        })});
 }
@@ -700,11 +1609,15 @@ void FileSystem::download_item_async(std::shared_ptr<ICloudProvider> p,
   if (!p || !item) return cb(Error{IHttpRequest::ServiceUnavailable, ""});
   class Callback : public IDownloadFileCallback {
    public:
-    Callback(DownloadItemCallback cb)
-        : start_(std::chrono::system_clock::now()), callback_(cb) {}
+    Callback(Range range, DownloadItemCallback cb)
+        : start_(std::chrono::system_clock::now()),
+          buffer_(std::make_shared<std::string>()),
+          callback_(cb) {
+      if (range.size_ != Range::Full) buffer_->reserve(range.size_);
+    }
 
     void receivedData(const char* data, uint32_t length) override {
-      buffer_ += std::string(data, length);
+      buffer_->append(data, length);
     }
 
     void done(EitherError<void> e) override {
@@ -719,12 +1632,13 @@ void FileSystem::download_item_async(std::shared_ptr<ICloudProvider> p,
 
    private:
     std::chrono::system_clock::time_point start_;
-    std::string buffer_;
+    std::shared_ptr<std::string> buffer_;
     DownloadItemCallback callback_;
   };
   log("requesting", item->filename(), range.start_, "-",
       range.start_ + range.size_ - 1);
-  add({p, p->downloadFileAsync(item, util::make_unique<Callback>(cb), range)});
+  add({p, p->downloadFileAsync(item, util::make_unique<Callback>(range, cb),
+                               range)});
 }
 
 void FileSystem::get_url_async(std::shared_ptr<ICloudProvider> p,
@@ -747,8 +1661,10 @@ std::string FileSystem::sanitize(const std::string& name) {
 
 IFileSystem::Pointer IFileSystem::create(
     const std::vector<ProviderEntry>& p, IHttp::Pointer http,
-    const std::string& temporary_directory) {
-  return util::make_unique<FileSystem>(p, std::move(http), temporary_directory);
+    const std::string& temporary_directory,
+    const std::string& cache_directory) {
+  return util::make_unique<FileSystem>(p, std::move(http), temporary_directory,
+                                       cache_directory, FileSystem::Options());
 }
 
 }  // namespace cloudstorage
@@ -1,6 +1,7 @@
 #ifndef FILE_SYSTEM_H
 #define FILE_SYSTEM_H
 
+#include <array>
 #include <atomic>
 #include <condition_variable>
 #include <deque>
@@ -8,24 +9,56 @@
 #include <future>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <mutex>
 #include <unordered_map>
 #include <unordered_set>
 
+#include <json/json.h>
+
 #include "ICloudStorage.h"
 #include "IFileSystem.h"
+#include "MetadataCache.h"
 #include "Utility/Utility.h"
 
 namespace cloudstorage {
 
-const int READ_AHEAD = 2 * 1024 * 1024;
-const int CACHED_CHUNK_COUNT = 4;
+const uint64_t MIN_READ_AHEAD = 1024 * 1024;
+const uint64_t MAX_READ_AHEAD = 16 * 1024 * 1024;
+const uint64_t MIN_READ_WINDOW = 128 * 1024;
+const uint64_t READ_WINDOW_COUNT = 4;
+const uint64_t SEQUENTIAL_READ_DISTANCE = 1024 * 1024;
+const uint64_t MAX_CACHED_READ_SIZE = 2 * MAX_READ_AHEAD;
 const auto CACHE_DIRECTORY_DURATION = std::chrono::seconds(60);
+const auto CACHE_WATCHED_DIRECTORY_DURATION = std::chrono::minutes(30);
+const auto WATCH_CHANGES_INTERVAL = std::chrono::seconds(30);
+const auto NEGATIVE_LOOKUP_DURATION = std::chrono::seconds(5);
+const size_t MAX_NEGATIVE_LOOKUP_COUNT = 1024;
+const size_t NODE_SHARD_COUNT = 64;
+const auto FLUSH_DELAY = std::chrono::seconds(5);
+const auto FLUSH_RETRY_DELAY = std::chrono::seconds(30);
+const auto RECOVER_RETRY_DELAY = std::chrono::seconds(30);
+const uint64_t FLUSH_THRESHOLD = 64 * 1024 * 1024;
+const uint64_t FLUSH_FILL_WINDOW = 4 * 1024 * 1024;
 
 class FileSystem : public IFileSystem {
  public:
   using mutex = std::recursive_mutex;
 
+  /**
+   * Delays of the write-back engine.
+   */
+  struct Options {
+    // between the last write of a file and its upload
+    std::chrono::system_clock::duration flush_delay_ = FLUSH_DELAY;
+    // before a failed upload is tried again
+    std::chrono::system_clock::duration flush_retry_delay_ =
+        FLUSH_RETRY_DELAY;
+    // before a journaled file which couldn't be looked up is tried again
+    std::chrono::system_clock::duration recover_retry_delay_ =
+        RECOVER_RETRY_DELAY;
+  };
+
   class Node : public IFileSystem::INode {
    public:
     using Pointer = std::shared_ptr<Node>;
@@ -49,19 +82,47 @@ class FileSystem : public IFileSystem {
 
    private:
     friend class FileSystem;
+    friend class FileSystemTest;
 
     struct Chunk {
       Range range_;
-      std::string data_;
+      std::shared_ptr<const std::string> data_;
+      bool ready_;
+      uint64_t last_access_;
     };
 
     struct ReadRequest {
       Range range_;
-      DownloadItemCallback callback_;
-
-      bool operator==(const ReadRequest &r) const { return range_ == r.range_; }
+      ReadBuffersCallback callback_;
     };
 
+    /**
+     * Registers a read and returns how far past it the data should be
+     * prefetched: more with every sequential read, less after every seek.
+     */
+    uint64_t read_ahead(Range);
+
+    /**
+     * Collects slices of downloaded chunks covering range.
+     *
+     * @return false if part of the range isn't downloaded, output covers the
+     * part before the gap then
+     */
+    bool slice(Range, BufferList &output);
+
+    bool pending(Range) const;
+    void evict();
+
+    /**
+     * Returns the first range below end which wasn't written locally.
+     */
+    Range clean(uint64_t start, uint64_t end) const;
+    bool written(Range) const;
+    void mark_written(Range);
+    void open_store(const std::string &filename, bool truncate);
+    std::string read_store(Range);
+    void discard_store();
+
     mutex mutex_;
     std::shared_ptr<ICloudProvider> provider_;
     IItem::Pointer item_;
@@ -70,16 +131,31 @@ class FileSystem : public IFileSystem {
     uint64_t size_;
     std::shared_ptr<IGenericRequest> upload_request_;
     std::vector<ReadRequest> read_request_;
-    std::vector<Range> pending_download_;
-    std::deque<Chunk> chunk_;
+    std::map<uint64_t, Chunk> chunk_;
+    uint64_t cached_size_ = 0;
+    uint64_t access_count_ = 0;
+    uint64_t read_end_ = 0;
+    uint64_t read_ahead_ = 0;
     std::string cache_filename_;
     std::string path_;
     std::unique_ptr<std::fstream> store_;
+    // ranges of store_ holding written data, by start
+    std::map<uint64_t, uint64_t> written_;
+    // whether parts of the file which weren't written exist remotely
+    bool base_ = true;
+    uint64_t remote_size_ = 0;
+    bool journaled_ = false;
+    // whether an upload of store_ as it is now was started, so that the
+    // provider may already hold a part of it
+    bool resumable_ = false;
+    uint64_t generation_ = 0;
+    uint64_t unflushed_size_ = 0;
     bool list_directory_pending_ = false;
   };
 
   FileSystem(const std::vector<ProviderEntry> &, IHttp::Pointer http,
-             const std::string &temporary_directory);
+             const std::string &temporary_directory,
+             const std::string &cache_directory, Options);
   ~FileSystem() override;
 
   FileId mknod(FileId parent, const char *name) override;
@@ -92,35 +168,100 @@ class FileSystem : public IFileSystem {
   void readdir(FileId node, ListDirectoryCallback) override;
   void read(FileId node, size_t offset, size_t size,
             DownloadItemCallback) override;
+  void read_buffers(FileId node, size_t offset, size_t size,
+                    ReadBuffersCallback) override;
   void rename(FileId parent, const char *name, FileId newparent,
               const char *newname, RenameItemCallback) override;
   void mkdir(FileId parent, const char *name, GetItemCallback) override;
   void remove(FileId parent, const char *name, DeleteItemCallback) override;
   void fsync(FileId, DataSynchronizedCallback) override;
+  void reference(FileId) override;
+  void forget(FileId, uint64_t count) override;
   std::string sanitize(const std::string &) override;
 
  private:
+  friend class FileSystemTest;
+
   struct RequestData {
     std::shared_ptr<ICloudProvider> provider_;
     std::shared_ptr<IGenericRequest> request_;
   };
 
+  struct ChangeFeed {
+    std::shared_ptr<ICloudProvider> provider_;
+    std::string cursor_;
+    // id under which the provider reports its root directory in changes
+    std::string root_id_;
+  };
+
+  /**
+   * Part of the inode table; nodes are spread over shards by inode, so that
+   * requests for different nodes don't wait for each other. Modifications
+   * are made with node_data_mutex_ held as well.
+   */
+  struct NodeShard {
+    std::mutex mutex_;
+    std::unordered_map<FileId, Node::Pointer> node_;
+    std::unordered_map<FileId, uint64_t> reference_count_;
+  };
+
+  NodeShard &shard(FileId);
+  Node::Pointer find_node(FileId);
+  void insert_node(FileId, Node::Pointer);
+  void erase_node(FileId);
+  bool pinned(Node::Pointer);
+  bool evict_children(FileId parent);
+  void index_node(Node::Pointer);
+  void unindex_node(Node::Pointer);
+  // key of the item in node_id_map_ and metadata_
+  std::string id(std::shared_ptr<ICloudProvider>, IItem::Pointer) const;
+
   void add(RequestData r);
   Node::Pointer add(std::shared_ptr<ICloudProvider>, FileId parent,
                     IItem::Pointer);
 
   void set(FileId, Node::Pointer);
 
+  void add_child(FileId parent, Node::Pointer);
+  void remove_child(FileId parent, Node::Pointer);
+  void set_children(FileId parent, const std::unordered_set<FileId> &);
+  void restore_children(FileId parent);
+  Node::Pointer find_child(FileId parent, const std::string &name);
+  bool known_missing(FileId parent, const std::string &name);
+  void set_missing(FileId parent, const std::string &name);
+
   Node::Pointer get(FileId node);
   void get_path(FileId node, const std::string &path, GetItemCallback);
 
   void invalidate(FileId);
+  bool fresh(Node::Pointer, std::chrono::system_clock::time_point timestamp);
+  void watch(std::vector<ProviderEntry>);
+  bool poll(ChangeFeed &);
+  void apply(const ChangeFeed &, const ChangeData &);
+  template <class T>
+  EitherError<T> wait(std::unique_ptr<IRequest<EitherError<T>>>);
   void cleanup();
   void cancelled();
   void cancel(std::shared_ptr<IGenericRequest>);
 
+  void modified(Node::Pointer);
+  void discard(Node::Pointer);
+  void schedule_flush(FileId, std::chrono::system_clock::duration delay);
+  void flushed(FileId);
+  void write_back();
+  void flush(Node::Pointer);
+  void fill(Node::Pointer, uint64_t start, GenericCallback<EitherError<void>>);
+  void upload(Node::Pointer);
+  void save_journal();
+  void load_journal();
+  void recover(Json::Value entry);
+
   void list_directory_async(std::shared_ptr<ICloudProvider>, IItem::Pointer,
                             cloudstorage::ListDirectoryCallback);
+  void read_written(Node::Pointer, Range, ReadBuffersCallback);
+  void read_chunks(Node::Pointer, Range, ReadBuffersCallback);
+  void fetch(Node::Pointer, uint64_t start, uint64_t end, uint64_t window);
+  void complete_reads(Node::Pointer, EitherError<std::string>);
   void download_item_async(std::shared_ptr<ICloudProvider>, IItem::Pointer,
                            Range, DownloadItemCallback);
   void get_url_async(std::shared_ptr<ICloudProvider>, IItem::Pointer,
@@ -132,22 +273,61 @@ class FileSystem : public IFileSystem {
   mutable mutex node_data_mutex_;
   mutable mutex request_data_mutex_;
   std::unordered_map<std::string, FileId> node_path_to_id_;
-  std::unordered_map<FileId, Node::Pointer> node_map_;
+  std::array<NodeShard, NODE_SHARD_COUNT> node_shard_;
   std::unordered_map<std::string, Node::Pointer> node_id_map_;
   std::unordered_map<FileId, std::unordered_set<FileId>> node_directory_;
+  std::unordered_map<FileId, std::unordered_multimap<std::string, FileId>>
+      node_name_;
+  std::unordered_map<
+      FileId,
+      std::unordered_map<std::string, std::chrono::system_clock::time_point>>
+      node_missing_;
   std::unordered_map<FileId, std::chrono::system_clock::time_point>
       node_timestamp_;
+  // when the change feed last reported a change in the directory
+  std::unordered_map<FileId, std::chrono::system_clock::time_point>
+      node_changed_;
+  // nodes by provider and item id, to find the ones a change refers to
+  std::unordered_map<const ICloudProvider *,
+                     std::unordered_map<std::string, std::unordered_set<FileId>>>
+      node_item_;
   std::unordered_map<std::string, FileId> auth_node_;
+  // accounts of the same cloud provider are told apart by their labels
+  std::unordered_map<const ICloudProvider *, std::string> provider_label_;
   FileId next_;
   std::deque<RequestData> request_data_;
   std::deque<std::shared_ptr<IGenericRequest>> cancelled_request_;
   std::atomic_bool running_;
   IHttp::Pointer http_;
+  Options options_;
   std::string temporary_directory_;
+  // write-back journal of this mount, in cache_directory if there is one
+  std::string journal_filename_;
+  MetadataCache::Pointer metadata_;
   std::condition_variable_any cancelled_request_condition_;
   std::condition_variable_any request_data_condition_;
+  mutable mutex write_back_mutex_;
+  mutable mutex journal_mutex_;
+  std::condition_variable_any write_back_condition_;
+  std::unordered_set<FileId> modified_;
+  std::unordered_map<FileId, std::chrono::system_clock::time_point>
+      flush_time_;
+  std::unordered_set<FileId> flushing_;
+  std::vector<Json::Value> unrecovered_;
+  // entries of unrecovered_ to be recovered again at recover_time_
+  std::vector<Json::Value> recover_queue_;
+  std::chrono::system_clock::time_point recover_time_;
+  std::mutex watch_mutex_;
+  std::condition_variable watch_condition_;
+  // providers whose change feed works, with the time it started covering
+  std::unordered_map<const ICloudProvider *,
+                     std::chrono::system_clock::time_point>
+      watched_since_;
+  std::shared_ptr<IGenericRequest> watch_request_;
   std::future<void> cancelled_request_thread_;
   std::future<void> cleanup_;
+  std::future<void> write_back_thread_;
+  std::future<void> watch_thread_;
 };
 
 }  // namespace cloudstorage
@@ -21,6 +21,8 @@ namespace {
 #define OPTION(t, p) \
   { t, offsetof(struct options, p), 1 }
 
+const uint64_t DEFAULT_CACHE_SIZE = 1024;
+
 template <class T>
 using pointer = std::unique_ptr<T, std::function<void(T *)>>;
 
@@ -93,7 +95,8 @@ IHttpServer::IResponse::Pointer HttpServerCallback::handle(
 ICloudProvider::Pointer create(
     int index, std::shared_ptr<IHttpServerFactory> http_server_factory,
     std::shared_ptr<IHttp> http, std::shared_ptr<IThreadPool> thread_pool,
-    std::string temporary_directory, Json::Value config) {
+    std::string temporary_directory, std::string cache_directory,
+    uint64_t cache_size, Json::Value config) {
   class ServerFactoryWrapper : public IHttpServerFactory {
    public:
     ServerFactoryWrapper(std::shared_ptr<IHttpServerFactory> f) : factory_(f) {}
@@ -120,6 +123,11 @@ ICloudProvider::Pointer create(
   init_data.http_server_ =
       util::make_unique<ServerFactoryWrapper>(http_server_factory);
   init_data.thread_pool_ = util::make_unique<ThreadPoolWrapper>(thread_pool);
+  init_data.cache_directory_ = cache_directory;
+  init_data.cache_size_ = cache_size;
+  if (!cache_directory.empty())
+    init_data.upload_journal_ =
+        util::join_path(cache_directory, "cloudstorage-uploads.json");
   init_data.hints_["file_url"] =
       "http://127.0.0.1:12345/" + std::to_string(index);
   init_data.hints_["state"] = std::to_string(index);
@@ -133,13 +141,15 @@ std::vector<IFileSystem::ProviderEntry> providers(
     const Json::Value &data,
     std::shared_ptr<IHttpServerFactory> http_server_factory,
     std::shared_ptr<IHttp> http, std::shared_ptr<IThreadPool> thread_pool,
-    const std::string &temporary_directory) {
+    const std::string &temporary_directory, const std::string &cache_directory,
+    uint64_t cache_size) {
   std::vector<IFileSystem::ProviderEntry> providers;
   int index = 0;
   for (auto &&p : data)
     providers.push_back(
-        {p["label"].asString(), create(index++, http_server_factory, http,
-                                       thread_pool, temporary_directory, p)});
+        {p["label"].asString(),
+         create(index++, http_server_factory, http, thread_pool,
+                temporary_directory, cache_directory, cache_size, p)});
   return providers;
 }
 
@@ -160,10 +170,15 @@ int fuse_run(fuse_args *args, fuse_cmdline_opts *opts, Json::Value &json) {
   auto temporary_directory = json["temporary_directory"].asString();
   if (temporary_directory.empty())
     temporary_directory = util::temporary_directory();
+  auto cache_directory = json["cache_directory"].asString();
+  auto cache_size = json.isMember("cache_size")
+                        ? json["cache_size"].asUInt64()
+                        : DEFAULT_CACHE_SIZE;
   auto p = providers(json["providers"], http_server_factory, http, thread_pool,
-                     temporary_directory);
+                     temporary_directory, cache_directory,
+                     cache_size * 1024 * 1024);
   *ctx = IFileSystem::create(p, util::make_unique<HttpWrapper>(http),
-                             temporary_directory)
+                             temporary_directory, cache_directory)
              .release();
   int ret = fuse.run(opts->singlethread, opts->clone_fd);
   for (size_t i = 0; i < p.size(); i++) {
@@ -93,12 +93,16 @@ class HttpServerCallback : public IHttpServer::ICallback {
 
 struct FUSE_STAT item_to_stat(IFileSystem::INode::Pointer i);
 cloudstorage::ICloudProvider::Pointer create(
+    int index, std::shared_ptr<IHttpServerFactory> http_server_factory,
     std::shared_ptr<IHttp> http, std::shared_ptr<IThreadPool> thread_pool,
-    std::string temporary_directory, Json::Value config);
+    std::string temporary_directory, std::string cache_directory,
+    uint64_t cache_size, Json::Value config);
 std::vector<cloudstorage::IFileSystem::ProviderEntry> providers(
-    const Json::Value &data, std::shared_ptr<IHttp> http,
-    std::shared_ptr<IThreadPool> thread_pool,
-    const std::string &temporary_directory);
+    const Json::Value &data,
+    std::shared_ptr<IHttpServerFactory> http_server_factory,
+    std::shared_ptr<IHttp> http, std::shared_ptr<IThreadPool> thread_pool,
+    const std::string &temporary_directory, const std::string &cache_directory,
+    uint64_t cache_size);
 
 int fuse_run(int argc, char **argv);
 
@@ -4,9 +4,12 @@
 
 #include <cassert>
 #include <cfloat>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <mutex>
 #include <sstream>
+#include <vector>
 
 #include "FuseCommon.h"
 #include "IFileSystem.h"
@@ -18,10 +21,39 @@ using util::log;
 
 namespace {
 
+/**
+ * Listing of a directory taken when it's read from the beginning; later
+ * offsets of the same open directory are served from it.
+ */
+struct DirectoryStream {
+  std::mutex mutex_;
+  IFileSystem::INode::List entries_;
+  bool listed_ = false;
+};
+
 IFileSystem *context(fuse_req_t req) {
   return *static_cast<IFileSystem **>(fuse_req_userdata(req));
 }
 
+/**
+ * Kernel holds on to every entry it's given until it forgets it; the file
+ * system needs to know about that to evict nodes safely.
+ */
+void reply_entry(fuse_req_t req, const fuse_entry_param &entry) {
+  if (entry.ino != 0) context(req)->reference(entry.ino);
+  fuse_reply_entry(req, &entry);
+}
+
+fuse_entry_param entry_param(IFileSystem::INode::Pointer node) {
+  fuse_entry_param entry = {};
+  entry.ino = node->inode();
+  entry.attr = item_to_stat(node);
+  entry.attr_timeout = 1;
+  entry.entry_timeout = 1;
+  entry.generation = 1;
+  return entry;
+}
+
 void getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *) {
   context(req)->getattr(ino, [=](EitherError<IFileSystem::INode> e) {
     if (auto i = e.right()) {
@@ -35,9 +67,15 @@ void getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *) {
 }
 
 void opendir(fuse_req_t req, fuse_ino_t, struct fuse_file_info *fi) {
+  fi->fh = reinterpret_cast<uint64_t>(new DirectoryStream);
   fuse_reply_open(req, fi);
 }
 
+void releasedir(fuse_req_t req, fuse_ino_t, struct fuse_file_info *fi) {
+  delete reinterpret_cast<DirectoryStream *>(fi->fh);
+  fuse_reply_err(req, 0);
+}
+
 void open(fuse_req_t req, fuse_ino_t, struct fuse_file_info *fi) {
   fuse_reply_open(req, fi);
 }
@@ -56,40 +94,96 @@ void flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *f) {
   fsync(req, ino, 0, f);
 }
 
+/**
+ * Passes buffers to the kernel without copying them first. They are in
+ * memory, so splicing them would only add a copy into a pipe.
+ */
+void reply_buffers(fuse_req_t req, const IFileSystem::BufferList &buffers) {
+  if (buffers.empty()) {
+    fuse_reply_buf(req, nullptr, 0);
+    return;
+  }
+#ifdef WITH_FUSE
+  auto size = sizeof(fuse_bufvec) + (buffers.size() - 1) * sizeof(fuse_buf);
+  std::unique_ptr<fuse_bufvec, void (*)(void *)> vector(
+      static_cast<fuse_bufvec *>(calloc(1, size)), free);
+  vector->count = buffers.size();
+  for (size_t i = 0; i < buffers.size(); i++) {
+    vector->buf[i].size = buffers[i].size_;
+    vector->buf[i].mem =
+        const_cast<char *>(buffers[i].data_->data() + buffers[i].offset_);
+    vector->buf[i].fd = -1;
+  }
+  fuse_reply_data(req, vector.get(), fuse_buf_copy_flags());
+#else
+  std::vector<iovec> vector(buffers.size());
+  for (size_t i = 0; i < buffers.size(); i++) {
+    vector[i].iov_base =
+        const_cast<char *>(buffers[i].data_->data() + buffers[i].offset_);
+    vector[i].iov_len = buffers[i].size_;
+  }
+  fuse_reply_iov(req, vector.data(), static_cast<int>(vector.size()));
+#endif
+}
+
 void read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
           struct fuse_file_info *) {
-  context(req)->read(ino, off, size, [=](EitherError<std::string> e) {
-    if (auto data = e.right()) {
-      fuse_reply_buf(req, data->data(), data->size());
-    } else {
-      log("read:", e.left()->code_, e.left()->description_);
-      fuse_reply_err(req, ENOENT);
-    }
-  });
+  context(req)->read_buffers(
+      ino, off, size, [=](EitherError<IFileSystem::BufferList> e) {
+        if (auto buffers = e.right()) {
+          reply_buffers(req, *buffers);
+        } else {
+          log("read:", e.left()->code_, e.left()->description_);
+          fuse_reply_err(req, ENOENT);
+        }
+      });
 }
 
-void readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
-             struct fuse_file_info *) {
+size_t add_entry(fuse_req_t req, char *buffer, size_t size,
+                 IFileSystem::INode::Pointer node, off_t off, bool plus) {
+  auto name = context(req)->sanitize(node->filename());
+#ifdef WITH_FUSE
+  if (plus) {
+    auto entry = entry_param(node);
+    return fuse_add_direntry_plus(req, buffer, size, name.c_str(), &entry, off);
+  }
+#else
+  (void)plus;
+#endif
+  auto stat = item_to_stat(node);
+  return fuse_add_direntry(req, buffer, size, name.c_str(), &stat, off);
+}
+
+void reply_entries(fuse_req_t req, const IFileSystem::INode::List &lst,
+                   size_t size, off_t off, bool plus) {
+  std::vector<char> buffer(size);
+  size_t used = 0;
+  for (size_t i = off; i < lst.size(); i++) {
+    auto length = add_entry(req, buffer.data() + used, size - used, lst[i],
+                            i + 1, plus);
+    if (length > size - used) break;
+    if (plus) context(req)->reference(lst[i]->inode());
+    used += length;
+  }
+  fuse_reply_buf(req, buffer.data(), used);
+}
+
+void list_directory(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                    struct fuse_file_info *fi, bool plus) {
+  auto directory = reinterpret_cast<DirectoryStream *>(fi->fh);
+  if (directory && off > 0) {
+    std::lock_guard<std::mutex> lock(directory->mutex_);
+    if (directory->listed_)
+      return reply_entries(req, directory->entries_, size, off, plus);
+  }
   context(req)->readdir(
       ino, [=](EitherError<std::vector<IFileSystem::INode::Pointer>> e) {
         if (auto lst = e.right()) {
-          std::string data;
-          for (size_t i = off; i < lst->size(); i++) {
-            auto item = lst->at(i);
-            auto name = context(req)->sanitize(item->filename());
-            auto sz =
-                fuse_add_direntry(req, nullptr, 0, name.c_str(), nullptr, 0);
-            if (data.size() + sz > size) {
-              fuse_reply_buf(req, data.data(), data.size());
-              return;
-            }
-            std::vector<char> buffer(sz);
-            auto stat = item_to_stat(lst->at(i));
-            fuse_add_direntry(req, buffer.data(), buffer.size(), name.c_str(),
-                              &stat, i + 1);
-            data += std::string(buffer.begin(), buffer.end());
-          }
-          fuse_reply_buf(req, data.data(), data.size());
+          if (!directory) return reply_entries(req, *lst, size, off, plus);
+          std::lock_guard<std::mutex> lock(directory->mutex_);
+          directory->entries_ = std::move(*lst);
+          directory->listed_ = true;
+          reply_entries(req, directory->entries_, size, off, plus);
         } else {
           log("readdir:", e.left()->code_, e.left()->description_);
           fuse_reply_err(req, ENOENT);
@@ -97,16 +191,22 @@ void readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
       });
 }
 
+void readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+             struct fuse_file_info *fi) {
+  list_directory(req, ino, size, off, fi, false);
+}
+
+#ifdef WITH_FUSE
+void readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                 struct fuse_file_info *fi) {
+  list_directory(req, ino, size, off, fi, true);
+}
+#endif
+
 void lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
   context(req)->lookup(parent, name, [=](EitherError<IFileSystem::INode> e) {
     if (auto node = e.right()) {
-      fuse_entry_param entry = {};
-      entry.ino = node->inode();
-      entry.attr = item_to_stat(node);
-      entry.attr_timeout = 1;
-      entry.entry_timeout = 1;
-      entry.generation = 1;
-      fuse_reply_entry(req, &entry);
+      reply_entry(req, entry_param(node));
     } else {
       log("lookup:", name, e.left()->code_, e.left()->description_);
       fuse_reply_err(req, ENOENT);
@@ -145,14 +245,7 @@ void mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t) {
       log("mkdir:", e.left()->code_, e.left()->description_);
       fuse_reply_err(req, ENOSYS);
     } else {
-      auto node = e.right();
-      fuse_entry_param entry = {};
-      entry.ino = node->inode();
-      entry.attr = item_to_stat(node);
-      entry.attr_timeout = 1;
-      entry.entry_timeout = 1;
-      entry.generation = 1;
-      fuse_reply_entry(req, &entry);
+      reply_entry(req, entry_param(e.right()));
     }
   });
 }
@@ -185,8 +278,28 @@ void mknod(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t, dev_t) {
   entry.attr_timeout = 0;
   entry.entry_timeout = 0;
   entry.generation = 1;
-  fuse_reply_entry(req, &entry);
+  reply_entry(req, entry);
+}
+
+#ifdef WITH_LEGACY_FUSE
+using forget_count = unsigned long;
+#else
+using forget_count = uint64_t;
+#endif
+
+void forget(fuse_req_t req, fuse_ino_t ino, forget_count count) {
+  context(req)->forget(ino, count);
+  fuse_reply_none(req);
+}
+
+#ifdef WITH_FUSE
+void forget_multi(fuse_req_t req, size_t count,
+                  struct fuse_forget_data *forgets) {
+  for (size_t i = 0; i < count; i++)
+    context(req)->forget(forgets[i].ino, forgets[i].nlookup);
+  fuse_reply_none(req);
 }
+#endif
 
 void write(fuse_req_t req, fuse_ino_t ino, const char *data, size_t size,
            off_t off, struct fuse_file_info *) {
@@ -207,7 +320,15 @@ fuse_lowlevel_ops low_level_operations() {
   operations.getattr = getattr;
   operations.opendir = opendir;
   operations.readdir = readdir;
+#ifdef WITH_FUSE
+  operations.readdirplus = readdirplus;
+#endif
+  operations.releasedir = releasedir;
   operations.lookup = lookup;
+  operations.forget = forget;
+#ifdef WITH_FUSE
+  operations.forget_multi = forget_multi;
+#endif
   operations.read = read;
   operations.open = open;
   operations.rename = fuse_rename;
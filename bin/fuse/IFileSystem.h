@@ -4,6 +4,8 @@
 #include <chrono>
 #include <cstdint>
 #include <memory>
+#include <string>
+#include <vector>
 #include "ICloudProvider.h"
 #include "IItem.h"
 #include "IRequest.h"
@@ -13,6 +15,9 @@ namespace cloudstorage {
 class IFileSystem {
  public:
   class INode;
+  struct Buffer;
+
+  using BufferList = std::vector<Buffer>;
 
   using FileId = uint64_t;
   using Pointer = std::unique_ptr<IFileSystem>;
@@ -36,9 +41,20 @@ class IFileSystem {
   using ListDirectoryCallback = GenericCallback<EitherError<INode::List>>;
   using GetItemCallback = GenericCallback<EitherError<INode>>;
   using DownloadItemCallback = GenericCallback<EitherError<std::string>>;
+  using ReadBuffersCallback = GenericCallback<EitherError<BufferList>>;
   using WriteDataCallback = GenericCallback<EitherError<uint32_t>>;
   using DataSynchronizedCallback = GenericCallback<EitherError<void>>;
 
+  /**
+   * Slice of downloaded file content; the buffer it points into stays alive
+   * as long as the slice does.
+   */
+  struct Buffer {
+    std::shared_ptr<const std::string> data_;
+    size_t offset_;
+    size_t size_;
+  };
+
   struct ProviderEntry {
     std::string label_;
     std::shared_ptr<ICloudProvider> provider_;
@@ -46,9 +62,16 @@ class IFileSystem {
 
   virtual ~IFileSystem() = default;
 
+  /**
+   * @param cache_directory where directory listings are kept between mounts,
+   * they aren't kept if it's empty; the journal of written files, named after
+   * the mounted providers' labels, is kept there too, or in
+   * temporary_directory if it's empty
+   */
   static IFileSystem::Pointer create(const std::vector<ProviderEntry> &,
                                      IHttp::Pointer http,
-                                     const std::string &temporary_directory);
+                                     const std::string &temporary_directory,
+                                     const std::string &cache_directory);
 
   virtual std::string sanitize(const std::string &filename) = 0;
 
@@ -69,6 +92,13 @@ class IFileSystem {
   virtual void read(FileId node, size_t offset, size_t size,
                     DownloadItemCallback) = 0;
 
+  /**
+   * Works like read, but passes slices of cached buffers instead of copying
+   * the data out of them.
+   */
+  virtual void read_buffers(FileId node, size_t offset, size_t size,
+                            ReadBuffersCallback) = 0;
+
   virtual void rename(FileId parent, const char *name, FileId newparent,
                       const char *newname, RenameItemCallback) = 0;
 
@@ -76,7 +106,28 @@ class IFileSystem {
 
   virtual void remove(FileId parent, const char *name, DeleteItemCallback) = 0;
 
+  /**
+   * Records written data in the local journal right away and uploads it in
+   * the background, so that bursts of writes and closes of the same file end
+   * up as a single upload. Neither the journal nor the file's store are
+   * fsync(2)'d, so the data survives a crash of the process, but not
+   * necessarily of the system. The upload sends the whole file, downloading
+   * ranges which weren't written first; an interrupted upload is resumed
+   * where the provider supports it.
+   */
   virtual void fsync(FileId, DataSynchronizedCallback) = 0;
+
+  /**
+   * Counts node as referenced by the kernel, which it is after being passed
+   * in reply to lookup, mkdir, mknod or readdirplus.
+   */
+  virtual void reference(FileId) = 0;
+
+  /**
+   * Drops count references to node; once there are none, the node and its
+   * cached directory listing may be evicted.
+   */
+  virtual void forget(FileId, uint64_t count) = 0;
 };
 
 }  // namespace cloudstorage
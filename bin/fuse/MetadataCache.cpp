@@ -0,0 +1,145 @@
+#include "MetadataCache.h"
+
+#include <json/json.h>
+#include <cstdio>
+#include <ctime>
+
+#include "Utility/Utility.h"
+
+namespace cloudstorage {
+
+namespace {
+
+const char* METADATA_FILE = "metadata.log";
+
+// File smaller than that isn't compacted while the cache is open.
+const uint64_t MIN_COMPACTED_SIZE = 1024 * 1024;
+
+}  // namespace
+
+MetadataCache::MetadataCache(const std::string& filename)
+    : filename_(filename), file_size_(), live_size_() {
+  std::ofstream(filename_, std::ios::app | std::ios::binary);
+  file_.open(filename_, std::ios::in | std::ios::out | std::ios::binary);
+  load();
+}
+
+MetadataCache::~MetadataCache() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (file_size_ > 2 * live_size_) compact();
+}
+
+MetadataCache::Pointer MetadataCache::create(const std::string& directory) {
+  if (directory.empty()) return nullptr;
+  return util::make_unique<MetadataCache>(
+      util::join_path(directory, METADATA_FILE));
+}
+
+bool MetadataCache::get(const std::string& key, Listing& listing) {
+  std::string line;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(key);
+    if (it == index_.end()) return false;
+    file_.seekg(it->second.offset_);
+    std::getline(file_, line);
+    file_.clear();
+  }
+  auto timestamp = line.find('\t');
+  auto items = timestamp == std::string::npos
+                   ? std::string::npos
+                   : line.find('\t', timestamp + 1);
+  if (items == std::string::npos) return false;
+  try {
+    listing.timestamp_ = std::chrono::system_clock::from_time_t(
+        std::stoll(line.substr(timestamp + 1, items - timestamp - 1)));
+    listing.items_.clear();
+    for (auto&& item : util::json::from_string(line.substr(items + 1)))
+      listing.items_.push_back(IItem::fromString(item.asString()));
+  } catch (const std::exception& e) {
+    util::log("[METADATA CACHE] invalid entry", e.what());
+    return false;
+  }
+  return true;
+}
+
+void MetadataCache::put(const std::string& key, const Listing& listing) {
+  Json::Value items(Json::arrayValue);
+  for (auto&& item : listing.items_) items.append(item->toString());
+  auto line =
+      key + "\t" +
+      std::to_string(std::chrono::system_clock::to_time_t(listing.timestamp_)) +
+      "\t" + util::json::to_string(items) + "\n";
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!file_.is_open()) return;
+  file_.seekp(file_size_);
+  file_.write(line.data(), line.size());
+  file_.flush();
+  if (!file_) {
+    file_.clear();
+    return;
+  }
+  auto it = index_.find(key);
+  if (it != index_.end()) live_size_ -= it->second.size_;
+  index_[key] = {file_size_, line.size()};
+  file_size_ += line.size();
+  live_size_ += line.size();
+  if (file_size_ > MIN_COMPACTED_SIZE && file_size_ > 2 * live_size_)
+    compact();
+}
+
+void MetadataCache::load() {
+  if (!file_.is_open()) return;
+  std::string line;
+  uint64_t offset = 0;
+  while (std::getline(file_, line)) {
+    if (file_.eof()) break;
+    auto separator = line.find('\t');
+    if (separator != std::string::npos) {
+      auto key = line.substr(0, separator);
+      auto it = index_.find(key);
+      if (it != index_.end()) live_size_ -= it->second.size_;
+      index_[key] = {offset, line.size() + 1};
+      live_size_ += line.size() + 1;
+    }
+    offset += line.size() + 1;
+  }
+  file_.clear();
+  file_size_ = offset;
+}
+
+void MetadataCache::compact() {
+  if (!file_.is_open()) return;
+  auto temporary = filename_ + ".tmp";
+  std::ofstream output(temporary, std::ios::binary | std::ios::trunc);
+  std::unordered_map<std::string, Entry> index;
+  uint64_t offset = 0;
+  for (auto&& entry : index_) {
+    std::string line(entry.second.size_, 0);
+    file_.seekg(entry.second.offset_);
+    file_.read(&line[0], line.size());
+    if (!file_) {
+      file_.clear();
+      return;
+    }
+    output.write(line.data(), line.size());
+    index[entry.first] = {offset, line.size()};
+    offset += line.size();
+  }
+  output.close();
+  if (!output) return;
+  file_.close();
+  if (std::rename(temporary.c_str(), filename_.c_str()) != 0) {
+    (void)std::remove(filename_.c_str());
+    if (std::rename(temporary.c_str(), filename_.c_str()) != 0) {
+      index_.clear();
+      file_size_ = live_size_ = 0;
+      return;
+    }
+  }
+  index_ = std::move(index);
+  file_size_ = live_size_ = offset;
+  file_.open(filename_, std::ios::in | std::ios::out | std::ios::binary);
+}
+
+}  // namespace cloudstorage
@@ -0,0 +1,61 @@
+#ifndef METADATA_CACHE_H
+#define METADATA_CACHE_H
+
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "IItem.h"
+
+namespace cloudstorage {
+
+/**
+ * Keeps directory listings on disk, so that a fresh mount can answer from
+ * them right away. Listings are appended to a single file, one per line;
+ * when the cache is opened only keys and offsets of the lines are read, a
+ * listing is parsed once it's asked for. Superseded lines are dropped, if they
+ * take up most of the file, when the cache is closed or, once the file is big
+ * enough, when a listing is put.
+ */
+class MetadataCache {
+ public:
+  using Pointer = std::unique_ptr<MetadataCache>;
+
+  struct Listing {
+    std::chrono::system_clock::time_point timestamp_;
+    IItem::List items_;
+  };
+
+  MetadataCache(const std::string& filename);
+  ~MetadataCache();
+
+  /**
+   * @return nullptr if directory is empty
+   */
+  static Pointer create(const std::string& directory);
+
+  bool get(const std::string& key, Listing&);
+  void put(const std::string& key, const Listing&);
+
+ private:
+  struct Entry {
+    uint64_t offset_;
+    uint64_t size_;
+  };
+
+  void load();
+  void compact();
+
+  std::mutex mutex_;
+  std::string filename_;
+  std::fstream file_;
+  std::unordered_map<std::string, Entry> index_;
+  uint64_t file_size_;
+  uint64_t live_size_;
+};
+
+}  // namespace cloudstorage
+
+#endif  // METADATA_CACHE_H
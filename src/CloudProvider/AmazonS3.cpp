@@ -27,41 +27,16 @@
 #include <tinyxml2.h>
 #include <algorithm>
 #include <iomanip>
+#include <mutex>
 
 #include "Request/RecursiveRequest.h"
+#include "Request/UploadFileRequest.h"
 #include "Utility/Utility.h"
 
-using namespace std::placeholders;
-
 namespace cloudstorage {
 
 namespace {
 
-std::string escapePath(const std::string& str) {
-  std::string data = util::Url::escape(str);
-  std::string slash = util::Url::escape("/");
-  std::string result;
-  for (size_t i = 0; i < data.size();)
-    if (data.substr(i, slash.length()) == slash) {
-      result += "/";
-      i += slash.length();
-    } else {
-      result += data[i];
-      i++;
-    }
-  return result;
-}
-
-std::string currentDate() {
-  auto time =
-      util::gmtime(std::chrono::duration_cast<std::chrono::seconds>(
-                       std::chrono::system_clock::now().time_since_epoch())
-                       .count());
-  std::stringstream ss;
-  ss << std::put_time(&time, "%Y%m%d");
-  return ss.str();
-}
-
 std::string currentDateAndTime() {
   auto time =
       util::gmtime(std::chrono::duration_cast<std::chrono::seconds>(
@@ -72,14 +47,536 @@ std::string currentDateAndTime() {
   return ss.str();
 }
 
+std::string escapeXml(const std::string& str) {
+  std::string result;
+  for (auto c : str)
+    switch (c) {
+      case '&':
+        result += "&amp;";
+        break;
+      case '<':
+        result += "&lt;";
+        break;
+      case '>':
+        result += "&gt;";
+        break;
+      case '"':
+        result += "&quot;";
+        break;
+      case '\'':
+        result += "&apos;";
+        break;
+      default:
+        result += c;
+    }
+  return result;
+}
+
+const int DELETE_PARALLELISM = 4;
+const int URL_EXPIRATION = 86400;
+
+/**
+ * Deletes every key under a prefix. Pages of the flat listing are deleted
+ * with one request each, while the next page is being listed; up to
+ * DELETE_PARALLELISM of such requests run at once. Servers which refuse
+ * batch deletes, e.g. ones requiring Content-MD5 header, get the keys deleted
+ * one by one instead.
+ */
+class BatchDelete : public std::enable_shared_from_this<BatchDelete> {
+ public:
+  using Request = cloudstorage::Request<EitherError<void>>;
+
+  BatchDelete(std::shared_ptr<const AmazonS3> p, Request::Pointer r,
+              const std::string& prefix)
+      : provider_(p),
+        request_(r),
+        prefix_(prefix),
+        running_(),
+        listing_(),
+        listed_(),
+        failed_(),
+        done_(),
+        batch_unsupported_() {}
+
+  void start() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    next(lock);
+  }
+
+ private:
+  void list(const std::string& page_token) {
+    auto self = shared_from_this();
+    request_->request(
+        [=](util::Output) {
+          return provider_->listObjectsRequest(prefix_, page_token);
+        },
+        [=](EitherError<Response> e) {
+          std::vector<std::string> keys;
+          std::string next_page_token;
+          if (e.left()) return self->listed(e.left(), {}, "");
+          try {
+            keys = provider_->listObjectsResponse(e.right()->output(),
+                                                  next_page_token);
+          } catch (const std::exception& exception) {
+            return self->listed(
+                Error{IHttpRequest::Failure, exception.what()}, {}, "");
+          }
+          self->listed(nullptr, keys, next_page_token);
+        });
+  }
+
+  void listed(EitherError<void> e, const std::vector<std::string>& keys,
+              const std::string& next_page_token) {
+    std::vector<std::vector<std::string>> batches;
+    for (size_t i = 0; i < keys.size(); i += AmazonS3::DeleteBatchSize)
+      batches.emplace_back(
+          keys.begin() + i,
+          keys.begin() + std::min(i + AmazonS3::DeleteBatchSize, keys.size()));
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      listing_ = false;
+      if (e.left()) {
+        fail(e);
+        batches.clear();
+      }
+      page_token_ = next_page_token;
+      listed_ = next_page_token.empty();
+      running_ += batches.size();
+    }
+    for (auto&& keys : batches) remove(keys);
+    std::unique_lock<std::mutex> lock(mutex_);
+    next(lock);
+  }
+
+  void remove(const std::vector<std::string>& keys) {
+    bool batch_unsupported;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      batch_unsupported = batch_unsupported_;
+    }
+    if (batch_unsupported) return remove(keys, 0);
+    auto self = shared_from_this();
+    request_->request(
+        [=](util::Output input) {
+          return provider_->deleteObjectsRequest(keys, *input);
+        },
+        [=](EitherError<Response> e) {
+          if (e.left()) {
+            if (e.left()->code_ != IHttpRequest::Bad ||
+                e.left()->description_.find("<Code>InvalidRequest</Code>") ==
+                    std::string::npos)
+              return self->removed(e.left());
+            {
+              std::lock_guard<std::mutex> lock(self->mutex_);
+              self->batch_unsupported_ = true;
+            }
+            return self->remove(keys, 0);
+          }
+          try {
+            provider_->deleteObjectsResponse(e.right()->output());
+            self->removed(nullptr);
+          } catch (const std::exception& exception) {
+            self->removed(Error{IHttpRequest::Failure, exception.what()});
+          }
+        });
+  }
+
+  void remove(const std::vector<std::string>& keys, size_t index) {
+    if (index == keys.size()) return removed(nullptr);
+    auto self = shared_from_this();
+    request_->request(
+        [=](util::Output) {
+          return provider_->deleteObjectRequest(keys[index]);
+        },
+        [=](EitherError<Response> e) {
+          if (e.left()) return self->removed(e.left());
+          self->remove(keys, index + 1);
+        });
+  }
+
+  void removed(EitherError<void> e) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    running_--;
+    if (e.left()) fail(e);
+    next(lock);
+  }
+
+  void fail(EitherError<void> e) {
+    if (failed_) return;
+    failed_ = true;
+    error_ = e;
+  }
+
+  /**
+   * Lists next page if there's room for its batch, or finishes the request
+   * once nothing is in progress.
+   */
+  void next(std::unique_lock<std::mutex>& lock) {
+    if (!failed_ && !listed_ && !listing_ && running_ < DELETE_PARALLELISM) {
+      listing_ = true;
+      auto page_token = page_token_;
+      lock.unlock();
+      return list(page_token);
+    }
+    if (running_ > 0 || listing_ || done_) return;
+    done_ = true;
+    auto result = failed_ ? error_ : EitherError<void>(nullptr);
+    lock.unlock();
+    request_->done(result);
+  }
+
+  std::shared_ptr<const AmazonS3> provider_;
+  Request::Pointer request_;
+  std::string prefix_;
+  std::mutex mutex_;
+  std::string page_token_;
+  int running_;
+  bool listing_;
+  bool listed_;
+  bool failed_;
+  bool done_;
+  bool batch_unsupported_;
+  EitherError<void> error_;
+};
+
 }  // namespace
 
-AmazonS3::AmazonS3() : CloudProvider(util::make_unique<Auth>()) {}
+constexpr size_t AmazonS3::DeleteBatchSize;
+
+constexpr uint64_t AmazonS3::MinPartSize;
+constexpr uint64_t AmazonS3::DefaultPartSize;
+constexpr uint32_t AmazonS3::MaxPartCount;
+constexpr int AmazonS3::DefaultUploadParallelism;
+
+/**
+ * Uploads parts of a file, at most upload_parallelism_ of them at once, and
+ * assembles them into an object. Reads of the file are serialized, as
+ * IUploadFileCallback isn't expected to handle concurrent calls. Pending
+ * upload of the key is continued only if resume is set; its parts may hold
+ * different content otherwise, so it's aborted and a new one is created.
+ */
+class AmazonS3::MultipartUpload
+    : public std::enable_shared_from_this<AmazonS3::MultipartUpload> {
+ public:
+  using Request = cloudstorage::Request<EitherError<IItem>>;
+
+  MultipartUpload(std::shared_ptr<AmazonS3> p, Request::Pointer r,
+                  IItem::Pointer directory, const std::string& filename,
+                  IUploadFileCallback::Pointer callback, bool resume)
+      : provider_(p),
+        request_(r),
+        directory_(directory),
+        filename_(filename),
+        key_(directory->id() + filename),
+        journal_key_(UploadJournal::key(p->name(), p->endpoint(),
+                                        directory->id(), filename,
+                                        callback->size())),
+        callback_(callback),
+        size_(callback->size()),
+        part_size_(std::max(p->part_size_,
+                            (size_ + MaxPartCount - 1) / MaxPartCount)),
+        parallelism_(p->upload_parallelism_),
+        resume_(resume),
+        part_(static_cast<size_t>((size_ + part_size_ - 1) / part_size_)),
+        progress_(part_.size()),
+        next_part_(),
+        stored_(),
+        running_(),
+        completing_(),
+        failed_() {
+    for (size_t i = 0; i < part_.size(); i++)
+      part_[i] = {static_cast<uint32_t>(i + 1),
+                  std::min(part_size_, size_ - i * part_size_), ""};
+  }
+
+  void start() {
+    std::string stale;
+    {
+      std::lock_guard<std::mutex> lock(provider_->pending_upload_mutex_);
+      auto it = provider_->pending_upload_.find(key_);
+      if (it != provider_->pending_upload_.end()) {
+        if (!resume_) {
+          stale = it->second.upload_id_;
+          provider_->pending_upload_.erase(it);
+        } else if (it->second.size_ == size_ &&
+                   it->second.part_size_ == part_size_) {
+          upload_id_ = it->second.upload_id_;
+        }
+      }
+    }
+    if (!stale.empty()) abort(stale);
+    auto journal = provider_->upload_journal();
+    if (upload_id_.empty() && journal) {
+      auto session = journal->get(journal_key_);
+      auto upload_id = session["upload_id"].asString();
+      if (!resume_) {
+        if (!upload_id.empty() && upload_id != stale) abort(upload_id);
+        journal->remove(journal_key_);
+      } else if (session["part_size"].asUInt64() == part_size_) {
+        upload_id_ = upload_id;
+      }
+    }
+    if (upload_id_.empty())
+      create();
+    else
+      resume("");
+  }
+
+ private:
+  void create() {
+    auto self = shared_from_this();
+    request_->request(
+        [=](util::Output) {
+          return provider_->createMultipartUploadRequest(key_);
+        },
+        [=](EitherError<Response> e) {
+          if (e.left()) return self->finish(e.left());
+          try {
+            upload_id_ =
+                provider_->createMultipartUploadResponse(e.right()->output());
+          } catch (const std::exception& exception) {
+            return self->finish(Error{IHttpRequest::Failure, exception.what()});
+          }
+          {
+            std::lock_guard<std::mutex> lock(provider_->pending_upload_mutex_);
+            provider_->pending_upload_[key_] = {upload_id_, size_, part_size_};
+          }
+          auto journal = provider_->upload_journal();
+          if (journal) {
+            Json::Value session;
+            session["upload_id"] = upload_id_;
+            session["part_size"] = Json::UInt64(part_size_);
+            journal->put(journal_key_, session);
+          }
+          self->schedule();
+        });
+  }
+
+  /**
+   * Asks which parts of the pending upload are already stored; an upload
+   * which no longer exists is started over.
+   */
+  void resume(const std::string& marker) {
+    auto self = shared_from_this();
+    request_->request(
+        [=](util::Output) {
+          return provider_->listPartsRequest(key_, upload_id_, marker);
+        },
+        [=](EitherError<Response> e) {
+          if (e.left()) {
+            if (e.left()->code_ != IHttpRequest::NotFound)
+              return self->finish(e.left());
+            self->forget();
+            return self->create();
+          }
+          std::string next_marker;
+          try {
+            for (auto&& part : provider_->listPartsResponse(
+                     e.right()->output(), next_marker))
+              if (part.number_ >= 1 && part.number_ <= part_.size() &&
+                  part.size_ == part_[part.number_ - 1].size_ &&
+                  part_[part.number_ - 1].etag_.empty()) {
+                part_[part.number_ - 1].etag_ = part.etag_;
+                progress_[part.number_ - 1] = part.size_;
+                stored_++;
+              }
+          } catch (const std::exception& exception) {
+            return self->finish(Error{IHttpRequest::Failure, exception.what()});
+          }
+          if (!next_marker.empty()) return self->resume(next_marker);
+          self->schedule();
+        });
+  }
+
+  void schedule() {
+    std::vector<size_t> parts;
+    bool assemble = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (failed_ || completing_) return;
+      if (stored_ == part_.size()) {
+        assemble = completing_ = true;
+      } else {
+        while (running_ < parallelism_ && next_part_ < part_.size()) {
+          if (part_[next_part_].etag_.empty()) {
+            parts.push_back(next_part_);
+            running_++;
+          }
+          next_part_++;
+        }
+      }
+    }
+    if (assemble) return complete();
+    for (auto index : parts) upload(index);
+  }
+
+  void upload(size_t index) {
+    auto self = shared_from_this();
+    auto offset = index * part_size_;
+    auto number = part_[index].number_;
+    auto stream = std::make_shared<UploadStreamWrapper>(
+        [=](char* data, uint32_t maxlength, uint64_t position) {
+          std::lock_guard<std::mutex> lock(self->read_mutex_);
+          auto length = std::min<uint64_t>(
+              maxlength, self->part_[index].size_ - position);
+          return self->callback_->putData(data, static_cast<uint32_t>(length),
+                                          offset + position);
+        },
+        part_[index].size_);
+    request_->send(
+        [=](util::Output) {
+          stream->reset();
+          auto request =
+              provider_->uploadPartRequest(key_, upload_id_, number);
+          request->setPriority(IHttpRequest::Priority::Bulk);
+          return request;
+        },
+        [=](EitherError<Response> e) {
+          if (e.left()) return self->uploaded(index, e.left(), "");
+          auto etag = e.right()->headers().find("etag");
+          if (etag == e.right()->headers().end())
+            return self->uploaded(
+                index, Error{IHttpRequest::Failure, util::Error::INVALID_XML},
+                "");
+          self->uploaded(index, nullptr, etag->second);
+        },
+        [=] { return std::make_shared<std::iostream>(stream.get()); },
+        std::make_shared<std::stringstream>(), nullptr,
+        [=](uint64_t, uint64_t now) { self->progress(index, now); }, true);
+  }
+
+  void progress(size_t index, uint64_t now) {
+    uint64_t total = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      progress_[index] = now;
+      for (auto bytes : progress_) total += bytes;
+    }
+    callback_->progress(size_, total);
+  }
+
+  void uploaded(size_t index, EitherError<void> e, const std::string& etag) {
+    std::shared_ptr<Error> error;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      running_--;
+      if (e.left() && !failed_) {
+        failed_ = true;
+        error_ = e.left();
+      }
+      if (!failed_) {
+        part_[index].etag_ = etag;
+        progress_[index] = part_[index].size_;
+        stored_++;
+      } else if (running_ > 0) {
+        return;
+      } else {
+        error = error_.left();
+      }
+    }
+    if (error) return finish(error);
+    schedule();
+  }
+
+  void complete() {
+    auto self = shared_from_this();
+    request_->request(
+        [=](util::Output input) {
+          return provider_->completeMultipartUploadRequest(key_, upload_id_,
+                                                           part_, *input);
+        },
+        [=](EitherError<Response> e) {
+          if (e.left()) return self->finish(e.left());
+          try {
+            provider_->completeMultipartUploadResponse(e.right()->output());
+          } catch (const std::exception& exception) {
+            return self->finish(Error{IHttpRequest::Failure, exception.what()});
+          }
+          self->forget();
+          std::stringstream stream;
+          self->finish(provider_->uploadFileResponse(*directory_, filename_,
+                                                     size_, stream));
+        });
+  }
+
+  void forget() {
+    {
+      std::lock_guard<std::mutex> lock(provider_->pending_upload_mutex_);
+      auto it = provider_->pending_upload_.find(key_);
+      if (it != provider_->pending_upload_.end() &&
+          it->second.upload_id_ == upload_id_)
+        provider_->pending_upload_.erase(it);
+    }
+    auto journal = provider_->upload_journal();
+    if (journal && journal->get(journal_key_)["upload_id"] == upload_id_)
+      journal->remove(journal_key_);
+  }
+
+  /**
+   * Abort request is sent directly, as the request may be unable to send
+   * anything anymore; nothing waits for its outcome.
+   */
+  void abort(const std::string& upload_id) {
+    auto request = provider_->abortMultipartUploadRequest(key_, upload_id);
+    provider_->authorizeRequest(*request);
+    request->send([](IHttpRequest::Response) {},
+                  std::make_shared<std::stringstream>(),
+                  std::make_shared<std::stringstream>(),
+                  std::make_shared<std::stringstream>(), nullptr);
+  }
+
+  /**
+   * Cancelled upload is aborted, so that its parts don't take up space.
+   */
+  void finish(EitherError<IItem> e) {
+    if (request_->is_cancelled() && !upload_id_.empty()) {
+      forget();
+      abort(upload_id_);
+    }
+    request_->done(e);
+  }
+
+  std::shared_ptr<AmazonS3> provider_;
+  Request::Pointer request_;
+  IItem::Pointer directory_;
+  std::string filename_;
+  std::string key_;
+  std::string journal_key_;
+  IUploadFileCallback::Pointer callback_;
+  uint64_t size_;
+  uint64_t part_size_;
+  int parallelism_;
+  bool resume_;
+  std::string upload_id_;
+  std::mutex mutex_;
+  std::mutex read_mutex_;
+  std::vector<Part> part_;
+  std::vector<uint64_t> progress_;
+  size_t next_part_;
+  size_t stored_;
+  int running_;
+  bool completing_;
+  bool failed_;
+  EitherError<IItem> error_;
+};
+
+AmazonS3::AmazonS3()
+    : CloudProvider(util::make_unique<Auth>()),
+      part_size_(DefaultPartSize),
+      upload_parallelism_(DefaultUploadParallelism),
+      signer_("s3") {}
 
 void AmazonS3::initialize(InitData&& init_data) {
   if (init_data.token_.empty())
     init_data.token_ = credentialsToString(Json::Value(Json::objectValue));
   unpackCredentials(init_data.token_);
+  setWithHint(init_data.hints_, "upload_part_size", [this](std::string v) {
+    part_size_ = std::max<uint64_t>(std::strtoull(v.c_str(), nullptr, 10),
+                                    MinPartSize);
+  });
+  setWithHint(init_data.hints_, "upload_parallelism", [this](std::string v) {
+    upload_parallelism_ = std::max(std::atoi(v.c_str()), 1);
+  });
   CloudProvider::initialize(std::move(init_data));
 }
 
@@ -173,15 +670,17 @@ ICloudProvider::MoveItemRequest::Pointer AmazonS3::moveItemAsync(
           auto request = http()->create(endpoint() + "/" + new_path, "PUT");
           if (item->type() != IItem::FileType::Directory)
             request->setHeaderParameter(
-                "x-amz-copy-source", bucket() + "/" + escapePath(item->id()));
+                "x-amz-copy-source",
+                bucket() + "/" + util::Url::escapePath(item->id()));
           return request;
         },
         [=](EitherError<Response> e) {
           if (e.left()) return callback(e.left());
           r->request(
               [=](util::Output) {
-                return http()->create(endpoint() + "/" + escapePath(item->id()),
-                                      "DELETE");
+                return http()->create(
+                    endpoint() + "/" + util::Url::escapePath(item->id()),
+                    "DELETE");
               },
               [=](EitherError<Response> e) {
                 if (e.left()) return callback(e.left());
@@ -212,15 +711,17 @@ ICloudProvider::RenameItemRequest::Pointer AmazonS3::renameItemAsync(
           auto request = http()->create(endpoint() + "/" + new_path, "PUT");
           if (item->type() != IItem::FileType::Directory)
             request->setHeaderParameter(
-                "x-amz-copy-source", bucket() + "/" + escapePath(item->id()));
+                "x-amz-copy-source",
+                bucket() + "/" + util::Url::escapePath(item->id()));
           return request;
         },
         [=](EitherError<Response> e) {
           if (e.left()) return callback(e.left());
           r->request(
               [=](util::Output) {
-                return http()->create(endpoint() + "/" + escapePath(item->id()),
-                                      "DELETE");
+                return http()->create(
+                    endpoint() + "/" + util::Url::escapePath(item->id()),
+                    "DELETE");
               },
               [=](EitherError<Response> e) {
                 if (e.left()) return callback(e.left());
@@ -238,8 +739,9 @@ ICloudProvider::RenameItemRequest::Pointer AmazonS3::renameItemAsync(
 IHttpRequest::Pointer AmazonS3::createDirectoryRequest(const IItem& parent,
                                                        const std::string& name,
                                                        std::ostream&) const {
-  return http()->create(endpoint() + "/" + escapePath(parent.id() + name + "/"),
-                        "PUT");
+  return http()->create(
+      endpoint() + "/" + util::Url::escapePath(parent.id() + name + "/"),
+      "PUT");
 }
 
 IItem::Pointer AmazonS3::createDirectoryResponse(const IItem& parent,
@@ -252,22 +754,57 @@ IItem::Pointer AmazonS3::createDirectoryResponse(const IItem& parent,
 
 ICloudProvider::DeleteItemRequest::Pointer AmazonS3::deleteItemAsync(
     IItem::Pointer item, DeleteItemCallback callback) {
-  using Request = RecursiveRequest<EitherError<void>>;
-  auto visitor = [=](Request::Pointer r, IItem::Pointer item,
-                     Request::CompleteCallback complete) {
+  using Request = BatchDelete::Request;
+  auto provider = std::static_pointer_cast<AmazonS3>(shared_from_this());
+  auto resolver = [=](Request::Pointer r) {
+    if (item->type() == IItem::FileType::Directory)
+      return std::make_shared<BatchDelete>(provider, r, item->id())->start();
     r->request(
-        [=](util::Output) {
-          return http()->create(endpoint() + "/" + escapePath(item->id()),
-                                "DELETE");
-        },
+        [=](util::Output) { return deleteObjectRequest(item->id()); },
         [=](EitherError<Response> e) {
           if (e.left())
-            complete(e.left());
+            r->done(e.left());
           else
-            complete(nullptr);
+            r->done(nullptr);
         });
   };
-  return std::make_shared<Request>(shared_from_this(), item, callback, visitor)
+  return std::make_shared<Request>(shared_from_this(), callback, resolver)
+      ->run();
+}
+
+ICloudProvider::UploadFileRequest::Pointer AmazonS3::uploadFileAsync(
+    IItem::Pointer directory, const std::string& filename,
+    IUploadFileCallback::Pointer callback) {
+  if (callback->size() <= part_size_)
+    return CloudProvider::uploadFileAsync(directory, filename, callback);
+  using Request = MultipartUpload::Request;
+  auto provider = std::static_pointer_cast<AmazonS3>(shared_from_this());
+  auto resolver = [=](Request::Pointer r) {
+    std::make_shared<MultipartUpload>(provider, r, directory, filename,
+                                      callback, false)
+        ->start();
+  };
+  return std::make_shared<Request>(
+             shared_from_this(),
+             [=](EitherError<IItem> e) { callback->done(e); }, resolver)
+      ->run();
+}
+
+ICloudProvider::UploadFileRequest::Pointer AmazonS3::resumeUploadFileAsync(
+    IItem::Pointer directory, const std::string& filename,
+    IUploadFileCallback::Pointer callback) {
+  if (callback->size() <= part_size_)
+    return CloudProvider::uploadFileAsync(directory, filename, callback);
+  using Request = MultipartUpload::Request;
+  auto provider = std::static_pointer_cast<AmazonS3>(shared_from_this());
+  auto resolver = [=](Request::Pointer r) {
+    std::make_shared<MultipartUpload>(provider, r, directory, filename,
+                                      callback, true)
+        ->start();
+  };
+  return std::make_shared<Request>(
+             shared_from_this(),
+             [=](EitherError<IItem> e) { callback->done(e); }, resolver)
       ->run();
 }
 
@@ -348,12 +885,22 @@ IHttpRequest::Pointer AmazonS3::listDirectoryRequest(
   return request;
 }
 
+IHttpRequest::Pointer AmazonS3::getItemByPathRequest(const std::string& path,
+                                                     std::ostream&) const {
+  auto request = http()->create(endpoint() + "/", "GET");
+  request->setParameter("list-type", "2");
+  request->setParameter("prefix", path.substr(1));
+  request->setParameter("delimiter", "/");
+  return request;
+}
+
 IHttpRequest::Pointer AmazonS3::uploadFileRequest(const IItem& directory,
                                                   const std::string& filename,
                                                   std::ostream&,
                                                   std::ostream&) const {
   return http()->create(
-      endpoint() + "/" + escapePath(directory.id() + filename), "PUT");
+      endpoint() + "/" + util::Url::escapePath(directory.id() + filename),
+      "PUT");
 }
 
 IItem::Pointer AmazonS3::uploadFileResponse(const IItem& item,
@@ -367,7 +914,211 @@ IItem::Pointer AmazonS3::uploadFileResponse(const IItem& item,
 
 IHttpRequest::Pointer AmazonS3::downloadFileRequest(const IItem& item,
                                                     std::ostream&) const {
-  return http()->create(endpoint() + "/" + escapePath(item.id()), "GET");
+  return http()->create(endpoint() + "/" + util::Url::escapePath(item.id()),
+                        "GET");
+}
+
+IItem::Pointer AmazonS3::getItemByPathResponse(
+    const std::string& path, const IHttpRequest::HeaderParameters&,
+    std::istream& response) const {
+  // keys sharing the prefix are listed in order, the item is on the first page
+  // unless it's a directory preceded by a lot of them
+  auto key = path.substr(1);
+  std::string next_page_token;
+  for (auto&& item :
+       listDirectoryResponse(*rootDirectory(), response, next_page_token))
+    if (item->id() == key || item->id() == key + "/") return item;
+  if (!next_page_token.empty())
+    throw std::logic_error(util::Error::ITEM_NOT_FOUND);
+  return nullptr;
+}
+
+IHttpRequest::Pointer AmazonS3::listObjectsRequest(
+    const std::string& prefix, const std::string& page_token) const {
+  auto request = http()->create(endpoint() + "/", "GET");
+  request->setParameter("list-type", "2");
+  request->setParameter("prefix", prefix);
+  request->setParameter("max-keys", std::to_string(DeleteBatchSize));
+  if (!page_token.empty())
+    request->setParameter("continuation-token", page_token);
+  return request;
+}
+
+std::vector<std::string> AmazonS3::listObjectsResponse(
+    std::istream& stream, std::string& next_page_token) const {
+  std::stringstream sstream;
+  sstream << stream.rdbuf();
+  tinyxml2::XMLDocument document;
+  if (document.Parse(sstream.str().c_str()) != tinyxml2::XML_SUCCESS)
+    throw std::logic_error(util::Error::FAILED_TO_PARSE_XML);
+  std::vector<std::string> result;
+  for (auto child = document.RootElement()->FirstChildElement("Contents");
+       child; child = child->NextSiblingElement("Contents")) {
+    auto key_element = child->FirstChildElement("Key");
+    if (!key_element || !key_element->GetText())
+      throw std::logic_error(util::Error::INVALID_XML);
+    result.push_back(key_element->GetText());
+  }
+  auto is_truncated_element =
+      document.RootElement()->FirstChildElement("IsTruncated");
+  if (!is_truncated_element) throw std::logic_error(util::Error::INVALID_XML);
+  if (is_truncated_element->GetText() == std::string("true")) {
+    auto next_token_element =
+        document.RootElement()->FirstChildElement("NextContinuationToken");
+    if (!next_token_element || !next_token_element->GetText())
+      throw std::logic_error(util::Error::INVALID_XML);
+    next_page_token = next_token_element->GetText();
+  }
+  return result;
+}
+
+IHttpRequest::Pointer AmazonS3::deleteObjectRequest(
+    const std::string& key) const {
+  return http()->create(endpoint() + "/" + util::Url::escapePath(key),
+                        "DELETE");
+}
+
+IHttpRequest::Pointer AmazonS3::deleteObjectsRequest(
+    const std::vector<std::string>& keys, std::ostream& input) const {
+  if (!crypto()) throw std::runtime_error("no crypto functions provided");
+  std::string body =
+      "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+      "<Delete><Quiet>true</Quiet>";
+  for (auto&& key : keys)
+    body += "<Object><Key>" + escapeXml(key) + "</Key></Object>";
+  body += "</Delete>";
+  auto request = http()->create(endpoint() + "/", "POST");
+  request->setParameter("delete", "");
+  request->setHeaderParameter("Content-Type", "application/xml");
+  request->setHeaderParameter("x-amz-sdk-checksum-algorithm", "SHA256");
+  request->setHeaderParameter("x-amz-checksum-sha256",
+                              util::to_base64(crypto()->sha256(body)));
+  input << body;
+  return request;
+}
+
+void AmazonS3::deleteObjectsResponse(std::istream& stream) const {
+  std::stringstream sstream;
+  sstream << stream.rdbuf();
+  tinyxml2::XMLDocument document;
+  if (document.Parse(sstream.str().c_str()) != tinyxml2::XML_SUCCESS)
+    throw std::logic_error(util::Error::FAILED_TO_PARSE_XML);
+  if (auto error = document.RootElement()->FirstChildElement("Error")) {
+    std::string description;
+    for (auto name : {"Key", "Code", "Message"})
+      if (auto element = error->FirstChildElement(name))
+        if (auto text = element->GetText())
+          description += (description.empty() ? "" : " ") + std::string(text);
+    throw std::logic_error(description);
+  }
+}
+
+IHttpRequest::Pointer AmazonS3::createMultipartUploadRequest(
+    const std::string& key) const {
+  auto request = http()->create(
+      endpoint() + "/" + util::Url::escapePath(key), "POST");
+  request->setParameter("uploads", "");
+  return request;
+}
+
+std::string AmazonS3::createMultipartUploadResponse(
+    std::istream& stream) const {
+  std::stringstream sstream;
+  sstream << stream.rdbuf();
+  tinyxml2::XMLDocument document;
+  if (document.Parse(sstream.str().c_str()) != tinyxml2::XML_SUCCESS)
+    throw std::logic_error(util::Error::FAILED_TO_PARSE_XML);
+  auto upload_id = document.RootElement()->FirstChildElement("UploadId");
+  if (!upload_id || !upload_id->GetText())
+    throw std::logic_error(util::Error::INVALID_XML);
+  return upload_id->GetText();
+}
+
+IHttpRequest::Pointer AmazonS3::listPartsRequest(
+    const std::string& key, const std::string& upload_id,
+    const std::string& marker) const {
+  auto request =
+      http()->create(endpoint() + "/" + util::Url::escapePath(key), "GET");
+  request->setParameter("uploadId", upload_id);
+  if (!marker.empty()) request->setParameter("part-number-marker", marker);
+  return request;
+}
+
+std::vector<AmazonS3::Part> AmazonS3::listPartsResponse(
+    std::istream& stream, std::string& next_marker) const {
+  std::stringstream sstream;
+  sstream << stream.rdbuf();
+  tinyxml2::XMLDocument document;
+  if (document.Parse(sstream.str().c_str()) != tinyxml2::XML_SUCCESS)
+    throw std::logic_error(util::Error::FAILED_TO_PARSE_XML);
+  std::vector<Part> result;
+  for (auto child = document.RootElement()->FirstChildElement("Part"); child;
+       child = child->NextSiblingElement("Part")) {
+    auto number = child->FirstChildElement("PartNumber");
+    auto size = child->FirstChildElement("Size");
+    auto etag = child->FirstChildElement("ETag");
+    if (!number || !number->GetText() || !size || !size->GetText() || !etag ||
+        !etag->GetText())
+      throw std::logic_error(util::Error::INVALID_XML);
+    result.push_back({static_cast<uint32_t>(std::stoul(number->GetText())),
+                      std::stoull(size->GetText()), etag->GetText()});
+  }
+  auto is_truncated = document.RootElement()->FirstChildElement("IsTruncated");
+  if (is_truncated && is_truncated->GetText() == std::string("true")) {
+    auto marker =
+        document.RootElement()->FirstChildElement("NextPartNumberMarker");
+    if (!marker || !marker->GetText())
+      throw std::logic_error(util::Error::INVALID_XML);
+    next_marker = marker->GetText();
+  }
+  return result;
+}
+
+IHttpRequest::Pointer AmazonS3::uploadPartRequest(const std::string& key,
+                                                  const std::string& upload_id,
+                                                  uint32_t part_number) const {
+  auto request =
+      http()->create(endpoint() + "/" + util::Url::escapePath(key), "PUT");
+  request->setParameter("partNumber", std::to_string(part_number));
+  request->setParameter("uploadId", upload_id);
+  return request;
+}
+
+IHttpRequest::Pointer AmazonS3::completeMultipartUploadRequest(
+    const std::string& key, const std::string& upload_id,
+    const std::vector<Part>& parts, std::ostream& input) const {
+  auto request = http()->create(
+      endpoint() + "/" + util::Url::escapePath(key), "POST");
+  request->setParameter("uploadId", upload_id);
+  request->setHeaderParameter("Content-Type", "application/xml");
+  input << "<CompleteMultipartUpload>";
+  for (auto&& part : parts)
+    input << "<Part><PartNumber>" << part.number_ << "</PartNumber><ETag>"
+          << escapeXml(part.etag_) << "</ETag></Part>";
+  input << "</CompleteMultipartUpload>";
+  return request;
+}
+
+void AmazonS3::completeMultipartUploadResponse(std::istream& stream) const {
+  std::stringstream sstream;
+  sstream << stream.rdbuf();
+  tinyxml2::XMLDocument document;
+  if (document.Parse(sstream.str().c_str()) != tinyxml2::XML_SUCCESS)
+    throw std::logic_error(util::Error::FAILED_TO_PARSE_XML);
+  if (document.RootElement()->Name() == std::string("Error")) {
+    auto message = document.RootElement()->FirstChildElement("Message");
+    throw std::logic_error(message && message->GetText()
+                               ? message->GetText()
+                               : util::Error::INVALID_XML);
+  }
+}
+
+IHttpRequest::Pointer AmazonS3::abortMultipartUploadRequest(
+    const std::string& key, const std::string& upload_id) const {
+  auto request = http()->create(
+      endpoint() + "/" + util::Url::escapePath(key), "DELETE");
+  request->setParameter("uploadId", upload_id);
+  return request;
 }
 
 IItem::List AmazonS3::listDirectoryResponse(
@@ -425,74 +1176,7 @@ IItem::List AmazonS3::listDirectoryResponse(
 
 void AmazonS3::authorizeRequest(IHttpRequest& request) const {
   if (!crypto()) throw std::runtime_error("no crypto functions provided");
-  std::string current_date = currentDate();
-  std::string time = currentDateAndTime();
-  std::string scope = current_date + "/" + region() + "/s3/aws4_request";
-  util::Url url(request.url());
-  request.setParameter("X-Amz-Algorithm", "AWS4-HMAC-SHA256");
-  request.setParameter("X-Amz-Credential", access_id() + "/" + scope);
-  request.setParameter("X-Amz-Date", time);
-  request.setParameter("X-Amz-Expires", "86400");
-  request.setHeaderParameter("host", url.host());
-
-  std::vector<std::pair<std::string, std::string>> header_parameters;
-  for (auto q : request.headerParameters())
-    header_parameters.push_back({util::to_lower(q.first), q.second});
-  std::sort(header_parameters.begin(), header_parameters.end());
-
-  std::string signed_headers;
-  {
-    bool first = false;
-    for (auto q : header_parameters) {
-      if (first)
-        signed_headers += ";";
-      else
-        first = true;
-      signed_headers += q.first;
-    }
-    request.setParameter("X-Amz-SignedHeaders", signed_headers);
-  }
-
-  std::vector<std::pair<std::string, std::string>> query_parameters;
-  for (auto q : request.parameters())
-    query_parameters.push_back({q.first, q.second});
-  std::sort(query_parameters.begin(), query_parameters.end());
-
-  std::string canonical_request = request.method() + "\n" + url.path() + "\n";
-
-  bool first = false;
-  for (auto q : query_parameters) {
-    if (first)
-      canonical_request += "&";
-    else
-      first = true;
-    canonical_request +=
-        util::Url::escape(q.first) + "=" + util::Url::escape(q.second);
-  }
-  canonical_request += "\n";
-
-  for (auto q : header_parameters)
-    canonical_request += util::Url::escape(q.first) + ":" + q.second + "\n";
-  canonical_request += "\n";
-  canonical_request += signed_headers + "\n";
-  canonical_request += "UNSIGNED-PAYLOAD";
-
-  auto hash = std::bind(&ICrypto::sha256, crypto(), _1);
-  auto sign = std::bind(&ICrypto::hmac_sha256, crypto(), _1, _2);
-  auto hex = std::bind(&ICrypto::hex, crypto(), _1);
-
-  std::string string_to_sign = "AWS4-HMAC-SHA256\n" + time + "\n" + scope +
-                               "\n" + hex(hash(canonical_request));
-  std::string key =
-      sign(sign(sign(sign("AWS4" + secret(), current_date), region()), "s3"),
-           "aws4_request");
-  std::string signature = hex(sign(key, string_to_sign));
-
-  request.setParameter("X-Amz-Signature", signature);
-
-  auto params = request.parameters();
-  for (auto p : params)
-    request.setParameter(p.first, util::Url::escape(p.second));
+  signer_.authorize(*crypto(), request, credentials(), currentDateAndTime());
 }
 
 bool AmazonS3::reauthorize(int code,
@@ -509,6 +1193,11 @@ bool AmazonS3::isSuccess(int code,
          CloudProvider::isSuccess(code, headers);
 }
 
+AwsSigner::Credentials AmazonS3::credentials() const {
+  auto lock = auth_lock();
+  return {access_id_, secret_, region_};
+}
+
 std::string AmazonS3::access_id() const {
   auto lock = auth_lock();
   return access_id_;
@@ -544,9 +1233,11 @@ bool AmazonS3::unpackCredentials(const std::string& code) {
 }
 
 std::string AmazonS3::getUrl(const Item& item) const {
-  auto request =
-      http()->create(endpoint() + "/" + escapePath(item.id()), "GET");
-  authorizeRequest(*request);
+  if (!crypto()) throw std::runtime_error("no crypto functions provided");
+  auto request = http()->create(
+      endpoint() + "/" + util::Url::escapePath(item.id()), "GET");
+  signer_.presign(*crypto(), *request, credentials(), currentDateAndTime(),
+                  URL_EXPIRATION);
   std::string parameters;
   for (const auto& p : request->parameters())
     parameters += p.first + "=" + p.second + "&";
@@ -26,6 +26,10 @@
 
 #include "CloudProvider.h"
 
+#include <mutex>
+#include <unordered_map>
+
+#include "Utility/AwsSigner.h"
 #include "Utility/Item.h"
 
 namespace cloudstorage {
@@ -33,13 +37,35 @@ namespace cloudstorage {
 /**
  * AmazonS3 requires computing HMAC-SHA256 hashes, so it requires a valid
  * ICrypto implementation. Be careful about renaming and moving directories,
- * because there has to be an http request per each of its subelement. Buckets
- * are listed as root directory's children, renaming and moving them doesn't
- * work. Token in this case is a base64 encoded json with fields
- * username (access_id), password (secret_key), region.
+ * because there has to be an http request per each of its subelement;
+ * deleting them takes a request per thousand subelements. Buckets are listed
+ * as root directory's children, renaming and moving them doesn't work. Token
+ * in this case is a base64 encoded json with fields username (access_id),
+ * password (secret_key), region.
+ *
+ * Files larger than a part are uploaded in parts, several at once. Part size
+ * and count of parts sent at once can be set with hints upload_part_size and
+ * upload_parallelism. If such upload fails, resumeUploadFileAsync of a file
+ * of the same size to the same key continues it, skipping parts already
+ * stored; uploadFileAsync aborts it and starts over, as the parts may hold
+ * different content. Cancelled uploads are aborted. Ids of such uploads are
+ * kept in the upload journal too, so that they can be continued after a
+ * restart.
  */
 class AmazonS3 : public CloudProvider {
  public:
+  static constexpr size_t DeleteBatchSize = 1000;
+  static constexpr uint64_t MinPartSize = 5 * 1024 * 1024;
+  static constexpr uint64_t DefaultPartSize = 8 * 1024 * 1024;
+  static constexpr uint32_t MaxPartCount = 10000;
+  static constexpr int DefaultUploadParallelism = 4;
+
+  struct Part {
+    uint32_t number_;
+    uint64_t size_;
+    std::string etag_;
+  };
+
   AmazonS3();
 
   void initialize(InitData&& data) override;
@@ -60,6 +86,12 @@ class AmazonS3 : public CloudProvider {
                                              RenameItemCallback) override;
   DeleteItemRequest::Pointer deleteItemAsync(IItem::Pointer,
                                              DeleteItemCallback) override;
+  UploadFileRequest::Pointer uploadFileAsync(
+      IItem::Pointer, const std::string& filename,
+      IUploadFileCallback::Pointer) override;
+  UploadFileRequest::Pointer resumeUploadFileAsync(
+      IItem::Pointer, const std::string& filename,
+      IUploadFileCallback::Pointer) override;
   GeneralDataRequest::Pointer getGeneralDataAsync(GeneralDataCallback) override;
 
   IHttpRequest::Pointer createDirectoryRequest(const IItem&,
@@ -68,6 +100,8 @@ class AmazonS3 : public CloudProvider {
   IHttpRequest::Pointer listDirectoryRequest(
       const IItem&, const std::string& page_token,
       std::ostream& input_stream) const override;
+  IHttpRequest::Pointer getItemByPathRequest(
+      const std::string& path, std::ostream& input_stream) const override;
   IHttpRequest::Pointer uploadFileRequest(
       const IItem& directory, const std::string& filename,
       std::ostream& prefix_stream, std::ostream& suffix_stream) const override;
@@ -76,6 +110,9 @@ class AmazonS3 : public CloudProvider {
 
   IItem::List listDirectoryResponse(
       const IItem&, std::istream&, std::string& next_page_token) const override;
+  IItem::Pointer getItemByPathResponse(const std::string& path,
+                                       const IHttpRequest::HeaderParameters&,
+                                       std::istream& response) const override;
   IItem::Pointer createDirectoryResponse(const IItem& parent,
                                          const std::string& name,
                                          std::istream& response) const override;
@@ -83,6 +120,50 @@ class AmazonS3 : public CloudProvider {
                                     const std::string& filename, uint64_t,
                                     std::istream& response) const override;
 
+  /**
+   * Lists all keys starting with prefix, without grouping them into
+   * directories.
+   */
+  IHttpRequest::Pointer listObjectsRequest(const std::string& prefix,
+                                           const std::string& page_token) const;
+  std::vector<std::string> listObjectsResponse(
+      std::istream&, std::string& next_page_token) const;
+
+  IHttpRequest::Pointer deleteObjectRequest(const std::string& key) const;
+
+  /**
+   * Deletes up to DeleteBatchSize keys with a single request.
+   */
+  IHttpRequest::Pointer deleteObjectsRequest(
+      const std::vector<std::string>& keys, std::ostream& input_stream) const;
+
+  /**
+   * @throws std::logic_error if any of the keys wasn't deleted
+   */
+  void deleteObjectsResponse(std::istream&) const;
+
+  IHttpRequest::Pointer createMultipartUploadRequest(
+      const std::string& key) const;
+  std::string createMultipartUploadResponse(std::istream&) const;
+  IHttpRequest::Pointer listPartsRequest(const std::string& key,
+                                         const std::string& upload_id,
+                                         const std::string& marker) const;
+  std::vector<Part> listPartsResponse(std::istream&,
+                                      std::string& next_marker) const;
+  IHttpRequest::Pointer uploadPartRequest(const std::string& key,
+                                          const std::string& upload_id,
+                                          uint32_t part_number) const;
+  IHttpRequest::Pointer completeMultipartUploadRequest(
+      const std::string& key, const std::string& upload_id,
+      const std::vector<Part>& parts, std::ostream& input_stream) const;
+
+  /**
+   * @throws std::logic_error if the server failed to assemble the object
+   */
+  void completeMultipartUploadResponse(std::istream&) const;
+  IHttpRequest::Pointer abortMultipartUploadRequest(
+      const std::string& key, const std::string& upload_id) const;
+
   void authorizeRequest(IHttpRequest&) const override;
   bool reauthorize(int, const IHttpRequest::HeaderParameters&) const override;
   bool isSuccess(int code,
@@ -108,13 +189,27 @@ class AmazonS3 : public CloudProvider {
   };
 
  private:
+  class MultipartUpload;
+
+  struct PendingUpload {
+    std::string upload_id_;
+    uint64_t size_;
+    uint64_t part_size_;
+  };
+
   bool unpackCredentials(const std::string&) override;
   std::string getUrl(const Item&) const;
+  AwsSigner::Credentials credentials() const;
 
   std::string access_id_;
   std::string secret_;
   std::string region_;
   std::string bucket_;
+  uint64_t part_size_;
+  int upload_parallelism_;
+  std::mutex pending_upload_mutex_;
+  std::unordered_map<std::string, PendingUpload> pending_upload_;
+  mutable AwsSigner signer_;
 };
 
 }  // namespace cloudstorage
@@ -196,6 +196,14 @@ IHttpRequest::Pointer Box::getGeneralDataRequest(std::ostream&) const {
   return http()->create(endpoint() + "/2.0/users/me");
 }
 
+IHttpRequest::Pointer Box::listChangesRequest(const std::string& cursor,
+                                              std::ostream&) const {
+  auto request = http()->create(endpoint() + "/2.0/events");
+  request->setParameter("stream_type", "changes");
+  request->setParameter("stream_position", cursor.empty() ? "now" : cursor);
+  return request;
+}
+
 IItem::Pointer Box::getItemDataResponse(std::istream& stream) const {
   return toItem(util::json::from_stream(stream));
 }
@@ -213,6 +221,26 @@ IItem::List Box::listDirectoryResponse(const IItem&, std::istream& stream,
   return result;
 }
 
+ChangeData Box::listChangesResponse(std::istream& stream) const {
+  auto response = util::json::from_stream(stream);
+  ChangeData result;
+  for (const Json::Value& v : response["entries"]) {
+    const Json::Value& source = v["source"];
+    auto type = source["type"].asString();
+    if (type != "file" && type != "folder") continue;
+    Change change;
+    change.id_ = FileId(type == "folder", source["id"].asString());
+    if (source["parent"].isMember("id"))
+      change.parents_ = {FileId(true, source["parent"]["id"].asString())};
+    if (v["event_type"].asString() != "ITEM_TRASH")
+      change.item_ = toItem(source);
+    result.changes_.push_back(change);
+  }
+  result.cursor_ = response["next_stream_position"].asString();
+  result.has_more_ = !response["entries"].empty();
+  return result;
+}
+
 IItem::Pointer Box::toItem(const Json::Value& v) const {
   IItem::FileType type = IItem::FileType::Unknown;
   if (v["type"].asString() == "folder") type = IItem::FileType::Directory;
@@ -64,6 +64,8 @@ class Box : public CloudProvider {
   IHttpRequest::Pointer renameItemRequest(const IItem&, const std::string& name,
                                           std::ostream&) const override;
   IHttpRequest::Pointer getGeneralDataRequest(std::ostream&) const override;
+  IHttpRequest::Pointer listChangesRequest(const std::string& cursor,
+                                           std::ostream&) const override;
 
   IItem::Pointer getItemDataResponse(std::istream& response) const override;
   IItem::List listDirectoryResponse(
@@ -75,6 +77,7 @@ class Box : public CloudProvider {
                                     const std::string& filename, uint64_t,
                                     std::istream& response) const override;
   GeneralData getGeneralDataResponse(std::istream& response) const override;
+  ChangeData listChangesResponse(std::istream& response) const override;
 
   IItem::Pointer toItem(const Json::Value&) const;
 
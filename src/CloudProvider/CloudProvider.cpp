@@ -130,7 +130,10 @@ class UploadFileCallback : public cloudstorage::IUploadFileCallback {
 namespace cloudstorage {
 
 CloudProvider::CloudProvider(IAuth::Pointer auth)
-    : auth_(std::move(auth)), http_(), deleted_() {}
+    : auth_(std::move(auth)),
+      http_(),
+      rate_limiter_(util::make_unique<RateLimiter>()),
+      deleted_() {}
 
 void CloudProvider::initialize(InitData&& data) {
   auto lock = auth_lock();
@@ -139,6 +142,8 @@ void CloudProvider::initialize(InitData&& data) {
   http_ = std::move(data.http_engine_);
   http_server_ = std::move(data.http_server_);
   thread_pool_ = std::move(data.thread_pool_);
+  block_cache_ = BlockCache::create(data.cache_directory_, data.cache_size_);
+  upload_journal_ = UploadJournal::create(data.upload_journal_);
 
   auto t = auth()->fromTokenString(data.token_);
   setWithHint(data.hints_, "access_token",
@@ -181,7 +186,8 @@ void CloudProvider::initialize(InitData&& data) {
   if (!http_server_)
     throw std::runtime_error("No http server module specified.");
 
-  file_daemon_ = FileServer::create(shared_from_this(), auth()->state());
+  file_daemon_ = FileServer::create(shared_from_this(), auth()->state(),
+                                    data.stream_prefetch_);
   if (file_url_.empty()) file_url_ = DEFAULT_FILE_URL;
 
   if (auth()->state().empty()) auth()->set_state(DEFAULT_STATE);
@@ -201,6 +207,8 @@ void CloudProvider::destroy() {
   http_ = nullptr;
   http_server_ = nullptr;
   thread_pool_ = nullptr;
+  block_cache_ = nullptr;
+  upload_journal_ = nullptr;
 }
 
 std::string ICloudProvider::serializeSession(const std::string& token,
@@ -242,6 +250,14 @@ ICloudProvider::Hints CloudProvider::hints() const {
           {"file_url", file_url_}};
 }
 
+ICloudProvider::RequestStatistics CloudProvider::requestStatistics() const {
+  return rate_limiter_->statistics();
+}
+
+ICloudProvider::CacheStatistics CloudProvider::cacheStatistics() const {
+  return block_cache_ ? block_cache_->statistics() : CacheStatistics{};
+}
+
 std::string CloudProvider::access_token() const {
   auto lock = auth_lock();
   if (auth()->access_token() == nullptr) return "";
@@ -288,6 +304,46 @@ IHttpServerFactory* CloudProvider::http_server() const {
 
 IThreadPool* CloudProvider::thread_pool() const { return thread_pool_.get(); }
 
+RateLimiter* CloudProvider::rate_limiter() const { return rate_limiter_.get(); }
+
+std::shared_ptr<BlockCache> CloudProvider::block_cache() const {
+  return block_cache_;
+}
+
+std::shared_ptr<UploadJournal> CloudProvider::upload_journal() const {
+  return upload_journal_;
+}
+
+void CloudProvider::upload_journal_key(
+    std::shared_ptr<Request<EitherError<IItem>>> r, const std::string& parent,
+    const std::string& filename, uint64_t size,
+    GenericCallback<EitherError<std::string>> callback) {
+  if (!upload_journal()) return callback(std::string());
+  auto key = [=](const std::string& account) {
+    return UploadJournal::key(name(), account, parent, filename, size);
+  };
+  {
+    std::lock_guard<std::mutex> lock(account_mutex_);
+    if (!account_.empty()) return callback(key(account_));
+  }
+  r->make_subrequest(&CloudProvider::getGeneralDataAsync,
+                     [=](EitherError<GeneralData> e) {
+                       if (e.left()) return callback(e.left());
+                       {
+                         std::lock_guard<std::mutex> lock(account_mutex_);
+                         account_ = e.right()->username_;
+                       }
+                       callback(key(e.right()->username_));
+                     });
+}
+
+PathCache* CloudProvider::path_cache() const {
+  std::lock_guard<std::mutex> lock(path_cache_mutex_);
+  if (!path_cache_)
+    path_cache_ = util::make_unique<PathCache>(rootDirectory()->id());
+  return path_cache_.get();
+}
+
 bool CloudProvider::isSuccess(int code,
                               const IHttpRequest::HeaderParameters&) const {
   return IHttpRequest::isSuccess(code);
@@ -331,6 +387,13 @@ ICloudProvider::UploadFileRequest::Pointer CloudProvider::uploadFileAsync(
       ->run();
 }
 
+ICloudProvider::UploadFileRequest::Pointer
+CloudProvider::resumeUploadFileAsync(IItem::Pointer directory,
+                                     const std::string& filename,
+                                     IUploadFileCallback::Pointer callback) {
+  return uploadFileAsync(directory, filename, callback);
+}
+
 ICloudProvider::GetItemDataRequest::Pointer CloudProvider::getItemDataAsync(
     const std::string& id, GetItemDataCallback f) {
   return std::make_shared<cloudstorage::GetItemDataRequest>(shared_from_this(),
@@ -580,6 +643,31 @@ ICloudProvider::GeneralDataRequest::Pointer CloudProvider::getGeneralDataAsync(
       ->run();
 }
 
+ICloudProvider::ListChangesRequest::Pointer CloudProvider::listChangesAsync(
+    const std::string& cursor, ListChangesCallback cb) {
+  auto resolver = [=](Request<EitherError<ChangeData>>::Pointer r) {
+    std::stringstream stream;
+    if (!r->provider()->listChangesRequest(cursor, stream))
+      return r->done(
+          Error{IHttpRequest::ServiceUnavailable, util::Error::UNIMPLEMENTED});
+    r->request(
+        [=](util::Output stream) {
+          return r->provider()->listChangesRequest(cursor, *stream);
+        },
+        [=](EitherError<Response> e) {
+          if (e.left()) return r->done(e.left());
+          try {
+            r->done(r->provider()->listChangesResponse(e.right()->output()));
+          } catch (const std::exception&) {
+            r->done(Error{IHttpRequest::Failure, e.right()->output().str()});
+          }
+        });
+  };
+  return std::make_shared<Request<EitherError<ChangeData>>>(shared_from_this(),
+                                                            cb, resolver)
+      ->run();
+}
+
 ICloudProvider::GetItemUrlRequest::Pointer CloudProvider::getFileDaemonUrlAsync(
     IItem::Pointer item, GetItemUrlCallback cb) {
   auto resolver = [=](Request<EitherError<std::string>>::Pointer r) {
@@ -619,6 +707,11 @@ IHttpRequest::Pointer CloudProvider::getItemDataRequest(const std::string&,
   return nullptr;
 }
 
+IHttpRequest::Pointer CloudProvider::getItemByPathRequest(const std::string&,
+                                                          std::ostream&) const {
+  return nullptr;
+}
+
 IHttpRequest::Pointer CloudProvider::getItemUrlRequest(
     const IItem& item, std::ostream& stream) const {
   return getItemDataRequest(item.id(), stream);
@@ -675,10 +768,21 @@ IHttpRequest::Pointer CloudProvider::getGeneralDataRequest(
   return nullptr;
 }
 
+IHttpRequest::Pointer CloudProvider::listChangesRequest(const std::string&,
+                                                        std::ostream&) const {
+  return nullptr;
+}
+
 IItem::Pointer CloudProvider::getItemDataResponse(std::istream&) const {
   return nullptr;
 }
 
+IItem::Pointer CloudProvider::getItemByPathResponse(
+    const std::string&, const IHttpRequest::HeaderParameters&,
+    std::istream& response) const {
+  return getItemDataResponse(response);
+}
+
 IItem::Pointer CloudProvider::renameItemResponse(const IItem&,
                                                  const std::string&,
                                                  std::istream& response) const {
@@ -700,6 +804,10 @@ GeneralData CloudProvider::getGeneralDataResponse(std::istream&) const {
   return {};
 }
 
+ChangeData CloudProvider::listChangesResponse(std::istream&) const {
+  return {};
+}
+
 std::string CloudProvider::getItemUrlResponse(
     const IItem&, const IHttpRequest::HeaderParameters&,
     std::istream& stream) const {
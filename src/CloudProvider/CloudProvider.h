@@ -33,6 +33,10 @@
 #include "ICloudProvider.h"
 #include "Request/AuthorizeRequest.h"
 #include "Utility/Auth.h"
+#include "Utility/BlockCache.h"
+#include "Utility/PathCache.h"
+#include "Utility/RateLimiter.h"
+#include "Utility/UploadJournal.h"
 
 namespace cloudstorage {
 
@@ -47,6 +51,8 @@ class CloudProvider : public ICloudProvider,
   virtual void destroy();
 
   Hints hints() const override;
+  RequestStatistics requestStatistics() const override;
+  CacheStatistics cacheStatistics() const override;
   std::string access_token() const;
   IAuth* auth() const;
 
@@ -58,6 +64,19 @@ class CloudProvider : public ICloudProvider,
   IHttp* http() const;
   IHttpServerFactory* http_server() const;
   IThreadPool* thread_pool() const;
+  RateLimiter* rate_limiter() const;
+  std::shared_ptr<BlockCache> block_cache() const;
+  std::shared_ptr<UploadJournal> upload_journal() const;
+  /**
+   * Calls back with key of the upload in upload_journal(), or an empty one if
+   * there is no journal. Account is identified by the username reported by
+   * getGeneralDataAsync, which is asked for once.
+   */
+  void upload_journal_key(std::shared_ptr<Request<EitherError<IItem>>>,
+                          const std::string& parent,
+                          const std::string& filename, uint64_t size,
+                          GenericCallback<EitherError<std::string>>);
+  PathCache* path_cache() const;
   IAuthCallback* auth_callback() const;
   std::string file_url() const;
 
@@ -79,6 +98,9 @@ class CloudProvider : public ICloudProvider,
   UploadFileRequest::Pointer uploadFileAsync(
       IItem::Pointer, const std::string&,
       IUploadFileCallback::Pointer) override;
+  UploadFileRequest::Pointer resumeUploadFileAsync(
+      IItem::Pointer, const std::string&,
+      IUploadFileCallback::Pointer) override;
   GetItemDataRequest::Pointer getItemDataAsync(const std::string& id,
                                                GetItemDataCallback f) override;
   DownloadFileRequest::Pointer getThumbnailAsync(
@@ -111,6 +133,8 @@ class CloudProvider : public ICloudProvider,
   GeneralDataRequest::Pointer getGeneralDataAsync(GeneralDataCallback) override;
   GetItemUrlRequest::Pointer getFileDaemonUrlAsync(IItem::Pointer,
                                                    GetItemUrlCallback) override;
+  ListChangesRequest::Pointer listChangesAsync(const std::string& cursor,
+                                               ListChangesCallback) override;
 
   /**
    * Used by default implementation of getItemDataAsync.
@@ -122,6 +146,18 @@ class CloudProvider : public ICloudProvider,
   virtual IHttpRequest::Pointer getItemDataRequest(
       const std::string& id, std::ostream& input_stream) const;
 
+  /**
+   * Used by getItemAsync to look up an item by its absolute path directly,
+   * instead of listing every directory on the way; providers which can't do
+   * that return nullptr.
+   *
+   * @param path absolute path, without trailing slash
+   * @param input_stream request body
+   * @return http request
+   */
+  virtual IHttpRequest::Pointer getItemByPathRequest(
+      const std::string& path, std::ostream& input_stream) const;
+
   virtual IHttpRequest::Pointer getItemUrlRequest(
       const IItem&, std::ostream& input_stream) const;
 
@@ -211,6 +247,16 @@ class CloudProvider : public ICloudProvider,
 
   virtual IHttpRequest::Pointer getGeneralDataRequest(std::ostream&) const;
 
+  /**
+   * Used by default implementation of listChangesAsync; providers which don't
+   * keep track of changes return nullptr.
+   *
+   * @param cursor empty if asking for the current cursor
+   * @return http request
+   */
+  virtual IHttpRequest::Pointer listChangesRequest(const std::string& cursor,
+                                                   std::ostream&) const;
+
   /**
    * Used by default implementation of getItemDataAsync, should translate
    * reponse into IItem object.
@@ -220,6 +266,16 @@ class CloudProvider : public ICloudProvider,
    */
   virtual IItem::Pointer getItemDataResponse(std::istream& response) const;
 
+  /**
+   * Used by getItemAsync; by default same as getItemDataResponse.
+   *
+   * @return nullptr if there is no item at path; throws if the response
+   * doesn't tell, directories are listed to find the item then
+   */
+  virtual IItem::Pointer getItemByPathResponse(
+      const std::string& path, const IHttpRequest::HeaderParameters&,
+      std::istream& response) const;
+
   virtual std::string getItemUrlResponse(const IItem& item,
                                          const IHttpRequest::HeaderParameters&,
                                          std::istream& response) const;
@@ -251,6 +307,7 @@ class CloudProvider : public ICloudProvider,
                                             uint64_t size,
                                             std::istream& response) const;
   virtual GeneralData getGeneralDataResponse(std::istream& response) const;
+  virtual ChangeData listChangesResponse(std::istream& response) const;
 
   /**
    * Used by default implementation of createDirectoryAsync, should translate
@@ -320,6 +377,13 @@ class CloudProvider : public ICloudProvider,
   IHttp::Pointer http_;
   IHttpServerFactory::Pointer http_server_;
   IThreadPool::Pointer thread_pool_;
+  std::unique_ptr<RateLimiter> rate_limiter_;
+  std::shared_ptr<BlockCache> block_cache_;
+  std::shared_ptr<UploadJournal> upload_journal_;
+  std::mutex account_mutex_;
+  std::string account_;
+  mutable std::mutex path_cache_mutex_;
+  mutable std::unique_ptr<PathCache> path_cache_;
   AuthorizeRequest::Pointer current_authorization_;
   std::unordered_map<IGenericRequest*,
                      std::vector<AuthorizeRequest::AuthorizeCompleted>>
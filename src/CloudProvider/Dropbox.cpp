@@ -30,69 +30,154 @@
 #include "Utility/Item.h"
 #include "Utility/Utility.h"
 
+#include "Request/ChunkedUpload.h"
 #include "Request/Request.h"
 
 const std::string DROPBOXAPI_ENDPOINT = "https://api.dropboxapi.com";
-const int CHUNK_SIZE = 60 * 1024 * 1024;
+const std::string UPLOAD_SESSION_ENDPOINT =
+    "https://content.dropboxapi.com/2/files/upload_session";
 
 namespace cloudstorage {
 
 namespace {
-void upload(Request<EitherError<IItem>>::Pointer r,
+void forget(Request<EitherError<IItem>>::Pointer r, const std::string& key) {
+  auto journal =
+      static_cast<CloudProvider*>(r->provider().get())->upload_journal();
+  if (journal) journal->remove(key);
+}
+
+void finish(Request<EitherError<IItem>>::Pointer r,
             const std::string& session_id, const std::string& path,
-            uint64_t sent, IUploadFileCallback* callback) {
-  auto size = callback->size();
-  auto length = std::make_shared<uint64_t>(0);
-  r->send(
-      [=](util::Output stream) {
-        std::vector<char> buffer(CHUNK_SIZE);
-        if (sent < size)
-          *length = callback->putData(buffer.data(), CHUNK_SIZE, sent);
-        std::string upload_url =
-            "https://content.dropboxapi.com/2/files/upload_session";
+            uint64_t size, const std::string& key) {
+  r->request(
+      [=](util::Output) {
+        auto request = r->provider()->http()->create(
+            UPLOAD_SESSION_ENDPOINT + "/finish", "POST");
         Json::Value json;
-        if (sent == 0)
-          upload_url += "/start";
-        else if (sent + *length >= size) {
-          json["commit"]["path"] = path;
-          json["commit"]["mode"] = "overwrite";
-          upload_url += "/finish";
-        } else
-          upload_url += "/append_v2";
-        auto request = r->provider()->http()->create(upload_url, "POST");
-        if (sent != 0) {
-          json["cursor"]["session_id"] = session_id;
-          json["cursor"]["offset"] = Json::Int64(static_cast<int64_t>(sent));
-        }
+        json["cursor"]["session_id"] = session_id;
+        json["cursor"]["offset"] = Json::Int64(static_cast<int64_t>(size));
+        json["commit"]["path"] = path;
+        json["commit"]["mode"] = "overwrite";
         request->setHeaderParameter("Content-Type", "application/octet-stream");
         request->setHeaderParameter("Dropbox-API-Arg",
                                     util::json::to_string(json));
-        stream->write(buffer.data(), *length);
         return request;
       },
       [=](EitherError<Response> e) {
-        if (e.left()) return r->done(e.left());
+        if (e.left()) {
+          if (r->is_cancelled()) forget(r, key);
+          return r->done(e.left());
+        }
+        forget(r, key);
         try {
           auto json = util::json::from_stream(e.right()->output());
-          if (sent < size)
-            upload(
-                r,
-                session_id.empty() ? json["session_id"].asString() : session_id,
-                path, sent + *length, callback);
-          else
-            r->done(Dropbox::toItem(json));
+          r->done(Dropbox::toItem(json));
         } catch (const Json::Exception&) {
           r->done(Error{IHttpRequest::Failure, e.right()->output().str()});
         }
+      });
+}
+
+void append(Request<EitherError<IItem>>::Pointer r,
+            const std::string& session_id, const std::string& path,
+            IUploadFileCallback::Pointer callback, uint64_t chunk_size,
+            int parallelism, uint64_t offset, const std::string& key) {
+  auto size = callback->size();
+  auto upload =
+      std::make_shared<ChunkedUpload>(r, callback, chunk_size, parallelism);
+  upload->run(
+      offset,
+      [=](uint64_t offset, uint64_t length) {
+        auto request = r->provider()->http()->create(
+            UPLOAD_SESSION_ENDPOINT + "/append_v2", "POST");
+        Json::Value json;
+        json["cursor"]["session_id"] = session_id;
+        json["cursor"]["offset"] = Json::Int64(static_cast<int64_t>(offset));
+        json["close"] = offset + length == size;
+        request->setHeaderParameter("Content-Type", "application/octet-stream");
+        request->setHeaderParameter("Dropbox-API-Arg",
+                                    util::json::to_string(json));
+        return request;
+      },
+      [](uint64_t, Response&) { return EitherError<void>(nullptr); },
+      [=](EitherError<void> e) {
+        if (e.left()) {
+          if (r->is_cancelled()) forget(r, key);
+          return r->done(e.left());
+        }
+        finish(r, session_id, path, size, key);
+      });
+}
+
+/**
+ * Sessions recorded in the upload journal are sequential, as only they can
+ * tell the offset at which they stopped.
+ */
+void upload(Request<EitherError<IItem>>::Pointer r, const std::string& path,
+            IUploadFileCallback::Pointer callback, uint64_t chunk_size,
+            int parallelism, const std::string& key) {
+  auto size = callback->size();
+  auto journal =
+      static_cast<CloudProvider*>(r->provider().get())->upload_journal();
+  r->request(
+      [=](util::Output) {
+        auto request = r->provider()->http()->create(
+            UPLOAD_SESSION_ENDPOINT + "/start", "POST");
+        Json::Value json;
+        if (size == 0)
+          json["close"] = true;
+        else if (journal)
+          json["session_type"] = "sequential";
+        else
+          json["session_type"] = "concurrent";
+        request->setHeaderParameter("Content-Type", "application/octet-stream");
+        request->setHeaderParameter("Dropbox-API-Arg",
+                                    util::json::to_string(json));
+        return request;
       },
-      [] { return std::make_shared<std::stringstream>(); },
-      std::make_shared<std::stringstream>(), nullptr,
-      [=](uint64_t, uint64_t now) { callback->progress(size, sent + now); },
-      true);
+      [=](EitherError<Response> e) {
+        if (e.left()) return r->done(e.left());
+        std::string session_id;
+        try {
+          session_id = util::json::from_stream(e.right()->output())
+                           ["session_id"].asString();
+        } catch (const Json::Exception&) {
+          return r->done(
+              Error{IHttpRequest::Failure, e.right()->output().str()});
+        }
+        if (journal && size > 0) {
+          Json::Value session;
+          session["session_id"] = session_id;
+          journal->put(key, session);
+        }
+        append(r, session_id, path, callback, chunk_size,
+               journal ? 1 : parallelism, 0, key);
+      });
 }
 }  // namespace
 
-Dropbox::Dropbox() : CloudProvider(util::make_unique<Auth>()) {}
+constexpr uint64_t Dropbox::ChunkAlignment;
+constexpr uint64_t Dropbox::MaxChunkSize;
+constexpr uint64_t Dropbox::DefaultChunkSize;
+constexpr int Dropbox::DefaultUploadParallelism;
+
+Dropbox::Dropbox()
+    : CloudProvider(util::make_unique<Auth>()),
+      chunk_size_(DefaultChunkSize),
+      upload_parallelism_(DefaultUploadParallelism) {}
+
+void Dropbox::initialize(InitData&& init_data) {
+  setWithHint(init_data.hints_, "upload_chunk_size", [this](std::string v) {
+    auto size = std::strtoull(v.c_str(), nullptr, 10);
+    chunk_size_ = std::min(std::max<uint64_t>(size / ChunkAlignment, 1) *
+                               ChunkAlignment,
+                           MaxChunkSize);
+  });
+  setWithHint(init_data.hints_, "upload_parallelism", [this](std::string v) {
+    upload_parallelism_ = std::max(std::atoi(v.c_str()), 1);
+  });
+  CloudProvider::initialize(std::move(init_data));
+}
 
 std::string Dropbox::name() const { return "dropbox"; }
 
@@ -112,11 +197,84 @@ bool Dropbox::reauthorize(int code,
 ICloudProvider::UploadFileRequest::Pointer Dropbox::uploadFileAsync(
     IItem::Pointer parent, const std::string& filename,
     IUploadFileCallback::Pointer cb) {
-  auto callback = cb.get();
+  auto chunk_size = chunk_size_;
+  auto parallelism = upload_parallelism_;
+  return std::make_shared<Request<EitherError<IItem>>>(
+             shared_from_this(), [=](EitherError<IItem> e) { cb->done(e); },
+             [=](Request<EitherError<IItem>>::Pointer r) {
+               upload_journal_key(
+                   r, parent->id(), filename, cb->size(),
+                   [=](EitherError<std::string> key) {
+                     if (key.left()) return r->done(key.left());
+                     upload(r, parent->id() + "/" + filename, cb, chunk_size,
+                            parallelism, *key.right());
+                   });
+             })
+      ->run();
+}
+
+/**
+ * Offset at which the session stopped is found out by appending nothing at
+ * offset zero, which the session refuses with the offset it expects unless
+ * it didn't receive anything yet.
+ */
+ICloudProvider::UploadFileRequest::Pointer Dropbox::resumeUploadFileAsync(
+    IItem::Pointer parent, const std::string& filename,
+    IUploadFileCallback::Pointer cb) {
+  auto journal = upload_journal();
+  if (!journal) return uploadFileAsync(parent, filename, cb);
+  auto chunk_size = chunk_size_;
+  auto path = parent->id() + "/" + filename;
+  auto resume = [=](Request<EitherError<IItem>>::Pointer r,
+                    const std::string& key) {
+    auto session_id = journal->get(key)["session_id"].asString();
+    if (session_id.empty()) return upload(r, path, cb, chunk_size, 1, key);
+    r->request(
+        [=](util::Output) {
+          auto request =
+              http()->create(UPLOAD_SESSION_ENDPOINT + "/append_v2", "POST");
+          Json::Value json;
+          json["cursor"]["session_id"] = session_id;
+          json["cursor"]["offset"] = 0;
+          json["close"] = false;
+          request->setHeaderParameter("Content-Type",
+                                      "application/octet-stream");
+          request->setHeaderParameter("Dropbox-API-Arg",
+                                      util::json::to_string(json));
+          return request;
+        },
+        [=](EitherError<Response> e) {
+          uint64_t offset = 0;
+          if (e.left()) {
+            Json::Value error;
+            try {
+              error = util::json::from_string(e.left()->description_)["error"];
+            } catch (const Json::Exception&) {
+              return r->done(e.left());
+            }
+            auto tag = error[".tag"].asString();
+            if (tag == "incorrect_offset") {
+              offset = error["correct_offset"].asUInt64();
+            } else if (tag == "closed") {
+              return finish(r, session_id, path, cb->size(), key);
+            } else if (tag == "not_found") {
+              journal->remove(key);
+              return upload(r, path, cb, chunk_size, 1, key);
+            } else {
+              return r->done(e.left());
+            }
+          }
+          append(r, session_id, path, cb, chunk_size, 1, offset, key);
+        });
+  };
   return std::make_shared<Request<EitherError<IItem>>>(
              shared_from_this(), [=](EitherError<IItem> e) { cb->done(e); },
              [=](Request<EitherError<IItem>>::Pointer r) {
-               upload(r, "", parent->id() + "/" + filename, 0, callback);
+               upload_journal_key(r, parent->id(), filename, cb->size(),
+                                  [=](EitherError<std::string> key) {
+                                    if (key.left()) return r->done(key.left());
+                                    resume(r, *key.right());
+                                  });
              })
       ->run();
 }
@@ -189,6 +347,11 @@ IHttpRequest::Pointer Dropbox::getItemDataRequest(const std::string& id,
   return request;
 }
 
+IHttpRequest::Pointer Dropbox::getItemByPathRequest(const std::string& path,
+                                                    std::ostream& input) const {
+  return getItemDataRequest(path, input);
+}
+
 IItem::Pointer Dropbox::getItemDataResponse(std::istream& stream) const {
   return toItem(util::json::from_stream(stream));
 }
@@ -213,6 +376,40 @@ IHttpRequest::Pointer Dropbox::listDirectoryRequest(
   return request;
 }
 
+IHttpRequest::Pointer Dropbox::listChangesRequest(
+    const std::string& cursor, std::ostream& input_stream) const {
+  Json::Value parameter;
+  IHttpRequest::Pointer request;
+  if (cursor.empty()) {
+    request = http()->create(
+        endpoint() + "/2/files/list_folder/get_latest_cursor", "POST");
+    parameter["path"] = rootDirectory()->id();
+    parameter["recursive"] = true;
+  } else {
+    request =
+        http()->create(endpoint() + "/2/files/list_folder/continue", "POST");
+    parameter["cursor"] = cursor;
+  }
+  request->setHeaderParameter("Content-Type", "application/json");
+  input_stream << util::json::to_string(parameter);
+  return request;
+}
+
+ChangeData Dropbox::listChangesResponse(std::istream& stream) const {
+  auto response = util::json::from_stream(stream);
+  ChangeData result;
+  for (const Json::Value& v : response["entries"]) {
+    Change change;
+    change.id_ = v["path_display"].asString();
+    change.parents_ = {change.id_.substr(0, change.id_.find_last_of('/'))};
+    if (v[".tag"].asString() != "deleted") change.item_ = toItem(v);
+    result.changes_.push_back(change);
+  }
+  result.cursor_ = response["cursor"].asString();
+  result.has_more_ = response["has_more"].asBool();
+  return result;
+}
+
 void Dropbox::authorizeRequest(IHttpRequest& r) const {
   r.setHeaderParameter("Authorization", "Bearer " + token());
 }
@@ -30,10 +30,23 @@
 
 namespace cloudstorage {
 
+/**
+ * Files are uploaded to concurrent upload sessions, in chunks whose size and
+ * number sent at once can be set with hints upload_chunk_size and
+ * upload_parallelism. If upload journal is used, sessions are sequential
+ * instead, so that they can be resumed; their chunks are sent one at a time.
+ */
 class Dropbox : public CloudProvider {
  public:
+  static constexpr uint64_t ChunkAlignment = 4 * 1024 * 1024;
+  static constexpr uint64_t MaxChunkSize = 148 * 1024 * 1024;
+  static constexpr uint64_t DefaultChunkSize = 60 * 1024 * 1024;
+  static constexpr int DefaultUploadParallelism = 4;
+
   Dropbox();
 
+  void initialize(InitData&&) override;
+
   std::string name() const override;
   std::string endpoint() const override;
   IItem::Pointer rootDirectory() const override;
@@ -42,12 +55,17 @@ class Dropbox : public CloudProvider {
   UploadFileRequest::Pointer uploadFileAsync(
       IItem::Pointer, const std::string& filename,
       IUploadFileCallback::Pointer) override;
+  UploadFileRequest::Pointer resumeUploadFileAsync(
+      IItem::Pointer, const std::string& filename,
+      IUploadFileCallback::Pointer) override;
   GeneralDataRequest::Pointer getGeneralDataAsync(GeneralDataCallback) override;
 
   IHttpRequest::Pointer getItemUrlRequest(
       const IItem&, std::ostream& input_stream) const override;
   IHttpRequest::Pointer getItemDataRequest(
       const std::string&, std::ostream& input_stream) const override;
+  IHttpRequest::Pointer getItemByPathRequest(
+      const std::string&, std::ostream& input_stream) const override;
   IHttpRequest::Pointer listDirectoryRequest(
       const IItem&, const std::string& page_token,
       std::ostream& input_stream) const override;
@@ -65,6 +83,8 @@ class Dropbox : public CloudProvider {
   IHttpRequest::Pointer renameItemRequest(const IItem& item,
                                           const std::string& name,
                                           std::ostream&) const override;
+  IHttpRequest::Pointer listChangesRequest(const std::string& cursor,
+                                           std::ostream&) const override;
 
   IItem::List listDirectoryResponse(
       const IItem&, std::istream&, std::string& next_page_token) const override;
@@ -78,6 +98,7 @@ class Dropbox : public CloudProvider {
   IItem::Pointer renameItemResponse(const IItem& old_item,
                                     const std::string& name,
                                     std::istream& response) const override;
+  ChangeData listChangesResponse(std::istream& response) const override;
   IItem::Pointer moveItemResponse(const IItem&, const IItem&,
                                   std::istream&) const override;
   void authorizeRequest(IHttpRequest&) const override;
@@ -100,6 +121,9 @@ class Dropbox : public CloudProvider {
         std::istream&) const override;
     Token::Pointer refreshTokenResponse(std::istream&) const override;
   };
+
+  uint64_t chunk_size_;
+  int upload_parallelism_;
 };
 
 }  // namespace cloudstorage
@@ -28,6 +28,7 @@
 #include <cstring>
 #include <sstream>
 
+#include "Request/ChunkedUpload.h"
 #include "Request/DownloadFileRequest.h"
 #include "Request/UploadFileRequest.h"
 #include "Utility/Item.h"
@@ -37,6 +38,8 @@ const std::string GOOGLEAPI_ENDPOINT = "https://www.googleapis.com";
 const std::string SHARED_ID = "shared";
 const std::string SHARED_FILENAME = "Shared with me";
 const auto THUMBNAIL_SIZE = 256;
+const auto RESUME_INCOMPLETE = 308;
+const auto GONE = 410;
 
 using namespace std::placeholders;
 
@@ -96,9 +99,142 @@ std::string icon_link(const std::string& link) {
          std::string(link.begin() + it + strlen(default_size), link.end());
 }
 
+Json::Value upload_metadata(const std::string& parent,
+                            const std::string& filename, bool create) {
+  Json::Value result(Json::objectValue);
+  auto it = filename.find_last_of('.');
+  if (it != std::string::npos) {
+    auto mime = google_extension_to_mime_type(filename.substr(it));
+    if (!mime.empty()) result["mimeType"] = mime;
+  }
+  if (create) {
+    result["name"] = filename;
+    result["parents"].append(parent);
+  }
+  return result;
+}
+
+// Offset of the first byte the session is missing, according to its range
+// header; no header means nothing was received yet.
+uint64_t received(const IHttpRequest::HeaderParameters& headers) {
+  auto it = headers.find("range");
+  if (it == headers.end()) return 0;
+  auto dash = it->second.find('-');
+  if (dash == std::string::npos)
+    throw std::invalid_argument("invalid range " + it->second);
+  return std::stoull(it->second.substr(dash + 1)) + 1;
+}
+
+void upload_session(Request<EitherError<IItem>>::Pointer r,
+                    const std::string& upload_url,
+                    IUploadFileCallback::Pointer callback,
+                    uint64_t chunk_size, uint64_t offset,
+                    const std::string& key) {
+  auto provider = static_cast<GoogleDrive*>(r->provider().get());
+  auto size = callback->size();
+  auto item = std::make_shared<IItem::Pointer>();
+  auto upload = std::make_shared<ChunkedUpload>(r, callback, chunk_size, 1);
+  upload->run(
+      offset,
+      [=](uint64_t offset, uint64_t length) {
+        auto request = r->provider()->http()->create(upload_url, "PUT");
+        std::stringstream content_range;
+        content_range << "bytes " << offset << "-" << offset + length - 1
+                      << "/" << size;
+        request->setHeaderParameter("Content-Range", content_range.str());
+        return request;
+      },
+      [=](uint64_t offset, Response& response) -> EitherError<void> {
+        try {
+          if (response.http_code() == RESUME_INCOMPLETE) {
+            if (received(response.headers()) == offset + chunk_size)
+              return nullptr;
+            return Error{IHttpRequest::Failure,
+                         "upload session didn't receive whole chunk"};
+          }
+          *item = provider->toItem(util::json::from_stream(response.output()));
+          return nullptr;
+        } catch (const std::exception&) {
+          return Error{IHttpRequest::Failure, response.output().str()};
+        }
+      },
+      [=](EitherError<void> e) {
+        auto journal = provider->upload_journal();
+        if (journal && (!e.left() || r->is_cancelled())) journal->remove(key);
+        if (e.left()) return r->done(e.left());
+        r->done(*item);
+      });
+}
+
+void start_session(Request<EitherError<IItem>>::Pointer r,
+                   IItem::Pointer directory, const std::string& filename,
+                   IUploadFileCallback::Pointer callback, uint64_t chunk_size,
+                   const std::string& key) {
+  auto provider = static_cast<GoogleDrive*>(r->provider().get());
+  auto create = [=](IItem::Pointer item) {
+    r->request(
+        [=](util::Output input) {
+          auto request = provider->http()->create(
+              provider->endpoint() + "/upload/drive/v3/files" +
+                  (item ? "/" + item->id() : ""),
+              item ? "PATCH" : "POST");
+          request->setParameter("uploadType", "resumable");
+          request->setParameter("fields",
+                                "id,name,thumbnailLink,trashed,"
+                                "mimeType,iconLink,parents,size,modifiedTime");
+          request->setHeaderParameter("Content-Type",
+                                      "application/json; charset=UTF-8");
+          request->setHeaderParameter("X-Upload-Content-Length",
+                                      std::to_string(callback->size()));
+          *input << util::json::to_string(
+              upload_metadata(directory->id(), filename, !item));
+          return request;
+        },
+        [=](EitherError<Response> e) {
+          if (e.left()) return r->done(e.left());
+          auto location = e.right()->headers().find("location");
+          if (location == e.right()->headers().end())
+            return r->done(Error{IHttpRequest::Failure,
+                                 "upload session without location"});
+          auto journal = provider->upload_journal();
+          if (journal) {
+            Json::Value session;
+            session["upload_url"] = location->second;
+            journal->put(key, session);
+          }
+          upload_session(r, location->second, callback, chunk_size, 0, key);
+        });
+  };
+  r->make_subrequest(&GoogleDrive::listDirectorySimpleAsync, directory,
+                     [=](EitherError<IItem::List> e) {
+                       if (e.left()) return r->done(e.left());
+                       IItem::Pointer item = nullptr;
+                       int cnt = 0;
+                       for (auto&& i : *e.right())
+                         if (i->filename() == filename) {
+                           item = i;
+                           cnt++;
+                         }
+                       create(cnt == 1 ? item : nullptr);
+                     });
+}
+
 }  // namespace
 
-GoogleDrive::GoogleDrive() : CloudProvider(util::make_unique<Auth>()) {}
+constexpr uint64_t GoogleDrive::ChunkAlignment;
+constexpr uint64_t GoogleDrive::DefaultChunkSize;
+
+GoogleDrive::GoogleDrive()
+    : CloudProvider(util::make_unique<Auth>()),
+      chunk_size_(DefaultChunkSize) {}
+
+void GoogleDrive::initialize(InitData&& d) {
+  setWithHint(d.hints_, "upload_chunk_size", [this](std::string v) {
+    auto size = std::strtoull(v.c_str(), nullptr, 10);
+    chunk_size_ = std::max<uint64_t>(size / ChunkAlignment, 1) * ChunkAlignment;
+  });
+  CloudProvider::initialize(std::move(d));
+}
 
 std::string GoogleDrive::name() const { return "google"; }
 
@@ -194,6 +330,21 @@ ICloudProvider::DownloadFileRequest::Pointer GoogleDrive::downloadFileAsync(
 ICloudProvider::UploadFileRequest::Pointer GoogleDrive::uploadFileAsync(
     IItem::Pointer directory, const std::string& filename,
     IUploadFileCallback::Pointer cb) {
+  if (upload_journal() && cb->size() > 0) {
+    auto chunk_size = chunk_size_;
+    return std::make_shared<Request<EitherError<IItem>>>(
+               shared_from_this(), [=](EitherError<IItem> e) { cb->done(e); },
+               [=](Request<EitherError<IItem>>::Pointer r) {
+                 upload_journal_key(
+                     r, directory->id(), filename, cb->size(),
+                     [=](EitherError<std::string> key) {
+                       if (key.left()) return r->done(key.left());
+                       start_session(r, directory, filename, cb, chunk_size,
+                                     *key.right());
+                     });
+               })
+        ->run();
+  }
   auto resolve = [=](Request<EitherError<IItem>>::Pointer r) {
     auto resolve_directory = [=](EitherError<IItem::List> e) {
       if (e.left()) return r->done(e.left());
@@ -241,6 +392,62 @@ ICloudProvider::UploadFileRequest::Pointer GoogleDrive::uploadFileAsync(
       ->run();
 }
 
+/**
+ * Session is asked how much of the file it already received; session which
+ * expired is started over, one which received everything gives the item.
+ */
+ICloudProvider::UploadFileRequest::Pointer GoogleDrive::resumeUploadFileAsync(
+    IItem::Pointer directory, const std::string& filename,
+    IUploadFileCallback::Pointer cb) {
+  auto journal = upload_journal();
+  if (!journal || cb->size() == 0)
+    return uploadFileAsync(directory, filename, cb);
+  auto chunk_size = chunk_size_;
+  auto resume = [=](Request<EitherError<IItem>>::Pointer r,
+                    const std::string& key) {
+    auto upload_url = journal->get(key)["upload_url"].asString();
+    if (upload_url.empty())
+      return start_session(r, directory, filename, cb, chunk_size, key);
+    r->request(
+        [=](util::Output) {
+          auto request = http()->create(upload_url, "PUT");
+          request->setHeaderParameter(
+              "Content-Range", "bytes */" + std::to_string(cb->size()));
+          return request;
+        },
+        [=](EitherError<Response> e) {
+          if (e.left()) {
+            if (e.left()->code_ != IHttpRequest::NotFound &&
+                e.left()->code_ != GONE)
+              return r->done(e.left());
+            journal->remove(key);
+            return start_session(r, directory, filename, cb, chunk_size, key);
+          }
+          try {
+            if (e.right()->http_code() != RESUME_INCOMPLETE) {
+              journal->remove(key);
+              return r->done(
+                  toItem(util::json::from_stream(e.right()->output())));
+            }
+            upload_session(r, upload_url, cb, chunk_size,
+                           received(e.right()->headers()), key);
+          } catch (const std::exception&) {
+            r->done(Error{IHttpRequest::Failure, e.right()->output().str()});
+          }
+        });
+  };
+  return std::make_shared<Request<EitherError<IItem>>>(
+             shared_from_this(), [=](EitherError<IItem> e) { cb->done(e); },
+             [=](Request<EitherError<IItem>>::Pointer r) {
+               upload_journal_key(r, directory->id(), filename, cb->size(),
+                                  [=](EitherError<std::string> key) {
+                                    if (key.left()) return r->done(key.left());
+                                    resume(r, *key.right());
+                                  });
+             })
+      ->run();
+}
+
 IHttpRequest::Pointer GoogleDrive::deleteItemRequest(const IItem& item,
                                                      std::ostream&) const {
   return http()->create(endpoint() + "/drive/v3/files/" + item.id(), "DELETE");
@@ -300,6 +507,20 @@ IHttpRequest::Pointer GoogleDrive::getGeneralDataRequest(std::ostream&) const {
   return request;
 }
 
+IHttpRequest::Pointer GoogleDrive::listChangesRequest(const std::string& cursor,
+                                                      std::ostream&) const {
+  if (cursor.empty())
+    return http()->create(endpoint() + "/drive/v3/changes/startPageToken",
+                          "GET");
+  auto request = http()->create(endpoint() + "/drive/v3/changes", "GET");
+  request->setParameter("pageToken", cursor);
+  request->setParameter("fields",
+                        "changes(removed,fileId,file(id,name,thumbnailLink,"
+                        "trashed,mimeType,iconLink,parents,size,modifiedTime)),"
+                        "nextPageToken,newStartPageToken");
+  return request;
+}
+
 IItem::Pointer GoogleDrive::getItemDataResponse(std::istream& response) const {
   return toItem(util::json::from_stream(response));
 }
@@ -320,6 +541,29 @@ IItem::List GoogleDrive::listDirectoryResponse(
   return result;
 }
 
+ChangeData GoogleDrive::listChangesResponse(std::istream& stream) const {
+  auto response = util::json::from_stream(stream);
+  ChangeData result;
+  for (const Json::Value& v : response["changes"]) {
+    Change change;
+    change.id_ = v["fileId"].asString();
+    if (!v["removed"].asBool() && !v["file"]["trashed"].asBool()) {
+      auto item = toItem(v["file"]);
+      change.parents_ = static_cast<const Item&>(*item).parents();
+      change.item_ = item;
+    }
+    result.changes_.push_back(change);
+  }
+  result.has_more_ = response.isMember("nextPageToken");
+  if (result.has_more_)
+    result.cursor_ = response["nextPageToken"].asString();
+  else if (response.isMember("newStartPageToken"))
+    result.cursor_ = response["newStartPageToken"].asString();
+  else
+    result.cursor_ = response["startPageToken"].asString();
+  return result;
+}
+
 GeneralData GoogleDrive::getGeneralDataResponse(std::istream& response) const {
   auto json = util::json::from_stream(response);
   GeneralData data;
@@ -350,19 +594,11 @@ IHttpRequest::Pointer GoogleDrive::upload(const IItem& f,
   request->setParameter("fields",
                         "id,name,thumbnailLink,trashed,"
                         "mimeType,iconLink,parents,size,modifiedTime");
-  Json::Value request_data;
-  auto it = filename.find_last_of('.');
-  if (it != std::string::npos) {
-    auto mime = google_extension_to_mime_type(filename.substr(it));
-    if (!mime.empty()) request_data["mimeType"] = mime;
-  }
-  if (method == "POST") {
-    request_data["name"] = filename;
-    request_data["parents"].append(item.id());
-  }
   prefix_stream << "--" << separator << "\r\n"
                 << "Content-Type: application/json; charset=UTF-8\r\n\r\n"
-                << util::json::to_string(request_data) << "\r\n"
+                << util::json::to_string(
+                       upload_metadata(item.id(), filename, method == "POST"))
+                << "\r\n"
                 << "--" << separator << "\r\n"
                 << "Content-Type: \r\n\r\n";
   suffix_stream << "\r\n--" << separator << "--\r\n";
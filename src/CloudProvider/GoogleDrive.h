@@ -31,9 +31,19 @@
 
 namespace cloudstorage {
 
+/**
+ * If upload journal is used, files are uploaded to resumable upload sessions,
+ * one chunk after another; chunk size can be set with hint upload_chunk_size.
+ * Upload urls of sessions are kept in the upload journal until the upload is
+ * done. Otherwise files are sent in a single multipart request.
+ */
 class GoogleDrive : public CloudProvider {
  public:
+  static constexpr uint64_t ChunkAlignment = 256 * 1024;
+  static constexpr uint64_t DefaultChunkSize = 8 * 1024 * 1024;
+
   GoogleDrive();
+  void initialize(InitData&&) override;
   std::string name() const override;
   std::string endpoint() const override;
 
@@ -43,6 +53,9 @@ class GoogleDrive : public CloudProvider {
   UploadFileRequest::Pointer uploadFileAsync(
       IItem::Pointer, const std::string&,
       IUploadFileCallback::Pointer) override;
+  UploadFileRequest::Pointer resumeUploadFileAsync(
+      IItem::Pointer, const std::string&,
+      IUploadFileCallback::Pointer) override;
 
   IHttpRequest::Pointer getItemDataRequest(
       const std::string&, std::ostream& input_stream) const override;
@@ -66,6 +79,8 @@ class GoogleDrive : public CloudProvider {
   IHttpRequest::Pointer renameItemRequest(const IItem&, const std::string& name,
                                           std::ostream&) const override;
   IHttpRequest::Pointer getGeneralDataRequest(std::ostream&) const override;
+  IHttpRequest::Pointer listChangesRequest(const std::string& cursor,
+                                           std::ostream&) const override;
 
   IItem::Pointer getItemDataResponse(std::istream& response) const override;
   std::string getItemUrlResponse(const IItem& item,
@@ -74,6 +89,7 @@ class GoogleDrive : public CloudProvider {
   IItem::List listDirectoryResponse(
       const IItem&, std::istream&, std::string& next_page_token) const override;
   GeneralData getGeneralDataResponse(std::istream& response) const override;
+  ChangeData listChangesResponse(std::istream& response) const override;
 
   IHttpRequest::Pointer upload(const IItem& f, const std::string& url,
                                const std::string& method,
@@ -99,6 +115,9 @@ class GoogleDrive : public CloudProvider {
         std::istream&) const override;
     Token::Pointer refreshTokenResponse(std::istream&) const override;
   };
+
+ private:
+  uint64_t chunk_size_;
 };
 
 }  // namespace cloudstorage
@@ -27,53 +27,88 @@
 #include <sstream>
 
 #include <iostream>
+#include "Request/ChunkedUpload.h"
 #include "Request/Request.h"
 #include "Utility/Item.h"
 #include "Utility/Utility.h"
 
-const uint32_t CHUNK_SIZE = 60 * 1024 * 1024;
 using namespace std::placeholders;
 
 namespace cloudstorage {
 
 namespace {
 void upload(Request<EitherError<IItem>>::Pointer r,
-            const std::string& upload_url, uint64_t sent,
-            IUploadFileCallback* callback, Json::Value response) {
+            const std::string& upload_url,
+            IUploadFileCallback::Pointer callback, uint64_t chunk_size,
+            uint64_t offset, const std::string& key) {
+  auto provider = static_cast<OneDrive*>(r->provider().get());
   auto size = callback->size();
-  auto length = std::make_shared<uint64_t>(0);
-  if (sent >= size)
-    return r->done(
-        static_cast<OneDrive*>(r->provider().get())->toItem(response));
-  r->send(
-      [=](util::Output stream) {
-        std::vector<char> buffer(CHUNK_SIZE);
-        *length = callback->putData(buffer.data(), CHUNK_SIZE, sent);
+  auto item = std::make_shared<IItem::Pointer>();
+  auto upload = std::make_shared<ChunkedUpload>(r, callback, chunk_size, 1);
+  upload->run(
+      offset,
+      [=](uint64_t offset, uint64_t length) {
         auto request = r->provider()->http()->create(upload_url, "PUT");
         std::stringstream content_range;
-        content_range << "bytes " << sent << "-" << sent + *length - 1 << "/"
-                      << size;
+        content_range << "bytes " << offset << "-" << offset + length - 1
+                      << "/" << size;
         request->setHeaderParameter("Content-Range", content_range.str());
-        stream->write(buffer.data(), *length);
         return request;
       },
-      [=](EitherError<Response> e) {
-        if (e.left()) return r->done(e.left());
+      [=](uint64_t offset, Response& response) -> EitherError<void> {
+        if (offset + chunk_size < size) return nullptr;
         try {
-          auto json = util::json::from_stream(e.right()->output());
-          upload(r, upload_url, sent + *length, callback, json);
+          *item = provider->toItem(util::json::from_stream(response.output()));
+          return nullptr;
         } catch (const Json::Exception&) {
-          r->done(Error{IHttpRequest::Failure, e.right()->output().str()});
+          return Error{IHttpRequest::Failure, response.output().str()};
         }
       },
-      [] { return std::make_shared<std::stringstream>(); },
-      std::make_shared<std::stringstream>(), nullptr,
-      [=](uint64_t, uint64_t now) { callback->progress(size, sent + now); },
-      true);
+      [=](EitherError<void> e) {
+        auto journal = provider->upload_journal();
+        if (journal && (!e.left() || r->is_cancelled())) journal->remove(key);
+        if (e.left()) return r->done(e.left());
+        r->done(*item);
+      });
+}
+
+void start(Request<EitherError<IItem>>::Pointer r, IItem::Pointer parent,
+           const std::string& filename, IUploadFileCallback::Pointer callback,
+           uint64_t chunk_size, const std::string& key) {
+  auto provider = static_cast<OneDrive*>(r->provider().get());
+  r->request(
+      [=](util::Output) {
+        return provider->http()->create(
+            provider->endpoint() + "/me/drive/items/" + parent->id() + ":/" +
+                util::Url::escape(filename) + ":/createUploadSession",
+            "POST");
+      },
+      [=](EitherError<Response> e) {
+        if (e.left()) return r->done(e.left());
+        try {
+          auto response = util::json::from_stream(e.right()->output());
+          if (callback->size() == 0)
+            return r->done(provider->toItem(response));
+          auto upload_url = response["uploadUrl"].asString();
+          auto journal = provider->upload_journal();
+          if (journal) {
+            Json::Value session;
+            session["upload_url"] = upload_url;
+            journal->put(key, session);
+          }
+          upload(r, upload_url, callback, chunk_size, 0, key);
+        } catch (const Json::Exception& e) {
+          r->done(Error{IHttpRequest::Failure, e.what()});
+        }
+      });
 }
 }  // namespace
 
-OneDrive::OneDrive() : CloudProvider(util::make_unique<Auth>()) {}
+constexpr uint64_t OneDrive::ChunkAlignment;
+constexpr uint64_t OneDrive::MaxChunkSize;
+
+OneDrive::OneDrive()
+    : CloudProvider(util::make_unique<Auth>()), chunk_size_(MaxChunkSize) {}
 
 std::string OneDrive::name() const { return "onedrive"; }
 
@@ -87,6 +122,12 @@ void OneDrive::initialize(ICloudProvider::InitData&& d) {
     auto lock = auth_lock();
     endpoint_ = v;
   });
+  setWithHint(d.hints_, "upload_chunk_size", [this](std::string v) {
+    auto size = std::strtoull(v.c_str(), nullptr, 10);
+    chunk_size_ = std::min(std::max<uint64_t>(size / ChunkAlignment, 1) *
+                               ChunkAlignment,
+                           MaxChunkSize);
+  });
   CloudProvider::initialize(std::move(d));
 }
 
@@ -140,29 +181,66 @@ AuthorizeRequest::Pointer OneDrive::authorizeAsync() {
 ICloudProvider::UploadFileRequest::Pointer OneDrive::uploadFileAsync(
     IItem::Pointer parent, const std::string& filename,
     IUploadFileCallback::Pointer cb) {
-  auto callback = cb.get();
+  auto chunk_size = chunk_size_;
+  return std::make_shared<Request<EitherError<IItem>>>(
+             shared_from_this(), [=](EitherError<IItem> e) { cb->done(e); },
+             [=](Request<EitherError<IItem>>::Pointer r) {
+               upload_journal_key(r, parent->id(), filename, cb->size(),
+                                  [=](EitherError<std::string> key) {
+                                    if (key.left()) return r->done(key.left());
+                                    start(r, parent, filename, cb, chunk_size,
+                                          *key.right());
+                                  });
+             })
+      ->run();
+}
+
+/**
+ * Upload session tells which ranges of the file it's still missing; session
+ * which expired, or which has nothing left to receive, is started over.
+ */
+ICloudProvider::UploadFileRequest::Pointer OneDrive::resumeUploadFileAsync(
+    IItem::Pointer parent, const std::string& filename,
+    IUploadFileCallback::Pointer cb) {
+  auto journal = upload_journal();
+  if (!journal) return uploadFileAsync(parent, filename, cb);
+  auto chunk_size = chunk_size_;
+  auto resume = [=](Request<EitherError<IItem>>::Pointer r,
+                    const std::string& key) {
+    auto upload_url = journal->get(key)["upload_url"].asString();
+    if (upload_url.empty())
+      return start(r, parent, filename, cb, chunk_size, key);
+    r->request(
+        [=](util::Output) { return http()->create(upload_url, "GET"); },
+        [=](EitherError<Response> e) {
+          if (e.left() && e.left()->code_ != IHttpRequest::NotFound)
+            return r->done(e.left());
+          uint64_t offset = cb->size();
+          if (e.right()) {
+            try {
+              auto ranges = util::json::from_stream(
+                  e.right()->output())["nextExpectedRanges"];
+              if (!ranges.empty()) offset = std::stoull(ranges[0].asString());
+            } catch (const std::exception&) {
+              return r->done(
+                  Error{IHttpRequest::Failure, e.right()->output().str()});
+            }
+          }
+          if (offset >= cb->size()) {
+            journal->remove(key);
+            return start(r, parent, filename, cb, chunk_size, key);
+          }
+          upload(r, upload_url, cb, chunk_size, offset, key);
+        });
+  };
   return std::make_shared<Request<EitherError<IItem>>>(
              shared_from_this(), [=](EitherError<IItem> e) { cb->done(e); },
              [=](Request<EitherError<IItem>>::Pointer r) {
-               r->request(
-                   [=](util::Output) {
-                     return http()->create(endpoint() + "/me/drive/items/" +
-                                               parent->id() + ":/" +
-                                               util::Url::escape(filename) +
-                                               ":/createUploadSession",
-                                           "POST");
-                   },
-                   [=](EitherError<Response> e) {
-                     if (e.left()) return r->done(e.left());
-                     try {
-                       auto response =
-                           util::json::from_stream(e.right()->output());
-                       upload(r, response["uploadUrl"].asString(), 0, callback,
-                              response);
-                     } catch (const Json::Exception& e) {
-                       r->done(Error{IHttpRequest::Failure, e.what()});
-                     }
-                   });
+               upload_journal_key(r, parent->id(), filename, cb->size(),
+                                  [=](EitherError<std::string> key) {
+                                    if (key.left()) return r->done(key.left());
+                                    resume(r, *key.right());
+                                  });
              })
       ->run();
 }
@@ -208,6 +286,17 @@ IHttpRequest::Pointer OneDrive::getItemDataRequest(const std::string& id,
   return request;
 }
 
+IHttpRequest::Pointer OneDrive::getItemByPathRequest(const std::string& path,
+                                                     std::ostream&) const {
+  IHttpRequest::Pointer request = http()->create(
+      endpoint() + "/drive/root:" + util::Url::escapePath(path), "GET");
+  request->setParameter("select",
+                        "name,folder,audio,image,photo,video,id,size,"
+                        "lastModifiedDateTime,thumbnails,@content.downloadUrl");
+  request->setParameter("expand", "thumbnails");
+  return request;
+}
+
 IHttpRequest::Pointer OneDrive::listDirectoryRequest(
     const IItem& item, const std::string& page_token, std::ostream&) const {
   if (!page_token.empty()) return http()->create(page_token, "GET");
@@ -272,6 +361,14 @@ IHttpRequest::Pointer OneDrive::renameItemRequest(const IItem& item,
   return request;
 }
 
+IHttpRequest::Pointer OneDrive::listChangesRequest(const std::string& cursor,
+                                                   std::ostream&) const {
+  if (!cursor.empty()) return http()->create(cursor, "GET");
+  auto request = http()->create(endpoint() + "/drive/root/delta", "GET");
+  request->setParameter("token", "latest");
+  return request;
+}
+
 IItem::Pointer OneDrive::getItemDataResponse(std::istream& response) const {
   return toItem(util::json::from_stream(response));
 }
@@ -304,6 +401,24 @@ IItem::List OneDrive::listDirectoryResponse(
   return result;
 }
 
+ChangeData OneDrive::listChangesResponse(std::istream& stream) const {
+  auto response = util::json::from_stream(stream);
+  ChangeData result;
+  for (const Json::Value& v : response["value"]) {
+    Change change;
+    change.id_ = v["id"].asString();
+    if (v["parentReference"].isMember("id"))
+      change.parents_ = {v["parentReference"]["id"].asString()};
+    if (!v.isMember("deleted")) change.item_ = toItem(v);
+    result.changes_.push_back(change);
+  }
+  result.has_more_ = response.isMember("@odata.nextLink");
+  result.cursor_ = response[result.has_more_ ? "@odata.nextLink"
+                                             : "@odata.deltaLink"]
+                       .asString();
+  return result;
+}
+
 void OneDrive::Auth::initialize(IHttp* http, IHttpServerFactory* factory) {
   cloudstorage::Auth::initialize(http, factory);
   if (client_id().empty()) {
@@ -31,8 +31,16 @@
 
 namespace cloudstorage {
 
+/**
+ * Files are uploaded to upload sessions, one chunk after another; chunk size
+ * can be set with hint upload_chunk_size. Upload urls of sessions are kept in
+ * the upload journal until the upload is done.
+ */
 class OneDrive : public CloudProvider {
  public:
+  static constexpr uint64_t ChunkAlignment = 320 * 1024;
+  static constexpr uint64_t MaxChunkSize = 60 * 1024 * 1024;
+
   OneDrive();
 
   std::string name() const override;
@@ -50,10 +58,15 @@ class OneDrive : public CloudProvider {
   UploadFileRequest::Pointer uploadFileAsync(
       IItem::Pointer, const std::string& filename,
       IUploadFileCallback::Pointer) override;
+  UploadFileRequest::Pointer resumeUploadFileAsync(
+      IItem::Pointer, const std::string& filename,
+      IUploadFileCallback::Pointer) override;
   GeneralDataRequest::Pointer getGeneralDataAsync(GeneralDataCallback) override;
 
   IHttpRequest::Pointer getItemDataRequest(
       const std::string&, std::ostream& input_stream) const override;
+  IHttpRequest::Pointer getItemByPathRequest(
+      const std::string&, std::ostream& input_stream) const override;
   IHttpRequest::Pointer listDirectoryRequest(
       const IItem&, const std::string& page_token,
       std::ostream& input_stream) const override;
@@ -68,10 +81,13 @@ class OneDrive : public CloudProvider {
                                         std::ostream&) const override;
   IHttpRequest::Pointer renameItemRequest(const IItem&, const std::string& name,
                                           std::ostream&) const override;
+  IHttpRequest::Pointer listChangesRequest(const std::string& cursor,
+                                           std::ostream&) const override;
 
   IItem::List listDirectoryResponse(const IItem&, std::istream&,
                                     std::string&) const override;
   IItem::Pointer getItemDataResponse(std::istream& response) const override;
+  ChangeData listChangesResponse(std::istream& response) const override;
 
  private:
   class Auth : public cloudstorage::Auth {
@@ -90,6 +106,7 @@ class OneDrive : public CloudProvider {
   };
 
   std::string endpoint_;
+  uint64_t chunk_size_;
 };
 
 }  // namespace cloudstorage
@@ -125,6 +125,11 @@ IHttpRequest::Pointer WebDav::getItemDataRequest(const std::string& id,
   return request;
 }
 
+IHttpRequest::Pointer WebDav::getItemByPathRequest(const std::string& path,
+                                                   std::ostream& input) const {
+  return getItemDataRequest(util::Url::escapePath(path), input);
+}
+
 IHttpRequest::Pointer WebDav::listDirectoryRequest(const IItem& item,
                                                    const std::string&,
                                                    std::ostream&) const {
@@ -66,6 +66,9 @@ class CLOUDSTORAGE_API ICloudFactory {
     ICrypto::Pointer crypto_;
     IThreadPoolFactory::Pointer thread_pool_factory_;
     ICallback::Pointer callback_;
+    std::string cache_directory_;
+    uint64_t cache_size_ = 0;
+    std::string upload_journal_;
   };
 
   struct ProviderInitData {
@@ -56,6 +56,7 @@ class CLOUDSTORAGE_API ICloudProvider {
   using MoveItemRequest = IRequest<EitherError<IItem>>;
   using RenameItemRequest = IRequest<EitherError<IItem>>;
   using GeneralDataRequest = IRequest<EitherError<GeneralData>>;
+  using ListChangesRequest = IRequest<EitherError<ChangeData>>;
 
   using OperationSet = uint32_t;
 
@@ -143,6 +144,37 @@ class CLOUDSTORAGE_API ICloudProvider {
      */
     IThreadPool::Pointer thread_pool_;
 
+    /**
+     * Maximum count of ranges downloaded in parallel when streaming a file
+     * through the file daemon; actual count adapts to the rate at which the
+     * stream is consumed.
+     */
+    uint32_t stream_prefetch_ = 4;
+
+    /**
+     * Directory in which contents of downloaded files are cached; nothing is
+     * cached if empty.
+     */
+    std::string cache_directory_;
+
+    /**
+     * Maximum size in bytes of the cache of files' contents.
+     */
+    uint64_t cache_size_ = 0;
+
+    /**
+     * File in which sessions of uploads in progress are recorded, so that
+     * resumeUploadFileAsync can continue them after a restart; the journal
+     * is shared by all cloud providers which use the same file. Sessions
+     * aren't recorded if empty.
+     *
+     * Setting it costs an extra request per cloud provider, which tells the
+     * account uploads belong to. Dropbox uploads chunks one at a time then,
+     * ignoring upload_parallelism, as only its sequential sessions can tell
+     * how much they received.
+     */
+    std::string upload_journal_;
+
     /**
      * Various hints which can be retrieved by some previous run with
      * ICloudProvider::hints; providing them may speed up the authorization
@@ -167,6 +199,52 @@ class CLOUDSTORAGE_API ICloudProvider {
     Hints hints_;
   };
 
+  /**
+   * Statistics of pacing requests sent to the cloud provider.
+   */
+  struct RequestStatistics {
+    /**
+     * Count of responses in which server asked to slow down.
+     */
+    uint64_t throttled_;
+
+    /**
+     * Count of requests sent again after being throttled.
+     */
+    uint64_t retries_;
+
+    /**
+     * Count of requests which had to wait for the rate limit.
+     */
+    uint64_t delayed_;
+
+    /**
+     * Currently allowed count of requests per second, 0 if unlimited.
+     */
+    double request_rate_;
+  };
+
+  /**
+   * Statistics of the cache of files' contents.
+   */
+  struct CacheStatistics {
+    /**
+     * Count of blocks read from the cache.
+     */
+    uint64_t hits_;
+
+    /**
+     * Count of lookups of blocks which weren't in the cache; a download
+     * starts at the first such block.
+     */
+    uint64_t misses_;
+
+    /**
+     * Size in bytes of data currently stored in the cache.
+     */
+    uint64_t size_;
+  };
+
   virtual ~ICloudProvider() = default;
 
   /**
@@ -232,6 +310,23 @@ class CLOUDSTORAGE_API ICloudProvider {
    */
   virtual std::string endpoint() const = 0;
 
+  /**
+   * Cloud provider retries requests when server asks to slow down and adapts
+   * rate of sending requests to what server tolerates.
+   *
+   * @return statistics gathered since the cloud provider was created
+   */
+  virtual RequestStatistics requestStatistics() const { return {}; }
+
+  /**
+   * Ranges of files downloaded with downloadFileAsync are cached on disk if
+   * cache_directory_ was provided in InitData; the cache is shared by all
+   * cloud providers which use the same directory.
+   *
+   * @return statistics gathered since the cache was opened
+   */
+  virtual CacheStatistics cacheStatistics() const { return {}; }
+
   /**
    * Returns the url to which user has to go in his web browser in order to give
    * consent to our library.
@@ -306,6 +401,29 @@ class CLOUDSTORAGE_API ICloudProvider {
       IItem::Pointer parent, const std::string& filename,
       IUploadFileCallback::Pointer) = 0;
 
+  /**
+   * Continues upload of the file provided by callback, which was interrupted
+   * while this or some previous run was uploading it with uploadFileAsync.
+   * The cloud provider is asked which bytes of the upload session recorded
+   * in upload_journal_ it already stored, and only the rest is sent. The
+   * file is uploaded from the beginning if there is no such session or the
+   * cloud provider can't resume uploads.
+   *
+   * Callback has to provide the same content the interrupted upload did;
+   * sessions are told apart only by account, parent, filename and size, so
+   * bytes the cloud provider already stored aren't checked against it.
+   *
+   * @param parent parent of the uploaded file
+   *
+   * @param filename name at which the uploaded file will be saved in cloud
+   * provider
+   *
+   * @return object representing the pending request
+   */
+  virtual UploadFileRequest::Pointer resumeUploadFileAsync(
+      IItem::Pointer parent, const std::string& filename,
+      IUploadFileCallback::Pointer) = 0;
+
   /**
    * Retrieves IItem object from its id. That's the preferred way of updating
    * the IItem structure; IItem caches some data(e.g. thumbnail url or file url)
@@ -469,6 +587,25 @@ class CLOUDSTORAGE_API ICloudProvider {
   virtual GetItemUrlRequest::Pointer getFileDaemonUrlAsync(
       IItem::Pointer item,
       GetItemUrlCallback = [](EitherError<std::string>) {}) = 0;
+
+  /**
+   * Lists changes made in the whole cloud provider since the cursor was
+   * obtained. Called with empty cursor, returns no changes and the cursor
+   * pointing at the current state.
+   *
+   * Fails if the cloud provider doesn't keep track of changes, or if the
+   * cursor expired; in the latter case the caller should start over with
+   * empty cursor and consider everything it knows as changed.
+   *
+   * @param cursor cursor returned by the previous call, or empty string
+   *
+   * @param callback called when done
+   *
+   * @return object representing the pending request
+   */
+  virtual ListChangesRequest::Pointer listChangesAsync(
+      const std::string& cursor,
+      ListChangesCallback callback = [](EitherError<ChangeData>) {}) = 0;
 };
 
 }  // namespace cloudstorage
@@ -26,6 +26,7 @@
 
 #include <functional>
 #include <memory>
+#include <ostream>
 #include <string>
 #include <unordered_map>
 
@@ -33,6 +34,25 @@
 
 namespace cloudstorage {
 
+/**
+ * Consumer of response body, fed directly from http implementation's receive
+ * buffers.
+ */
+class CLOUDSTORAGE_API IDataSink {
+ public:
+  using Pointer = std::shared_ptr<IDataSink>;
+
+  virtual ~IDataSink() = default;
+
+  /**
+   * Called with consecutive chunks of response body.
+   *
+   * @param data chunk, valid only for the duration of the call
+   * @param length
+   */
+  virtual void write(const char* data, uint32_t length) = 0;
+};
+
 class CLOUDSTORAGE_API IHttpRequest {
  public:
   struct Response;
@@ -59,11 +79,23 @@ class CLOUDSTORAGE_API IHttpRequest {
   static constexpr int Forbidden = 403;
   static constexpr int NotFound = 404;
   static constexpr int RangeInvalid = 416;
+  static constexpr int TooManyRequests = 429;
   static constexpr int InternalServerError = 500;
   static constexpr int ServiceUnavailable = 503;
   static constexpr int Aborted = 600;
   static constexpr int Unknown = 700;
   static constexpr int Failure = 800;
+  static constexpr int RangeUnsupported = 801;
+
+  /**
+   * Scheduling class of the request; when requests have to wait for a free
+   * slot, ones of a lower class go first.
+   */
+  enum class Priority {
+    Interactive,  // user waits for the result, e.g. reads file's contents
+    Metadata,     // listings, item lookups and other short requests
+    Bulk          // long transfers e.g. uploads and whole file downloads
+  };
 
   virtual ~IHttpRequest() = default;
 
@@ -120,6 +152,17 @@ class CLOUDSTORAGE_API IHttpRequest {
   virtual void setHeaderParameter(const std::string& parameter,
                                   const std::string& value) = 0;
 
+  /**
+   * Sets scheduling class of the request, Priority::Metadata by default.
+   */
+  virtual void setPriority(Priority) {}
+
+  /**
+   * Sets name of the group of requests which share a limit of requests in
+   * flight, e.g. requests made on behalf of the same cloud provider.
+   */
+  virtual void setGroup(const std::string&) {}
+
   /**
    * Returns GET parameters set with setParameter.
    *
@@ -168,6 +211,30 @@ class CLOUDSTORAGE_API IHttpRequest {
                     std::shared_ptr<std::ostream> error_stream = nullptr,
                     ICallback::Pointer = nullptr) const = 0;
 
+  /**
+   * Sends http request in an asynchronous fashion, writing successful
+   * response's body to the sink instead of a stream; default implementation
+   * wraps the sink in a stream and forwards to send.
+   *
+   * @param on_completed callback to be called when request is finished,
+   * response's output_stream_ is unspecified
+   *
+   * @param data data to be sent in the request body
+   *
+   * @param response sink receiving server's response
+   *
+   * @param error_stream if set, response will be redirected here if http
+   * request wasn't successful
+   */
+  virtual void sendToSink(CompleteCallback on_completed,
+                          std::shared_ptr<std::istream> data,
+                          IDataSink::Pointer response,
+                          std::shared_ptr<std::ostream> error_stream = nullptr,
+                          ICallback::Pointer callback = nullptr) const {
+    send(on_completed, data, std::make_shared<SinkStream>(response),
+         error_stream, callback);
+  }
+
   static bool isSuccess(int code) {
     return code / 100 == 2 || isRedirect(code);
   }
@@ -176,12 +243,133 @@ class CLOUDSTORAGE_API IHttpRequest {
     return code / 100 == 4 || code / 100 == 5;
   }
   static bool isAuthorizationError(int code) { return code == 401; }
+  static bool isThrottled(int code) {
+    return code == TooManyRequests || code == ServiceUnavailable;
+  }
+
+ private:
+  class SinkStream : private std::streambuf, public std::ostream {
+   public:
+    SinkStream(IDataSink::Pointer sink) : std::ostream(this), sink_(sink) {}
+
+   private:
+    std::streamsize xsputn(const char* data, std::streamsize length) override {
+      sink_->write(data, static_cast<uint32_t>(length));
+      return length;
+    }
+
+    std::streambuf::int_type overflow(std::streambuf::int_type c) override {
+      using traits = std::streambuf::traits_type;
+      if (!traits::eq_int_type(c, traits::eof())) {
+        char data = traits::to_char_type(c);
+        sink_->write(&data, 1);
+      }
+      return traits::not_eof(c);
+    }
+
+    IDataSink::Pointer sink_;
+  };
 };
 
 class CLOUDSTORAGE_API IHttp {
  public:
   using Pointer = std::unique_ptr<IHttp>;
 
+  /**
+   * Connection management policy of the default http implementation.
+   */
+  struct Options {
+    /**
+     * Maximum number of simultaneously open connections to a single host, 0
+     * means no limit; requests above the limit wait for a free connection.
+     */
+    uint32_t max_host_connections_ = 8;
+
+    /**
+     * Maximum number of simultaneously open connections, 0 means no limit.
+     */
+    uint32_t max_total_connections_ = 64;
+
+    /**
+     * Whether to multiplex requests to the same host over a single http/2
+     * connection when the server supports it.
+     */
+    bool multiplex_ = true;
+
+    /**
+     * Whether to share dns cache, tls sessions and connections between all
+     * requests created by this object.
+     */
+    bool share_connections_ = true;
+
+    /**
+     * Whether to send tcp keep-alive probes on idle connections.
+     */
+    bool tcp_keep_alive_ = true;
+
+    /**
+     * Maximum number of requests to a single host being transferred at once, 0
+     * means no limit; requests above the limit wait in per priority queues.
+     */
+    uint32_t max_host_requests_ = 8;
+
+    /**
+     * Maximum number of Priority::Bulk requests to a single host being
+     * transferred at once, 0 means no limit; keeps the rest of host's slots
+     * available for requests of other priorities.
+     */
+    uint32_t max_host_bulk_requests_ = 4;
+
+    /**
+     * Maximum number of requests of a single group being transferred at once,
+     * 0 means no limit.
+     */
+    uint32_t max_group_requests_ = 0;
+
+    /**
+     * When server ignores Range header and responds with the whole body, the
+     * range is emulated if at most this many bytes precede it; otherwise the
+     * request fails early with RangeUnsupported, without even being sent if
+     * the resource is already known to ignore ranges.
+     */
+    uint64_t max_range_skip_ = 4 * 1024 * 1024;
+
+    /**
+     * Number of seconds for which a resource (url without its query) which
+     * ignored Range header is remembered as such.
+     */
+    uint32_t range_unsupported_expiry_ = 10 * 60;
+
+    /**
+     * Called with scheme and authority part of the url and requested range
+     * whenever server ignores Range header.
+     */
+    std::function<void(const std::string& host, Range)> range_unsupported_;
+  };
+
+  struct Statistics {
+    /**
+     * Count of finished requests which had to open a new connection.
+     */
+    uint64_t connections_opened_;
+
+    /**
+     * Count of finished requests which reused an already open connection.
+     */
+    uint64_t connections_reused_;
+
+    /**
+     * Count of ranged requests to which server responded with the whole body.
+     */
+    uint64_t ranges_unsupported_;
+
+    /**
+     * Count of received bytes thrown away because they were outside of
+     * requested range.
+     */
+    uint64_t bytes_discarded_;
+  };
+
   virtual ~IHttp() = default;
 
   /**
@@ -196,7 +384,13 @@ class CLOUDSTORAGE_API IHttp {
                                        const std::string& method = "GET",
                                        bool follow_redirect = true) const = 0;
 
+  /**
+   * @return connection statistics gathered since the object was created
+   */
+  virtual Statistics statistics() const { return {}; }
+
   static IHttp::Pointer create();
+  static IHttp::Pointer create(const Options&);
 };
 
 }  // namespace cloudstorage
@@ -52,6 +52,18 @@ struct PageData {
   std::string next_token_;  // empty if no next page
 };
 
+struct Change {
+  std::string id_;
+  std::vector<std::string> parents_;  // ids of directories holding the item
+  IItem::Pointer item_;               // nullptr if the item was removed
+};
+
+struct ChangeData {
+  std::vector<Change> changes_;
+  std::string cursor_;  // where to continue listing changes from
+  bool has_more_;       // if true, more changes are available right away
+};
+
 struct Token {
   std::string token_;
   std::string access_token_;
@@ -272,6 +284,7 @@ using DownloadFileCallback = GenericCallback<EitherError<void>>;
 using UploadFileCallback = GenericCallback<EitherError<IItem>>;
 using GetThumbnailCallback = GenericCallback<EitherError<void>>;
 using GeneralDataCallback = GenericCallback<EitherError<GeneralData>>;
+using ListChangesCallback = GenericCallback<EitherError<ChangeData>>;
 
 }  // namespace cloudstorage
 
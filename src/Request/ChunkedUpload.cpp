@@ -0,0 +1,223 @@
+/*****************************************************************************
+ * ChunkedUpload.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "ChunkedUpload.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "CloudProvider/CloudProvider.h"
+
+namespace cloudstorage {
+
+namespace {
+
+const size_t MAX_FREE_BUFFERS = 16;
+
+/**
+ * Keeps buffers of finished chunk streams, so that streams of next chunks
+ * don't have to allocate theirs.
+ */
+class BufferPool {
+ public:
+  std::unique_ptr<char[]> acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty())
+      return std::unique_ptr<char[]>(new char[ChunkedUpload::BufferSize]);
+    auto buffer = std::move(free_.back());
+    free_.pop_back();
+    return buffer;
+  }
+
+  void release(std::unique_ptr<char[]> buffer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.size() < MAX_FREE_BUFFERS) free_.push_back(std::move(buffer));
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<char[]>> free_;
+};
+
+BufferPool& buffer_pool() {
+  static BufferPool pool;
+  return pool;
+}
+
+}  // namespace
+
+constexpr uint32_t ChunkedUpload::BufferSize;
+
+/**
+ * Body of one chunk, read from the upload callback as the request consumes
+ * it.
+ */
+class ChunkedUpload::Stream : public std::streambuf {
+ public:
+  Stream(ChunkedUpload* upload, uint64_t offset, uint64_t size)
+      : upload_(upload),
+        buffer_(buffer_pool().acquire()),
+        offset_(offset),
+        size_(size),
+        read_(),
+        position_() {}
+
+  ~Stream() override { buffer_pool().release(std::move(buffer_)); }
+
+  void reset() {
+    read_ = 0;
+    setg(nullptr, nullptr, nullptr);
+  }
+
+  pos_type seekoff(off_type off, std::ios_base::seekdir way,
+                   std::ios_base::openmode) override {
+    if (off != 0) return pos_type(off_type(-1));
+    if (way == std::ios_base::beg)
+      return position_ = 0;
+    else if (way == std::ios_base::end)
+      return position_ = size_;
+    else
+      return position_;
+  }
+
+  int_type underflow() override {
+    if (read_ == size_) return std::char_traits<char>::eof();
+    auto length = static_cast<uint32_t>(
+        std::min<uint64_t>(BufferSize, size_ - read_));
+    uint32_t read;
+    {
+      std::lock_guard<std::mutex> lock(upload_->read_mutex_);
+      read = upload_->callback_->putData(buffer_.get(), length,
+                                         offset_ + read_);
+    }
+    if (read == 0) return std::char_traits<char>::eof();
+    read_ += read;
+    setg(buffer_.get(), buffer_.get(), buffer_.get() + read);
+    return std::char_traits<char>::to_int_type(*gptr());
+  }
+
+ private:
+  ChunkedUpload* upload_;
+  std::unique_ptr<char[]> buffer_;
+  uint64_t offset_;
+  uint64_t size_;
+  uint64_t read_;
+  pos_type position_;
+};
+
+ChunkedUpload::ChunkedUpload(Request<EitherError<IItem>>::Pointer request,
+                             IUploadFileCallback::Pointer callback,
+                             uint64_t chunk_size, int parallelism)
+    : request_(request),
+      callback_(callback),
+      size_(callback->size()),
+      chunk_size_(std::max<uint64_t>(chunk_size, 1)),
+      parallelism_(std::max(parallelism, 1)),
+      offset_(),
+      next_chunk_(),
+      stored_(),
+      running_(),
+      failed_(),
+      error_(nullptr) {}
+
+void ChunkedUpload::run(uint64_t offset, ChunkRequest request,
+                        ChunkResponse response, CompleteCallback complete) {
+  chunk_request_ = request;
+  chunk_response_ = response;
+  complete_ = complete;
+  offset_ = offset;
+  for (auto position = offset; position < size_; position += chunk_size_)
+    chunk_.push_back({position, std::min(chunk_size_, size_ - position), 0});
+  if (chunk_.empty()) return complete_(nullptr);
+  schedule();
+}
+
+void ChunkedUpload::schedule() {
+  std::vector<size_t> started;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (!failed_ && running_ < parallelism_ &&
+           next_chunk_ < chunk_.size()) {
+      started.push_back(next_chunk_++);
+      running_++;
+    }
+  }
+  for (auto index : started) send(index);
+}
+
+void ChunkedUpload::send(size_t index) {
+  auto self = shared_from_this();
+  auto offset = chunk_[index].offset_;
+  auto size = chunk_[index].size_;
+  auto stream = std::make_shared<Stream>(this, offset, size);
+  request_->send(
+      [=](util::Output) {
+        stream->reset();
+        auto request = self->chunk_request_(offset, size);
+        if (request) request->setPriority(IHttpRequest::Priority::Bulk);
+        return request;
+      },
+      [=](EitherError<Response> e) {
+        if (e.left()) return self->sent(index, e.left());
+        self->sent(index, self->chunk_response_(offset, *e.right()));
+      },
+      [=] { return std::make_shared<std::iostream>(stream.get()); },
+      std::make_shared<std::stringstream>(), nullptr,
+      [=](uint64_t, uint64_t now) { self->progress(index, now); }, true);
+}
+
+void ChunkedUpload::sent(size_t index, EitherError<void> e) {
+  bool done, stored = false;
+  uint64_t total = offset_;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    running_--;
+    if (e.left() && !failed_) {
+      failed_ = true;
+      error_ = e.left();
+    }
+    if (!failed_) {
+      chunk_[index].sent_ = chunk_[index].size_;
+      stored_++;
+      stored = true;
+      for (const auto& chunk : chunk_) total += chunk.sent_;
+    }
+    done = failed_ ? running_ == 0 : stored_ == chunk_.size();
+  }
+  if (stored) callback_->progress(size_, total);
+  if (done)
+    complete_(error_);
+  else
+    schedule();
+}
+
+void ChunkedUpload::progress(size_t index, uint64_t now) {
+  uint64_t total = offset_;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    chunk_[index].sent_ = now;
+    for (const auto& chunk : chunk_) total += chunk.sent_;
+  }
+  callback_->progress(size_, total);
+}
+
+}  // namespace cloudstorage
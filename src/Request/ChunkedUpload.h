@@ -0,0 +1,101 @@
+/*****************************************************************************
+ * ChunkedUpload.h
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#ifndef CHUNKEDUPLOAD_H
+#define CHUNKEDUPLOAD_H
+
+#include <mutex>
+#include <vector>
+
+#include "IItem.h"
+#include "Request.h"
+
+namespace cloudstorage {
+
+/**
+ * Sends a file to an upload session in chunks, up to parallelism chunks at
+ * once. Chunk bodies are read from the upload callback while they are sent,
+ * through buffers reused between chunks, so no chunk is ever held in memory
+ * as a whole. The first failed chunk stops the upload; it is reported once
+ * chunks already being sent are done.
+ */
+class ChunkedUpload : public std::enable_shared_from_this<ChunkedUpload> {
+ public:
+  using Pointer = std::shared_ptr<ChunkedUpload>;
+  using ChunkRequest =
+      std::function<IHttpRequest::Pointer(uint64_t offset, uint64_t length)>;
+  using ChunkResponse =
+      std::function<EitherError<void>(uint64_t offset, Response&)>;
+  using CompleteCallback = std::function<void(EitherError<void>)>;
+
+  static constexpr uint32_t BufferSize = 64 * 1024;
+
+  ChunkedUpload(Request<EitherError<IItem>>::Pointer,
+                IUploadFileCallback::Pointer, uint64_t chunk_size,
+                int parallelism);
+
+  /**
+   * Sends bytes of the file from offset to its end.
+   *
+   * @param request creates request sending the chunk, without its body
+   * @param response checks response to a sent chunk
+   * @param complete called after every chunk was sent, or one failed
+   */
+  void run(uint64_t offset, ChunkRequest request, ChunkResponse response,
+           CompleteCallback complete);
+
+ private:
+  class Stream;
+
+  struct Chunk {
+    uint64_t offset_;
+    uint64_t size_;
+    uint64_t sent_;
+  };
+
+  void schedule();
+  void send(size_t index);
+  void sent(size_t index, EitherError<void>);
+  void progress(size_t index, uint64_t now);
+
+  Request<EitherError<IItem>>::Pointer request_;
+  IUploadFileCallback::Pointer callback_;
+  uint64_t size_;
+  uint64_t chunk_size_;
+  int parallelism_;
+  ChunkRequest chunk_request_;
+  ChunkResponse chunk_response_;
+  CompleteCallback complete_;
+  std::mutex mutex_;
+  std::mutex read_mutex_;
+  std::vector<Chunk> chunk_;
+  uint64_t offset_;
+  size_t next_chunk_;
+  size_t stored_;
+  int running_;
+  bool failed_;
+  EitherError<void> error_;
+};
+
+}  // namespace cloudstorage
+
+#endif  // CHUNKEDUPLOAD_H
@@ -23,30 +23,190 @@
 
 #include "DownloadFileRequest.h"
 
+#include <algorithm>
+
 #include "CloudProvider/CloudProvider.h"
+#include "Utility/BlockCache.h"
 #include "Utility/Item.h"
 
 using namespace std::placeholders;
 
 namespace cloudstorage {
 
+namespace {
+
+/**
+ * Range missing in the cache is extended to whole blocks only if that makes
+ * it at most this many times longer.
+ */
+const uint64_t MAX_EXTENSION = 2;
+
+using SinkFactory = std::function<IDataSink::Pointer()>;
+
+/**
+ * Passes data to callback, skipping bytes which previous attempts of the
+ * download already passed; delivered is shared by sinks of all attempts.
+ */
+class DownloadSink : public IDataSink {
+ public:
+  DownloadSink(IDownloadFileCallback* callback,
+               std::shared_ptr<uint64_t> delivered)
+      : callback_(callback), delivered_(std::move(delivered)), received_() {}
+
+  void write(const char* data, uint32_t length) override {
+    auto skipped = static_cast<uint32_t>(std::min<uint64_t>(
+        length, *delivered_ - std::min(*delivered_, received_)));
+    received_ += length;
+    if (skipped < length) {
+      callback_->receivedData(data + skipped, length - skipped);
+      *delivered_ = received_;
+    }
+  }
+
+ private:
+  IDownloadFileCallback* callback_;
+  std::shared_ptr<uint64_t> delivered_;
+  uint64_t received_;
+};
+
+SinkFactory download_sink(IDownloadFileCallback* callback) {
+  auto delivered = std::make_shared<uint64_t>(0);
+  return [=] { return std::make_shared<DownloadSink>(callback, delivered); };
+}
+
+/**
+ * Passes data within requested range to callback and stores whole blocks in
+ * the cache; last block of the file is stored even if it's shorter. Each
+ * attempt of the download needs its own sink, as it tracks position in the
+ * file; bytes of the range which previous attempts already passed aren't
+ * passed again.
+ */
+class CacheSink : public IDataSink {
+ public:
+  CacheSink(std::shared_ptr<BlockCache> cache, const std::string& key,
+            uint64_t file_size, uint64_t position, Range range,
+            IDownloadFileCallback* callback,
+            std::shared_ptr<uint64_t> delivered)
+      : cache_(std::move(cache)),
+        key_(key),
+        file_size_(file_size),
+        position_(position),
+        range_(range),
+        callback_(callback),
+        delivered_(std::move(delivered)) {}
+
+  void write(const char* data, uint32_t length) override {
+    auto from = std::max(position_, range_.start_ + *delivered_);
+    auto to = std::min(position_ + length, range_.start_ + range_.size_);
+    if (from < to) {
+      callback_->receivedData(data + (from - position_),
+                              static_cast<uint32_t>(to - from));
+      *delivered_ = to - range_.start_;
+    }
+    while (length > 0) {
+      auto cnt = std::min<uint64_t>(
+          length, BlockCache::BlockSize - position_ % BlockCache::BlockSize);
+      block_.append(data, cnt);
+      data += cnt;
+      length -= cnt;
+      position_ += cnt;
+      if (position_ % BlockCache::BlockSize == 0 || position_ == file_size_) {
+        cache_->put(key_, (position_ - 1) / BlockCache::BlockSize, block_);
+        block_.clear();
+      }
+    }
+  }
+
+ private:
+  std::shared_ptr<BlockCache> cache_;
+  std::string key_;
+  uint64_t file_size_;
+  uint64_t position_;
+  Range range_;
+  IDownloadFileCallback* callback_;
+  std::shared_ptr<uint64_t> delivered_;
+  std::string block_;
+};
+
+/**
+ * If provider caches contents of the file, passes blocks at the beginning of
+ * range found in the cache to callback and replaces range with the rest of
+ * it. The rest is extended to whole blocks, and sink with one which fills the
+ * cache, unless that would more than double it; small reads, like the ones
+ * of fuse, don't download a whole block each.
+ *
+ * @return false if the whole range was read from the cache
+ */
+bool use_cache(CloudProvider& provider, const IItem& file,
+               IDownloadFileCallback* callback, Range& range,
+               SinkFactory& sink) {
+  auto cache = provider.block_cache();
+  if (!cache || range == FullRange) return true;
+  auto key = BlockCache::key(provider.name(), file);
+  auto file_size = static_cast<uint64_t>(file.size());
+  auto requested = range;
+  if (requested.size_ == Range::Full)
+    requested.size_ = file_size - std::min(file_size, requested.start_);
+  if (key.empty() || requested.size_ == 0 ||
+      requested.start_ + requested.size_ > file_size)
+    return true;
+  auto block = requested.start_ / BlockCache::BlockSize;
+  auto last = (requested.start_ + requested.size_ - 1) / BlockCache::BlockSize;
+  std::string data;
+  for (; block <= last && cache->get(key, block, data); block++) {
+    auto start = block * BlockCache::BlockSize;
+    auto from = std::max(start, requested.start_);
+    auto to = std::min(start + data.size(), requested.start_ + requested.size_);
+    if (from < to)
+      callback->receivedData(data.data() + (from - start),
+                             static_cast<uint32_t>(to - from));
+  }
+  if (block > last) {
+    callback->progress(requested.size_, requested.size_);
+    return false;
+  }
+  auto start = block * BlockCache::BlockSize;
+  auto end = std::min((last + 1) * BlockCache::BlockSize, file_size);
+  auto rest = Range{std::max(start, requested.start_), 0};
+  rest.size_ = requested.start_ + requested.size_ - rest.start_;
+  if (end - start > MAX_EXTENSION * rest.size_) {
+    range = rest;
+    return true;
+  }
+  range = Range{start, end - start};
+  auto delivered = std::make_shared<uint64_t>(0);
+  sink = [=] {
+    return std::make_shared<CacheSink>(cache, key, file_size, start, rest,
+                                       callback, delivered);
+  };
+  return true;
+}
+
+}  // namespace
+
 DownloadFileRequest::DownloadFileRequest(std::shared_ptr<CloudProvider> p,
                                          IItem::Pointer file,
                                          ICallback::Pointer cb, Range range,
                                          RequestFactory request_factory)
     : Request(p, [=](EitherError<void> e) { cb->done(e); },
               std::bind(&DownloadFileRequest::resolve, this, _1, file, cb.get(),
-                        range, request_factory)),
-      stream_wrapper_(std::bind(&ICallback::receivedData, cb.get(), _1, _2)) {}
+                        range, request_factory)) {}
 
 DownloadFileRequest::~DownloadFileRequest() { cancel(); }
 
 void DownloadFileRequest::resolve(Request::Pointer request, IItem::Pointer file,
                                   ICallback* callback, Range range,
                                   RequestFactory request_factory) {
+  auto sink = download_sink(callback);
+  if (!use_cache(*provider(), *file, callback, range, sink))
+    return request->done(nullptr);
   send(
       [=](util::Output input) {
         auto request = request_factory(*file, *input);
+        if (!request) return request;
+        request->setPriority(range != FullRange
+                                 ? IHttpRequest::Priority::Interactive
+                                 : IHttpRequest::Priority::Bulk);
         if (range != FullRange)
           request->setHeaderParameter("Range", util::range_to_string(range));
         return request;
@@ -71,7 +231,7 @@ void DownloadFileRequest::resolve(Request::Pointer request, IItem::Pointer file,
         }
       },
       []() { return std::make_shared<std::stringstream>(); },
-      std::make_shared<std::ostream>(&stream_wrapper_),
+      sink(),
       std::bind(&DownloadFileRequest::ICallback::progress, callback, _1, _2),
       nullptr, true);
 }
@@ -91,59 +251,67 @@ DownloadFileFromUrlRequest::DownloadFileFromUrlRequest(
     ICallback::Pointer cb, Range range)
     : Request(p, [=](EitherError<void> e) { cb->done(e); },
               std::bind(&DownloadFileFromUrlRequest::resolve, this, _1, file,
-                        cb.get(), range)),
-      stream_wrapper_(std::bind(&ICallback::receivedData, cb.get(), _1, _2)) {}
+                        cb.get(), range)) {}
 
 DownloadFileFromUrlRequest::~DownloadFileFromUrlRequest() { cancel(); }
 
 void DownloadFileFromUrlRequest::resolve(Request::Pointer r,
                                          IItem::Pointer file,
                                          ICallback* callback, Range range) {
-  auto download = [=](std::string url,
+  auto sink = download_sink(callback);
+  if (!use_cache(*provider(), *file, callback, range, sink))
+    return r->done(nullptr);
+  auto download = [=](std::string url, Range range, IDataSink::Pointer sink,
                       std::function<void(EitherError<void>)> cb) {
     r->send(
         [=](util::Output) {
           auto r = provider()->http()->create(url, "GET");
+          r->setPriority(range != FullRange
+                             ? IHttpRequest::Priority::Interactive
+                             : IHttpRequest::Priority::Bulk);
           if (range != FullRange)
             r->setHeaderParameter("Range", util::range_to_string(range));
           return r;
         },
         [=](EitherError<Response> e) {
-          if (e.left())
-            cb(e.left());
-          else {
-            if (range != FullRange && file->size() != IItem::UnknownSize) {
-              auto it = e.right()->headers().find("content-range");
-              std::stringstream range_stream;
-              range_stream << "bytes " << range.start_ << "-"
-                           << range.start_ + range.size_ - 1 << "/"
-                           << file->size();
-              if (it == e.right()->headers().end() ||
-                  it->second != range_stream.str())
-                return r->done(
-                    Error{IHttpRequest::ServiceUnavailable,
-                          util::Error::INVALID_RANGE_HEADER_RESPONSE});
-            }
-            r->done(nullptr);
+          if (e.left()) return cb(e.left());
+          if (range != FullRange && file->size() != IItem::UnknownSize) {
+            auto it = e.right()->headers().find("content-range");
+            std::stringstream range_stream;
+            range_stream << "bytes " << range.start_ << "-"
+                         << range.start_ + range.size_ - 1 << "/"
+                         << file->size();
+            if (it == e.right()->headers().end() ||
+                it->second != range_stream.str())
+              return cb(Error{IHttpRequest::ServiceUnavailable,
+                              util::Error::INVALID_RANGE_HEADER_RESPONSE});
           }
+          cb(nullptr);
         },
         [] { return std::make_shared<std::stringstream>(); },
-        std::make_shared<std::ostream>(&stream_wrapper_),
+        sink,
         std::bind(&IDownloadFileCallback::progress, callback, _1, _2), nullptr,
         true);
   };
+  // Http layer emulates ranges of servers which ignore Range header only
+  // up to IHttp::Options::max_range_skip_ into the file; past that the
+  // download fails with RangeUnsupported rather than fetching everything
+  // before the range.
+  auto fetch = [=](std::string url, std::function<void(EitherError<void>)> cb) {
+    download(url, range, sink(), cb);
+  };
   auto cached_url = static_cast<Item*>(file.get())->url();
   auto get_url = [=]() {
     r->make_subrequest(
         &CloudProvider::getItemUrlAsync, file, [=](EitherError<std::string> e) {
           if (e.left()) return r->done(e.left());
           static_cast<Item*>(file.get())->set_url(*e.right());
-          download(*e.right(), [=](EitherError<void> e) { r->done(e); });
+          fetch(*e.right(), [=](EitherError<void> e) { r->done(e); });
         });
   };
   if (!cached_url.empty())
-    download(cached_url, [=](EitherError<void> e) {
-      if (e.left())
+    fetch(cached_url, [=](EitherError<void> e) {
+      if (e.left() && e.left()->code_ != IHttpRequest::RangeUnsupported)
         get_url();
       else
         r->done(e);
@@ -53,8 +53,6 @@ class DownloadFileRequest : public Request<EitherError<void>> {
  private:
   void resolve(Request::Pointer request, IItem::Pointer file, ICallback*, Range,
                RequestFactory request_factory);
-
-  DownloadStreamWrapper stream_wrapper_;
 };
 
 class DownloadFileFromUrlRequest : public Request<EitherError<void>> {
@@ -67,8 +65,6 @@ class DownloadFileFromUrlRequest : public Request<EitherError<void>> {
 
  private:
   void resolve(Request::Pointer, IItem::Pointer, ICallback*, Range);
-
-  DownloadStreamWrapper stream_wrapper_;
 };
 
 }  // namespace cloudstorage
@@ -33,7 +33,19 @@ GetItemRequest::GetItemRequest(std::shared_ptr<CloudProvider> p,
         if (path.empty() || path.front() != '/')
           return done(
               Error{IHttpRequest::Forbidden, util::Error::INVALID_PATH});
-        work(provider()->rootDirectory(), path, callback);
+        auto absolute_path = path;
+        while (absolute_path.size() > 1 && absolute_path.back() == '/')
+          absolute_path.pop_back();
+        if (absolute_path.size() == 1)
+          return done(provider()->rootDirectory());
+        std::string prefix;
+        auto item = provider()->path_cache()->find(absolute_path, prefix);
+        if (item && prefix == absolute_path) return done(item);
+        if (lookup(absolute_path)) return;
+        if (item)
+          work(item, prefix, absolute_path.substr(prefix.size()));
+        else
+          work(provider()->rootDirectory(), "", absolute_path);
       }) {}
 
 GetItemRequest::~GetItemRequest() { cancel(); }
@@ -45,8 +57,38 @@ IItem::Pointer GetItemRequest::getItem(const IItem::List& items,
   return nullptr;
 }
 
-void GetItemRequest::work(IItem::Pointer item, std::string p,
-                          Callback complete) {
+bool GetItemRequest::lookup(const std::string& path) {
+  std::stringstream stream;
+  if (!provider()->getItemByPathRequest(path, stream)) return false;
+  request(
+      [=](util::Output input) {
+        return provider()->getItemByPathRequest(path, *input);
+      },
+      [=](EitherError<Response> e) {
+        if (e.left()) {
+          if (e.left()->code_ == IHttpRequest::NotFound ||
+              e.left()->code_ == IHttpRequest::Aborted)
+            return done(e.left());
+          return work(provider()->rootDirectory(), "", path);
+        }
+        IItem::Pointer item;
+        try {
+          item = provider()->getItemByPathResponse(path, e.right()->headers(),
+                                                   e.right()->output());
+        } catch (const std::exception&) {
+          return work(provider()->rootDirectory(), "", path);
+        }
+        if (!item)
+          return done(
+              Error{IHttpRequest::NotFound, util::Error::ITEM_NOT_FOUND});
+        provider()->path_cache()->put(path, item);
+        done(item);
+      });
+  return true;
+}
+
+void GetItemRequest::work(IItem::Pointer item, std::string prefix,
+                          std::string p) {
   if (!item)
     return done(Error{IHttpRequest::NotFound, util::Error::ITEM_NOT_FOUND});
   if (p.empty() || p.size() == 1) return done(item);
@@ -62,10 +104,11 @@ void GetItemRequest::work(IItem::Pointer item, std::string p,
   auto request = this->shared_from_this();
   make_subrequest(&CloudProvider::listDirectorySimpleAsync, item,
                   [=](EitherError<IItem::List> e) {
-                    if (e.left())
-                      request->done(e.left());
-                    else
-                      work(getItem(*e.right(), name), rest, complete);
+                    if (e.left()) return request->done(e.left());
+                    auto child = getItem(*e.right(), name);
+                    if (child)
+                      provider()->path_cache()->put(prefix + "/" + name, child);
+                    work(child, prefix + "/" + name, rest);
                   });
 }
 
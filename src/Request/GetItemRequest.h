@@ -39,7 +39,8 @@ class GetItemRequest : public Request<EitherError<IItem>> {
  private:
   IItem::Pointer getItem(const IItem::List& items,
                          const std::string& name) const;
-  void work(IItem::Pointer item, std::string path, Callback);
+  bool lookup(const std::string& path);
+  void work(IItem::Pointer item, std::string prefix, std::string path);
 };
 
 }  // namespace cloudstorage
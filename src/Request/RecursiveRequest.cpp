@@ -22,53 +22,155 @@
  *****************************************************************************/
 #include "RecursiveRequest.h"
 
+#include <algorithm>
+#include <deque>
+
 #include "CloudProvider/CloudProvider.h"
 
 namespace cloudstorage {
 
+template <class T>
+class RecursiveRequest<T>::Walk
+    : public std::enable_shared_from_this<RecursiveRequest<T>::Walk> {
+ public:
+  Walk(typename Request<T>::Pointer r, CompleteCallback callback,
+       Visitor visitor, int parallelism)
+      : request_(r),
+        callback_(callback),
+        visitor_(visitor),
+        parallelism_(std::max(parallelism, 1)),
+        running_(),
+        pumping_(),
+        failed_(),
+        finished_() {}
+
+  void start(IItem::Pointer item) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      add(std::make_shared<Node>(Node{item, nullptr, 0}));
+    }
+    pump();
+  }
+
+ private:
+  struct Node {
+    IItem::Pointer item_;
+    std::shared_ptr<Node> parent_;
+    size_t pending_;
+  };
+
+  struct Task {
+    std::shared_ptr<Node> node_;
+    bool list_;
+  };
+
+  void add(std::shared_ptr<Node> node) {
+    queue_.push_back(
+        {node, node->item_->type() == IItem::FileType::Directory});
+  }
+
+  /**
+   * Runs queued tasks while there are free slots. Only one thread does it at
+   * a time, tasks completing synchronously don't recurse into it.
+   */
+  void pump() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (pumping_) return;
+    pumping_ = true;
+    while (!failed_ && running_ < parallelism_ && !queue_.empty()) {
+      auto task = queue_.front();
+      queue_.pop_front();
+      running_++;
+      lock.unlock();
+      run(task);
+      lock.lock();
+    }
+    pumping_ = false;
+  }
+
+  void run(const Task& task) {
+    auto walk = this->shared_from_this();
+    auto node = task.node_;
+    if (request_->is_cancelled())
+      return visited(node, Error{IHttpRequest::Aborted, util::Error::ABORTED});
+    if (task.list_)
+      request_->make_subrequest(
+          &CloudProvider::listDirectorySimpleAsync, node->item_,
+          [=](EitherError<IItem::List> e) { walk->listed(node, e); });
+    else
+      visitor_(request_, node->item_,
+               [=](const T& e) { walk->visited(node, e); });
+  }
+
+  void listed(std::shared_ptr<Node> node, EitherError<IItem::List> e) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    running_--;
+    if (e.left() || failed_) return fail(lock, e.left());
+    if (e.right()->empty()) queue_.push_back({node, false});
+    node->pending_ = e.right()->size();
+    for (auto&& item : *e.right())
+      add(std::make_shared<Node>(Node{item, node, 0}));
+    lock.unlock();
+    pump();
+  }
+
+  void visited(std::shared_ptr<Node> node, const T& e) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    running_--;
+    if (e.left() || failed_) return fail(lock, e);
+    if (!node->parent_) {
+      lock.unlock();
+      return callback_(e);
+    }
+    if (--node->parent_->pending_ == 0)
+      queue_.push_back({node->parent_, false});
+    lock.unlock();
+    pump();
+  }
+
+  /**
+   * Stops starting new tasks and reports the first error once the ones in
+   * progress are done, as they still use the request.
+   */
+  void fail(std::unique_lock<std::mutex>& lock, const T& e) {
+    if (!failed_) {
+      failed_ = true;
+      error_ = e;
+      queue_.clear();
+    }
+    if (running_ > 0 || finished_) return;
+    finished_ = true;
+    lock.unlock();
+    callback_(error_);
+  }
+
+  std::mutex mutex_;
+  typename Request<T>::Pointer request_;
+  CompleteCallback callback_;
+  Visitor visitor_;
+  int parallelism_;
+  int running_;
+  bool pumping_;
+  bool failed_;
+  bool finished_;
+  T error_;
+  std::deque<Task> queue_;
+};
+
+template <class T>
+constexpr int RecursiveRequest<T>::DefaultParallelism;
+
 template <class T>
 RecursiveRequest<T>::RecursiveRequest(std::shared_ptr<CloudProvider> p,
                                       IItem::Pointer item,
                                       CompleteCallback callback,
-                                      Visitor visitor)
+                                      Visitor visitor, int parallelism)
     : Request<T>(p, callback, [=](typename Request<T>::Pointer r) {
-        visit(r, item, [=](const T& e) { r->done(e); }, visitor);
+        std::make_shared<Walk>(r, [=](const T& e) { r->done(e); }, visitor,
+                               parallelism)
+            ->start(item);
       }) {}
 
-template <class T>
-void RecursiveRequest<T>::visit(typename Request<T>::Pointer r,
-                                IItem::Pointer item, CompleteCallback callback,
-                                Visitor visitor) {
-  if (item->type() != IItem::FileType::Directory)
-    visitor(r, item, callback);
-  else
-    r->make_subrequest(&CloudProvider::listDirectorySimpleAsync, item,
-                       [=](EitherError<IItem::List> lst) {
-                         if (lst.left()) return callback(lst.left());
-                         visit(r, lst.right(),
-                               [=](const T& e) {
-                                 if (e.left()) return callback(e);
-                                 visitor(r, item, callback);
-                               },
-                               visitor);
-                       });
-}
-
-template <class T>
-void RecursiveRequest<T>::visit(typename Request<T>::Pointer r,
-                                std::shared_ptr<IItem::List> lst,
-                                CompleteCallback callback, Visitor visitor) {
-  if (lst->empty()) return callback(T());
-  auto i = lst->back();
-  lst->pop_back();
-  visit(r, i,
-        [=](const T& e) {
-          if (e.left()) return callback(e.left());
-          visit(r, lst, callback, visitor);
-        },
-        visitor);
-}
-
 template class RecursiveRequest<EitherError<void>>;
 template class RecursiveRequest<EitherError<IItem>>;
 
@@ -28,6 +28,12 @@
 
 namespace cloudstorage {
 
+/**
+ * Visits every item in the tree rooted at given item, children before their
+ * parent directory. Up to parallelism listings and visits are in progress at
+ * once; the first error stops the walk and is reported. Value reported by
+ * visitor for the root item is the result of the request.
+ */
 template <class ReturnValue>
 class RecursiveRequest : public Request<ReturnValue> {
  public:
@@ -35,15 +41,14 @@ class RecursiveRequest : public Request<ReturnValue> {
   using Visitor = std::function<void(typename Request<ReturnValue>::Pointer,
                                      IItem::Pointer, CompleteCallback)>;
 
+  static constexpr int DefaultParallelism = 8;
+
   RecursiveRequest(std::shared_ptr<CloudProvider>, IItem::Pointer item,
-                   CompleteCallback, Visitor);
+                   CompleteCallback, Visitor,
+                   int parallelism = DefaultParallelism);
 
  private:
-  static void visit(typename Request<ReturnValue>::Pointer, IItem::Pointer item,
-                    CompleteCallback, Visitor);
-  static void visit(typename Request<ReturnValue>::Pointer,
-                    std::shared_ptr<IItem::List> lst, CompleteCallback,
-                    Visitor);
+  class Walk;
 };
 
 }  // namespace cloudstorage
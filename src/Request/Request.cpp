@@ -36,6 +36,8 @@ namespace cloudstorage {
 
 namespace {
 
+const int MAX_RETRIES = 5;
+
 template <class T1, class T2>
 struct compare {
   bool operator()(Request<T1>*, Request<T2>*) const { return false; }
@@ -293,48 +295,108 @@ void Request<T>::send(RequestFactory factory, RequestCompleted complete,
                       std::shared_ptr<std::ostream> output,
                       ProgressFunction download, ProgressFunction upload,
                       bool authorized) {
+  send_to(factory, complete, input_factory, output, download, upload,
+          authorized);
+}
+
+template <class T>
+void Request<T>::send(RequestFactory factory, RequestCompleted complete,
+                      InputFactory input_factory, IDataSink::Pointer output,
+                      ProgressFunction download, ProgressFunction upload,
+                      bool authorized) {
+  send_to(factory, complete, input_factory, output, download, upload,
+          authorized);
+}
+
+template <class T>
+template <class Output>
+void Request<T>::send_to(RequestFactory factory, RequestCompleted complete,
+                         InputFactory input_factory, Output output,
+                         ProgressFunction download, ProgressFunction upload,
+                         bool authorized, int attempt) {
+  auto request = this->shared_from_this();
+  auto resend = [=] {
+    request->send_to(factory, complete, input_factory, output, download,
+                     upload, authorized, attempt + 1);
+  };
+  provider()->rate_limiter()->acquire(
+      [=] {
+        if (request->is_cancelled())
+          return complete(
+              Error{IHttpRequest::Aborted, util::Error::ABORTED});
+        auto input = input_factory();
+        auto error_stream = std::make_shared<std::stringstream>();
+        auto r = factory(input);
+        if (authorized) authorize(r);
+        send(
+            r.get(),
+            [=](IHttpRequest::Response response) {
+              if (retry(response, attempt, resend)) return;
+              if (provider()->isSuccess(response.http_code_,
+                                        response.headers_))
+                return complete(Response(response));
+              if (authorized &&
+                  this->reauthorize(response.http_code_, response.headers_)) {
+                this->reauthorize([=](EitherError<void> e) {
+                  if (e.left()) {
+                    if (e.left()->code_ != IHttpRequest::Aborted &&
+                        e.left()->code_ > 0)
+                      return complete(Error{IHttpRequest::Unauthorized,
+                                            e.left()->description_});
+                    else
+                      return complete(
+                          Error{response.http_code_, error_stream->str()});
+                  }
+                  auto input = input_factory();
+                  auto error_stream = std::make_shared<std::stringstream>();
+                  auto r = factory(input);
+                  if (authorized) authorize(r);
+                  this->send(
+                      r.get(),
+                      [=](IHttpRequest::Response response) {
+                        (void)request;
+                        if (retry(response, attempt, resend)) return;
+                        if (provider()->isSuccess(response.http_code_,
+                                                  response.headers_))
+                          complete(Response(response));
+                        else
+                          complete(
+                              Error{response.http_code_, error_stream->str()});
+                      },
+                      input, output, error_stream, download, upload);
+                });
+              } else {
+                complete(Error{response.http_code_, error_stream->str()});
+              }
+            },
+            input, output, error_stream, download, upload);
+      },
+      [=] { return request->is_cancelled(); });
+}
+
+template <class T>
+bool Request<T>::retry(const IHttpRequest::Response& response, int attempt,
+                       std::function<void()> send) {
+  auto limiter = provider()->rate_limiter();
+  if (!IHttpRequest::isThrottled(response.http_code_)) {
+    if (provider()->isSuccess(response.http_code_, response.headers_))
+      limiter->succeeded();
+    return false;
+  }
+  auto retry_after = response.headers_.find("retry-after");
+  auto delay = limiter->throttled(
+      attempt, retry_after != response.headers_.end()
+                   ? RateLimiter::parseRetryAfter(retry_after->second)
+                   : RateLimiter::Clock::duration::zero());
+  if (attempt >= MAX_RETRIES) return false;
   auto request = this->shared_from_this();
-  auto input = input_factory();
-  auto error_stream = std::make_shared<std::stringstream>();
-  auto r = factory(input);
-  if (authorized) authorize(r);
-  send(r.get(),
-       [=](IHttpRequest::Response response) {
-         if (provider()->isSuccess(response.http_code_, response.headers_))
-           return complete(Response(response));
-         if (authorized &&
-             this->reauthorize(response.http_code_, response.headers_)) {
-           this->reauthorize([=](EitherError<void> e) {
-             if (e.left()) {
-               if (e.left()->code_ != IHttpRequest::Aborted &&
-                   e.left()->code_ > 0)
-                 return complete(
-                     Error{IHttpRequest::Unauthorized, e.left()->description_});
-               else
-                 return complete(
-                     Error{response.http_code_, error_stream->str()});
-             }
-             auto input = input_factory();
-             auto error_stream = std::make_shared<std::stringstream>();
-             auto r = factory(input);
-             if (authorized) authorize(r);
-             this->send(
-                 r.get(),
-                 [=](IHttpRequest::Response response) {
-                   (void)request;
-                   if (provider()->isSuccess(response.http_code_,
-                                             response.headers_))
-                     complete(Response(response));
-                   else
-                     complete(Error{response.http_code_, error_stream->str()});
-                 },
-                 input, output, error_stream, download, upload);
-           });
-         } else {
-           complete(Error{response.http_code_, error_stream->str()});
-         }
-       },
-       input, output, error_stream, download, upload);
+  limiter->schedule(delay,
+                    [=] {
+                      limiter->retried();
+                      send();
+                    },
+                    [=] { return request->is_cancelled(); });
+  return true;
 }
 
 template <class T>
@@ -344,15 +406,33 @@ void Request<T>::send(IHttpRequest* request,
                       std::shared_ptr<std::ostream> output,
                       std::shared_ptr<std::ostream> error,
                       ProgressFunction download, ProgressFunction upload) {
-  if (request)
+  if (request) {
+    request->setGroup(provider()->name());
     request->send(complete, input, output, error,
                   http_callback(download, upload));
-  else {
+  } else {
     *error << util::Error::UNIMPLEMENTED;
     complete({IHttpRequest::Aborted, {}, output, error});
   }
 }
 
+template <class T>
+void Request<T>::send(IHttpRequest* request,
+                      IHttpRequest::CompleteCallback complete,
+                      std::shared_ptr<std::istream> input,
+                      IDataSink::Pointer output,
+                      std::shared_ptr<std::ostream> error,
+                      ProgressFunction download, ProgressFunction upload) {
+  if (request) {
+    request->setGroup(provider()->name());
+    request->sendToSink(complete, input, output, error,
+                        http_callback(download, upload));
+  } else {
+    *error << util::Error::UNIMPLEMENTED;
+    complete({IHttpRequest::Aborted, {}, nullptr, error});
+  }
+}
+
 template <class T>
 std::shared_ptr<CloudProvider> Request<T>::provider() const {
   return provider_;
@@ -388,5 +468,6 @@ template class Request<EitherError<IItem>>;
 template class Request<EitherError<IItem::List>>;
 template class Request<EitherError<void>>;
 template class Request<EitherError<GeneralData>>;
+template class Request<EitherError<ChangeData>>;
 
 }  // namespace cloudstorage
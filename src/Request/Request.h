@@ -100,6 +100,9 @@ class Request : public IRequest<ReturnValue>,
   void send(RequestFactory factory, RequestCompleted, InputFactory,
             std::shared_ptr<std::ostream> output, ProgressFunction download,
             ProgressFunction upload, bool authorized);
+  void send(RequestFactory factory, RequestCompleted, InputFactory,
+            IDataSink::Pointer output, ProgressFunction download,
+            ProgressFunction upload, bool authorized);
 
   void request(RequestFactory factory, RequestCompleted);
   void send(RequestFactory factory, RequestCompleted);
@@ -132,12 +135,31 @@ class Request : public IRequest<ReturnValue>,
       ProgressFunction progress_download = nullptr,
       ProgressFunction progress_upload = nullptr);
 
+  template <class Output>
+  void send_to(RequestFactory factory, RequestCompleted, InputFactory,
+               Output output, ProgressFunction download,
+               ProgressFunction upload, bool authorized, int attempt = 0);
+
+  /**
+   * If server asked to slow down, schedules sending the request again;
+   * successful responses let the rate limiter speed up.
+   *
+   * @return whether the request will be retried
+   */
+  bool retry(const IHttpRequest::Response&, int attempt,
+             std::function<void()> send);
+
   void send(IHttpRequest*, IHttpRequest::CompleteCallback complete,
             std::shared_ptr<std::istream> input,
             std::shared_ptr<std::ostream> output,
             std::shared_ptr<std::ostream> error,
             ProgressFunction download = nullptr,
             ProgressFunction upload = nullptr);
+  void send(IHttpRequest*, IHttpRequest::CompleteCallback complete,
+            std::shared_ptr<std::istream> input, IDataSink::Pointer output,
+            std::shared_ptr<std::ostream> error,
+            ProgressFunction download = nullptr,
+            ProgressFunction upload = nullptr);
 
   void subrequest(std::shared_ptr<IGenericRequest>);
 
@@ -48,9 +48,11 @@ void UploadFileRequest::resolve(Request::Pointer r,
   r->send(
       [=](util::Output) {
         stream_wrapper->reset();
-        return r->provider()->uploadFileRequest(*directory, filename,
-                                                stream_wrapper->prefix_,
-                                                stream_wrapper->suffix_);
+        auto request = r->provider()->uploadFileRequest(
+            *directory, filename, stream_wrapper->prefix_,
+            stream_wrapper->suffix_);
+        if (request) request->setPriority(IHttpRequest::Priority::Bulk);
+        return request;
       },
       [=](EitherError<Response> e) {
         if (e.left()) return r->done(e.left());
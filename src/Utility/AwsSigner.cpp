@@ -0,0 +1,233 @@
+/*****************************************************************************
+ * AwsSigner.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "AwsSigner.h"
+
+#include <algorithm>
+#include <cctype>
+#include <tuple>
+#include <vector>
+
+#include "Utility/Utility.h"
+
+namespace cloudstorage {
+
+namespace {
+
+const std::string ALGORITHM = "AWS4-HMAC-SHA256";
+const std::string UNSIGNED_PAYLOAD = "UNSIGNED-PAYLOAD";
+
+struct Header {
+  std::string name_;
+  std::string value_;
+
+  bool operator<(const Header& h) const {
+    return std::tie(name_, value_) < std::tie(h.name_, h.value_);
+  }
+};
+
+struct Parameter {
+  const std::string* key_;
+  std::string name_;
+  std::string value_;
+
+  bool operator<(const Parameter& p) const {
+    return std::tie(name_, value_) < std::tie(p.name_, p.value_);
+  }
+};
+
+/**
+ * Storage reused by all requests signed on a thread; strings keep their
+ * capacity, so after a few requests signing allocates very little.
+ */
+struct Buffer {
+  std::string canonical_request_;
+  std::string signed_headers_;
+  std::vector<Header> header_;
+  std::vector<Parameter> parameter_;
+};
+
+thread_local Buffer buffer;
+
+template <class T>
+T& next(std::vector<T>& vector, size_t& count) {
+  if (count == vector.size()) vector.emplace_back();
+  auto& result = vector[count++];
+  result.name_.clear();
+  result.value_.clear();
+  return result;
+}
+
+void escape(const std::string& value, std::string& output) {
+  const char* hex = "0123456789ABCDEF";
+  for (unsigned char c : value) {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+        (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '.' ||
+        c == '~') {
+      output += c;
+    } else {
+      output += '%';
+      output += hex[c >> 4];
+      output += hex[c & 15];
+    }
+  }
+}
+
+}  // namespace
+
+AwsSigner::AwsSigner(const std::string& service) : service_(service) {}
+
+void AwsSigner::authorize(ICrypto& crypto, IHttpRequest& request,
+                          const Credentials& credentials,
+                          const std::string& time) {
+  sign(crypto, request, credentials, time, false, 0);
+}
+
+void AwsSigner::presign(ICrypto& crypto, IHttpRequest& request,
+                        const Credentials& credentials,
+                        const std::string& time, int expires) {
+  sign(crypto, request, credentials, time, true, expires);
+}
+
+std::string AwsSigner::signingKey(ICrypto& crypto,
+                                  const Credentials& credentials,
+                                  const std::string& date) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (date != date_) {
+    key_.clear();
+    date_ = date;
+  }
+  auto it = key_.find(credentials.region_);
+  if (it != key_.end() && it->second.secret_ == credentials.secret_)
+    return it->second.key_;
+  auto key = crypto.hmac_sha256(
+      crypto.hmac_sha256(
+          crypto.hmac_sha256(
+              crypto.hmac_sha256("AWS4" + credentials.secret_, date),
+              credentials.region_),
+          service_),
+      "aws4_request");
+  key_[credentials.region_] = {credentials.secret_, key};
+  return key;
+}
+
+void AwsSigner::sign(ICrypto& crypto, IHttpRequest& request,
+                     const Credentials& credentials, const std::string& time,
+                     bool presign, int expires) {
+  auto date = time.substr(0, 8);
+  auto scope =
+      date + "/" + credentials.region_ + "/" + service_ + "/aws4_request";
+  util::Url url(request.url());
+  request.setHeaderParameter("host", url.host());
+  if (!presign) {
+    request.setHeaderParameter("x-amz-date", time);
+    request.setHeaderParameter("x-amz-content-sha256", UNSIGNED_PAYLOAD);
+  }
+
+  auto& b = buffer;
+  size_t header_count = 0;
+  for (const auto& h : request.headerParameters()) {
+    auto& header = next(b.header_, header_count);
+    header.name_ = h.first;
+    std::transform(header.name_.begin(), header.name_.end(),
+                   header.name_.begin(), ::tolower);
+    header.value_ = h.second;
+  }
+  std::sort(b.header_.begin(), b.header_.begin() + header_count);
+  b.signed_headers_.clear();
+  for (size_t i = 0; i < header_count; i++) {
+    if (i > 0 && b.header_[i].name_ == b.header_[i - 1].name_) continue;
+    if (i > 0) b.signed_headers_ += ';';
+    b.signed_headers_ += b.header_[i].name_;
+  }
+
+  if (presign) {
+    request.setParameter("X-Amz-Algorithm", ALGORITHM);
+    request.setParameter("X-Amz-Credential",
+                         credentials.access_id_ + "/" + scope);
+    request.setParameter("X-Amz-Date", time);
+    request.setParameter("X-Amz-Expires", std::to_string(expires));
+    request.setParameter("X-Amz-SignedHeaders", b.signed_headers_);
+  }
+  size_t parameter_count = 0;
+  for (const auto& p : request.parameters()) {
+    auto& parameter = next(b.parameter_, parameter_count);
+    parameter.key_ = &p.first;
+    escape(p.first, parameter.name_);
+    escape(p.second, parameter.value_);
+  }
+  std::sort(b.parameter_.begin(), b.parameter_.begin() + parameter_count);
+
+  auto& canonical_request = b.canonical_request_;
+  canonical_request.clear();
+  canonical_request += request.method();
+  canonical_request += '\n';
+  canonical_request += url.path();
+  canonical_request += '\n';
+  for (size_t i = 0; i < parameter_count; i++) {
+    if (i > 0) canonical_request += '&';
+    canonical_request += b.parameter_[i].name_;
+    canonical_request += '=';
+    canonical_request += b.parameter_[i].value_;
+  }
+  canonical_request += '\n';
+  for (size_t i = 0; i < header_count; i++) {
+    if (i > 0 && b.header_[i].name_ == b.header_[i - 1].name_) {
+      canonical_request.back() = ',';
+    } else {
+      canonical_request += b.header_[i].name_;
+      canonical_request += ':';
+    }
+    canonical_request += b.header_[i].value_;
+    canonical_request += '\n';
+  }
+  canonical_request += '\n';
+  canonical_request += b.signed_headers_;
+  canonical_request += '\n';
+  canonical_request += UNSIGNED_PAYLOAD;
+
+  auto hash = crypto.hex(crypto.sha256(canonical_request));
+  auto& string_to_sign = canonical_request;
+  string_to_sign.clear();
+  string_to_sign += ALGORITHM;
+  string_to_sign += '\n';
+  string_to_sign += time;
+  string_to_sign += '\n';
+  string_to_sign += scope;
+  string_to_sign += '\n';
+  string_to_sign += hash;
+  auto signature = crypto.hex(crypto.hmac_sha256(
+      signingKey(crypto, credentials, date), string_to_sign));
+
+  for (size_t i = 0; i < parameter_count; i++)
+    request.setParameter(*b.parameter_[i].key_, b.parameter_[i].value_);
+  if (presign)
+    request.setParameter("X-Amz-Signature", signature);
+  else
+    request.setHeaderParameter(
+        "Authorization", ALGORITHM + " Credential=" + credentials.access_id_ +
+                             "/" + scope +
+                             ", SignedHeaders=" + b.signed_headers_ +
+                             ", Signature=" + signature);
+}
+
+}  // namespace cloudstorage
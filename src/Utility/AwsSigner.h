@@ -0,0 +1,95 @@
+/*****************************************************************************
+ * AwsSigner.h
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#ifndef AWSSIGNER_H
+#define AWSSIGNER_H
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "ICrypto.h"
+#include "IHttp.h"
+
+namespace cloudstorage {
+
+/**
+ * Signs requests with AWS Signature Version 4 for one service.
+ *
+ * Signing keys are derived once per date and region, and then reused for all
+ * requests signed during that day. Payloads are never hashed, requests are
+ * signed as UNSIGNED-PAYLOAD.
+ */
+class AwsSigner {
+ public:
+  struct Credentials {
+    std::string access_id_;
+    std::string secret_;
+    std::string region_;
+  };
+
+  AwsSigner(const std::string& service);
+
+  /**
+   * Signs request with Authorization header. All headers set on request are
+   * signed; host, x-amz-date and x-amz-content-sha256 headers are added.
+   *
+   * @param time request time formatted as yyyymmddThhmmssZ
+   */
+  void authorize(ICrypto&, IHttpRequest& request, const Credentials&,
+                 const std::string& time);
+
+  /**
+   * Signs request with query parameters, so that its url can be used without
+   * any headers until it expires.
+   *
+   * @param time request time formatted as yyyymmddThhmmssZ
+   * @param expires number of seconds the url is valid for
+   */
+  void presign(ICrypto&, IHttpRequest& request, const Credentials&,
+               const std::string& time, int expires);
+
+  /**
+   * @param date date formatted as yyyymmdd
+   * @return key derived from secret, date, region and service
+   */
+  std::string signingKey(ICrypto&, const Credentials&,
+                         const std::string& date);
+
+ private:
+  struct Key {
+    std::string secret_;
+    std::string key_;
+  };
+
+  void sign(ICrypto&, IHttpRequest& request, const Credentials&,
+            const std::string& time, bool presign, int expires);
+
+  std::string service_;
+  std::mutex mutex_;
+  std::string date_;
+  std::unordered_map<std::string, Key> key_;
+};
+
+}  // namespace cloudstorage
+
+#endif  // AWSSIGNER_H
@@ -0,0 +1,198 @@
+/*****************************************************************************
+ * BlockCache.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "BlockCache.h"
+
+#include <json/json.h>
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "Utility/Utility.h"
+
+namespace cloudstorage {
+
+namespace {
+
+const char* STORE_FILE = "blocks.bin";
+const char* INDEX_FILE = "blocks.json";
+
+std::string slot_id(const std::string& key, uint64_t block) {
+  return key + "#" + std::to_string(block);
+}
+
+std::mutex instances_mutex;
+std::unordered_map<std::string, std::weak_ptr<BlockCache>> instances;
+
+}  // namespace
+
+constexpr uint64_t BlockCache::BlockSize;
+
+BlockCache::BlockCache(const std::string& directory, uint64_t size)
+    : directory_(directory),
+      slot_count_(
+          static_cast<uint32_t>(std::max<uint64_t>(size / BlockSize, 1))),
+      next_index_(),
+      statistics_() {
+  auto store = util::join_path(directory_, STORE_FILE);
+  std::ofstream(store, std::ios::app | std::ios::binary);
+  store_.open(store, std::ios::in | std::ios::out | std::ios::binary);
+  load();
+}
+
+BlockCache::~BlockCache() { save(); }
+
+BlockCache::Pointer BlockCache::create(const std::string& directory,
+                                       uint64_t size) {
+  if (directory.empty() || size == 0) return nullptr;
+  std::lock_guard<std::mutex> lock(instances_mutex);
+  auto cache = instances[directory].lock();
+  if (!cache) {
+    cache = std::make_shared<BlockCache>(directory, size);
+    if (!cache->store_.is_open()) {
+      util::log("[BLOCK CACHE] couldn't open", directory);
+      return nullptr;
+    }
+    instances[directory] = cache;
+  }
+  return cache;
+}
+
+std::string BlockCache::key(const std::string& provider, const IItem& item) {
+  if (item.size() == IItem::UnknownSize ||
+      item.timestamp() == IItem::UnknownTimeStamp ||
+      item.type() == IItem::FileType::Directory)
+    return "";
+  return provider + "\n" + item.id() + "\n" +
+         std::to_string(item.timestamp().time_since_epoch().count());
+}
+
+bool BlockCache::get(const std::string& key, uint64_t block,
+                     std::string& data) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(slot_id(key, block));
+  if (it == index_.end()) {
+    statistics_.misses_++;
+    return false;
+  }
+  auto slot = it->second;
+  data.resize(slot->size_);
+  store_.seekg(static_cast<std::streamoff>(slot->index_ * BlockSize));
+  if (!store_.read(&data[0], slot->size_)) {
+    store_.clear();
+    statistics_.misses_++;
+    statistics_.size_ -= slot->size_;
+    free_.push_back(slot->index_);
+    index_.erase(it);
+    slots_.erase(slot);
+    return false;
+  }
+  slots_.splice(slots_.begin(), slots_, slot);
+  statistics_.hits_++;
+  return true;
+}
+
+void BlockCache::put(const std::string& key, uint64_t block,
+                     const std::string& data) {
+  if (data.empty() || data.size() > BlockSize) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto id = slot_id(key, block);
+  auto it = index_.find(id);
+  if (it != index_.end()) {
+    slots_.splice(slots_.begin(), slots_, it->second);
+    return;
+  }
+  uint32_t index;
+  if (!free_.empty()) {
+    index = free_.back();
+    free_.pop_back();
+  } else if (next_index_ < slot_count_) {
+    index = next_index_++;
+  } else {
+    auto& evicted = slots_.back();
+    index = evicted.index_;
+    statistics_.size_ -= evicted.size_;
+    index_.erase(evicted.id_);
+    slots_.pop_back();
+  }
+  store_.seekp(static_cast<std::streamoff>(index * BlockSize));
+  if (!store_.write(data.data(), static_cast<std::streamsize>(data.size()))) {
+    store_.clear();
+    free_.push_back(index);
+    return;
+  }
+  slots_.push_front({id, index, static_cast<uint32_t>(data.size())});
+  index_[id] = slots_.begin();
+  statistics_.size_ += data.size();
+}
+
+BlockCache::Statistics BlockCache::statistics() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return statistics_;
+}
+
+void BlockCache::load() {
+  std::ifstream file(util::join_path(directory_, INDEX_FILE));
+  if (!file) return;
+  try {
+    auto json = util::json::from_stream(file);
+    std::vector<bool> used(slot_count_);
+    for (const auto& d : json["slots"]) {
+      Slot slot{d["id"].asString(), d["index"].asUInt(), d["size"].asUInt()};
+      if (slot.index_ >= slot_count_ || used[slot.index_] ||
+          slot.size_ > BlockSize || index_.find(slot.id_) != index_.end())
+        continue;
+      used[slot.index_] = true;
+      slots_.push_back(slot);
+      index_[slot.id_] = std::prev(slots_.end());
+      statistics_.size_ += slot.size_;
+    }
+    for (const auto& slot : slots_)
+      next_index_ = std::max(next_index_, slot.index_ + 1);
+    for (uint32_t i = 0; i < next_index_; i++)
+      if (!used[i]) free_.push_back(i);
+  } catch (const Json::Exception& e) {
+    util::log("[BLOCK CACHE] invalid index", e.what());
+  }
+  file.close();
+  std::remove(util::join_path(directory_, INDEX_FILE).c_str());
+}
+
+void BlockCache::save() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!store_.is_open()) return;
+  store_.flush();
+  Json::Value slots(Json::arrayValue);
+  for (const auto& d : slots_) {
+    Json::Value slot;
+    slot["id"] = d.id_;
+    slot["index"] = d.index_;
+    slot["size"] = d.size_;
+    slots.append(slot);
+  }
+  Json::Value json;
+  json["slots"] = slots;
+  std::ofstream(util::join_path(directory_, INDEX_FILE))
+      << util::json::to_string(json);
+}
+
+}  // namespace cloudstorage
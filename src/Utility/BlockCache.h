@@ -0,0 +1,97 @@
+/*****************************************************************************
+ * BlockCache.h
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ICloudProvider.h"
+
+namespace cloudstorage {
+
+/**
+ * Stores fixed size blocks of files' contents on disk, in a single file of
+ * slots, evicting least recently used blocks once the size limit is reached.
+ * Index of slots is loaded when the cache is opened and saved when it's
+ * destroyed; cache which wasn't closed cleanly starts empty.
+ */
+class BlockCache {
+ public:
+  using Pointer = std::shared_ptr<BlockCache>;
+  using Statistics = ICloudProvider::CacheStatistics;
+
+  static constexpr uint64_t BlockSize = 1024 * 1024;
+
+  BlockCache(const std::string& directory, uint64_t size);
+  ~BlockCache();
+
+  /**
+   * Returns cache stored in given directory, shared by everyone who asks for
+   * the same directory while it's alive.
+   *
+   * @return nullptr if directory is empty or size is zero
+   */
+  static Pointer create(const std::string& directory, uint64_t size);
+
+  /**
+   * Identifies version of item's contents.
+   *
+   * @return empty string if item's contents can't be cached
+   */
+  static std::string key(const std::string& provider, const IItem&);
+
+  bool get(const std::string& key, uint64_t block, std::string& data);
+  void put(const std::string& key, uint64_t block, const std::string& data);
+
+  Statistics statistics() const;
+
+ private:
+  struct Slot {
+    std::string id_;
+    uint32_t index_;
+    uint32_t size_;
+  };
+
+  void load();
+  void save();
+
+  std::string directory_;
+  uint32_t slot_count_;
+  mutable std::mutex mutex_;
+  std::fstream store_;
+  std::list<Slot> slots_;
+  std::unordered_map<std::string, std::list<Slot>::iterator> index_;
+  std::vector<uint32_t> free_;
+  uint32_t next_index_;
+  Statistics statistics_;
+};
+
+}  // namespace cloudstorage
+
+#endif  // BLOCKCACHE_H
@@ -217,6 +217,9 @@ CloudFactory::CloudFactory(CloudFactory::InitData&& d)
     : callback_(std::make_shared<FactoryCallbackWrapper>(this, d.callback_)),
       event_loop_(d.thread_pool_factory_.get(), callback_),
       base_url_(d.base_url_),
+      cache_directory_(d.cache_directory_),
+      cache_size_(d.cache_size_),
+      upload_journal_(d.upload_journal_),
       http_(std::move(d.http_)),
       http_server_factory_(util::make_unique<ServerWrapperFactory>(
           d.http_server_factory_.get())),
@@ -277,6 +280,9 @@ CloudAccess CloudFactory::createImpl(
   init_data.token_ = std::move(data.token_);
   init_data.hints_ = std::move(data.hints_);
   init_data.permission_ = data.permission_;
+  init_data.cache_directory_ = cache_directory_;
+  init_data.cache_size_ = cache_size_;
+  init_data.upload_journal_ = upload_journal_;
   init_data.http_engine_ =
       http_ ? util::make_unique<HttpWrapper>(http_) : nullptr;
   init_data.http_server_ =
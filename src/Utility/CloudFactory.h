@@ -87,6 +87,9 @@ class CloudFactory : public ICloudFactory {
   std::shared_ptr<ICallback> callback_;
   CloudEventLoop event_loop_;
   std::string base_url_;
+  std::string cache_directory_;
+  uint64_t cache_size_;
+  std::string upload_journal_;
   std::shared_ptr<IHttp> http_;
   std::shared_ptr<ServerWrapperFactory> http_server_factory_;
   std::shared_ptr<ICrypto> crypto_;
@@ -46,6 +46,44 @@ namespace cloudstorage {
 
 namespace {
 
+class InvalidatingUploadFileCallback : public IUploadFileCallback {
+ public:
+  InvalidatingUploadFileCallback(std::shared_ptr<CloudProvider> p,
+                                 const std::string& parent_id,
+                                 const std::string& filename,
+                                 IUploadFileCallback::Pointer callback)
+      : p_(p),
+        parent_id_(parent_id),
+        filename_(filename),
+        callback_(callback) {}
+
+  uint32_t putData(char* data, uint32_t maxlength, uint64_t offset) override {
+    return callback_->putData(data, maxlength, offset);
+  }
+
+  uint64_t size() override { return callback_->size(); }
+
+  void done(EitherError<IItem> e) override {
+    p_->path_cache()->invalidate(parent_id_, filename_);
+    callback_->done(e);
+  }
+
+  void progress(uint64_t total, uint64_t now) override {
+    callback_->progress(total, now);
+  }
+
+ private:
+  std::shared_ptr<CloudProvider> p_;
+  std::string parent_id_;
+  std::string filename_;
+  IUploadFileCallback::Pointer callback_;
+};
+
+/**
+ * Forwards calls to the provider. Operations changing the tree forget cached
+ * paths they affect both when they start and when they're done, so that
+ * lookups made in the meantime don't stay around.
+ */
 class CloudProviderWrapper : public ICloudProvider {
  public:
   CloudProviderWrapper(std::shared_ptr<CloudProvider> p) : p_(p) {}
@@ -64,6 +102,14 @@ class CloudProviderWrapper : public ICloudProvider {
     return p_->supportedOperations();
   }
 
+  RequestStatistics requestStatistics() const override {
+    return p_->requestStatistics();
+  }
+
+  CacheStatistics cacheStatistics() const override {
+    return p_->cacheStatistics();
+  }
+
   std::string authorizeLibraryUrl() const override {
     return p_->authorizeLibraryUrl();
   }
@@ -106,7 +152,21 @@ class CloudProviderWrapper : public ICloudProvider {
   UploadFileRequest::Pointer uploadFileAsync(
       IItem::Pointer parent, const std::string& filename,
       IUploadFileCallback::Pointer cb) override {
-    return p_->uploadFileAsync(parent, filename, cb);
+    p_->path_cache()->invalidate(parent->id(), filename);
+    return p_->uploadFileAsync(
+        parent, filename,
+        std::make_shared<InvalidatingUploadFileCallback>(p_, parent->id(),
+                                                         filename, cb));
+  }
+
+  UploadFileRequest::Pointer resumeUploadFileAsync(
+      IItem::Pointer parent, const std::string& filename,
+      IUploadFileCallback::Pointer cb) override {
+    p_->path_cache()->invalidate(parent->id(), filename);
+    return p_->resumeUploadFileAsync(
+        parent, filename,
+        std::make_shared<InvalidatingUploadFileCallback>(p_, parent->id(),
+                                                         filename, cb));
   }
 
   GetItemDataRequest::Pointer getItemDataAsync(
@@ -121,7 +181,12 @@ class CloudProviderWrapper : public ICloudProvider {
 
   DeleteItemRequest::Pointer deleteItemAsync(
       IItem::Pointer item, DeleteItemCallback callback) override {
-    return p_->deleteItemAsync(item, callback);
+    auto p = p_;
+    p->path_cache()->invalidate(item->id());
+    return p->deleteItemAsync(item, [=](EitherError<void> e) {
+      p->path_cache()->invalidate(item->id());
+      callback(e);
+    });
   }
 
   CreateDirectoryRequest::Pointer createDirectoryAsync(
@@ -133,13 +198,23 @@ class CloudProviderWrapper : public ICloudProvider {
   MoveItemRequest::Pointer moveItemAsync(IItem::Pointer source,
                                          IItem::Pointer destination,
                                          MoveItemCallback callback) override {
-    return p_->moveItemAsync(source, destination, callback);
+    auto p = p_;
+    p->path_cache()->invalidate(source->id());
+    return p->moveItemAsync(source, destination, [=](EitherError<IItem> e) {
+      p->path_cache()->invalidate(source->id());
+      callback(e);
+    });
   }
 
   RenameItemRequest::Pointer renameItemAsync(
       IItem::Pointer item, const std::string& name,
       RenameItemCallback callback) override {
-    return p_->renameItemAsync(item, name, callback);
+    auto p = p_;
+    p->path_cache()->invalidate(item->id());
+    return p->renameItemAsync(item, name, [=](EitherError<IItem> e) {
+      p->path_cache()->invalidate(item->id());
+      callback(e);
+    });
   }
 
   ListDirectoryPageRequest::Pointer listDirectoryPageAsync(
@@ -168,7 +243,14 @@ class CloudProviderWrapper : public ICloudProvider {
   UploadFileRequest::Pointer uploadFileAsync(
       IItem::Pointer parent, const std::string& path,
       const std::string& filename, UploadFileCallback callback) override {
-    return p_->uploadFileAsync(parent, path, filename, callback);
+    auto p = p_;
+    p->path_cache()->invalidate(parent->id(), filename);
+    return p->uploadFileAsync(parent, path, filename,
+                              [=](EitherError<IItem> e) {
+                                p->path_cache()->invalidate(parent->id(),
+                                                            filename);
+                                callback(e);
+                              });
   }
 
   GeneralDataRequest::Pointer getGeneralDataAsync(
@@ -181,6 +263,11 @@ class CloudProviderWrapper : public ICloudProvider {
     return p_->getFileDaemonUrlAsync(item, callback);
   }
 
+  ListChangesRequest::Pointer listChangesAsync(
+      const std::string& cursor, ListChangesCallback callback) override {
+    return p_->listChangesAsync(cursor, callback);
+  }
+
  private:
   std::shared_ptr<CloudProvider> p_;
 };
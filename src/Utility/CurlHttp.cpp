@@ -26,6 +26,7 @@
 #include "CurlHttp.h"
 
 #include <json/json.h>
+#include <algorithm>
 #include <array>
 #include <cstring>
 #include <sstream>
@@ -37,13 +38,25 @@
 #include <jni.h>
 #endif
 
+#ifdef WITH_CURL_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
 const uint32_t MAX_URL_LENGTH = 1024;
 const uint32_t POLL_TIMEOUT = 100;
+const int MAX_EVENTS = 64;
+const size_t MAX_POOL_SIZE = 64;
 
 namespace cloudstorage {
 
 IHttp::Pointer IHttp::create() { return util::make_unique<curl::CurlHttp>(); }
 
+IHttp::Pointer IHttp::create(const Options& options) {
+  return util::make_unique<curl::CurlHttp>(options);
+}
+
 namespace curl {
 
 namespace {
@@ -53,21 +66,29 @@ size_t write_callback(char* ptr, size_t size, size_t nmemb, void* userdata) {
   if (!data->http_code_)
     curl_easy_getinfo(data->handle_.get(), CURLINFO_RESPONSE_CODE,
                       &data->http_code_);
+  auto http_code = static_cast<int>(data->http_code_);
   if (!data->error_stream_ ||
-      data->callback_->isSuccess(static_cast<int>(data->http_code_),
-                                 data->response_headers_)) {
-    auto range_it = data->query_headers_.find("Range");
-    if (range_it != data->query_headers_.end() &&
-        data->http_code_ != IHttpRequest::Partial) {
-      auto range = util::parse_range(range_it->second);
-      auto begin = std::max<size_t>(range.start_, data->received_bytes_);
-      auto end = std::min<size_t>(range.start_ + range.size_,
-                                  data->received_bytes_ + size * nmemb);
+      (data->callback_
+           ? data->callback_->isSuccess(http_code, data->response_headers_)
+           : IHttpRequest::isSuccess(http_code))) {
+    if (data->range_ != FullRange && data->http_code_ == IHttpRequest::Ok) {
+      const auto& range = data->range_;
+      if (!data->range_ignored_) {
+        data->range_ignored_ = true;
+        data->connections_->rangeIgnored(data->url_, range);
+        if (!data->connections_->canSkipTo(range)) return 0;
+      }
+      auto begin = std::max<uint64_t>(range.start_, data->received_bytes_);
+      auto end = std::min<uint64_t>(range.start_ + range.size_,
+                                    data->received_bytes_ + size * nmemb);
       if (begin < end)
-        data->stream_->write(ptr + begin - data->received_bytes_,
-                             static_cast<std::streamsize>(end - begin));
+        data->write(ptr + begin - data->received_bytes_, end - begin);
+      data->connections_->discarded(size * nmemb -
+                                    (begin < end ? end - begin : 0));
+      data->received_bytes_ += size * nmemb;
+      return data->rangeReceived() ? 0 : size * nmemb;
     } else
-      data->stream_->write(ptr, static_cast<std::streamsize>(size * nmemb));
+      data->write(ptr, size * nmemb);
   } else
     data->error_stream_->write(ptr, static_cast<std::streamsize>(size * nmemb));
   data->received_bytes_ += size * nmemb;
@@ -113,7 +134,8 @@ int progress_callback(void* clientp, curl_off_t dltotal, curl_off_t dlnow,
     if (dltotal != 0)
       callback->progressDownload(static_cast<uint64_t>(dltotal),
                                  static_cast<uint64_t>(dlnow));
-    if (callback->pause())
+    data->paused_ = callback->pause();
+    if (data->paused_)
       curl_easy_pause(data->handle_.get(), CURLPAUSE_ALL);
     else
       curl_easy_pause(data->handle_.get(), CURLPAUSE_CONT);
@@ -122,6 +144,20 @@ int progress_callback(void* clientp, curl_off_t dltotal, curl_off_t dlnow,
   return 0;
 }
 
+size_t host_length(const std::string& url) {
+  auto begin = url.find("://");
+  begin = begin == std::string::npos ? 0 : begin + 3;
+  return std::min(url.find_first_of("/?#", begin), url.size());
+}
+
+std::string host_name(const std::string& url) {
+  return url.substr(0, host_length(url));
+}
+
+std::string resource_name(const std::string& url) {
+  return url.substr(0, url.find_first_of("?#"));
+}
+
 std::ios::pos_type stream_length(std::istream& data) {
   data.seekg(0, data.end);
   std::ios::pos_type length = data.tellg();
@@ -131,49 +167,252 @@ std::ios::pos_type stream_length(std::istream& data) {
 
 }  // namespace
 
-CurlHttp::Worker::Worker() : done_(), thread_(std::bind(&Worker::work, this)) {}
+ConnectionManager::ConnectionManager(const IHttp::Options& options)
+    : options_(options),
+      share_(options.share_connections_ ? curl_share_init() : nullptr),
+      connections_opened_(),
+      connections_reused_(),
+      ranges_unsupported_(),
+      bytes_discarded_() {
+  if (share_) {
+    curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, lock);
+    curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, unlock);
+    curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+  }
+}
+
+ConnectionManager::~ConnectionManager() {
+  if (share_) curl_share_cleanup(share_);
+}
+
+void ConnectionManager::setupMultiHandle(CURLM* handle) const {
+  curl_multi_setopt(handle, CURLMOPT_MAX_HOST_CONNECTIONS,
+                    static_cast<long>(options_.max_host_connections_));
+  curl_multi_setopt(handle, CURLMOPT_MAX_TOTAL_CONNECTIONS,
+                    static_cast<long>(options_.max_total_connections_));
+  if (options_.max_total_connections_ > 0)
+    curl_multi_setopt(handle, CURLMOPT_MAXCONNECTS,
+                      static_cast<long>(options_.max_total_connections_));
+  curl_multi_setopt(
+      handle, CURLMOPT_PIPELINING,
+      static_cast<long>(options_.multiplex_ ? CURLPIPE_MULTIPLEX
+                                            : CURLPIPE_NOTHING));
+}
+
+void ConnectionManager::setupHandle(CURL* handle,
+                                    const std::string& url) const {
+  if (share_) curl_easy_setopt(handle, CURLOPT_SHARE, share_);
+  if (options_.multiplex_) {
+    curl_easy_setopt(handle, CURLOPT_HTTP_VERSION,
+                     static_cast<long>(CURL_HTTP_VERSION_2TLS));
+    // Only tls connections may turn out to be multiplexed; waiting for a
+    // plain http one would just queue the transfer behind a busy connection.
+    if (url.compare(0, 8, "https://") == 0)
+      curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+  }
+  curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE,
+                   static_cast<long>(options_.tcp_keep_alive_));
+}
+
+void ConnectionManager::completed(CURL* handle) {
+  long connections = 0;
+  if (curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connections) !=
+      CURLE_OK)
+    return;
+  if (connections > 0)
+    connections_opened_ += static_cast<uint64_t>(connections);
+  else
+    connections_reused_++;
+}
+
+void ConnectionManager::rangeIgnored(const std::string& url, Range range) {
+  ranges_unsupported_++;
+  {
+    std::lock_guard<std::mutex> lock(range_lock_);
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = range_unsupported_.begin();
+         it != range_unsupported_.end();)
+      if (it->second <= now)
+        it = range_unsupported_.erase(it);
+      else
+        ++it;
+    range_unsupported_[resource_name(url)] =
+        now + std::chrono::seconds(options_.range_unsupported_expiry_);
+  }
+  if (options_.range_unsupported_)
+    options_.range_unsupported_(host_name(url), range);
+}
+
+void ConnectionManager::discarded(uint64_t bytes) { bytes_discarded_ += bytes; }
+
+bool ConnectionManager::rangeUnsupported(const std::string& url) {
+  std::lock_guard<std::mutex> lock(range_lock_);
+  auto it = range_unsupported_.find(resource_name(url));
+  if (it == range_unsupported_.end()) return false;
+  if (it->second > std::chrono::steady_clock::now()) return true;
+  range_unsupported_.erase(it);
+  return false;
+}
+
+bool ConnectionManager::canSkipTo(Range range) const {
+  return range.start_ <= options_.max_range_skip_;
+}
+
+IHttp::Statistics ConnectionManager::statistics() const {
+  return {connections_opened_, connections_reused_, ranges_unsupported_,
+          bytes_discarded_};
+}
+
+void ConnectionManager::lock(CURL*, curl_lock_data data, curl_lock_access,
+                             void* userptr) {
+  static_cast<ConnectionManager*>(userptr)->share_lock_[data].lock();
+}
+
+void ConnectionManager::unlock(CURL*, curl_lock_data data, void* userptr) {
+  static_cast<ConnectionManager*>(userptr)->share_lock_[data].unlock();
+}
+
+Scheduler::Scheduler(const IHttp::Options& options) : options_(options) {}
+
+void Scheduler::push(RequestData::Pointer r) {
+  queues_[static_cast<size_t>(r->priority_)].push_back(std::move(r));
+}
+
+std::vector<RequestData::Pointer> Scheduler::pop() {
+  std::vector<RequestData::Pointer> result;
+  for (auto&& queue : queues_) {
+    auto it = queue.begin();
+    for (auto&& r : queue) {
+      if (admissible(*r)) {
+        host_requests_[r->host_]++;
+        if (r->priority_ == IHttpRequest::Priority::Bulk)
+          host_bulk_requests_[r->host_]++;
+        if (!r->group_.empty()) group_requests_[r->group_]++;
+        result.push_back(std::move(r));
+      } else {
+        *it++ = std::move(r);
+      }
+    }
+    queue.erase(it, queue.end());
+  }
+  return result;
+}
+
+void Scheduler::finished(const RequestData& r) {
+  decrement(host_requests_, r.host_);
+  if (r.priority_ == IHttpRequest::Priority::Bulk)
+    decrement(host_bulk_requests_, r.host_);
+  if (!r.group_.empty()) decrement(group_requests_, r.group_);
+}
+
+std::vector<RequestData::Pointer> Scheduler::cancelled() {
+  std::vector<RequestData::Pointer> result;
+  for (auto&& queue : queues_) {
+    auto it = queue.begin();
+    for (auto&& r : queue) {
+      if (r->callback_ && r->callback_->abort())
+        result.push_back(std::move(r));
+      else
+        *it++ = std::move(r);
+    }
+    queue.erase(it, queue.end());
+  }
+  return result;
+}
+
+bool Scheduler::empty() const {
+  return std::all_of(queues_.begin(), queues_.end(),
+                     [](const std::deque<RequestData::Pointer>& queue) {
+                       return queue.empty();
+                     });
+}
+
+bool Scheduler::admissible(const RequestData& r) const {
+  auto below = [](const std::unordered_map<std::string, uint32_t>& count,
+                  const std::string& key, uint32_t limit) {
+    if (limit == 0) return true;
+    auto it = count.find(key);
+    return it == count.end() || it->second < limit;
+  };
+  return below(host_requests_, r.host_, options_.max_host_requests_) &&
+         (r.priority_ != IHttpRequest::Priority::Bulk ||
+          below(host_bulk_requests_, r.host_,
+                options_.max_host_bulk_requests_)) &&
+         (r.group_.empty() ||
+          below(group_requests_, r.group_, options_.max_group_requests_));
+}
+
+void Scheduler::decrement(std::unordered_map<std::string, uint32_t>& count,
+                          const std::string& key) {
+  auto it = count.find(key);
+  if (it != count.end() && --it->second == 0) count.erase(it);
+}
+
+CurlHttp::Worker::Worker(const IHttp::Options& options)
+    : connections_(options),
+      scheduler_(options),
+      done_(),
+      handle_(curl_multi_init()),
+      timeout_(Clock::time_point::max()),
+      last_housekeeping_(Clock::now()) {
+#ifdef WITH_CURL_EPOLL
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = wakeup_fd_;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wakeup_fd_, &event);
+  curl_multi_setopt(handle_, CURLMOPT_SOCKETFUNCTION, socketCallback);
+  curl_multi_setopt(handle_, CURLMOPT_SOCKETDATA, this);
+#endif
+  connections_.setupMultiHandle(handle_);
+  curl_multi_setopt(handle_, CURLMOPT_TIMERFUNCTION, timerCallback);
+  curl_multi_setopt(handle_, CURLMOPT_TIMERDATA, this);
+  thread_ = std::thread(std::bind(&Worker::work, this));
+}
 
 CurlHttp::Worker::~Worker() {
   done_ = true;
-  nonempty_.notify_one();
+  wakeup();
   thread_.join();
+  curl_multi_cleanup(handle_);
+#ifdef WITH_CURL_EPOLL
+  close(wakeup_fd_);
+  close(epoll_fd_);
+#endif
 }
 
 void CurlHttp::Worker::work() {
   util::set_thread_name("cs-curl");
   util::attach_thread();
-  auto handle = curl_multi_init();
-  while (!done_ || !pending_.empty()) {
+  while (true) {
     std::unique_lock<std::mutex> lock(lock_);
-    nonempty_.wait(lock, [=]() {
-      return done_ || !requests_.empty() || !pending_.empty();
-    });
+    if (done_ && requests_.empty() && pending_.empty() && scheduler_.empty())
+      break;
     auto requests = util::exchange(requests_, {});
     lock.unlock();
     for (auto&& r : requests) {
-      curl_multi_add_handle(handle, r->handle_.get());
+      if (r->range_ != FullRange && !connections_.canSkipTo(r->range_) &&
+          connections_.rangeUnsupported(r->url_)) {
+        r->done(CURLE_RANGE_ERROR);
+        release(std::move(r));
+      } else {
+        scheduler_.push(std::move(r));
+      }
+    }
+    for (auto&& r : scheduler_.pop()) {
+      curl_multi_add_handle(handle_, r->handle_.get());
       pending_[r->handle_.get()] = std::move(r);
     }
-    int rc;
-    curl_multi_wait(handle, nullptr, 0, POLL_TIMEOUT, &rc);
-    if (rc == 0)
-      std::this_thread::sleep_for(std::chrono::milliseconds(POLL_TIMEOUT));
-    int running_handles = 0;
-    curl_multi_perform(handle, &running_handles);
-    CURLMsg* msg;
-    do {
-      int message_count;
-      msg = curl_multi_info_read(handle, &message_count);
-      if (msg && msg->msg == CURLMSG_DONE) {
-        auto easy_handle = msg->easy_handle;
-        curl_multi_remove_handle(handle, easy_handle);
-        auto it = pending_.find(easy_handle);
-        it->second->done(msg->data.result);
-        pending_.erase(it);
-      }
-    } while (msg);
+    wait(nextTimeout());
+    processMessages();
+    if (Clock::now() - last_housekeeping_ >=
+        std::chrono::milliseconds(POLL_TIMEOUT))
+      housekeeping();
   }
-  curl_multi_cleanup(handle);
   util::detach_thread();
 }
 
@@ -182,24 +421,255 @@ void CurlHttp::Worker::add(RequestData::Pointer r) {
     std::lock_guard<std::mutex> lock(lock_);
     requests_.push_back(std::move(r));
   }
-  nonempty_.notify_all();
+  wakeup();
+}
+
+RequestData::Pointer CurlHttp::Worker::acquire() {
+  {
+    std::lock_guard<std::mutex> lock(pool_lock_);
+    if (!pool_.empty()) {
+      auto r = std::move(pool_.back());
+      pool_.pop_back();
+      return r;
+    }
+  }
+  return util::make_unique<RequestData>();
+}
+
+void CurlHttp::Worker::release(RequestData::Pointer r) {
+  r->reset();
+  std::lock_guard<std::mutex> lock(pool_lock_);
+  if (pool_.size() < MAX_POOL_SIZE) pool_.push_back(std::move(r));
+}
+
+void CurlHttp::Worker::finish(CURL* handle, int result) {
+  curl_multi_remove_handle(handle_, handle);
+  connections_.completed(handle);
+  auto it = pending_.find(handle);
+  auto r = std::move(it->second);
+  pending_.erase(it);
+  scheduler_.finished(*r);
+  r->done(result);
+  release(std::move(r));
+}
+
+void CurlHttp::Worker::wakeup() {
+#ifdef WITH_CURL_EPOLL
+  uint64_t value = 1;
+  if (write(wakeup_fd_, &value, sizeof(value)) != sizeof(value)) return;
+#elif LIBCURL_VERSION_NUM >= 0x074400
+  curl_multi_wakeup(handle_);
+#endif
+}
+
+void CurlHttp::Worker::wait(long timeout) {
+  int running_handles = 0;
+#ifdef WITH_CURL_EPOLL
+  std::array<epoll_event, MAX_EVENTS> events;
+  int count = epoll_wait(epoll_fd_, events.data(), MAX_EVENTS,
+                         static_cast<int>(timeout));
+  for (int i = 0; i < count; i++) {
+    const auto& event = events[i];
+    if (event.data.fd == wakeup_fd_) {
+      uint64_t value;
+      if (read(wakeup_fd_, &value, sizeof(value)) != sizeof(value)) continue;
+    } else {
+      int action = 0;
+      if (event.events & EPOLLIN) action |= CURL_CSELECT_IN;
+      if (event.events & EPOLLOUT) action |= CURL_CSELECT_OUT;
+      if (event.events & (EPOLLERR | EPOLLHUP)) action |= CURL_CSELECT_ERR;
+      curl_multi_socket_action(handle_, event.data.fd, action,
+                               &running_handles);
+    }
+  }
+  if (Clock::now() >= timeout_) {
+    timeout_ = Clock::time_point::max();
+    curl_multi_socket_action(handle_, CURL_SOCKET_TIMEOUT, 0,
+                             &running_handles);
+  }
+#else
+  // curl rejects negative timeouts; idle workers rely on wakeup()
+  auto poll_timeout = static_cast<int>(timeout < 0 ? POLL_TIMEOUT : timeout);
+#if LIBCURL_VERSION_NUM >= 0x074400
+  curl_multi_poll(handle_, nullptr, 0, poll_timeout, nullptr);
+#else
+  curl_multi_wait(handle_, nullptr, 0, poll_timeout, nullptr);
+#endif
+  curl_multi_perform(handle_, &running_handles);
+#endif
+}
+
+void CurlHttp::Worker::housekeeping() {
+  last_housekeeping_ = Clock::now();
+  std::vector<CURL*> aborted;
+  for (auto&& r : pending_) {
+    auto callback = r.second->callback_.get();
+    if (!callback) continue;
+    if (callback->abort())
+      aborted.push_back(r.first);
+    else if (r.second->paused_ && !callback->pause()) {
+      r.second->paused_ = false;
+      curl_easy_pause(r.first, CURLPAUSE_CONT);
+    }
+  }
+  for (auto&& easy_handle : aborted)
+    finish(easy_handle, CURLE_ABORTED_BY_CALLBACK);
+  for (auto&& r : scheduler_.cancelled()) {
+    r->done(CURLE_ABORTED_BY_CALLBACK);
+    release(std::move(r));
+  }
+}
+
+void CurlHttp::Worker::processMessages() {
+  CURLMsg* msg;
+  do {
+    int message_count;
+    msg = curl_multi_info_read(handle_, &message_count);
+    if (msg && msg->msg == CURLMSG_DONE)
+      finish(msg->easy_handle, msg->data.result);
+  } while (msg);
+}
+
+long CurlHttp::Worker::nextTimeout() const {
+  if (pending_.empty()) return done_ ? 0 : -1;
+  auto now = Clock::now();
+  auto timeout = std::chrono::milliseconds(POLL_TIMEOUT);
+  if (timeout_ != Clock::time_point::max())
+    timeout = std::min(
+        timeout, std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::max(timeout_, now) - now));
+  return static_cast<long>(timeout.count());
+}
+
+int CurlHttp::Worker::socketCallback(CURL*, curl_socket_t socket, int what,
+                                     void* userp, void*) {
+#ifdef WITH_CURL_EPOLL
+  auto worker = static_cast<Worker*>(userp);
+  if (what == CURL_POLL_REMOVE) {
+    epoll_ctl(worker->epoll_fd_, EPOLL_CTL_DEL, socket, nullptr);
+  } else {
+    epoll_event event = {};
+    event.data.fd = socket;
+    if (what & CURL_POLL_IN) event.events |= EPOLLIN;
+    if (what & CURL_POLL_OUT) event.events |= EPOLLOUT;
+    if (epoll_ctl(worker->epoll_fd_, EPOLL_CTL_MOD, socket, &event) != 0)
+      epoll_ctl(worker->epoll_fd_, EPOLL_CTL_ADD, socket, &event);
+  }
+#else
+  (void)socket;
+  (void)what;
+  (void)userp;
+#endif
+  return 0;
+}
+
+int CurlHttp::Worker::timerCallback(CURLM*, long timeout, void* userp) {
+  auto worker = static_cast<Worker*>(userp);
+  if (timeout < 0)
+    worker->timeout_ = Clock::time_point::max();
+  else
+    worker->timeout_ = Clock::now() + std::chrono::milliseconds(timeout);
+  return 0;
+}
+
+RequestData::RequestData()
+    : handle_(curl_easy_init()),
+      connections_(),
+      priority_(IHttpRequest::Priority::Metadata),
+      range_(FullRange),
+      follow_redirect_(),
+      http_code_(),
+      received_bytes_(),
+      paused_(),
+      range_ignored_() {}
+
+void RequestData::setHeaders(const IHttpRequest::HeaderParameters& headers) {
+  if (header_data_.size() < headers.size()) header_data_.resize(headers.size());
+  headers_.resize(headers.size());
+  size_t index = 0;
+  for (const auto& p : headers) {
+    auto& header = header_data_[index];
+    header.assign(p.first);
+    header.append(": ");
+    header.append(p.second);
+    headers_[index].data = const_cast<char*>(header.c_str());
+    headers_[index].next =
+        index + 1 < headers_.size() ? &headers_[index + 1] : nullptr;
+    index++;
+  }
+}
+
+void RequestData::reset() {
+  curl_easy_reset(handle_.get());
+  group_.clear();
+  priority_ = IHttpRequest::Priority::Metadata;
+  headers_.clear();
+  range_ = FullRange;
+  response_headers_.clear();
+  data_ = nullptr;
+  stream_ = nullptr;
+  sink_ = nullptr;
+  error_stream_ = nullptr;
+  callback_ = nullptr;
+  complete_ = nullptr;
+  http_code_ = 0;
+  received_bytes_ = 0;
+  paused_ = false;
+  range_ignored_ = false;
+}
+
+void RequestData::write(const char* data, size_t length) {
+  if (sink_)
+    sink_->write(data, static_cast<uint32_t>(length));
+  else
+    stream_->write(data, static_cast<std::streamsize>(length));
+}
+
+bool RequestData::rangeReceived() const {
+  return range_ignored_ && range_.size_ != Range::Full &&
+         received_bytes_ >= range_.start_ + range_.size_;
 }
 
 void RequestData::done(int code) {
   int ret = IHttpRequest::Unknown;
+  if (range_ignored_ && code == CURLE_WRITE_ERROR)
+    code = rangeReceived() ? CURLE_OK : CURLE_RANGE_ERROR;
   if (code == CURLE_OK) {
     long http_code = static_cast<long>(IHttpRequest::Unknown);
     curl_easy_getinfo(handle_.get(), CURLINFO_RESPONSE_CODE, &http_code);
     ret = http_code;
+    if (range_ignored_) {
+      if (received_bytes_ > range_.start_) {
+        auto length = response_headers_.find("content-length");
+        auto total =
+            length != response_headers_.end() ? length->second : "*";
+        auto end = std::min(range_.start_ + range_.size_, received_bytes_);
+        ret = IHttpRequest::Partial;
+        response_headers_.erase("content-range");
+        response_headers_.erase("content-length");
+        response_headers_.insert(
+            {"content-range", "bytes " + std::to_string(range_.start_) + "-" +
+                                  std::to_string(end - 1) + "/" + total});
+        response_headers_.insert(
+            {"content-length", std::to_string(end - range_.start_)});
+      } else {
+        ret = IHttpRequest::RangeInvalid;
+      }
+    }
     if (!follow_redirect_ && IHttpRequest::isRedirect(http_code)) {
       std::array<char, MAX_URL_LENGTH> redirect_url;
       char* data = redirect_url.data();
       curl_easy_getinfo(handle_.get(), CURLINFO_REDIRECT_URL, &data);
-      *stream_ << data;
+      if (data) write(data, strlen(data));
     }
   } else {
     *error_stream_ << curl_easy_strerror(static_cast<CURLcode>(code));
-    ret = (code == CURLE_ABORTED_BY_CALLBACK) ? IHttpRequest::Aborted : -code;
+    if (code == CURLE_ABORTED_BY_CALLBACK)
+      ret = IHttpRequest::Aborted;
+    else if (code == CURLE_RANGE_ERROR)
+      ret = IHttpRequest::RangeUnsupported;
+    else
+      ret = -code;
   }
   complete_({ret, response_headers_, stream_, error_stream_});
 }
@@ -211,23 +681,30 @@ CurlHttpRequest::CurlHttpRequest(const std::string& url,
     : url_(url),
       method_(method),
       follow_redirect_(follow_redirect),
+      priority_(Priority::Metadata),
       worker_(worker) {}
 
-std::unique_ptr<CURL, CurlDeleter> CurlHttpRequest::init() const {
-  std::unique_ptr<CURL, CurlDeleter> handle(curl_easy_init());
-  curl_easy_setopt(handle.get(), CURLOPT_WRITEFUNCTION, write_callback);
-  curl_easy_setopt(handle.get(), CURLOPT_READFUNCTION, read_callback);
-  curl_easy_setopt(handle.get(), CURLOPT_HEADERFUNCTION, header_callback);
-  curl_easy_setopt(handle.get(), CURLOPT_SSL_VERIFYPEER,
-                   static_cast<long>(false));
-  curl_easy_setopt(handle.get(), CURLOPT_FOLLOWLOCATION,
+void CurlHttpRequest::init(RequestData* data) const {
+  auto handle = data->handle_.get();
+  data->connections_ = &worker_->connections_;
+  curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, write_callback);
+  curl_easy_setopt(handle, CURLOPT_READFUNCTION, read_callback);
+  curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, header_callback);
+  curl_easy_setopt(handle, CURLOPT_SSL_VERIFYPEER, static_cast<long>(false));
+  curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION,
                    static_cast<long>(follow_redirect_));
-  curl_easy_setopt(handle.get(), CURLOPT_XFERINFOFUNCTION, progress_callback);
-  curl_easy_setopt(handle.get(), CURLOPT_NOPROGRESS, static_cast<long>(false));
-  std::string parameters = parametersToString();
-  std::string url = url_ + (!parameters.empty() ? ("?" + parameters) : "");
-  curl_easy_setopt(handle.get(), CURLOPT_URL, url.c_str());
-  return handle;
+  curl_easy_setopt(handle, CURLOPT_XFERINFOFUNCTION, progress_callback);
+  curl_easy_setopt(handle, CURLOPT_NOPROGRESS, static_cast<long>(false));
+  worker_->connections_.setupHandle(handle, url_);
+  data->url_.assign(url_);
+  data->host_.assign(url_, 0, host_length(url_));
+  data->group_.assign(group_);
+  data->priority_ = priority_;
+  if (!parameters_.empty()) {
+    data->url_ += "?";
+    appendParameters(data->url_);
+  }
+  curl_easy_setopt(handle, CURLOPT_URL, data->url_.c_str());
 }
 
 void CurlHttpRequest::setParameter(const std::string& parameter,
@@ -240,6 +717,10 @@ void CurlHttpRequest::setHeaderParameter(const std::string& parameter,
   header_parameters_.insert({parameter, value});
 }
 
+void CurlHttpRequest::setPriority(Priority priority) { priority_ = priority; }
+
+void CurlHttpRequest::setGroup(const std::string& group) { group_ = group; }
+
 const IHttpRequest::GetParameters& CurlHttpRequest::parameters() const {
   return parameters_;
 }
@@ -257,28 +738,27 @@ const std::string& CurlHttpRequest::method() const { return method_; }
 
 RequestData::Pointer CurlHttpRequest::prepare(
     CompleteCallback complete, std::shared_ptr<std::istream> data,
-    std::shared_ptr<std::ostream> response,
     std::shared_ptr<std::ostream> error_stream,
     ICallback::Pointer callback) const {
-  auto cb_data =
-      util::make_unique<RequestData>(RequestData{init(),
-                                                 headerParametersToList(),
-                                                 headerParameters(),
-                                                 {},
-                                                 data,
-                                                 response,
-                                                 error_stream,
-                                                 callback,
-                                                 complete,
-                                                 follow_redirect(),
-                                                 0,
-                                                 0});
+  auto cb_data = worker_->acquire();
+  init(cb_data.get());
+  cb_data->setHeaders(header_parameters_);
+  auto range_it = header_parameters_.find("Range");
+  if (range_it != header_parameters_.end())
+    cb_data->range_ = util::parse_range(range_it->second);
+  cb_data->data_ = data;
+  cb_data->error_stream_ = error_stream;
+  cb_data->callback_ = callback;
+  cb_data->complete_ = complete;
+  cb_data->follow_redirect_ = follow_redirect();
   auto handle = cb_data->handle_.get();
   curl_easy_setopt(handle, CURLOPT_WRITEDATA, cb_data.get());
   curl_easy_setopt(handle, CURLOPT_XFERINFODATA, cb_data.get());
   curl_easy_setopt(handle, CURLOPT_HEADERDATA, &cb_data->response_headers_);
   curl_easy_setopt(handle, CURLOPT_READDATA, cb_data.get());
-  curl_easy_setopt(handle, CURLOPT_HTTPHEADER, cb_data->headers_.get());
+  curl_easy_setopt(handle, CURLOPT_HTTPHEADER,
+                   cb_data->headers_.empty() ? nullptr
+                                             : cb_data->headers_.data());
   if (method_ == "POST") {
     curl_easy_setopt(handle, CURLOPT_POST, static_cast<long>(true));
     curl_easy_setopt(handle, CURLOPT_POSTFIELDSIZE,
@@ -305,37 +785,44 @@ void CurlHttpRequest::send(CompleteCallback c,
                            std::shared_ptr<std::ostream> response,
                            std::shared_ptr<std::ostream> error_stream,
                            ICallback::Pointer cb) const {
-  worker_->add(prepare(c, data, response, error_stream, cb));
+  auto request = prepare(c, data, error_stream, cb);
+  request->stream_ = response;
+  worker_->add(std::move(request));
+}
+
+void CurlHttpRequest::sendToSink(CompleteCallback c,
+                                 std::shared_ptr<std::istream> data,
+                                 IDataSink::Pointer response,
+                                 std::shared_ptr<std::ostream> error_stream,
+                                 ICallback::Pointer cb) const {
+  auto request = prepare(c, data, error_stream, cb);
+  request->sink_ = response;
+  worker_->add(std::move(request));
 }
 
 std::string CurlHttpRequest::parametersToString() const {
   std::string result;
+  appendParameters(result);
+  return result;
+}
+
+void CurlHttpRequest::appendParameters(std::string& result) const {
   bool first = false;
-  for (std::pair<std::string, std::string> p : parameters_) {
+  for (const auto& p : parameters_) {
     if (first)
       result += "&";
     else
       first = true;
-    result += p.first + "=" + p.second;
+    result += p.first;
+    result += "=";
+    result += p.second;
   }
-  return result;
-}
-
-std::unique_ptr<curl_slist, CurlListDeleter>
-CurlHttpRequest::headerParametersToList() const {
-  curl_slist* list = nullptr;
-  for (std::pair<std::string, std::string> p : header_parameters_)
-    list = curl_slist_append(list, (p.first + ": " + p.second).c_str());
-  return std::unique_ptr<curl_slist, CurlListDeleter>(list);
 }
 
 void CurlDeleter::operator()(CURL* handle) const { curl_easy_cleanup(handle); }
 
-void CurlListDeleter::operator()(curl_slist* lst) const {
-  curl_slist_free_all(lst);
-}
-
-CurlHttp::CurlHttp() : worker_(std::make_shared<Worker>()) {}
+CurlHttp::CurlHttp(const IHttp::Options& options)
+    : worker_(std::make_shared<Worker>(options)) {}
 
 IHttpRequest::Pointer CurlHttp::create(const std::string& url,
                                        const std::string& method,
@@ -344,6 +831,10 @@ IHttpRequest::Pointer CurlHttp::create(const std::string& url,
                                             worker_);
 }
 
+IHttp::Statistics CurlHttp::statistics() const {
+  return worker_->connections_.statistics();
+}
+
 }  // namespace curl
 
 }  // namespace cloudstorage
@@ -354,6 +845,7 @@ IHttpRequest::Pointer CurlHttp::create(const std::string& url,
 
 namespace cloudstorage {
 IHttp::Pointer IHttp::create() { return nullptr; }
+IHttp::Pointer IHttp::create(const Options&) { return nullptr; }
 }  // namespace cloudstorage
 
 #endif  // WITH_CURL
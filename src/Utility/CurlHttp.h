@@ -27,10 +27,13 @@
 #ifdef WITH_CURL
 
 #include <curl/curl.h>
+#include <array>
 #include <atomic>
 #include <cctype>
-#include <condition_variable>
+#include <chrono>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <unordered_map>
@@ -38,59 +41,234 @@
 
 #include "IHttp.h"
 
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_EVENTFD_H)
+#define WITH_CURL_EPOLL
+#endif
+
 namespace cloudstorage {
 
 namespace curl {
 
+class ConnectionManager;
+
 struct CurlDeleter {
   void operator()(CURL*) const;
 };
 
-struct CurlListDeleter {
-  void operator()(curl_slist*) const;
-};
-
 struct RequestData {
   using Pointer = std::unique_ptr<RequestData>;
 
+  RequestData();
+
+  /**
+   * Builds curl's header list in place, reusing memory left by previous
+   * requests handled with this object.
+   */
+  void setHeaders(const IHttpRequest::HeaderParameters&);
+
+  /**
+   * Drops request's state so that the object can be reused; keeps curl
+   * handle's connection and buffers alive.
+   */
+  void reset();
+
+  /**
+   * Passes chunk of response body to the sink, or the stream if there is no
+   * sink.
+   */
+  void write(const char* data, size_t length);
+
+  void done(int result);
+
+  /**
+   * @return whether all bytes of the range were received from a server which
+   * ignored the Range header
+   */
+  bool rangeReceived() const;
+
   std::unique_ptr<CURL, CurlDeleter> handle_;
-  std::unique_ptr<curl_slist, CurlListDeleter> headers_;
-  IHttpRequest::HeaderParameters query_headers_;
+  ConnectionManager* connections_;
+  std::string url_;
+  std::string host_;
+  std::string group_;
+  IHttpRequest::Priority priority_;
+  std::vector<std::string> header_data_;
+  std::vector<curl_slist> headers_;
+  Range range_;
   IHttpRequest::HeaderParameters response_headers_;
   std::shared_ptr<std::istream> data_;
   std::shared_ptr<std::ostream> stream_;
+  IDataSink::Pointer sink_;
   std::shared_ptr<std::ostream> error_stream_;
   std::shared_ptr<IHttpRequest::ICallback> callback_;
   IHttpRequest::CompleteCallback complete_;
   bool follow_redirect_;
   long http_code_;
   uint64_t received_bytes_;
+  bool paused_;
+  bool range_ignored_;
+};
 
-  void done(int result);
+class ConnectionManager {
+ public:
+  ConnectionManager(const IHttp::Options&);
+  ~ConnectionManager();
+
+  void setupMultiHandle(CURLM*) const;
+  void setupHandle(CURL*, const std::string& url) const;
+
+  /**
+   * Updates statistics with information about a finished transfer.
+   */
+  void completed(CURL*);
+
+  /**
+   * Records that resource at the url responded with whole body to a ranged
+   * request.
+   */
+  void rangeIgnored(const std::string& url, Range);
+
+  void discarded(uint64_t bytes);
+
+  /**
+   * @return whether resource at the url was recently known to ignore ranges
+   */
+  bool rangeUnsupported(const std::string& url);
+
+  /**
+   * @return whether range can be emulated by skipping bytes preceding it
+   */
+  bool canSkipTo(Range) const;
+
+  IHttp::Statistics statistics() const;
+
+ private:
+  static void lock(CURL*, curl_lock_data, curl_lock_access, void* userptr);
+  static void unlock(CURL*, curl_lock_data, void* userptr);
+
+  IHttp::Options options_;
+  CURLSH* share_;
+  std::array<std::mutex, CURL_LOCK_DATA_LAST> share_lock_;
+  std::atomic<uint64_t> connections_opened_;
+  std::atomic<uint64_t> connections_reused_;
+  std::atomic<uint64_t> ranges_unsupported_;
+  std::atomic<uint64_t> bytes_discarded_;
+  std::mutex range_lock_;
+  std::unordered_map<std::string, std::chrono::steady_clock::time_point>
+      range_unsupported_;
+};
+
+/**
+ * Holds requests back until they fit into per host and per group limits,
+ * serving them in priority order; used only by the worker thread.
+ */
+class Scheduler {
+ public:
+  Scheduler(const IHttp::Options&);
+
+  void push(RequestData::Pointer);
+
+  /**
+   * Takes queued requests which fit into the limits, higher priority first;
+   * they count as in flight until finished is called.
+   */
+  std::vector<RequestData::Pointer> pop();
+
+  void finished(const RequestData&);
+
+  /**
+   * Removes queued requests whose callbacks ask for abort.
+   */
+  std::vector<RequestData::Pointer> cancelled();
+
+  bool empty() const;
+
+ private:
+  static constexpr size_t PRIORITY_COUNT =
+      static_cast<size_t>(IHttpRequest::Priority::Bulk) + 1;
+
+  bool admissible(const RequestData&) const;
+
+  static void decrement(std::unordered_map<std::string, uint32_t>&,
+                        const std::string&);
+
+  IHttp::Options options_;
+  std::array<std::deque<RequestData::Pointer>, PRIORITY_COUNT> queues_;
+  std::unordered_map<std::string, uint32_t> host_requests_;
+  std::unordered_map<std::string, uint32_t> host_bulk_requests_;
+  std::unordered_map<std::string, uint32_t> group_requests_;
 };
 
 class CurlHttp : public IHttp {
  public:
-  CurlHttp();
+  CurlHttp(const IHttp::Options& = {});
 
   IHttpRequest::Pointer create(const std::string&, const std::string&,
                                bool) const override;
+  Statistics statistics() const override;
 
  private:
   friend class CurlHttpRequest;
 
   struct Worker {
-    Worker();
+    using Clock = std::chrono::steady_clock;
+
+    Worker(const IHttp::Options&);
     ~Worker();
 
     void work();
     void add(RequestData::Pointer r);
 
+    /**
+     * @return request data from the pool of already used ones, allocates a new
+     * one only if the pool is empty
+     */
+    RequestData::Pointer acquire();
+    void release(RequestData::Pointer r);
+    void finish(CURL* handle, int result);
+
+    /**
+     * Interrupts wait(), safe to call from any thread.
+     */
+    void wakeup();
+
+    /**
+     * Waits until any of the sockets used by curl becomes ready, the curl
+     * timer expires, wakeup() is called or timeout passes; then lets curl
+     * handle whatever happened.
+     *
+     * @param timeout in milliseconds, -1 to wait indefinitely
+     */
+    void wait(long timeout);
+
+    /**
+     * Resumes transfers which were unpaused and aborts cancelled ones; needed
+     * because curl doesn't call progress callbacks of idle transfers.
+     */
+    void housekeeping();
+
+    void processMessages();
+    long nextTimeout() const;
+
+    static int socketCallback(CURL*, curl_socket_t, int what, void* userp,
+                              void* socketp);
+    static int timerCallback(CURLM*, long timeout, void* userp);
+
+    ConnectionManager connections_;
+    Scheduler scheduler_;
     std::atomic_bool done_;
-    std::condition_variable nonempty_;
     std::vector<RequestData::Pointer> requests_;
     std::unordered_map<CURL*, RequestData::Pointer> pending_;
     std::mutex lock_;
+    std::vector<RequestData::Pointer> pool_;
+    std::mutex pool_lock_;
+    CURLM* handle_;
+    Clock::time_point timeout_;
+    Clock::time_point last_housekeeping_;
+#ifdef WITH_CURL_EPOLL
+    int epoll_fd_;
+    int wakeup_fd_;
+#endif
     std::thread thread_;
   };
 
@@ -103,7 +281,7 @@ class CurlHttpRequest : public IHttpRequest,
   CurlHttpRequest(const std::string& url, const std::string& method,
                   bool follow_redirect,
                   std::shared_ptr<CurlHttp::Worker> worker);
-  std::unique_ptr<CURL, CurlDeleter> init() const;
+  void init(RequestData*) const;
 
   void setParameter(const std::string& parameter,
                     const std::string& value) override;
@@ -113,13 +291,15 @@ class CurlHttpRequest : public IHttpRequest,
   const GetParameters& parameters() const override;
   const HeaderParameters& headerParameters() const override;
 
+  void setPriority(Priority) override;
+  void setGroup(const std::string&) override;
+
   const std::string& url() const override;
   const std::string& method() const override;
   bool follow_redirect() const override;
 
   RequestData::Pointer prepare(CompleteCallback,
                                std::shared_ptr<std::istream> data,
-                               std::shared_ptr<std::ostream> response,
                                std::shared_ptr<std::ostream> error_stream,
                                ICallback::Pointer = nullptr) const;
 
@@ -128,16 +308,23 @@ class CurlHttpRequest : public IHttpRequest,
             std::shared_ptr<std::ostream> error_stream,
             ICallback::Pointer = nullptr) const override;
 
+  void sendToSink(CompleteCallback, std::shared_ptr<std::istream> data,
+                  IDataSink::Pointer response,
+                  std::shared_ptr<std::ostream> error_stream,
+                  ICallback::Pointer = nullptr) const override;
+
   std::string parametersToString() const;
 
  private:
-  std::unique_ptr<curl_slist, CurlListDeleter> headerParametersToList() const;
+  void appendParameters(std::string&) const;
 
   std::string url_;
   GetParameters parameters_;
   HeaderParameters header_parameters_;
   std::string method_;
   bool follow_redirect_;
+  Priority priority_;
+  std::string group_;
   std::shared_ptr<CurlHttp::Worker> worker_;
 };
 
@@ -25,7 +25,8 @@
 #include <json/json.h>
 
 #include <algorithm>
-#include <queue>
+#include <cstring>
+#include <deque>
 
 #include "Utility/Item.h"
 
@@ -33,6 +34,7 @@ namespace cloudstorage {
 
 const int CHUNK_SIZE = 8 * 1024 * 1024;
 const int CACHE_SIZE = 128;
+const size_t SEGMENT_SIZE = 64 * 1024;
 
 namespace {
 
@@ -41,23 +43,29 @@ using Cache = util::LRUCache<std::string, IItem>;
 
 class HttpServerCallback : public IHttpServer::ICallback {
  public:
-  HttpServerCallback(std::shared_ptr<CloudProvider>);
+  HttpServerCallback(std::shared_ptr<CloudProvider>, uint32_t prefetch);
   IHttpServer::IResponse::Pointer handle(const IHttpServer::IRequest&) override;
 
  private:
   std::shared_ptr<Cache> item_cache_;
   std::shared_ptr<CloudProvider> provider_;
+  uint32_t prefetch_;
 };
 
+struct Download;
+
 class HttpDataCallback : public IDownloadFileCallback {
  public:
-  HttpDataCallback(std::shared_ptr<Buffer> d) : buffer_(d) {}
+  HttpDataCallback(std::shared_ptr<Buffer> d,
+                   std::shared_ptr<Download> download)
+      : buffer_(d), download_(download) {}
 
   void receivedData(const char* data, uint32_t length) override;
   void done(EitherError<void> e) override;
   void progress(uint64_t, uint64_t) override {}
 
   std::shared_ptr<Buffer> buffer_;
+  std::shared_ptr<Download> download_;
 };
 
 class StreamRequest : public Request<EitherError<void>> {
@@ -90,32 +98,145 @@ class StreamRequest : public Request<EitherError<void>> {
   std::mutex mutex_;
 };
 
+/**
+ * Byte queue made of fixed size segments; segments which were read out are
+ * kept for reuse, so that streaming doesn't allocate once the queue reached
+ * its working size. Not thread safe.
+ */
+class SegmentQueue {
+ public:
+  size_t size() const { return size_; }
+
+  void write(const char* data, size_t length) {
+    size_ += length;
+    while (length > 0) {
+      if (segments_.empty() || segments_.back().end_ == SEGMENT_SIZE)
+        segments_.push_back({allocate(), 0, 0});
+      auto& segment = segments_.back();
+      auto cnt = std::min(length, SEGMENT_SIZE - segment.end_);
+      memcpy(segment.data_.get() + segment.end_, data, cnt);
+      segment.end_ += cnt;
+      data += cnt;
+      length -= cnt;
+    }
+  }
+
+  /**
+   * Moves all data of the other queue to the end of this one.
+   */
+  void append(SegmentQueue& other) {
+    for (auto&& segment : other.segments_)
+      segments_.push_back(std::move(segment));
+    size_ += other.size_;
+    other.segments_.clear();
+    other.size_ = 0;
+  }
+
+  size_t read(char* data, size_t max) {
+    size_t total = 0;
+    while (total < max && !segments_.empty()) {
+      auto& segment = segments_.front();
+      auto cnt = std::min(max - total, segment.end_ - segment.begin_);
+      memcpy(data + total, segment.data_.get() + segment.begin_, cnt);
+      segment.begin_ += cnt;
+      total += cnt;
+      if (segment.begin_ == segment.end_) {
+        free_.push_back(std::move(segment.data_));
+        segments_.pop_front();
+      }
+    }
+    size_ -= total;
+    return total;
+  }
+
+ private:
+  struct Segment {
+    std::unique_ptr<char[]> data_;
+    size_t begin_;
+    size_t end_;
+  };
+
+  std::unique_ptr<char[]> allocate() {
+    if (free_.empty()) return std::unique_ptr<char[]>(new char[SEGMENT_SIZE]);
+    auto result = std::move(free_.back());
+    free_.pop_back();
+    return result;
+  }
+
+  std::deque<Segment> segments_;
+  std::vector<std::unique_ptr<char[]>> free_;
+  size_t size_ = 0;
+};
+
+/**
+ * Range of the file downloaded in parallel with other ones; its data is kept
+ * aside until all preceding ranges are passed to the reader.
+ */
+struct Download {
+  using Pointer = std::shared_ptr<Download>;
+
+  Range range_;
+  SegmentQueue data_;
+  bool done_;
+};
+
+/**
+ * Data of the streamed file, fetched by up to window_ ranged downloads at
+ * once. Window grows when the reader had to wait for data since the last
+ * download finished and shrinks when the reader didn't even consume half a
+ * chunk of already available data by then.
+ */
 struct Buffer : public std::enable_shared_from_this<Buffer> {
   using Pointer = std::shared_ptr<Buffer>;
 
+  Buffer(uint32_t max_window)
+      : max_window_(std::max<uint32_t>(max_window, 1)) {}
+
   int read(char* buf, uint32_t max) {
-    if (2 * size() < CHUNK_SIZE) {
-      std::unique_lock<std::mutex> lock(delayed_mutex_);
-      if (delayed_) {
-        delayed_ = false;
-        lock.unlock();
-        run_download();
-      }
-    }
     std::unique_lock<std::mutex> lock(mutex_);
     if (abort_) return IHttpServer::IResponse::ICallback::Abort;
-    if (data_.empty()) return IHttpServer::IResponse::ICallback::Suspend;
-    size_t cnt = std::min<size_t>(data_.size(), static_cast<size_t>(max));
-    for (size_t i = 0; i < cnt; i++) {
-      buf[i] = data_.front();
-      data_.pop();
+    if (data_.size() == 0) {
+      starved_ = true;
+      return IHttpServer::IResponse::ICallback::Suspend;
     }
-    return static_cast<int>(cnt);
+    auto result = static_cast<int>(data_.read(buf, max));
+    auto next = start_downloads();
+    lock.unlock();
+    run_downloads(next);
+    return result;
   }
 
-  void put(const char* data, uint32_t length) {
+  /**
+   * @return whether the reader may be suspended waiting for this data
+   */
+  bool put(const Download::Pointer& download, const char* data,
+           uint32_t length) {
     std::lock_guard<std::mutex> lock(mutex_);
-    for (uint32_t i = 0; i < length; i++) data_.push(data[i]);
+    if (downloads_.empty() || downloads_.front() != download) {
+      download->data_.write(data, length);
+      return false;
+    }
+    bool empty = data_.size() == 0;
+    data_.write(data, length);
+    return empty;
+  }
+
+  void finished(const Download::Pointer& download, EitherError<void> e) {
+    if (e.left()) return done(e);
+    std::unique_lock<std::mutex> lock(mutex_);
+    download->done_ = true;
+    if (starved_)
+      window_ = std::min(window_ + 1, max_window_);
+    else if (2 * data_.size() >= CHUNK_SIZE)
+      window_ = std::max<uint32_t>(window_ - 1, 1);
+    starved_ = false;
+    while (!downloads_.empty() && downloads_.front()->done_) {
+      downloads_.pop_front();
+      if (!downloads_.empty()) data_.append(downloads_.front()->data_);
+    }
+    auto next = start_downloads();
+    lock.unlock();
+    run_downloads(next);
   }
 
   void done(EitherError<void> e) {
@@ -137,51 +258,63 @@ struct Buffer : public std::enable_shared_from_this<Buffer> {
     if (response_) response_->resume();
   }
 
-  std::size_t size() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return data_.size();
+  void start(IItem::Pointer item, Range range) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    item_ = item;
+    range_ = range;
+    auto next = start_downloads();
+    lock.unlock();
+    run_downloads(next);
   }
 
-  void continue_download(EitherError<void> e) {
-    if (e.left() || range_.size_ < CHUNK_SIZE) return done(e);
-    range_.size_ -= CHUNK_SIZE;
-    range_.start_ += CHUNK_SIZE;
-    if (2 * size() < CHUNK_SIZE)
-      run_download();
-    else {
-      std::unique_lock<std::mutex> lock(delayed_mutex_);
-      delayed_ = true;
+  /**
+   * Picks ranges to be downloaded next, has to be called with mutex_ locked.
+   */
+  std::vector<Download::Pointer> start_downloads() {
+    std::vector<Download::Pointer> result;
+    while (!abort_ && range_.size_ > 0 && downloads_.size() < window_ &&
+           2 * data_.size() < CHUNK_SIZE) {
+      auto download = std::make_shared<Download>();
+      download->range_ = {range_.start_,
+                          std::min<uint64_t>(range_.size_, CHUNK_SIZE)};
+      download->done_ = false;
+      range_.start_ += download->range_.size_;
+      range_.size_ -= download->range_.size_;
+      downloads_.push_back(download);
+      result.push_back(download);
     }
+    return result;
   }
 
-  void run_download() {
-    request_->make_subrequest(
-        &CloudProvider::downloadFileRangeAsync, item_,
-        Range{range_.start_, std::min<uint64_t>(range_.size_, CHUNK_SIZE)},
-        util::make_unique<HttpDataCallback>(shared_from_this()));
+  void run_downloads(const std::vector<Download::Pointer>& downloads) {
+    for (auto&& d : downloads)
+      request_->make_subrequest(
+          &CloudProvider::downloadFileRangeAsync, item_, d->range_,
+          util::make_unique<HttpDataCallback>(shared_from_this(), d));
   }
 
   std::mutex mutex_;
-  std::queue<char> data_;
+  SegmentQueue data_;
+  std::deque<Download::Pointer> downloads_;
   std::mutex response_mutex_;
-  IHttpServer::IResponse* response_;
+  IHttpServer::IResponse* response_ = nullptr;
   std::shared_ptr<StreamRequest> request_;
   IItem::Pointer item_;
-  Range range_;
-  std::mutex delayed_mutex_;
-  bool delayed_ = false;
+  Range range_ = {};
+  uint32_t max_window_;
+  uint32_t window_ = 1;
+  bool starved_ = false;
   bool done_ = false;
   bool abort_ = false;
 };
 
 void HttpDataCallback::receivedData(const char* data, uint32_t length) {
-  buffer_->put(data, length);
-  buffer_->resume();
+  if (buffer_->put(download_, data, length)) buffer_->resume();
 }
 
 void HttpDataCallback::done(EitherError<void> e) {
+  buffer_->finished(download_, e);
   buffer_->resume();
-  buffer_->continue_download(e);
 }
 
 class HttpData : public IHttpServer::IResponse::ICallback {
@@ -221,15 +354,9 @@ class HttpData : public IHttpServer::IResponse::ICallback {
             buffer_->done(Error{IHttpRequest::Bad, util::Error::INVALID_RANGE});
           } else {
             status_ = Success;
-            buffer_->item_ = e.right();
-            buffer_->range_ = range;
             cache->put(file, e.right());
             p->addStreamRequest(r);
-            r->make_subrequest(
-                &CloudProvider::downloadFileRangeAsync, e.right(),
-                Range{range.start_,
-                      std::min<uint64_t>(range.size_, CHUNK_SIZE)},
-                util::make_unique<HttpDataCallback>(buffer_));
+            buffer_->start(e.right(), range);
           }
         }
         buffer_->resume();
@@ -265,8 +392,11 @@ class HttpData : public IHttpServer::IResponse::ICallback {
   std::shared_ptr<ICloudProvider::DownloadFileRequest> request_;
 };
 
-HttpServerCallback::HttpServerCallback(std::shared_ptr<CloudProvider> p)
-    : item_cache_(util::make_unique<Cache>(CACHE_SIZE)), provider_(p) {}
+HttpServerCallback::HttpServerCallback(std::shared_ptr<CloudProvider> p,
+                                       uint32_t prefetch)
+    : item_cache_(util::make_unique<Cache>(CACHE_SIZE)),
+      provider_(p),
+      prefetch_(prefetch) {}
 
 IHttpServer::IResponse::Pointer HttpServerCallback::handle(
     const IHttpServer::IRequest& request) {
@@ -305,7 +435,7 @@ IHttpServer::IResponse::Pointer HttpServerCallback::handle(
       headers["Content-Range"] = stream.str();
       code = IHttpRequest::Partial;
     }
-    auto buffer = std::make_shared<Buffer>();
+    auto buffer = std::make_shared<Buffer>(prefetch_);
     auto data =
         util::make_unique<HttpData>(buffer, provider_, id, range, item_cache_);
     auto response =
@@ -326,9 +456,11 @@ IHttpServer::IResponse::Pointer HttpServerCallback::handle(
 }  // namespace
 
 IHttpServer::Pointer FileServer::create(std::shared_ptr<CloudProvider> p,
-                                        const std::string& session) {
-  return p->http_server()->create(util::make_unique<HttpServerCallback>(p),
-                                  session, IHttpServer::Type::FileProvider);
+                                        const std::string& session,
+                                        uint32_t prefetch) {
+  return p->http_server()->create(
+      util::make_unique<HttpServerCallback>(p, prefetch), session,
+      IHttpServer::Type::FileProvider);
 }
 
 FileServer::FileServer() {}
@@ -29,8 +29,13 @@ namespace cloudstorage {
 
 class FileServer : public IHttpServer {
  public:
+  /**
+   * @param prefetch maximum count of ranges of a streamed file which are
+   * downloaded at once
+   */
   static IHttpServer::Pointer create(std::shared_ptr<CloudProvider> p,
-                                     const std::string& session);
+                                     const std::string& session,
+                                     uint32_t prefetch);
 
  private:
   FileServer();
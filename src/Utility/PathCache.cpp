@@ -0,0 +1,115 @@
+/*****************************************************************************
+ * PathCache.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "PathCache.h"
+
+namespace cloudstorage {
+
+namespace {
+
+const auto ENTRY_DURATION = std::chrono::seconds(60);
+
+}  // namespace
+
+constexpr size_t PathCache::MaxSize;
+
+PathCache::PathCache(const std::string& root_id) : root_id_(root_id) {}
+
+IItem::Pointer PathCache::find(const std::string& path, std::string& prefix) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto now = std::chrono::steady_clock::now();
+  prefix = path;
+  while (!prefix.empty()) {
+    auto it = entry_.find(prefix);
+    if (it != entry_.end()) {
+      if (now - it->second.timestamp_ <= ENTRY_DURATION)
+        return it->second.item_;
+      erase(it);
+    }
+    prefix.resize(prefix.find_last_of('/'));
+  }
+  return nullptr;
+}
+
+void PathCache::put(const std::string& path, IItem::Pointer item) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (entry_.size() >= MaxSize) {
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = entry_.begin(); it != entry_.end();)
+      if (now - it->second.timestamp_ > ENTRY_DURATION)
+        erase(it++);
+      else
+        ++it;
+    if (entry_.size() >= MaxSize) {
+      entry_.clear();
+      path_.clear();
+    }
+  }
+  auto it = entry_.find(path);
+  if (it != entry_.end()) erase(it);
+  entry_[path] = {item, std::chrono::steady_clock::now()};
+  path_[item->id()].insert(path);
+}
+
+void PathCache::invalidate(const std::string& id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (id == root_id_) {
+    entry_.clear();
+    path_.clear();
+    return;
+  }
+  auto it = path_.find(id);
+  if (it == path_.end()) return;
+  auto paths = it->second;
+  for (auto&& path : paths) erase_tree(path);
+}
+
+void PathCache::invalidate(const std::string& parent_id,
+                           const std::string& filename) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (parent_id == root_id_) return erase_tree("/" + filename);
+  auto it = path_.find(parent_id);
+  if (it == path_.end()) return;
+  auto paths = it->second;
+  for (auto&& path : paths) erase_tree(path + "/" + filename);
+}
+
+void PathCache::erase(std::map<std::string, Entry>::iterator it) {
+  auto paths = path_.find(it->second.item_->id());
+  if (paths != path_.end()) {
+    paths->second.erase(it->first);
+    if (paths->second.empty()) path_.erase(paths);
+  }
+  entry_.erase(it);
+}
+
+void PathCache::erase_tree(const std::string& path) {
+  auto it = entry_.find(path);
+  if (it != entry_.end()) erase(it);
+  auto directory = path + "/";
+  for (it = entry_.lower_bound(directory);
+       it != entry_.end() &&
+       it->first.compare(0, directory.size(), directory) == 0;)
+    erase(it++);
+}
+
+}  // namespace cloudstorage
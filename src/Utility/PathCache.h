@@ -0,0 +1,89 @@
+/*****************************************************************************
+ * PathCache.h
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "IItem.h"
+
+namespace cloudstorage {
+
+/**
+ * Remembers items found at absolute paths for a short while, so that
+ * resolving paths doesn't have to list every directory on the way again.
+ * Entries are dropped when they expire, or when the item they hold, or one of
+ * its ancestors, is moved, renamed or deleted.
+ */
+class PathCache {
+ public:
+  static constexpr size_t MaxSize = 4096;
+
+  PathCache(const std::string& root_id);
+
+  /**
+   * Looks for the longest prefix of path, ending at a path component, which
+   * is cached.
+   *
+   * @param path absolute path without trailing slash
+   * @param prefix set to the prefix found, empty if none was found
+   * @return item at prefix, nullptr if none was found
+   */
+  IItem::Pointer find(const std::string& path, std::string& prefix);
+  void put(const std::string& path, IItem::Pointer item);
+
+  /**
+   * Forgets paths at which item with given id was found, and everything
+   * below them.
+   */
+  void invalidate(const std::string& id);
+
+  /**
+   * Forgets path of the directory's child with given name, and everything
+   * below it.
+   */
+  void invalidate(const std::string& parent_id, const std::string& filename);
+
+ private:
+  struct Entry {
+    IItem::Pointer item_;
+    std::chrono::steady_clock::time_point timestamp_;
+  };
+
+  void erase(std::map<std::string, Entry>::iterator);
+  void erase_tree(const std::string& path);
+
+  std::mutex mutex_;
+  std::string root_id_;
+  std::map<std::string, Entry> entry_;
+  std::unordered_map<std::string, std::unordered_set<std::string>> path_;
+};
+
+}  // namespace cloudstorage
+
+#endif  // PATHCACHE_H
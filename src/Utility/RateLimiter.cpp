@@ -0,0 +1,230 @@
+/*****************************************************************************
+ * RateLimiter.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "RateLimiter.h"
+
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <ctime>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "Utility/Utility.h"
+
+namespace cloudstorage {
+
+namespace {
+
+using Seconds = std::chrono::duration<double>;
+
+const double MIN_RATE = 0.5;
+const double MAX_RATE = 1000;
+const double ADDITIVE_INCREASE = 1;
+const int BURST = 8;
+const auto BACKOFF_BASE = std::chrono::milliseconds(500);
+const auto MAX_BACKOFF = std::chrono::seconds(32);
+const auto MAX_RETRY_AFTER = std::chrono::minutes(5);
+const auto DECREASE_INTERVAL = std::chrono::seconds(1);
+const auto MEASURE_INTERVAL = std::chrono::seconds(1);
+const auto POLL_INTERVAL = std::chrono::milliseconds(100);
+
+}  // namespace
+
+struct RateLimiter::State {
+  struct PendingTask {
+    Task task_;
+    AbortCallback abort_;
+  };
+
+  State()
+      : done_(),
+        random_(std::random_device()()),
+        rate_(),
+        window_start_(Clock::now()),
+        window_count_(),
+        measured_rate_(),
+        statistics_() {}
+
+  double currentRate(Clock::time_point now) const {
+    if (rate_ > 0) return rate_;
+    auto elapsed = std::max(Seconds(now - window_start_).count(), 1.0);
+    return std::max(measured_rate_, window_count_ / elapsed);
+  }
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::multimap<Clock::time_point, PendingTask> tasks_;
+  bool done_;
+  std::thread thread_;
+  std::minstd_rand random_;
+  double rate_;
+  Clock::time_point arrival_time_;
+  Clock::time_point blocked_until_;
+  Clock::time_point last_decrease_;
+  Clock::time_point window_start_;
+  uint64_t window_count_;
+  double measured_rate_;
+  Statistics statistics_;
+};
+
+RateLimiter::RateLimiter() : state_(std::make_shared<State>()) {}
+
+RateLimiter::~RateLimiter() {
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex_);
+    state_->done_ = true;
+  }
+  state_->condition_.notify_one();
+  if (!state_->thread_.joinable()) return;
+  if (state_->thread_.get_id() == std::this_thread::get_id())
+    state_->thread_.detach();
+  else
+    state_->thread_.join();
+}
+
+void RateLimiter::acquire(Task task, AbortCallback abort) {
+  std::unique_lock<std::mutex> lock(state_->mutex_);
+  auto now = Clock::now();
+  if (now - state_->window_start_ >= MEASURE_INTERVAL) {
+    state_->measured_rate_ =
+        state_->window_count_ / Seconds(now - state_->window_start_).count();
+    state_->window_start_ = now;
+    state_->window_count_ = 0;
+  }
+  state_->window_count_++;
+  auto start = std::max(now, state_->blocked_until_);
+  if (state_->rate_ > 0) {
+    auto interval = std::chrono::duration_cast<Clock::duration>(
+        Seconds(1 / state_->rate_));
+    start = std::max(start, state_->arrival_time_ - interval * (BURST - 1));
+    state_->arrival_time_ = std::max(state_->arrival_time_, start) + interval;
+  }
+  if (start <= now) {
+    lock.unlock();
+    return task();
+  }
+  state_->statistics_.delayed_++;
+  lock.unlock();
+  schedule(start - now, std::move(task), std::move(abort));
+}
+
+void RateLimiter::schedule(Clock::duration delay, Task task,
+                           AbortCallback abort) {
+  std::lock_guard<std::mutex> lock(state_->mutex_);
+  state_->tasks_.insert(
+      {Clock::now() + delay, {std::move(task), std::move(abort)}});
+  if (!state_->thread_.joinable())
+    state_->thread_ = std::thread(&RateLimiter::run, state_);
+  state_->condition_.notify_one();
+}
+
+void RateLimiter::succeeded() {
+  std::lock_guard<std::mutex> lock(state_->mutex_);
+  if (state_->rate_ > 0) {
+    state_->rate_ += ADDITIVE_INCREASE / state_->rate_;
+    if (state_->rate_ > MAX_RATE) state_->rate_ = 0;
+  }
+}
+
+RateLimiter::Clock::duration RateLimiter::throttled(
+    int attempt, Clock::duration retry_after) {
+  std::lock_guard<std::mutex> lock(state_->mutex_);
+  auto now = Clock::now();
+  state_->statistics_.throttled_++;
+  if (now - state_->last_decrease_ >= DECREASE_INTERVAL) {
+    state_->last_decrease_ = now;
+    if (state_->rate_ == 0) state_->arrival_time_ = now;
+    state_->rate_ = std::max(MIN_RATE, state_->currentRate(now) / 2);
+  }
+  if (retry_after > Clock::duration::zero()) {
+    auto delay = std::min<Clock::duration>(retry_after, MAX_RETRY_AFTER);
+    state_->blocked_until_ = std::max(state_->blocked_until_, now + delay);
+    return delay;
+  }
+  auto limit = std::min<Clock::duration>(
+      MAX_BACKOFF, BACKOFF_BASE * (1 << std::min(attempt, 16)));
+  std::uniform_int_distribution<Clock::rep> jitter(0, limit.count() / 2);
+  return limit / 2 + Clock::duration(jitter(state_->random_));
+}
+
+void RateLimiter::retried() {
+  std::lock_guard<std::mutex> lock(state_->mutex_);
+  state_->statistics_.retries_++;
+}
+
+RateLimiter::Statistics RateLimiter::statistics() const {
+  std::lock_guard<std::mutex> lock(state_->mutex_);
+  auto result = state_->statistics_;
+  result.request_rate_ = state_->rate_;
+  return result;
+}
+
+RateLimiter::Clock::duration RateLimiter::parseRetryAfter(
+    const std::string& value) {
+  if (!value.empty() && value.size() < 10 &&
+      std::all_of(value.begin(), value.end(), [](char c) { return isdigit(c); }))
+    return std::chrono::seconds(std::stoll(value));
+  std::tm time = {};
+  std::stringstream stream(value);
+  stream >> std::get_time(&time, "%a, %d %b %Y %H:%M:%S");
+  if (stream.fail()) return Clock::duration::zero();
+  auto delay = util::timegm(time) - std::time(nullptr);
+  return delay > 0 ? std::chrono::seconds(delay) : Clock::duration::zero();
+}
+
+void RateLimiter::run(std::shared_ptr<State> state) {
+  util::set_thread_name("cs-ratelimiter");
+  util::attach_thread();
+  std::unique_lock<std::mutex> lock(state->mutex_);
+  while (!state->done_) {
+    auto now = Clock::now();
+    std::vector<Task> ready;
+    for (auto it = state->tasks_.begin(); it != state->tasks_.end();) {
+      if (it->first <= now || (it->second.abort_ && it->second.abort_())) {
+        ready.push_back(std::move(it->second.task_));
+        it = state->tasks_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    if (!ready.empty()) {
+      lock.unlock();
+      for (auto&& task : ready) task();
+      ready.clear();
+      lock.lock();
+    } else if (state->tasks_.empty()) {
+      state->condition_.wait(lock);
+    } else {
+      state->condition_.wait_until(
+          lock, std::min(now + POLL_INTERVAL, state->tasks_.begin()->first));
+    }
+  }
+  util::detach_thread();
+}
+
+}  // namespace cloudstorage
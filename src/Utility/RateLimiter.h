@@ -0,0 +1,102 @@
+/*****************************************************************************
+ * RateLimiter.h
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "ICloudProvider.h"
+
+namespace cloudstorage {
+
+/**
+ * Paces requests made on behalf of a single cloud provider. Rate is unlimited
+ * until the server asks to slow down; then it's cut in half and grows back
+ * additively with every successful response, so that it settles around what
+ * the server tolerates.
+ */
+class RateLimiter {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using Task = std::function<void()>;
+  using AbortCallback = std::function<bool()>;
+
+  using Statistics = ICloudProvider::RequestStatistics;
+
+  RateLimiter();
+  ~RateLimiter();
+
+  /**
+   * Runs task once a request may be sent: right away if the rate allows it,
+   * later on limiter's thread otherwise.
+   *
+   * @param abort polled while the task waits; when it returns true, the task
+   * is run immediately and should notice the abort itself
+   */
+  void acquire(Task task, AbortCallback abort);
+
+  /**
+   * Runs task on limiter's thread after delay; abort works the same way as
+   * in acquire.
+   */
+  void schedule(Clock::duration delay, Task task, AbortCallback abort);
+
+  /**
+   * Notifies that server accepted a request.
+   */
+  void succeeded();
+
+  /**
+   * Notifies that server asked to slow down.
+   *
+   * @param attempt count of previous retries of the request
+   * @param retry_after delay requested by server, zero if not specified
+   * @return delay after which the request should be retried
+   */
+  Clock::duration throttled(int attempt, Clock::duration retry_after);
+
+  void retried();
+
+  Statistics statistics() const;
+
+  /**
+   * Parses value of Retry-After header, either delay in seconds or http date.
+   *
+   * @return delay, zero if the value is invalid
+   */
+  static Clock::duration parseRetryAfter(const std::string&);
+
+ private:
+  struct State;
+
+  static void run(std::shared_ptr<State>);
+
+  std::shared_ptr<State> state_;
+};
+
+}  // namespace cloudstorage
+
+#endif  // RATELIMITER_H
@@ -0,0 +1,129 @@
+/*****************************************************************************
+ * UploadJournal.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "UploadJournal.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <unordered_map>
+
+#include "Utility/Utility.h"
+
+namespace cloudstorage {
+
+namespace {
+
+const char* TEMPORARY_SUFFIX = ".tmp";
+const int64_t MAX_SESSION_AGE = 7 * 24 * 60 * 60;
+
+int64_t now() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+std::mutex instances_mutex;
+std::unordered_map<std::string, std::weak_ptr<UploadJournal>> instances;
+
+}  // namespace
+
+UploadJournal::UploadJournal(const std::string& path)
+    : path_(path), sessions_(Json::objectValue) {
+  load();
+}
+
+UploadJournal::Pointer UploadJournal::create(const std::string& path) {
+  if (path.empty()) return nullptr;
+  std::lock_guard<std::mutex> lock(instances_mutex);
+  auto journal = instances[path].lock();
+  if (!journal) {
+    journal = std::make_shared<UploadJournal>(path);
+    instances[path] = journal;
+  }
+  return journal;
+}
+
+std::string UploadJournal::key(const std::string& provider,
+                               const std::string& account,
+                               const std::string& parent,
+                               const std::string& filename, uint64_t size) {
+  return provider + "\n" + account + "\n" + parent + "\n" + filename +
+         "\n" + std::to_string(size);
+}
+
+Json::Value UploadJournal::get(const std::string& key) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!sessions_.isMember(key)) return Json::Value();
+  return sessions_[key]["session"];
+}
+
+void UploadJournal::put(const std::string& key, const Json::Value& session) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  sessions_[key]["session"] = session;
+  sessions_[key]["time"] = Json::Int64(now());
+  save();
+}
+
+void UploadJournal::remove(const std::string& key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!sessions_.isMember(key)) return;
+  sessions_.removeMember(key);
+  save();
+}
+
+void UploadJournal::load() {
+  std::ifstream file(path_);
+  if (!file) return;
+  try {
+    auto json = util::json::from_stream(file);
+    auto time = now();
+    for (const auto& key : json["sessions"].getMemberNames()) {
+      const auto& d = json["sessions"][key];
+      if (d["session"].isObject() &&
+          time - d["time"].asInt64() < MAX_SESSION_AGE)
+        sessions_[key] = d;
+    }
+  } catch (const Json::Exception& e) {
+    util::log("[UPLOAD JOURNAL] invalid journal", e.what());
+  }
+}
+
+void UploadJournal::save() const {
+  Json::Value json;
+  json["sessions"] = sessions_;
+  auto temporary = path_ + TEMPORARY_SUFFIX;
+  {
+    std::ofstream file(temporary);
+    file << util::json::to_string(json);
+    if (!file) {
+      util::log("[UPLOAD JOURNAL] couldn't write", temporary);
+      return;
+    }
+  }
+  if (std::rename(temporary.c_str(), path_.c_str()) != 0) {
+    std::remove(path_.c_str());
+    std::rename(temporary.c_str(), path_.c_str());
+  }
+}
+
+}  // namespace cloudstorage
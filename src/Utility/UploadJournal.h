@@ -0,0 +1,81 @@
+/*****************************************************************************
+ * UploadJournal.h
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#ifndef UPLOADJOURNAL_H
+#define UPLOADJOURNAL_H
+
+#include <json/json.h>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace cloudstorage {
+
+/**
+ * Records sessions of uploads in progress in a file, so that uploads can be
+ * continued by later runs. The file is replaced whenever a session is
+ * recorded or forgotten, so a run which didn't end cleanly doesn't lose
+ * sessions of uploads it interrupted; sessions older than a week are dropped
+ * when the journal is opened.
+ */
+class UploadJournal {
+ public:
+  using Pointer = std::shared_ptr<UploadJournal>;
+
+  UploadJournal(const std::string& path);
+
+  /**
+   * Returns journal stored in given file, shared by everyone who asks for
+   * the same file while it's alive.
+   *
+   * @return nullptr if path is empty
+   */
+  static Pointer create(const std::string& path);
+
+  /**
+   * Identifies upload of a file of given size to given directory of given
+   * account; accounts of the same cloud provider may share the journal.
+   */
+  static std::string key(const std::string& provider,
+                         const std::string& account,
+                         const std::string& parent,
+                         const std::string& filename, uint64_t size);
+
+  /**
+   * @return session recorded under key, null value if there is none
+   */
+  Json::Value get(const std::string& key) const;
+  void put(const std::string& key, const Json::Value& session);
+  void remove(const std::string& key);
+
+ private:
+  void load();
+  void save() const;
+
+  std::string path_;
+  mutable std::mutex mutex_;
+  Json::Value sessions_;
+};
+
+}  // namespace cloudstorage
+
+#endif  // UPLOADJOURNAL_H
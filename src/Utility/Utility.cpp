@@ -344,6 +344,15 @@ std::string Url::escape(const std::string& value) {
   return escaped.str();
 }
 
+std::string Url::escapePath(const std::string& path) {
+  std::string result;
+  size_t start = 0;
+  for (auto it = path.find('/'); it != std::string::npos;
+       start = it + 1, it = path.find('/', start))
+    result += escape(path.substr(start, it - start)) + "/";
+  return result + escape(path.substr(start));
+}
+
 std::string Url::escapeHeader(const std::string& header) {
   return Json::valueToQuotedString(header.c_str());
 }
@@ -404,6 +413,12 @@ std::string home_directory() {
 #endif
 }
 
+std::string join_path(const std::string& directory, const std::string& name) {
+  if (directory.empty() || directory.back() == '/' || directory.back() == '\\')
+    return directory + name;
+  return directory + "/" + name;
+}
+
 std::string login_page(const std::string&) {
   return "<html>" + CDN +
          "<body>"
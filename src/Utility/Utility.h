@@ -118,6 +118,7 @@ class CLOUDSTORAGE_API Url {
 
   static std::string unescape(const std::string&);
   static std::string escape(const std::string&);
+  static std::string escapePath(const std::string&);
   static std::string escapeHeader(const std::string&);
 
   std::string protocol() const;
@@ -140,6 +141,9 @@ CLOUDSTORAGE_API IHttpServer::IResponse::Pointer response_from_string(
 
 CLOUDSTORAGE_API std::string temporary_directory();
 CLOUDSTORAGE_API std::string home_directory();
+// appends name to directory, adding a separator if it doesn't end with one
+CLOUDSTORAGE_API std::string join_path(const std::string& directory,
+                                       const std::string& name);
 CLOUDSTORAGE_API std::tm gmtime(time_t);
 CLOUDSTORAGE_API time_t timegm(const std::tm&);
 CLOUDSTORAGE_API std::string to_base64(const std::string&);
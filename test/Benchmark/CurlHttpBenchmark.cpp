@@ -0,0 +1,170 @@
+/*****************************************************************************
+ * CurlHttpBenchmark.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <new>
+#include <sstream>
+
+#include "IHttp.h"
+#include "Utility/LocalHttpServer.h"
+
+#if defined(WITH_CURL) && defined(__unix__)
+
+using namespace cloudstorage;
+
+namespace {
+std::atomic<uint64_t> allocation_count;
+}  // namespace
+
+void* operator new(size_t size) {
+  allocation_count++;
+  if (void* ptr = std::malloc(size)) return ptr;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+namespace {
+
+const int REQUEST_COUNT = 2000;
+const int DOWNLOAD_COUNT = 16;
+const size_t DOWNLOAD_SIZE = 32 * 1024 * 1024;
+
+class CountingSink : public IDataSink {
+ public:
+  void write(const char*, uint32_t length) override { received_ += length; }
+
+  uint64_t received_ = 0;
+};
+
+double requests_per_second(IHttp& http, const std::string& url,
+                           int request_count, int concurrency) {
+  std::mutex mutex;
+  std::condition_variable finished;
+  int sent = 0, received = 0, failed = 0;
+  std::function<void()> send_next = [&] {
+    auto request = http.create(url);
+    request->send(
+        [&](IHttpRequest::Response response) {
+          std::unique_lock<std::mutex> lock(mutex);
+          received++;
+          if (!IHttpRequest::isSuccess(response.http_code_)) failed++;
+          if (sent < request_count) {
+            sent++;
+            lock.unlock();
+            send_next();
+          } else if (received == request_count)
+            finished.notify_one();
+        },
+        std::make_shared<std::stringstream>(),
+        std::make_shared<std::stringstream>(),
+        std::make_shared<std::stringstream>());
+  };
+  auto start = std::chrono::steady_clock::now();
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    sent = std::min(concurrency, request_count);
+  }
+  for (int i = 0; i < std::min(concurrency, request_count); i++) send_next();
+  std::unique_lock<std::mutex> lock(mutex);
+  finished.wait(lock, [&] { return received == request_count; });
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  EXPECT_EQ(failed, 0);
+  return request_count / elapsed.count();
+}
+
+double megabytes_per_second(IHttp& http, const std::string& url,
+                            bool use_sink) {
+  uint64_t received = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < DOWNLOAD_COUNT; i++) {
+    std::promise<void> finished;
+    auto request = http.create(url);
+    auto sink = std::make_shared<CountingSink>();
+    auto stream = std::make_shared<std::stringstream>();
+    auto complete = [&](IHttpRequest::Response response) {
+      EXPECT_TRUE(IHttpRequest::isSuccess(response.http_code_));
+      finished.set_value();
+    };
+    if (use_sink)
+      request->sendToSink(complete, std::make_shared<std::stringstream>(),
+                          sink, std::make_shared<std::stringstream>());
+    else
+      request->send(complete, std::make_shared<std::stringstream>(), stream,
+                    std::make_shared<std::stringstream>());
+    finished.get_future().wait();
+    received += use_sink ? sink->received_ : stream->str().size();
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  EXPECT_EQ(received, DOWNLOAD_COUNT * DOWNLOAD_SIZE);
+  return received / elapsed.count() / (1024 * 1024);
+}
+
+}  // namespace
+
+TEST(CurlHttpBenchmark, SmallRequestThroughput) {
+  LocalHttpServer server;
+  auto http = IHttp::create();
+  for (int concurrency : {1, 8, 64}) {
+    auto allocations = allocation_count.load();
+    auto result = requests_per_second(*http, server.url() + "/item",
+                                      REQUEST_COUNT, concurrency);
+    std::cout << "[ BENCHMARK ] concurrency " << concurrency << ": " << result
+              << " requests/s, "
+              << (allocation_count - allocations) / REQUEST_COUNT
+              << " allocations/request\n";
+  }
+  auto statistics = http->statistics();
+  std::cout << "[ BENCHMARK ] connections opened: "
+            << statistics.connections_opened_
+            << ", reused: " << statistics.connections_reused_ << "\n";
+  EXPECT_GT(statistics.connections_reused_, statistics.connections_opened_);
+}
+
+TEST(CurlHttpBenchmark, LargeDownloadThroughput) {
+  std::string body(DOWNLOAD_SIZE, 'x');
+  LocalHttpServer server([&](const std::string&, const std::string&) {
+    return LocalHttpServer::Response{200, body};
+  });
+  auto http = IHttp::create();
+  for (bool use_sink : {false, true}) {
+    auto allocations = allocation_count.load();
+    auto result = megabytes_per_second(*http, server.url() + "/file", use_sink);
+    std::cout << "[ BENCHMARK ] " << (use_sink ? "sink" : "stream") << ": "
+              << result << " MB/s, "
+              << (allocation_count - allocations) / DOWNLOAD_COUNT
+              << " allocations/download\n";
+  }
+}
+
+#endif  // WITH_CURL && __unix__
@@ -0,0 +1,147 @@
+/*****************************************************************************
+ * FileServerBenchmark.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "gtest/gtest.h"
+
+#include <json/json.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "Utility/MemoryProvider.h"
+
+using namespace cloudstorage;
+
+namespace {
+
+const uint64_t FILE_SIZE = 256 * 1024 * 1024;
+const auto LATENCY = std::chrono::milliseconds(30);
+const size_t READ_SIZE = 32 * 1024;
+
+/**
+ * Pulls data the way http server does: reads until suspended, then waits to
+ * be resumed.
+ */
+class ServerResponse : public IHttpServer::IResponse {
+ public:
+  ServerResponse(ICallback::Pointer callback) : callback_(std::move(callback)) {}
+
+  ~ServerResponse() override {
+    if (completed_) completed_();
+  }
+
+  void resume() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    resumed_ = true;
+    condition_.notify_one();
+  }
+
+  void completed(CompletedCallback callback) override { completed_ = callback; }
+
+  uint64_t read(uint64_t size) {
+    std::vector<char> buffer(READ_SIZE);
+    uint64_t received = 0;
+    while (received < size) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        resumed_ = false;
+      }
+      int result = callback_->putData(buffer.data(), buffer.size());
+      if (result > 0) {
+        received += static_cast<uint64_t>(result);
+      } else if (result == ICallback::Suspend) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait_for(lock, std::chrono::milliseconds(10),
+                            [this] { return resumed_; });
+      } else {
+        break;
+      }
+    }
+    return received;
+  }
+
+ private:
+  ICallback::Pointer callback_;
+  CompletedCallback completed_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  bool resumed_ = false;
+};
+
+class ServerRequest : public IHttpServer::IRequest {
+ public:
+  ServerRequest(const std::string& url) : url_(url) {}
+
+  const char* get(const std::string&) const override { return nullptr; }
+  const char* header(const std::string&) const override { return nullptr; }
+  std::string method() const override { return "GET"; }
+  std::string url() const override { return url_; }
+
+  IHttpServer::IResponse::Pointer response(
+      int, const IHttpServer::IResponse::Headers&, int64_t,
+      IHttpServer::IResponse::ICallback::Pointer callback) const override {
+    return util::make_unique<ServerResponse>(std::move(callback));
+  }
+
+ private:
+  std::string url_;
+};
+
+double megabytes_per_second(uint32_t prefetch) {
+  auto provider = std::make_shared<MemoryProvider>(FILE_SIZE);
+  auto server_factory = new MemoryServerFactory;
+  ICloudProvider::InitData data;
+  data.http_engine_ = util::make_unique<MemoryHttp>(FILE_SIZE, LATENCY);
+  data.http_server_ = IHttpServerFactory::Pointer(server_factory);
+  data.stream_prefetch_ = prefetch;
+  provider->initialize(std::move(data));
+
+  Json::Value json;
+  json["state"] = provider->auth()->state();
+  json["id"] = "file";
+  json["name"] = "file.mp4";
+  json["size"] = Json::UInt64(FILE_SIZE);
+  auto fragment = util::to_base64(util::json::to_string(json));
+  std::replace(fragment.begin(), fragment.end(), '/', '-');
+
+  auto start = std::chrono::steady_clock::now();
+  auto response = server_factory->callback_->handle(ServerRequest("/" + fragment));
+  auto received = static_cast<ServerResponse&>(*response).read(FILE_SIZE);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  response = nullptr;
+  provider->destroy();
+  EXPECT_EQ(received, FILE_SIZE);
+  return received / elapsed.count() / (1024 * 1024);
+}
+
+}  // namespace
+
+TEST(FileServerBenchmark, StreamingThroughput) {
+  for (uint32_t prefetch : {1, 4}) {
+    std::cout << "[ BENCHMARK ] prefetch " << prefetch << ": "
+              << megabytes_per_second(prefetch) << " MB/s\n";
+  }
+}
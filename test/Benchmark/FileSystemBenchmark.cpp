@@ -0,0 +1,130 @@
+/*****************************************************************************
+ * FileSystemBenchmark.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <random>
+
+#include "FileSystem.h"
+#include "Utility/MemoryProvider.h"
+
+using namespace cloudstorage;
+
+namespace {
+
+const uint64_t FILE_SIZE = 1024 * 1024 * 1024;
+const auto LATENCY = std::chrono::milliseconds(30);
+const uint64_t READ_SIZE = 128 * 1024;
+const uint64_t SEQUENTIAL_SIZE = 64 * 1024 * 1024;
+const int RANDOM_READ_COUNT = 100;
+const int SEEK_COUNT = 10;
+const uint64_t SEEK_READ_SIZE = 4 * 1024 * 1024;
+
+std::vector<Range> sequential_trace() {
+  std::vector<Range> trace;
+  for (uint64_t offset = 0; offset < SEQUENTIAL_SIZE; offset += READ_SIZE)
+    trace.push_back({offset, READ_SIZE});
+  return trace;
+}
+
+std::vector<Range> random_trace() {
+  std::minstd_rand random(0);
+  std::uniform_int_distribution<uint64_t> offset(0, FILE_SIZE / READ_SIZE - 1);
+  std::vector<Range> trace;
+  for (int i = 0; i < RANDOM_READ_COUNT; i++)
+    trace.push_back({offset(random) * READ_SIZE, READ_SIZE});
+  return trace;
+}
+
+/**
+ * Seeks to a few random positions and plays a bit of the file from each of
+ * them, like a video player does.
+ */
+std::vector<Range> seek_trace() {
+  std::minstd_rand random(0);
+  std::uniform_int_distribution<uint64_t> offset(
+      0, (FILE_SIZE - SEEK_READ_SIZE) / READ_SIZE);
+  std::vector<Range> trace;
+  for (int i = 0; i < SEEK_COUNT; i++) {
+    auto start = offset(random) * READ_SIZE;
+    for (uint64_t position = 0; position < SEEK_READ_SIZE;
+         position += READ_SIZE)
+      trace.push_back({start + position, READ_SIZE});
+  }
+  return trace;
+}
+
+double megabytes_per_second(const std::vector<Range>& trace) {
+  auto provider = std::make_shared<MemoryProvider>(FILE_SIZE);
+  ICloudProvider::InitData data;
+  data.http_engine_ = util::make_unique<MemoryHttp>(FILE_SIZE, LATENCY);
+  data.http_server_ = util::make_unique<MemoryServerFactory>();
+  provider->initialize(std::move(data));
+  auto file_system = IFileSystem::create(
+      {{"memory", provider}},
+      util::make_unique<MemoryHttp>(FILE_SIZE, LATENCY), "", "");
+
+  std::promise<IFileSystem::FileId> file;
+  file_system->lookup(2, "file.mp4", [&](EitherError<IFileSystem::INode> e) {
+    file.set_value(e.right() ? e.right()->inode() : 0);
+  });
+  auto inode = file.get_future().get();
+  EXPECT_NE(inode, 0u);
+
+  uint64_t received = 0;
+  bool valid = true;
+  auto start = std::chrono::steady_clock::now();
+  for (auto&& range : trace) {
+    std::promise<std::string> result;
+    file_system->read(inode, range.start_, range.size_,
+                      [&](EitherError<std::string> e) {
+                        result.set_value(e.right() ? *e.right() : "");
+                      });
+    auto data = result.get_future().get();
+    received += data.size();
+    for (size_t i = 0; i < data.size(); i++)
+      if (static_cast<unsigned char>(data[i]) !=
+          (range.start_ + i) % MemoryHttpRequest::Period)
+        valid = false;
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  file_system = nullptr;
+  provider->destroy();
+  EXPECT_TRUE(valid);
+  EXPECT_EQ(received, trace.size() * READ_SIZE);
+  return received / elapsed.count() / (1024 * 1024);
+}
+
+}  // namespace
+
+TEST(FileSystemBenchmark, ReadThroughput) {
+  std::cout << "[ BENCHMARK ] sequential: "
+            << megabytes_per_second(sequential_trace()) << " MB/s\n";
+  std::cout << "[ BENCHMARK ] random: " << megabytes_per_second(random_trace())
+            << " MB/s\n";
+  std::cout << "[ BENCHMARK ] seek and play: "
+            << megabytes_per_second(seek_trace()) << " MB/s\n";
+}
@@ -0,0 +1,529 @@
+/*****************************************************************************
+ * AmazonS3Test.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "gtest/gtest.h"
+
+#include <json/json.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "CloudProvider/AmazonS3.h"
+#include "Utility/FakeRequest.h"
+#include "Utility/HttpMock.h"
+#include "Utility/HttpServerMock.h"
+#include "Utility/Item.h"
+#include "Utility/UploadJournal.h"
+#include "Utility/Utility.h"
+
+using namespace cloudstorage;
+using ::testing::_;
+using ::testing::Invoke;
+
+namespace {
+
+class Crypto : public ICrypto {
+ public:
+  std::string sha256(const std::string& message) override {
+    return std::to_string(std::hash<std::string>()(message));
+  }
+  std::string hmac_sha256(const std::string& key,
+                          const std::string& message) override {
+    return sha256(key + message);
+  }
+  std::string hmac_sha1(const std::string& key,
+                        const std::string& message) override {
+    return sha256(key + message);
+  }
+  std::string hex(const std::string& hash) override { return hash; }
+};
+
+const std::string ENDPOINT = "https://bucket.s3.us-east-1.amazonaws.com/";
+
+const std::vector<std::pair<std::string, std::string>> ENTITIES = {
+    {"<", "&lt;"}, {">", "&gt;"}, {"'", "&apos;"}, {"&", "&amp;"}};
+
+std::string escape(const std::string& str) {
+  std::string result;
+  for (auto c : str) {
+    auto it = std::find_if(
+        ENTITIES.begin(), ENTITIES.end(),
+        [=](const std::pair<std::string, std::string>& entity) {
+          return entity.first[0] == c;
+        });
+    result += it == ENTITIES.end() ? std::string(1, c) : it->second;
+  }
+  return result;
+}
+
+std::string unescape(std::string str) {
+  for (auto&& entity : ENTITIES)
+    for (auto it = str.find(entity.second); it != std::string::npos;
+         it = str.find(entity.second, it + 1))
+      str.replace(it, entity.second.size(), entity.first);
+  return str;
+}
+
+std::string key(size_t index) {
+  return "directory/" + std::to_string(index) + (index % 7 ? "" : "&<'>");
+}
+
+const uint64_t PART_SIZE = AmazonS3::MinPartSize;
+
+class UploadCallback : public IUploadFileCallback {
+ public:
+  UploadCallback(uint64_t size) : content_(size, 0) {
+    for (size_t i = 0; i < content_.size(); i++)
+      content_[i] = static_cast<char>(i % 251);
+  }
+
+  uint32_t putData(char* data, uint32_t maxlength, uint64_t offset) override {
+    auto length = std::min<uint64_t>(maxlength, content_.size() - offset);
+    memcpy(data, content_.data() + offset, length);
+    return static_cast<uint32_t>(length);
+  }
+
+  uint64_t size() override { return content_.size(); }
+
+  void progress(uint64_t, uint64_t) override {}
+
+  void done(EitherError<IItem>) override {}
+
+  std::string content_;
+};
+
+/**
+ * Server side of a multipart upload of a file.
+ */
+class MultipartServer {
+ public:
+  MultipartServer(const std::string& upload_id) : upload_id_(upload_id) {}
+
+  FakeRequest::Handler handler() {
+    return [=](const FakeRequest& request, const std::string& body,
+               std::ostream& response,
+               IHttpRequest::HeaderParameters& headers) {
+      return handle(request, body, response, headers);
+    };
+  }
+
+  int handle(const FakeRequest& request, const std::string& body,
+             std::ostream& response, IHttpRequest::HeaderParameters& headers) {
+    EXPECT_EQ(request.url(), ENDPOINT + "directory/file");
+    if (request.method() == "POST" && request.parameters().count("uploads")) {
+      created_++;
+      response << "<InitiateMultipartUploadResult><UploadId>" << upload_id_
+               << "</UploadId></InitiateMultipartUploadResult>";
+      return IHttpRequest::Ok;
+    }
+    EXPECT_EQ(request.parameter("uploadId"), upload_id_);
+    if (request.method() == "GET") {
+      response << "<ListPartsResult>";
+      for (auto&& part : part_)
+        response << "<Part><PartNumber>" << part.first
+                 << "</PartNumber><ETag>&quot;" << part.first
+                 << "&quot;</ETag><Size>" << part.second.size()
+                 << "</Size></Part>";
+      response << "<IsTruncated>false</IsTruncated></ListPartsResult>";
+      return IHttpRequest::Ok;
+    }
+    if (request.method() == "PUT") {
+      auto number = std::stoi(request.parameter("partNumber"));
+      if (number == failing_part_) return IHttpRequest::Bad;
+      part_[number] = body;
+      headers.insert({"etag", "\"" + std::to_string(number) + "\""});
+      return IHttpRequest::Ok;
+    }
+    if (request.method() == "DELETE") {
+      aborted_ = true;
+      return IHttpRequest::Ok;
+    }
+    EXPECT_EQ(request.method(), "POST");
+    std::string expected = "<CompleteMultipartUpload>";
+    for (auto&& part : part_) {
+      auto number = std::to_string(part.first);
+      expected += "<Part><PartNumber>" + number +
+                  "</PartNumber><ETag>&quot;" + number +
+                  "&quot;</ETag></Part>";
+      content_ += part.second;
+    }
+    expected += "</CompleteMultipartUpload>";
+    EXPECT_EQ(body, expected);
+    response << "<CompleteMultipartUploadResult>"
+             << "</CompleteMultipartUploadResult>";
+    return IHttpRequest::Ok;
+  }
+
+  std::string upload_id_;
+  std::map<int, std::string> part_;
+  std::string content_;
+  int created_ = 0;
+  int failing_part_ = 0;
+  bool aborted_ = false;
+};
+
+std::shared_ptr<Item> directory() {
+  return std::make_shared<Item>("directory", "directory/", IItem::UnknownSize,
+                                IItem::UnknownTimeStamp,
+                                IItem::FileType::Directory);
+}
+
+}  // namespace
+
+class AmazonS3Test : public ::testing::Test {
+ public:
+  void SetUp() { provider_ = create(); }
+
+  void TearDown() {
+    join();
+    provider_->destroy();
+  }
+
+  std::shared_ptr<AmazonS3> create(const std::string& upload_journal = "") {
+    Json::Value credentials;
+    credentials["username"] = "access_id";
+    credentials["password"] = "secret";
+    credentials["bucket"] = "bucket";
+    ICloudProvider::InitData data;
+    data.token_ = util::to_base64(
+        util::Url::escape(util::json::to_string(credentials)));
+    data.http_engine_ = util::make_unique<HttpMock>();
+    data.http_server_ = util::make_unique<HttpServerFactoryMock>();
+    data.crypto_engine_ = util::make_unique<Crypto>();
+    EXPECT_CALL(static_cast<HttpServerFactoryMock&>(*data.http_server_),
+                create(_, _, _))
+        .WillRepeatedly(Invoke([](IHttpServer::ICallback::Pointer,
+                                  const std::string&, IHttpServer::Type) {
+          return util::make_unique<HttpServerMock>();
+        }));
+    http_ = static_cast<HttpMock*>(data.http_engine_.get());
+    EXPECT_CALL(*http_, create(_, _, _))
+        .WillRepeatedly(Invoke([=](const std::string& url,
+                                   const std::string& method, bool) {
+          return std::make_shared<FakeRequest>(
+              url, method,
+              [=](const FakeRequest& request, const std::string& body,
+                  std::ostream& response,
+                  IHttpRequest::HeaderParameters& headers) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                return handler_(request, body, response, headers);
+              },
+              [=](const FakeRequest& request, std::function<void()> task) {
+                if (run_)
+                  run_(request, task);
+                else
+                  task();
+              });
+        }));
+    auto provider = std::make_shared<AmazonS3>();
+    data.hints_["upload_part_size"] = std::to_string(PART_SIZE);
+    data.hints_["upload_parallelism"] = "2";
+    data.upload_journal_ = upload_journal;
+    provider->initialize(std::move(data));
+    return provider;
+  }
+
+  void join() {
+    while (true) {
+      std::vector<std::thread> threads;
+      {
+        std::lock_guard<std::mutex> lock(thread_mutex_);
+        if (threads_.empty()) return;
+        std::swap(threads, threads_);
+      }
+      for (auto&& thread : threads) thread.join();
+    }
+  }
+
+  EitherError<IItem> upload(std::shared_ptr<UploadCallback> callback) {
+    return provider_->uploadFileAsync(directory(), "file", callback)->result();
+  }
+
+  HttpMock* http_;
+  std::mutex mutex_;
+  FakeRequest::Handler handler_;
+  FakeRequest::Run run_;
+  std::mutex thread_mutex_;
+  std::vector<std::thread> threads_;
+  std::shared_ptr<AmazonS3> provider_;
+};
+
+TEST_F(AmazonS3Test, DeletesDirectoryInBatches) {
+  const int KEY_COUNT = 2500;
+  const size_t PAGE_SIZE = 1000;
+  std::set<std::string> deleted;
+  std::vector<std::string> listed_prefixes;
+  int batch_count = 0;
+  handler_ = [&](const FakeRequest& request, const std::string& body,
+                 std::ostream& response, IHttpRequest::HeaderParameters&) {
+    EXPECT_EQ(request.url(), ENDPOINT);
+    if (request.method() == "GET") {
+      listed_prefixes.push_back(request.parameter("prefix"));
+      EXPECT_EQ(request.parameter("delimiter"), "");
+      auto token = request.parameter("continuation-token");
+      size_t start = token.empty() ? 0 : std::stoul(token);
+      response << "<ListBucketResult><Name>bucket</Name>";
+      for (size_t i = start; i < std::min<size_t>(start + PAGE_SIZE, KEY_COUNT);
+           i++) {
+        response << "<Contents><Key>" << escape(key(i)) << "</Key></Contents>";
+      }
+      if (start + PAGE_SIZE < static_cast<size_t>(KEY_COUNT))
+        response << "<IsTruncated>true</IsTruncated><NextContinuationToken>"
+                 << start + PAGE_SIZE << "</NextContinuationToken>";
+      else
+        response << "<IsTruncated>false</IsTruncated>";
+      response << "</ListBucketResult>";
+      return IHttpRequest::Ok;
+    }
+    EXPECT_EQ(request.method(), "POST");
+    EXPECT_EQ(request.parameters().count("delete"), 1u);
+    EXPECT_NE(request.header("x-amz-checksum-sha256"), "");
+    const std::string prefix =
+        R"(<?xml version="1.0" encoding="UTF-8"?>)"
+        "<Delete><Quiet>true</Quiet>";
+    EXPECT_EQ(body.substr(0, prefix.size()), prefix);
+    size_t count = 0;
+    for (auto it = body.find("<Object><Key>"); it != std::string::npos;
+         it = body.find("<Object><Key>", it + 1)) {
+      auto start = it + strlen("<Object><Key>");
+      auto key = body.substr(start, body.find("</Key>", start) - start);
+      EXPECT_EQ(key.find_first_of("<>'"), std::string::npos) << key;
+      key = unescape(key);
+      EXPECT_TRUE(deleted.insert(key).second) << key;
+      count++;
+    }
+    EXPECT_LE(count, AmazonS3::DeleteBatchSize);
+    EXPECT_EQ(body.substr(body.size() - strlen("</Delete>")), "</Delete>");
+    batch_count++;
+    response << "<DeleteResult></DeleteResult>";
+    return IHttpRequest::Ok;
+  };
+  auto e = provider_->deleteItemAsync(directory(), [](EitherError<void>) {})
+               ->result();
+  EXPECT_FALSE(e.left());
+  EXPECT_EQ(batch_count, 3);
+  EXPECT_EQ(listed_prefixes, std::vector<std::string>(3, "directory/"));
+  ASSERT_EQ(deleted.size(), static_cast<size_t>(KEY_COUNT));
+  for (int i = 0; i < KEY_COUNT; i++) EXPECT_EQ(deleted.count(key(i)), 1u);
+}
+
+TEST_F(AmazonS3Test, ReportsKeysFailedToDelete) {
+  int batch_count = 0;
+  handler_ = [&](const FakeRequest& request, const std::string&,
+                 std::ostream& response, IHttpRequest::HeaderParameters&) {
+    if (request.method() == "GET") {
+      response << "<ListBucketResult><Name>bucket</Name>";
+      for (int i = 1; i <= 3; i++)
+        response << "<Contents><Key>" << key(i) << "</Key></Contents>";
+      response << "<IsTruncated>false</IsTruncated></ListBucketResult>";
+    } else {
+      batch_count++;
+      response << "<DeleteResult><Error><Key>" << key(2)
+               << "</Key><Code>AccessDenied</Code><Message>Access Denied"
+                  "</Message></Error></DeleteResult>";
+    }
+    return IHttpRequest::Ok;
+  };
+  auto e = provider_->deleteItemAsync(directory(), [](EitherError<void>) {})
+               ->result();
+  ASSERT_TRUE(e.left());
+  EXPECT_NE(e.left()->description_.find(key(2)), std::string::npos);
+  EXPECT_NE(e.left()->description_.find("AccessDenied"), std::string::npos);
+  EXPECT_EQ(batch_count, 1);
+}
+
+TEST_F(AmazonS3Test, DeletesKeysOneByOneIfBatchIsRefused) {
+  const int KEY_COUNT = 5;
+  const int PAGE_SIZE = 2;
+  std::set<std::string> deleted;
+  int batch_count = 0;
+  handler_ = [&](const FakeRequest& request, const std::string&,
+                 std::ostream& response, IHttpRequest::HeaderParameters&) {
+    if (request.method() == "GET") {
+      auto token = request.parameter("continuation-token");
+      int start = token.empty() ? 0 : std::stoi(token);
+      response << "<ListBucketResult><Name>bucket</Name>";
+      for (int i = start; i < std::min(start + PAGE_SIZE, KEY_COUNT); i++)
+        response << "<Contents><Key>" << escape(key(i)) << "</Key></Contents>";
+      if (start + PAGE_SIZE < KEY_COUNT)
+        response << "<IsTruncated>true</IsTruncated><NextContinuationToken>"
+                 << start + PAGE_SIZE << "</NextContinuationToken>";
+      else
+        response << "<IsTruncated>false</IsTruncated>";
+      response << "</ListBucketResult>";
+      return IHttpRequest::Ok;
+    }
+    if (request.method() == "POST") {
+      batch_count++;
+      response << "<Error><Code>InvalidRequest</Code><Message>Missing "
+                  "required header for this request: Content-MD5</Message>"
+                  "</Error>";
+      return IHttpRequest::Bad;
+    }
+    EXPECT_EQ(request.method(), "DELETE");
+    auto key = util::Url::unescape(request.url().substr(ENDPOINT.size()));
+    EXPECT_TRUE(deleted.insert(key).second) << key;
+    return IHttpRequest::Ok;
+  };
+  auto e = provider_->deleteItemAsync(directory(), [](EitherError<void>) {})
+               ->result();
+  EXPECT_FALSE(e.left());
+  EXPECT_EQ(batch_count, 1);
+  ASSERT_EQ(deleted.size(), static_cast<size_t>(KEY_COUNT));
+  for (int i = 0; i < KEY_COUNT; i++) EXPECT_EQ(deleted.count(key(i)), 1u);
+}
+
+TEST_F(AmazonS3Test, UploadsInParts) {
+  MultipartServer server("upload");
+  handler_ = server.handler();
+  auto callback = std::make_shared<UploadCallback>(2 * PART_SIZE + 1000);
+  auto e = upload(callback);
+  ASSERT_TRUE(e.right());
+  EXPECT_EQ(e.right()->id(), "directory/file");
+  EXPECT_EQ(server.created_, 1);
+  EXPECT_EQ(server.part_.size(), 3u);
+  EXPECT_EQ(server.part_[3].size(), 1000u);
+  EXPECT_TRUE(server.content_ == callback->content_);
+}
+
+TEST_F(AmazonS3Test, ResumesFailedUpload) {
+  MultipartServer server("upload");
+  server.failing_part_ = 2;
+  handler_ = server.handler();
+  auto callback = std::make_shared<UploadCallback>(3 * PART_SIZE);
+  ASSERT_TRUE(upload(callback).left());
+  EXPECT_EQ(server.part_.size(), 2u);
+  server.failing_part_ = 0;
+  server.part_[1] = std::string(PART_SIZE, 'x');
+  ASSERT_TRUE(provider_->resumeUploadFileAsync(directory(), "file", callback)
+                  ->result()
+                  .right());
+  EXPECT_EQ(server.created_, 1);
+  EXPECT_FALSE(server.aborted_);
+  EXPECT_EQ(server.part_[1], std::string(PART_SIZE, 'x'));
+  EXPECT_TRUE(server.part_[2] ==
+              callback->content_.substr(PART_SIZE, PART_SIZE));
+}
+
+TEST_F(AmazonS3Test, StartsOverFailedUpload) {
+  MultipartServer server("upload");
+  server.failing_part_ = 2;
+  handler_ = server.handler();
+  auto callback = std::make_shared<UploadCallback>(3 * PART_SIZE);
+  ASSERT_TRUE(upload(callback).left());
+  server.failing_part_ = 0;
+  server.part_[1] = std::string(PART_SIZE, 'x');
+  ASSERT_TRUE(upload(callback).right());
+  EXPECT_EQ(server.created_, 2);
+  EXPECT_TRUE(server.aborted_);
+  EXPECT_TRUE(server.part_[1] == callback->content_.substr(0, PART_SIZE));
+}
+
+TEST_F(AmazonS3Test, ResumesUploadAfterRestart) {
+  auto journal = util::temporary_directory() + "cloudstorage-test-s3.json";
+  std::remove(journal.c_str());
+  MultipartServer server("upload");
+  server.failing_part_ = 3;
+  handler_ = server.handler();
+  auto callback = std::make_shared<UploadCallback>(3 * PART_SIZE);
+  provider_->destroy();
+  provider_ = create(journal);
+  ASSERT_TRUE(upload(callback).left());
+  EXPECT_EQ(server.part_.size(), 2u);
+  provider_->destroy();
+  provider_ = create(journal);
+  server.failing_part_ = 0;
+  server.part_[1] = std::string(PART_SIZE, 'x');
+  ASSERT_TRUE(provider_->resumeUploadFileAsync(directory(), "file", callback)
+                  ->result()
+                  .right());
+  EXPECT_EQ(server.created_, 1);
+  EXPECT_EQ(server.part_[1], std::string(PART_SIZE, 'x'));
+  EXPECT_TRUE(server.part_[3] ==
+              callback->content_.substr(2 * PART_SIZE, PART_SIZE));
+  EXPECT_TRUE(UploadJournal::create(journal)
+                  ->get(UploadJournal::key(
+                      provider_->name(), provider_->endpoint(), "directory/",
+                      "file", 3 * PART_SIZE))
+                  .isNull());
+  std::remove(journal.c_str());
+}
+
+TEST_F(AmazonS3Test, StartsOverUploadAfterRestart) {
+  auto journal = util::temporary_directory() + "cloudstorage-test-s3.json";
+  std::remove(journal.c_str());
+  MultipartServer server("upload");
+  server.failing_part_ = 3;
+  handler_ = server.handler();
+  auto callback = std::make_shared<UploadCallback>(3 * PART_SIZE);
+  provider_->destroy();
+  provider_ = create(journal);
+  ASSERT_TRUE(upload(callback).left());
+  provider_->destroy();
+  provider_ = create(journal);
+  server.failing_part_ = 0;
+  server.part_[1] = std::string(PART_SIZE, 'x');
+  ASSERT_TRUE(upload(callback).right());
+  EXPECT_EQ(server.created_, 2);
+  EXPECT_TRUE(server.aborted_);
+  EXPECT_TRUE(server.part_[1] == callback->content_.substr(0, PART_SIZE));
+  std::remove(journal.c_str());
+}
+
+TEST_F(AmazonS3Test, AbortsCancelledUpload) {
+  MultipartServer server("upload");
+  handler_ = server.handler();
+  std::promise<void> part_sent, released;
+  std::shared_future<void> release = released.get_future();
+  bool first = true;
+  run_ = [&](const FakeRequest& request, std::function<void()> task) {
+    std::lock_guard<std::mutex> lock(thread_mutex_);
+    if (request.method() == "PUT" && first) {
+      first = false;
+      part_sent.set_value();
+    }
+    threads_.emplace_back([=] {
+      if (request.method() == "PUT") release.wait();
+      task();
+    });
+  };
+  auto request = provider_->uploadFileAsync(
+      directory(), "file", std::make_shared<UploadCallback>(3 * PART_SIZE));
+  part_sent.get_future().wait();
+  std::thread releaser([&] {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    released.set_value();
+  });
+  request->cancel();
+  releaser.join();
+  auto e = request->result();
+  join();
+  ASSERT_TRUE(e.left());
+  EXPECT_TRUE(server.aborted_);
+  EXPECT_TRUE(server.content_.empty());
+}
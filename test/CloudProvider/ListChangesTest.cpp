@@ -0,0 +1,233 @@
+/*****************************************************************************
+ * ListChangesTest.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "CloudProvider/Box.h"
+#include "CloudProvider/Dropbox.h"
+#include "CloudProvider/GoogleDrive.h"
+#include "CloudProvider/OneDrive.h"
+#include "Utility/HttpMock.h"
+#include "Utility/MemoryProvider.h"
+#include "Utility/Utility.h"
+#include "gtest/gtest.h"
+
+using namespace cloudstorage;
+using ::testing::_;
+using ::testing::AtLeast;
+using ::testing::Return;
+
+namespace {
+
+const std::string GOOGLE_CHANGES =
+    "https://www.googleapis.com/drive/v3/changes";
+const std::string DROPBOX_CHANGES =
+    "https://api.dropboxapi.com/2/files/list_folder/continue";
+const std::string BOX_CHANGES = "https://api.box.com/2.0/events";
+
+class AuthCallback : public ICloudProvider::IAuthCallback {
+  Status userConsentRequired(const ICloudProvider&) override {
+    return Status::WaitForAuthorizationCode;
+  }
+
+  void done(const ICloudProvider&, EitherError<void>) override {}
+};
+
+ACTION_P(SendResponse, response) {
+  *arg2 << response;
+  arg0(IHttpRequest::Response{IHttpRequest::Ok, {}, arg2, arg3});
+}
+
+std::string box_id(bool folder, const std::string& id) {
+  return util::FileId(folder, id);
+}
+
+}  // namespace
+
+class ListChangesTest : public ::testing::Test {
+ public:
+  /**
+   * Lists changes of a new Provider from cursor; the request to url is
+   * answered with response.
+   */
+  template <class Provider>
+  ChangeData changes(const std::string& url, const std::string& cursor,
+                     const std::string& response) {
+    ICloudProvider::InitData data;
+    data.http_engine_ = util::make_unique<HttpMock>();
+    data.http_server_ = util::make_unique<MemoryServerFactory>();
+    data.callback_ = util::make_unique<AuthCallback>();
+    const HttpMock& http = static_cast<const HttpMock&>(*data.http_engine_);
+    auto request = std::make_shared<HttpRequestMock>();
+    EXPECT_CALL(*request, setParameter(_, _)).Times(AtLeast(0));
+    EXPECT_CALL(*request, setHeaderParameter(_, _)).Times(AtLeast(0));
+    EXPECT_CALL(*request, send(_, _, _, _, _))
+        .WillOnce(SendResponse(response));
+    EXPECT_CALL(http, create(url, _, _)).WillRepeatedly(Return(request));
+    std::shared_ptr<CloudProvider> provider = std::make_shared<Provider>();
+    provider->initialize(std::move(data));
+    auto r = static_cast<ICloudProvider&>(*provider)
+                 .listChangesAsync(cursor)
+                 ->result();
+    provider->destroy();
+    EXPECT_EQ(r.left(), nullptr);
+    return r.right() ? *r.right() : ChangeData{};
+  }
+};
+
+TEST_F(ListChangesTest, GoogleDrive) {
+  auto r = changes<GoogleDrive>(GOOGLE_CHANGES, "cursor", R"({
+    "changes": [
+      {"fileId": "removed", "removed": true},
+      {"fileId": "trashed", "removed": false,
+       "file": {"id": "trashed", "name": "a", "trashed": true,
+                "parents": ["directory"]}},
+      {"fileId": "moved", "removed": false,
+       "file": {"id": "moved", "name": "b.txt", "mimeType": "text/plain",
+                "size": "3", "parents": ["new_parent"]}}
+    ],
+    "nextPageToken": "next_page"
+  })");
+  ASSERT_EQ(r.changes_.size(), 3u);
+  EXPECT_EQ(r.changes_[0].id_, "removed");
+  EXPECT_EQ(r.changes_[0].item_, nullptr);
+  EXPECT_EQ(r.changes_[1].id_, "trashed");
+  EXPECT_EQ(r.changes_[1].item_, nullptr);
+  EXPECT_EQ(r.changes_[2].id_, "moved");
+  EXPECT_EQ(r.changes_[2].parents_, std::vector<std::string>{"new_parent"});
+  ASSERT_NE(r.changes_[2].item_, nullptr);
+  EXPECT_EQ(r.changes_[2].item_->filename(), "b.txt");
+  EXPECT_EQ(r.changes_[2].item_->size(), 3u);
+  EXPECT_TRUE(r.has_more_);
+  EXPECT_EQ(r.cursor_, "next_page");
+
+  r = changes<GoogleDrive>(
+      GOOGLE_CHANGES, "cursor",
+      R"({"changes": [], "newStartPageToken": "start_page"})");
+  EXPECT_TRUE(r.changes_.empty());
+  EXPECT_FALSE(r.has_more_);
+  EXPECT_EQ(r.cursor_, "start_page");
+
+  r = changes<GoogleDrive>(GOOGLE_CHANGES + "/startPageToken", "",
+                           R"({"startPageToken": "first_page"})");
+  EXPECT_FALSE(r.has_more_);
+  EXPECT_EQ(r.cursor_, "first_page");
+}
+
+TEST_F(ListChangesTest, Dropbox) {
+  auto r = changes<Dropbox>(DROPBOX_CHANGES, "cursor", R"({
+    "entries": [
+      {".tag": "deleted", "name": "removed", "path_display": "/dir/removed"},
+      {".tag": "deleted", "name": "moved", "path_display": "/old/moved"},
+      {".tag": "file", "name": "moved", "path_display": "/new/moved",
+       "size": 3},
+      {".tag": "folder", "name": "top", "path_display": "/top"}
+    ],
+    "cursor": "next_cursor",
+    "has_more": true
+  })");
+  ASSERT_EQ(r.changes_.size(), 4u);
+  EXPECT_EQ(r.changes_[0].id_, "/dir/removed");
+  EXPECT_EQ(r.changes_[0].parents_, std::vector<std::string>{"/dir"});
+  EXPECT_EQ(r.changes_[0].item_, nullptr);
+  EXPECT_EQ(r.changes_[1].id_, "/old/moved");
+  EXPECT_EQ(r.changes_[1].parents_, std::vector<std::string>{"/old"});
+  EXPECT_EQ(r.changes_[1].item_, nullptr);
+  EXPECT_EQ(r.changes_[2].id_, "/new/moved");
+  EXPECT_EQ(r.changes_[2].parents_, std::vector<std::string>{"/new"});
+  ASSERT_NE(r.changes_[2].item_, nullptr);
+  EXPECT_EQ(r.changes_[2].item_->size(), 3u);
+  // the root directory's id is empty
+  EXPECT_EQ(r.changes_[3].parents_, std::vector<std::string>{""});
+  ASSERT_NE(r.changes_[3].item_, nullptr);
+  EXPECT_EQ(r.changes_[3].item_->type(), IItem::FileType::Directory);
+  EXPECT_TRUE(r.has_more_);
+  EXPECT_EQ(r.cursor_, "next_cursor");
+
+  r = changes<Dropbox>(
+      DROPBOX_CHANGES, "next_cursor",
+      R"({"entries": [], "cursor": "last_cursor", "has_more": false})");
+  EXPECT_TRUE(r.changes_.empty());
+  EXPECT_FALSE(r.has_more_);
+  EXPECT_EQ(r.cursor_, "last_cursor");
+}
+
+TEST_F(ListChangesTest, Box) {
+  auto r = changes<Box>(BOX_CHANGES, "10", R"({
+    "entries": [
+      {"event_type": "ITEM_TRASH",
+       "source": {"type": "file", "id": "1", "name": "trashed",
+                  "parent": {"type": "folder", "id": "100"}}},
+      {"event_type": "ITEM_MOVE",
+       "source": {"type": "folder", "id": "2", "name": "moved",
+                  "parent": {"type": "folder", "id": "200"}}},
+      {"event_type": "COLLABORATION_INVITE",
+       "source": {"type": "collaboration", "id": "3"}}
+    ],
+    "next_stream_position": 1152922976252290886
+  })");
+  ASSERT_EQ(r.changes_.size(), 2u);
+  EXPECT_EQ(r.changes_[0].id_, box_id(false, "1"));
+  EXPECT_EQ(r.changes_[0].parents_,
+            std::vector<std::string>{box_id(true, "100")});
+  EXPECT_EQ(r.changes_[0].item_, nullptr);
+  EXPECT_EQ(r.changes_[1].id_, box_id(true, "2"));
+  EXPECT_EQ(r.changes_[1].parents_,
+            std::vector<std::string>{box_id(true, "200")});
+  ASSERT_NE(r.changes_[1].item_, nullptr);
+  EXPECT_EQ(r.changes_[1].item_->id(), box_id(true, "2"));
+  EXPECT_TRUE(r.has_more_);
+  EXPECT_EQ(r.cursor_, "1152922976252290886");
+
+  r = changes<Box>(
+      BOX_CHANGES, "1152922976252290886",
+      R"({"entries": [], "next_stream_position": 1152922976252290886})");
+  EXPECT_TRUE(r.changes_.empty());
+  EXPECT_FALSE(r.has_more_);
+  EXPECT_EQ(r.cursor_, "1152922976252290886");
+}
+
+TEST_F(ListChangesTest, OneDrive) {
+  auto r = changes<OneDrive>("https://delta/page", "https://delta/page", R"({
+    "value": [
+      {"id": "removed", "deleted": {}, "parentReference": {"id": "directory"}},
+      {"id": "moved", "name": "moved", "size": 3, "file": {},
+       "parentReference": {"id": "new_parent"}}
+    ],
+    "@odata.nextLink": "https://delta/next_page"
+  })");
+  ASSERT_EQ(r.changes_.size(), 2u);
+  EXPECT_EQ(r.changes_[0].id_, "removed");
+  EXPECT_EQ(r.changes_[0].parents_, std::vector<std::string>{"directory"});
+  EXPECT_EQ(r.changes_[0].item_, nullptr);
+  EXPECT_EQ(r.changes_[1].id_, "moved");
+  EXPECT_EQ(r.changes_[1].parents_, std::vector<std::string>{"new_parent"});
+  ASSERT_NE(r.changes_[1].item_, nullptr);
+  EXPECT_EQ(r.changes_[1].item_->filename(), "moved");
+  EXPECT_TRUE(r.has_more_);
+  EXPECT_EQ(r.cursor_, "https://delta/next_page");
+
+  r = changes<OneDrive>(
+      "https://delta/next_page", "https://delta/next_page",
+      R"({"value": [], "@odata.deltaLink": "https://delta/latest"})");
+  EXPECT_TRUE(r.changes_.empty());
+  EXPECT_FALSE(r.has_more_);
+  EXPECT_EQ(r.cursor_, "https://delta/latest");
+}
@@ -0,0 +1,559 @@
+/*****************************************************************************
+ * UploadSessionTest.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "gtest/gtest.h"
+
+#include <json/json.h>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "CloudProvider/Dropbox.h"
+#include "CloudProvider/GoogleDrive.h"
+#include "CloudProvider/OneDrive.h"
+#include "Utility/FakeRequest.h"
+#include "Utility/Item.h"
+#include "Utility/MemoryProvider.h"
+#include "Utility/Utility.h"
+
+using namespace cloudstorage;
+
+namespace {
+
+const int CONFLICT = 409;
+const int RESUME_INCOMPLETE = 308;
+
+const std::string DROPBOX_SESSION =
+    "https://content.dropboxapi.com/2/files/upload_session";
+const std::string GOOGLE_ENDPOINT = "https://www.googleapis.com";
+const std::string ONEDRIVE_ENDPOINT = "https://graph.microsoft.com/v1.0";
+
+class AuthCallback : public ICloudProvider::IAuthCallback {
+  Status userConsentRequired(const ICloudProvider&) override {
+    return Status::WaitForAuthorizationCode;
+  }
+
+  void done(const ICloudProvider&, EitherError<void>) override {}
+};
+
+class UploadCallback : public IUploadFileCallback {
+ public:
+  UploadCallback(uint64_t size) : content_(size, 0) {
+    for (size_t i = 0; i < content_.size(); i++)
+      content_[i] = static_cast<char>(i % 251);
+  }
+
+  uint32_t putData(char* data, uint32_t maxlength, uint64_t offset) override {
+    auto length = std::min<uint64_t>(maxlength, content_.size() - offset);
+    memcpy(data, content_.data() + offset, length);
+    return static_cast<uint32_t>(length);
+  }
+
+  uint64_t size() override { return content_.size(); }
+
+  void progress(uint64_t, uint64_t) override {}
+
+  void done(EitherError<IItem>) override {}
+
+  std::string content_;
+};
+
+/**
+ * Keeps Dropbox's sequential upload sessions, which refuse appends at other
+ * offsets than the amount of data they received. Sessions are shared by all
+ * accounts, so that an account picking up a session of another one shows.
+ */
+class DropboxServer {
+ public:
+  FakeRequest::Handler handler(const std::string& account) {
+    return [=](const FakeRequest& request, const std::string& body,
+               std::ostream& response, IHttpRequest::HeaderParameters&) {
+      return handle(account, request, body, response);
+    };
+  }
+
+  int handle(const std::string& account, const FakeRequest& request,
+             const std::string& body, std::ostream& response) {
+    if (request.url() == "https://api.dropboxapi.com/2/users/"
+                         "get_current_account") {
+      account_requests_++;
+      response << R"({"email": ")" << account << R"("})";
+      return IHttpRequest::Ok;
+    }
+    if (request.url() == "https://api.dropboxapi.com/2/users/get_space_usage") {
+      response << "{}";
+      return IHttpRequest::Ok;
+    }
+    auto argument = util::json::from_string(request.header("Dropbox-API-Arg"));
+    if (request.url() == DROPBOX_SESSION + "/start") {
+      EXPECT_EQ(argument["session_type"], "sequential");
+      auto id = "session" + std::to_string(++started_);
+      session_[id];
+      response << R"({"session_id": ")" << id << R"("})";
+      return IHttpRequest::Ok;
+    }
+    auto it = session_.find(argument["cursor"]["session_id"].asString());
+    if (it == session_.end())
+      return error(response, R"({".tag": "not_found"})");
+    auto& session = it->second;
+    auto offset = argument["cursor"]["offset"].asUInt64();
+    if (request.url() == DROPBOX_SESSION + "/append_v2") {
+      if (session.closed_) return error(response, R"({".tag": "closed"})");
+      if (offset != session.data_.size())
+        return error(response,
+                     R"({".tag": "incorrect_offset", "correct_offset": )" +
+                         std::to_string(session.data_.size()) + "}");
+      if (!body.empty() && offset == failing_offset_) {
+        failing_offset_ = UINT64_MAX;
+        return IHttpRequest::InternalServerError;
+      }
+      appended_ += body.size();
+      session.data_ += body;
+      session.closed_ = argument["close"].asBool();
+      return IHttpRequest::Ok;
+    }
+    EXPECT_EQ(request.url(), DROPBOX_SESSION + "/finish");
+    if (failing_finish_) {
+      failing_finish_ = false;
+      return IHttpRequest::InternalServerError;
+    }
+    EXPECT_EQ(offset, session.data_.size());
+    Json::Value item;
+    item[".tag"] = "file";
+    item["name"] = "file";
+    item["path_display"] = argument["commit"]["path"];
+    item["size"] = Json::UInt64(session.data_.size());
+    content_ = session.data_;
+    session_.erase(it);
+    response << item;
+    return IHttpRequest::Ok;
+  }
+
+  static int error(std::ostream& response, const std::string& error) {
+    response << R"({"error_summary": "", "error": )" << error << "}";
+    return CONFLICT;
+  }
+
+  struct Session {
+    std::string data_;
+    bool closed_ = false;
+  };
+
+  std::map<std::string, Session> session_;
+  std::string content_;
+  uint64_t appended_ = 0;
+  uint64_t failing_offset_ = UINT64_MAX;
+  bool failing_finish_ = false;
+  int started_ = 0;
+  int account_requests_ = 0;
+};
+
+/**
+ * Keeps OneDrive's upload sessions, which report the range they expect next
+ * and are gone once they received the whole file.
+ */
+class OneDriveServer {
+ public:
+  FakeRequest::Handler handler() {
+    return [=](const FakeRequest& request, const std::string& body,
+               std::ostream& response, IHttpRequest::HeaderParameters&) {
+      return handle(request, body, response);
+    };
+  }
+
+  int handle(const FakeRequest& request, const std::string& body,
+             std::ostream& response) {
+    if (request.url() == ONEDRIVE_ENDPOINT + "/me/drive") {
+      response << "{}";
+      return IHttpRequest::Ok;
+    }
+    if (request.url() == ONEDRIVE_ENDPOINT + "/me") {
+      response << R"({"userPrincipalName": "user"})";
+      return IHttpRequest::Ok;
+    }
+    if (request.url() == ONEDRIVE_ENDPOINT +
+                             "/me/drive/items/directory:/file:/"
+                             "createUploadSession") {
+      auto url = "https://upload/" + std::to_string(++started_);
+      session_[url];
+      response << R"({"uploadUrl": ")" << url << R"("})";
+      return IHttpRequest::Ok;
+    }
+    auto it = session_.find(request.url());
+    if (it == session_.end()) return IHttpRequest::NotFound;
+    auto& data = it->second;
+    if (request.method() == "GET") {
+      response << R"({"nextExpectedRanges": [")" << data.size() << R"(-"]})";
+      return IHttpRequest::Ok;
+    }
+    EXPECT_EQ(request.method(), "PUT");
+    uint64_t start, end, size;
+    EXPECT_EQ(sscanf(request.header("Content-Range").c_str(),
+                     "bytes %" SCNu64 "-%" SCNu64 "/%" SCNu64, &start, &end,
+                     &size),
+              3);
+    if (start != data.size()) return IHttpRequest::RangeInvalid;
+    if (start == failing_offset_) {
+      failing_offset_ = UINT64_MAX;
+      return IHttpRequest::InternalServerError;
+    }
+    EXPECT_EQ(end - start + 1, body.size());
+    sent_ += body.size();
+    data += body;
+    if (data.size() < size) {
+      response << R"({"nextExpectedRanges": [")" << data.size() << R"(-"]})";
+      return IHttpRequest::Accepted;
+    }
+    Json::Value item;
+    item["id"] = "file";
+    item["name"] = "file";
+    item["size"] = Json::UInt64(data.size());
+    content_ = data;
+    session_.erase(it);
+    response << item;
+    return IHttpRequest::Ok;
+  }
+
+  std::map<std::string, std::string> session_;
+  std::string content_;
+  uint64_t sent_ = 0;
+  uint64_t failing_offset_ = UINT64_MAX;
+  int started_ = 0;
+};
+
+/**
+ * Keeps Google Drive's resumable upload sessions, which report the range they
+ * received and give the uploaded file once they received all of it.
+ */
+class GoogleDriveServer {
+ public:
+  FakeRequest::Handler handler() {
+    return [=](const FakeRequest& request, const std::string& body,
+               std::ostream& response,
+               IHttpRequest::HeaderParameters& headers) {
+      return handle(request, body, response, headers);
+    };
+  }
+
+  int handle(const FakeRequest& request, const std::string& body,
+             std::ostream& response, IHttpRequest::HeaderParameters& headers) {
+    if (request.url() == GOOGLE_ENDPOINT + "/drive/v3/about") {
+      response << R"({"user": {"emailAddress": "user"},)"
+               << R"( "storageQuota": {"usage": "0"}})";
+      return IHttpRequest::Ok;
+    }
+    if (request.url() == GOOGLE_ENDPOINT + "/drive/v3/files") {
+      response << R"({"files": []})";
+      return IHttpRequest::Ok;
+    }
+    if (request.url() == GOOGLE_ENDPOINT + "/upload/drive/v3/files") {
+      EXPECT_EQ(request.parameter("uploadType"), "resumable");
+      EXPECT_EQ(util::json::from_string(body)["name"], "file");
+      auto url = "https://upload/" + std::to_string(++started_);
+      session_[url].size_ =
+          std::stoull(request.header("X-Upload-Content-Length"));
+      headers.insert({"location", url});
+      return IHttpRequest::Ok;
+    }
+    auto it = session_.find(request.url());
+    if (it == session_.end()) return IHttpRequest::NotFound;
+    auto& session = it->second;
+    EXPECT_EQ(request.method(), "PUT");
+    auto range = request.header("Content-Range");
+    uint64_t start, end, size;
+    if (range == "bytes */" + std::to_string(session.size_))
+      return status(session, response, headers);
+    EXPECT_EQ(sscanf(range.c_str(), "bytes %" SCNu64 "-%" SCNu64 "/%" SCNu64,
+                     &start, &end, &size),
+              3);
+    if (start != session.data_.size()) return IHttpRequest::Bad;
+    if (start == failing_offset_) {
+      failing_offset_ = UINT64_MAX;
+      return IHttpRequest::InternalServerError;
+    }
+    EXPECT_EQ(end - start + 1, body.size());
+    sent_ += body.size();
+    session.data_ += body;
+    if (session.data_.size() == session.size_ && failing_finish_) {
+      failing_finish_ = false;
+      return IHttpRequest::InternalServerError;
+    }
+    return status(session, response, headers);
+  }
+
+  struct Session {
+    std::string data_;
+    uint64_t size_;
+  };
+
+  int status(const Session& session, std::ostream& response,
+             IHttpRequest::HeaderParameters& headers) {
+    if (session.data_.size() < session.size_) {
+      if (!session.data_.empty())
+        headers.insert(
+            {"range", "bytes=0-" + std::to_string(session.data_.size() - 1)});
+      return RESUME_INCOMPLETE;
+    }
+    Json::Value item;
+    item["id"] = "file";
+    item["name"] = "file";
+    item["size"] = std::to_string(session.data_.size());
+    content_ = session.data_;
+    response << item;
+    return IHttpRequest::Ok;
+  }
+
+  std::map<std::string, Session> session_;
+  std::string content_;
+  uint64_t sent_ = 0;
+  uint64_t failing_offset_ = UINT64_MAX;
+  bool failing_finish_ = false;
+  int started_ = 0;
+};
+
+std::shared_ptr<Item> directory(const std::string& id) {
+  return std::make_shared<Item>("directory", id, IItem::UnknownSize,
+                                IItem::UnknownTimeStamp,
+                                IItem::FileType::Directory);
+}
+
+}  // namespace
+
+class UploadSessionTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    journal_ = util::temporary_directory() + "cloudstorage-test-sessions.json";
+    std::remove(journal_.c_str());
+  }
+
+  void TearDown() {
+    for (auto&& provider : provider_) provider->destroy();
+    std::remove(journal_.c_str());
+  }
+
+  template <class Provider>
+  std::shared_ptr<ICloudProvider> create(FakeRequest::Handler handler,
+                                         uint64_t chunk_size) {
+    ICloudProvider::InitData data;
+    data.token_ = "token";
+    data.http_engine_ = util::make_unique<FakeHttp>(handler);
+    data.http_server_ = util::make_unique<MemoryServerFactory>();
+    data.callback_ = util::make_unique<AuthCallback>();
+    data.upload_journal_ = journal_;
+    data.hints_["access_token"] = "token";
+    data.hints_["endpoint"] = ONEDRIVE_ENDPOINT;
+    data.hints_["upload_chunk_size"] = std::to_string(chunk_size);
+    std::shared_ptr<CloudProvider> provider = std::make_shared<Provider>();
+    provider->initialize(std::move(data));
+    provider_.push_back(provider);
+    return provider;
+  }
+
+  std::string journal_;
+  std::vector<std::shared_ptr<CloudProvider>> provider_;
+};
+
+TEST_F(UploadSessionTest, DropboxResumesSessionAtCorrectOffset) {
+  const auto chunk = Dropbox::ChunkAlignment;
+  DropboxServer server;
+  server.failing_offset_ = chunk;
+  auto provider = create<Dropbox>(server.handler("user"), chunk);
+  auto callback = std::make_shared<UploadCallback>(2 * chunk + 1000);
+  ASSERT_TRUE(
+      provider->uploadFileAsync(directory("/dir"), "file", callback)
+          ->result()
+          .left());
+  EXPECT_EQ(server.appended_, chunk);
+  auto e = provider->resumeUploadFileAsync(directory("/dir"), "file", callback)
+               ->result();
+  ASSERT_TRUE(e.right());
+  EXPECT_EQ(e.right()->id(), "/dir/file");
+  EXPECT_EQ(server.started_, 1);
+  EXPECT_EQ(server.appended_, callback->size());
+  EXPECT_TRUE(server.content_ == callback->content_);
+  EXPECT_EQ(server.account_requests_, 1);
+}
+
+TEST_F(UploadSessionTest, DropboxFinishesClosedSession) {
+  const auto chunk = Dropbox::ChunkAlignment;
+  DropboxServer server;
+  server.failing_finish_ = true;
+  auto provider = create<Dropbox>(server.handler("user"), chunk);
+  auto callback = std::make_shared<UploadCallback>(chunk + 1000);
+  ASSERT_TRUE(
+      provider->uploadFileAsync(directory("/dir"), "file", callback)
+          ->result()
+          .left());
+  ASSERT_TRUE(
+      provider->resumeUploadFileAsync(directory("/dir"), "file", callback)
+          ->result()
+          .right());
+  EXPECT_EQ(server.started_, 1);
+  EXPECT_EQ(server.appended_, callback->size());
+  EXPECT_TRUE(server.content_ == callback->content_);
+}
+
+TEST_F(UploadSessionTest, DropboxStartsOverExpiredSession) {
+  const auto chunk = Dropbox::ChunkAlignment;
+  DropboxServer server;
+  server.failing_offset_ = chunk;
+  auto provider = create<Dropbox>(server.handler("user"), chunk);
+  auto callback = std::make_shared<UploadCallback>(2 * chunk + 1000);
+  ASSERT_TRUE(
+      provider->uploadFileAsync(directory("/dir"), "file", callback)
+          ->result()
+          .left());
+  server.session_.clear();
+  ASSERT_TRUE(
+      provider->resumeUploadFileAsync(directory("/dir"), "file", callback)
+          ->result()
+          .right());
+  EXPECT_EQ(server.started_, 2);
+  EXPECT_TRUE(server.content_ == callback->content_);
+}
+
+TEST_F(UploadSessionTest, DropboxKeepsSessionsOfAccountsApart) {
+  const auto chunk = Dropbox::ChunkAlignment;
+  DropboxServer server;
+  server.failing_offset_ = chunk;
+  auto first = create<Dropbox>(server.handler("first"), chunk);
+  auto second = create<Dropbox>(server.handler("second"), chunk);
+  auto callback = std::make_shared<UploadCallback>(2 * chunk + 1000);
+  ASSERT_TRUE(first->uploadFileAsync(directory("/dir"), "file", callback)
+                  ->result()
+                  .left());
+  ASSERT_TRUE(
+      second->resumeUploadFileAsync(directory("/dir"), "file", callback)
+          ->result()
+          .right());
+  EXPECT_EQ(server.started_, 2);
+  EXPECT_EQ(server.session_["session1"].data_.size(), chunk);
+  ASSERT_TRUE(first->resumeUploadFileAsync(directory("/dir"), "file", callback)
+                  ->result()
+                  .right());
+  EXPECT_EQ(server.started_, 2);
+  EXPECT_EQ(server.session_.count("session1"), 0u);
+}
+
+TEST_F(UploadSessionTest, OneDriveResumesSessionAtNextExpectedRange) {
+  const auto chunk = OneDrive::ChunkAlignment;
+  OneDriveServer server;
+  server.failing_offset_ = chunk;
+  auto provider = create<OneDrive>(server.handler(), chunk);
+  auto callback = std::make_shared<UploadCallback>(2 * chunk + 1000);
+  ASSERT_TRUE(
+      provider->uploadFileAsync(directory("directory"), "file", callback)
+          ->result()
+          .left());
+  EXPECT_EQ(server.sent_, chunk);
+  auto e =
+      provider->resumeUploadFileAsync(directory("directory"), "file", callback)
+          ->result();
+  ASSERT_TRUE(e.right());
+  EXPECT_EQ(e.right()->id(), "file");
+  EXPECT_EQ(server.started_, 1);
+  EXPECT_EQ(server.sent_, callback->size());
+  EXPECT_TRUE(server.content_ == callback->content_);
+}
+
+TEST_F(UploadSessionTest, OneDriveStartsOverExpiredSession) {
+  const auto chunk = OneDrive::ChunkAlignment;
+  OneDriveServer server;
+  server.failing_offset_ = chunk;
+  auto provider = create<OneDrive>(server.handler(), chunk);
+  auto callback = std::make_shared<UploadCallback>(2 * chunk + 1000);
+  ASSERT_TRUE(
+      provider->uploadFileAsync(directory("directory"), "file", callback)
+          ->result()
+          .left());
+  server.session_.clear();
+  ASSERT_TRUE(
+      provider->resumeUploadFileAsync(directory("directory"), "file", callback)
+          ->result()
+          .right());
+  EXPECT_EQ(server.started_, 2);
+  EXPECT_TRUE(server.content_ == callback->content_);
+}
+
+TEST_F(UploadSessionTest, GoogleDriveResumesSessionAtReceivedRange) {
+  const auto chunk = GoogleDrive::ChunkAlignment;
+  GoogleDriveServer server;
+  server.failing_offset_ = chunk;
+  auto provider = create<GoogleDrive>(server.handler(), chunk);
+  auto callback = std::make_shared<UploadCallback>(2 * chunk + 1000);
+  ASSERT_TRUE(
+      provider->uploadFileAsync(directory("directory"), "file", callback)
+          ->result()
+          .left());
+  EXPECT_EQ(server.sent_, chunk);
+  auto e =
+      provider->resumeUploadFileAsync(directory("directory"), "file", callback)
+          ->result();
+  ASSERT_TRUE(e.right());
+  EXPECT_EQ(e.right()->id(), "file");
+  EXPECT_EQ(server.started_, 1);
+  EXPECT_EQ(server.sent_, callback->size());
+  EXPECT_TRUE(server.content_ == callback->content_);
+}
+
+TEST_F(UploadSessionTest, GoogleDriveFinishesCompletedSession) {
+  const auto chunk = GoogleDrive::ChunkAlignment;
+  GoogleDriveServer server;
+  server.failing_finish_ = true;
+  auto provider = create<GoogleDrive>(server.handler(), chunk);
+  auto callback = std::make_shared<UploadCallback>(chunk + 1000);
+  ASSERT_TRUE(
+      provider->uploadFileAsync(directory("directory"), "file", callback)
+          ->result()
+          .left());
+  auto e =
+      provider->resumeUploadFileAsync(directory("directory"), "file", callback)
+          ->result();
+  ASSERT_TRUE(e.right());
+  EXPECT_EQ(e.right()->id(), "file");
+  EXPECT_EQ(server.started_, 1);
+  EXPECT_EQ(server.sent_, callback->size());
+  EXPECT_TRUE(server.content_ == callback->content_);
+}
+
+TEST_F(UploadSessionTest, GoogleDriveStartsOverExpiredSession) {
+  const auto chunk = GoogleDrive::ChunkAlignment;
+  GoogleDriveServer server;
+  server.failing_offset_ = chunk;
+  auto provider = create<GoogleDrive>(server.handler(), chunk);
+  auto callback = std::make_shared<UploadCallback>(2 * chunk + 1000);
+  ASSERT_TRUE(
+      provider->uploadFileAsync(directory("directory"), "file", callback)
+          ->result()
+          .left());
+  server.session_.clear();
+  ASSERT_TRUE(
+      provider->resumeUploadFileAsync(directory("directory"), "file", callback)
+          ->result()
+          .right());
+  EXPECT_EQ(server.started_, 2);
+  EXPECT_TRUE(server.content_ == callback->content_);
+}
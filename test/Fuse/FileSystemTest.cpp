@@ -0,0 +1,769 @@
+/*****************************************************************************
+ * FileSystemTest.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "gtest/gtest.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <map>
+#include <set>
+#include <thread>
+
+#include "FileSystem.h"
+#include "Utility/MemoryProvider.h"
+
+using namespace cloudstorage;
+
+namespace {
+
+const auto TIMEOUT = std::chrono::seconds(10);
+
+/**
+ * Provider keeping a tree of files in memory. Requests complete on separate
+ * threads; listings and uploads can be made to fail, and each upload can be
+ * held after its data is read, before it's stored.
+ */
+class FakeProvider : public CloudProvider {
+ public:
+  FakeProvider() : CloudProvider(util::make_unique<MemoryProvider::Auth>()) {}
+
+  std::string name() const override { return "fake"; }
+  std::string endpoint() const override { return "fake://"; }
+
+  /**
+   * Ids of directories end with a slash; an item's id is its parent's id
+   * followed by its name, except for items in the root directory.
+   */
+  void add(const std::string& id, const std::string& content = "") {
+    std::lock_guard<std::mutex> lock(mutex_);
+    file_[id] = content;
+  }
+
+  // removes the item and everything in it if it's a directory
+  void remove(const std::string& id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = file_.begin(); it != file_.end();)
+      if (it->first.compare(0, id.size(), id) == 0)
+        it = file_.erase(it);
+      else
+        ++it;
+  }
+
+  std::string content(const std::string& id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = file_.find(id);
+    return it == file_.end() ? "" : it->second;
+  }
+
+  void fail_listing(int code) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    list_error_ = code;
+  }
+
+  void fail_uploads(int count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    failed_upload_count_ = count;
+  }
+
+  void hold_uploads(std::function<void()> hold) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    hold_ = hold;
+  }
+
+  int uploads() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return upload_count_;
+  }
+
+  int resumes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return resume_count_;
+  }
+
+  std::vector<std::chrono::steady_clock::time_point> upload_attempts() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return upload_attempt_;
+  }
+
+  void join() {
+    while (true) {
+      std::vector<std::thread> threads;
+      {
+        std::lock_guard<std::mutex> lock(thread_mutex_);
+        if (thread_.empty()) return;
+        std::swap(threads, thread_);
+      }
+      for (auto&& thread : threads) thread.join();
+    }
+  }
+
+  ListDirectoryRequest::Pointer listDirectorySimpleAsync(
+      IItem::Pointer directory, ListDirectoryCallback callback) override {
+    auto id = directory->id() == "root" ? "" : directory->id();
+    return run<IItem::List>(callback, [=]() -> EitherError<IItem::List> {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (list_error_ != 0) return Error{list_error_, "couldn't list"};
+      IItem::List result;
+      for (auto&& file : file_)
+        if (parent(file.first) == id) result.push_back(item(file.first));
+      return result;
+    });
+  }
+
+  DownloadFileRequest::Pointer downloadFileAsync(
+      IItem::Pointer file, IDownloadFileCallback::Pointer callback,
+      Range range) override {
+    return run<void>([=](EitherError<void> e) { callback->done(e); },
+                     [=]() -> EitherError<void> {
+                       auto data = content(file->id());
+                       if (range.start_ >= data.size()) return nullptr;
+                       data = data.substr(range.start_, range.size_);
+                       callback->receivedData(
+                           data.data(), static_cast<uint32_t>(data.size()));
+                       return nullptr;
+                     });
+  }
+
+  UploadFileRequest::Pointer uploadFileAsync(
+      IItem::Pointer directory, const std::string& filename,
+      IUploadFileCallback::Pointer callback) override {
+    auto id = (directory->id() == "root" ? "" : directory->id()) + filename;
+    return run<IItem>(
+        [=](EitherError<IItem> e) { callback->done(e); },
+        [=]() -> EitherError<IItem> {
+          std::string data(callback->size(), 0);
+          for (uint64_t offset = 0; offset < data.size();) {
+            auto length = callback->putData(
+                &data[offset],
+                static_cast<uint32_t>(std::min<uint64_t>(
+                    16 * 1024, data.size() - offset)),
+                offset);
+            if (length == 0) break;
+            offset += length;
+          }
+          std::function<void()> hold;
+          {
+            std::lock_guard<std::mutex> lock(mutex_);
+            upload_attempt_.push_back(std::chrono::steady_clock::now());
+            if (failed_upload_count_ > 0) {
+              failed_upload_count_--;
+              return Error{IHttpRequest::ServiceUnavailable, "upload failed"};
+            }
+            hold = hold_;
+          }
+          if (hold) hold();
+          std::lock_guard<std::mutex> lock(mutex_);
+          file_[id] = data;
+          upload_count_++;
+          return item(id);
+        });
+  }
+
+  UploadFileRequest::Pointer resumeUploadFileAsync(
+      IItem::Pointer directory, const std::string& filename,
+      IUploadFileCallback::Pointer callback) override {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      resume_count_++;
+    }
+    return uploadFileAsync(directory, filename, std::move(callback));
+  }
+
+ private:
+  static std::string parent(const std::string& id) {
+    auto separator = id.find_last_of('/', id.size() - 2);
+    return separator == std::string::npos ? "" : id.substr(0, separator + 1);
+  }
+
+  IItem::Pointer item(const std::string& id) const {
+    bool directory = id.back() == '/';
+    auto name = id.substr(parent(id).size());
+    if (directory) name.pop_back();
+    return std::make_shared<Item>(
+        name, id, directory ? IItem::UnknownSize : file_.at(id).size(),
+        IItem::UnknownTimeStamp,
+        directory ? IItem::FileType::Directory : IItem::FileType::Unknown);
+  }
+
+  template <class T>
+  typename IRequest<EitherError<T>>::Pointer run(
+      GenericCallback<EitherError<T>> callback,
+      std::function<EitherError<T>()> task) {
+    using Request = cloudstorage::Request<EitherError<T>>;
+    return std::make_shared<Request>(shared_from_this(), callback,
+                                     [=](typename Request::Pointer r) {
+                                       std::lock_guard<std::mutex> lock(
+                                           thread_mutex_);
+                                       thread_.emplace_back(
+                                           [=] { r->done(task()); });
+                                     })
+        ->run();
+  }
+
+  std::mutex mutex_;
+  std::map<std::string, std::string> file_;
+  int list_error_ = 0;
+  int failed_upload_count_ = 0;
+  int upload_count_ = 0;
+  int resume_count_ = 0;
+  std::vector<std::chrono::steady_clock::time_point> upload_attempt_;
+  std::function<void()> hold_;
+  std::mutex thread_mutex_;
+  std::vector<std::thread> thread_;
+};
+
+std::string content(size_t size) {
+  std::string result(size, 0);
+  for (size_t i = 0; i < size; i++) result[i] = static_cast<char>('a' + i % 26);
+  return result;
+}
+
+}  // namespace
+
+namespace cloudstorage {
+
+class FileSystemTest : public ::testing::Test {
+ public:
+  using FileId = IFileSystem::FileId;
+
+  // inodes of the directory of all providers and of the first provider
+  static constexpr FileId MOUNT = 1;
+  static constexpr FileId ROOT = 2;
+
+  void SetUp() override {
+    directory_ = util::temporary_directory() + "cloudstorage-fs-test";
+    cleanup();
+    mkdir(directory_.c_str(), 0700);
+    provider_ = create_provider();
+    providers_ = {{"fake", provider_}};
+  }
+
+  void TearDown() override {
+    unmount();
+    for (auto&& provider : created_) provider->destroy();
+    cleanup();
+  }
+
+  std::shared_ptr<FakeProvider> create_provider() {
+    auto provider = std::make_shared<FakeProvider>();
+    ICloudProvider::InitData data;
+    data.http_engine_ =
+        util::make_unique<MemoryHttp>(0, std::chrono::milliseconds(0));
+    data.http_server_ = util::make_unique<MemoryServerFactory>();
+    provider->initialize(std::move(data));
+    created_.push_back(provider);
+    return provider;
+  }
+
+  // removes the directory with journals and stores of written files
+  void cleanup() {
+    if (auto directory = opendir(directory_.c_str())) {
+      while (auto entry = readdir(directory))
+        std::remove((directory_ + "/" + entry->d_name).c_str());
+      closedir(directory);
+    }
+    rmdir(directory_.c_str());
+  }
+
+  static FileSystem::Options fast() {
+    FileSystem::Options options;
+    options.flush_delay_ = std::chrono::milliseconds(50);
+    options.flush_retry_delay_ = std::chrono::milliseconds(200);
+    options.recover_retry_delay_ = std::chrono::milliseconds(200);
+    return options;
+  }
+
+  static FileSystem::Options never() {
+    FileSystem::Options options;
+    options.flush_delay_ = options.flush_retry_delay_ =
+        options.recover_retry_delay_ = std::chrono::hours(1);
+    return options;
+  }
+
+  void mount(FileSystem::Options options = fast()) {
+    file_system_ = util::make_unique<FileSystem>(
+        providers_,
+        util::make_unique<MemoryHttp>(0, std::chrono::milliseconds(0)),
+        directory_, cache_directory_, options);
+  }
+
+  void unmount() {
+    file_system_ = nullptr;
+    for (auto&& provider : created_) provider->join();
+  }
+
+  FileId lookup(FileId parent, const std::string& name) {
+    std::promise<FileId> result;
+    file_system_->lookup(parent, name,
+                         [&](EitherError<IFileSystem::INode> e) {
+                           result.set_value(e.right() ? e.right()->inode() : 0);
+                         });
+    return result.get_future().get();
+  }
+
+  void write(FileId inode, const std::string& data, uint64_t offset) {
+    std::promise<uint32_t> result;
+    file_system_->write(inode, data.data(),
+                        static_cast<uint32_t>(data.size()), offset,
+                        [&](EitherError<uint32_t> e) {
+                          result.set_value(e.right() ? *e.right() : 0);
+                        });
+    EXPECT_EQ(result.get_future().get(), data.size());
+  }
+
+  std::string read(FileId inode, uint64_t offset, uint64_t size) {
+    std::promise<std::string> result;
+    file_system_->read(inode, offset, size, [&](EitherError<std::string> e) {
+      result.set_value(e.right() ? *e.right() : "");
+    });
+    return result.get_future().get();
+  }
+
+  void fsync(FileId inode) {
+    std::promise<void> result;
+    file_system_->fsync(inode, [&](EitherError<void>) { result.set_value(); });
+    result.get_future().get();
+  }
+
+  std::map<uint64_t, uint64_t> written(FileId inode) {
+    auto node = file_system_->get(inode);
+    std::lock_guard<FileSystem::mutex> lock(node->mutex_);
+    return node->written_;
+  }
+
+  // whether all written data is uploaded
+  bool flushed() {
+    std::lock_guard<FileSystem::mutex> lock(file_system_->write_back_mutex_);
+    return file_system_->modified_.empty() &&
+           file_system_->flushing_.empty() &&
+           file_system_->recover_queue_.empty();
+  }
+
+  size_t unrecovered() {
+    std::lock_guard<FileSystem::mutex> lock(file_system_->write_back_mutex_);
+    return file_system_->unrecovered_.size();
+  }
+
+  size_t recover_queue() {
+    std::lock_guard<FileSystem::mutex> lock(file_system_->write_back_mutex_);
+    return file_system_->recover_queue_.size();
+  }
+
+  bool in_shards(FileId inode) {
+    return file_system_->find_node(inode) != nullptr;
+  }
+
+  // whether any of the indexes by path, id or name refers to the node
+  bool indexed(FileId inode) {
+    std::lock_guard<FileSystem::mutex> lock(file_system_->node_data_mutex_);
+    for (auto&& entry : file_system_->node_path_to_id_)
+      if (entry.second == inode) return true;
+    for (auto&& entry : file_system_->node_id_map_)
+      if (entry.second->inode() == inode) return true;
+    for (auto&& provider : file_system_->node_item_)
+      for (auto&& entry : provider.second)
+        if (entry.second.count(inode) > 0) return true;
+    for (auto&& directory : file_system_->node_name_)
+      for (auto&& entry : directory.second)
+        if (entry.second == inode) return true;
+    return false;
+  }
+
+  bool listed(FileId directory) {
+    std::lock_guard<FileSystem::mutex> lock(file_system_->node_data_mutex_);
+    return file_system_->node_directory_.count(directory) > 0;
+  }
+
+  void apply(const std::string& root_id, std::vector<Change> changes) {
+    ChangeData data;
+    data.changes_ = std::move(changes);
+    data.has_more_ = false;
+    file_system_->apply(FileSystem::ChangeFeed{provider_, "cursor", root_id},
+                        data);
+  }
+
+  // directories the change feed marked as changed
+  std::set<FileId> changed() {
+    std::lock_guard<FileSystem::mutex> lock(file_system_->node_data_mutex_);
+    std::set<FileId> result;
+    for (auto&& entry : file_system_->node_changed_) result.insert(entry.first);
+    return result;
+  }
+
+  bool known_missing(FileId directory, const std::string& name) {
+    std::lock_guard<FileSystem::mutex> lock(file_system_->node_data_mutex_);
+    auto it = file_system_->node_missing_.find(directory);
+    return it != file_system_->node_missing_.end() && it->second.count(name);
+  }
+
+  std::vector<std::string> journals() {
+    std::vector<std::string> result;
+    if (auto directory = opendir(directory_.c_str())) {
+      while (auto entry = readdir(directory))
+        if (std::string(entry->d_name).find("cloudstorage-journal") == 0)
+          result.push_back(entry->d_name);
+      closedir(directory);
+    }
+    return result;
+  }
+
+  bool wait_for(std::function<bool()> condition) {
+    auto deadline = std::chrono::steady_clock::now() + TIMEOUT;
+    while (!condition()) {
+      if (std::chrono::steady_clock::now() > deadline) return false;
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+  }
+
+  std::string directory_;
+  std::string cache_directory_;
+  std::shared_ptr<FakeProvider> provider_;
+  std::vector<IFileSystem::ProviderEntry> providers_;
+  std::vector<std::shared_ptr<FakeProvider>> created_;
+  std::unique_ptr<FileSystem> file_system_;
+};
+
+constexpr FileSystemTest::FileId FileSystemTest::MOUNT;
+constexpr FileSystemTest::FileId FileSystemTest::ROOT;
+
+}  // namespace cloudstorage
+
+TEST_F(FileSystemTest, UploadsWrittenRangesOverRemoteContent) {
+  auto expected = content(1000);
+  provider_->add("file", expected);
+  mount();
+  auto file = lookup(ROOT, "file");
+  ASSERT_NE(file, 0u);
+  write(file, std::string(100, 'X'), 100);
+  write(file, std::string(150, 'Y'), 150);
+  write(file, std::string(100, 'Z'), 500);
+  write(file, "tail", 1000);
+  EXPECT_EQ(written(file), (std::map<uint64_t, uint64_t>{
+                               {100, 300}, {500, 600}, {1000, 1004}}));
+  expected.replace(100, 50, std::string(50, 'X'));
+  expected.replace(150, 150, std::string(150, 'Y'));
+  expected.replace(500, 100, std::string(100, 'Z'));
+  expected += "tail";
+  EXPECT_EQ(read(file, 0, 2000), expected);
+  fsync(file);
+  EXPECT_TRUE(wait_for([&] {
+    return flushed() && provider_->content("file") == expected;
+  }));
+  EXPECT_EQ(provider_->uploads(), 1);
+  EXPECT_TRUE(written(file).empty());
+  EXPECT_EQ(read(file, 0, 2000), expected);
+}
+
+TEST_F(FileSystemTest, UploadsAgainFileWrittenDuringUpload) {
+  auto expected = content(1000);
+  provider_->add("file", expected);
+  std::promise<void> held;
+  std::promise<void> released;
+  std::shared_future<void> release = released.get_future();
+  bool first = true;
+  provider_->hold_uploads([&] {
+    if (!first) return;
+    first = false;
+    held.set_value();
+    release.wait();
+  });
+  mount();
+  auto file = lookup(ROOT, "file");
+  write(file, "first", 0);
+  fsync(file);
+  held.get_future().wait();
+  write(file, "second", 10);
+  released.set_value();
+  expected.replace(0, 5, "first");
+  expected.replace(10, 6, "second");
+  EXPECT_TRUE(wait_for([&] {
+    return flushed() && provider_->content("file") == expected;
+  }));
+  EXPECT_EQ(provider_->uploads(), 2);
+}
+
+TEST_F(FileSystemTest, RetriesFailedUploadAfterDelay) {
+  auto expected = content(1000);
+  provider_->add("file", expected);
+  provider_->fail_uploads(1);
+  mount();
+  auto file = lookup(ROOT, "file");
+  write(file, "data", 0);
+  fsync(file);
+  expected.replace(0, 4, "data");
+  EXPECT_TRUE(wait_for([&] {
+    return flushed() && provider_->content("file") == expected;
+  }));
+  auto attempts = provider_->upload_attempts();
+  ASSERT_EQ(attempts.size(), 2u);
+  EXPECT_TRUE(attempts[1] - attempts[0] >= fast().flush_retry_delay_);
+  EXPECT_EQ(provider_->resumes(), 1);
+}
+
+TEST_F(FileSystemTest, StartsOverUploadOfFileWrittenAfterFailure) {
+  auto options = fast();
+  options.flush_retry_delay_ = std::chrono::hours(1);
+  provider_->add("file", content(1000));
+  provider_->fail_uploads(1);
+  mount(options);
+  auto file = lookup(ROOT, "file");
+  write(file, "data", 0);
+  fsync(file);
+  EXPECT_TRUE(wait_for([&] { return provider_->upload_attempts().size(); }));
+  write(file, "more", 4);
+  fsync(file);
+  EXPECT_TRUE(wait_for([&] { return flushed(); }));
+  EXPECT_EQ(provider_->content("file").substr(0, 8), "datamore");
+  EXPECT_EQ(provider_->resumes(), 0);
+}
+
+TEST_F(FileSystemTest, ResumesUploadInterruptedByRestart) {
+  auto options = fast();
+  options.flush_retry_delay_ = std::chrono::hours(1);
+  auto expected = content(1000);
+  provider_->add("file", expected);
+  provider_->fail_uploads(1);
+  mount(options);
+  auto file = lookup(ROOT, "file");
+  write(file, "data", 0);
+  fsync(file);
+  EXPECT_TRUE(wait_for([&] { return provider_->upload_attempts().size(); }));
+  unmount();
+  mount();
+  expected.replace(0, 4, "data");
+  EXPECT_TRUE(wait_for([&] {
+    return flushed() && provider_->content("file") == expected;
+  }));
+  EXPECT_EQ(provider_->resumes(), 1);
+}
+
+TEST_F(FileSystemTest, RecoversJournaledFilesAfterRestart) {
+  auto expected = content(1000);
+  provider_->add("file", expected);
+  mount(never());
+  auto file = lookup(ROOT, "file");
+  write(file, "patch", 10);
+  auto created = file_system_->mknod(ROOT, "new");
+  write(created, "new file", 0);
+  fsync(file);
+  fsync(created);
+  EXPECT_EQ(unrecovered(), 0u);
+  unmount();
+  EXPECT_EQ(provider_->uploads(), 0);
+  mount();
+  expected.replace(10, 5, "patch");
+  EXPECT_TRUE(wait_for([&] {
+    return flushed() && provider_->content("file") == expected &&
+           provider_->content("new") == "new file";
+  }));
+  EXPECT_EQ(unrecovered(), 0u);
+  unmount();
+  mount();
+  EXPECT_TRUE(flushed());
+  EXPECT_EQ(provider_->uploads(), 2);
+}
+
+TEST_F(FileSystemTest, KeepsJournalOfEachMount) {
+  provider_->add("file", "content");
+  mount(never());
+  auto file = lookup(ROOT, "file");
+  write(file, "new", 0);
+  fsync(file);
+  unmount();
+  providers_ = {{"other", create_provider()}};
+  mount(never());
+  unmount();
+  EXPECT_EQ(journals().size(), 2u);
+  providers_ = {{"fake", provider_}};
+  mount();
+  EXPECT_TRUE(wait_for([&] {
+    return flushed() && provider_->content("file") == "newtent";
+  }));
+}
+
+TEST_F(FileSystemTest, RetriesRecoveryWhenLookupFails) {
+  auto expected = content(1000);
+  provider_->add("file", expected);
+  mount(never());
+  write(lookup(ROOT, "file"), "patch", 10);
+  unmount();
+  provider_->fail_listing(IHttpRequest::ServiceUnavailable);
+  mount();
+  EXPECT_TRUE(wait_for([&] { return recover_queue() > 0; }));
+  EXPECT_EQ(unrecovered(), 1u);
+  provider_->fail_listing(0);
+  expected.replace(10, 5, "patch");
+  EXPECT_TRUE(wait_for([&] {
+    return flushed() && provider_->content("file") == expected;
+  }));
+  EXPECT_EQ(unrecovered(), 0u);
+  EXPECT_EQ(provider_->uploads(), 1);
+}
+
+TEST_F(FileSystemTest, DropsJournaledFileOfRemovedDirectory) {
+  provider_->add("dir/");
+  mount(never());
+  auto dir = lookup(ROOT, "dir");
+  auto created = file_system_->mknod(dir, "new");
+  write(created, "new file", 0);
+  fsync(created);
+  unmount();
+  provider_->remove("dir/");
+  mount();
+  EXPECT_TRUE(wait_for([&] { return unrecovered() == 0; }));
+  EXPECT_EQ(recover_queue(), 0u);
+  unmount();
+  auto files = journals();
+  ASSERT_EQ(files.size(), 1u);
+  std::ifstream file(directory_ + "/" + files[0]);
+  EXPECT_TRUE(util::json::from_stream(file)["files"].empty());
+  EXPECT_EQ(provider_->uploads(), 0);
+}
+
+TEST_F(FileSystemTest, KeepsListingsOfAccountsOfSameProviderApart) {
+  cache_directory_ = directory_;
+  auto other = create_provider();
+  for (auto&& p : {provider_, other}) p->add("dir/");
+  provider_->add("dir/first");
+  other->add("dir/second");
+  providers_ = {{"one", provider_}, {"two", other}};
+  auto dir = [&](const std::string& label) {
+    return lookup(lookup(MOUNT, label), "dir");
+  };
+  mount();
+  ASSERT_NE(dir("one"), dir("two"));
+  EXPECT_NE(lookup(dir("one"), "first"), 0u);
+  EXPECT_NE(lookup(dir("two"), "second"), 0u);
+  unmount();
+  provider_->fail_listing(IHttpRequest::ServiceUnavailable);
+  other->fail_listing(IHttpRequest::ServiceUnavailable);
+  mount();
+  EXPECT_NE(lookup(dir("one"), "first"), 0u);
+  EXPECT_EQ(lookup(dir("one"), "second"), 0u);
+  EXPECT_NE(lookup(dir("two"), "second"), 0u);
+  EXPECT_EQ(lookup(dir("two"), "first"), 0u);
+}
+
+TEST_F(FileSystemTest, EvictsUnreferencedSubtree) {
+  provider_->add("dir/");
+  provider_->add("dir/a", "a");
+  provider_->add("dir/sub/");
+  provider_->add("dir/sub/b", "b");
+  mount();
+  auto dir = lookup(ROOT, "dir");
+  auto a = lookup(dir, "a");
+  auto sub = lookup(dir, "sub");
+  auto b = lookup(sub, "b");
+  ASSERT_NE(b, 0u);
+  for (auto inode : {dir, a, sub, b}) file_system_->reference(inode);
+  for (auto inode : {b, a, sub}) file_system_->forget(inode, 1);
+  EXPECT_TRUE(in_shards(a));
+  EXPECT_TRUE(in_shards(sub));
+  EXPECT_FALSE(listed(sub));
+  EXPECT_FALSE(in_shards(b));
+  EXPECT_FALSE(indexed(b));
+  file_system_->forget(dir, 1);
+  EXPECT_TRUE(in_shards(dir));
+  EXPECT_TRUE(indexed(dir));
+  EXPECT_FALSE(listed(dir));
+  EXPECT_FALSE(listed(sub));
+  for (auto inode : {a, sub, b}) {
+    EXPECT_FALSE(in_shards(inode));
+    EXPECT_FALSE(indexed(inode));
+  }
+  auto relisted = lookup(dir, "a");
+  EXPECT_NE(relisted, 0u);
+  EXPECT_EQ(read(relisted, 0, 1), "a");
+}
+
+TEST_F(FileSystemTest, KeepsReferencedAndModifiedNodesWhenEvicting) {
+  provider_->add("dir/");
+  provider_->add("dir/a", "a");
+  provider_->add("dir/c", "c");
+  provider_->add("dir/sub/");
+  provider_->add("dir/sub/b", "b");
+  mount(never());
+  auto dir = lookup(ROOT, "dir");
+  auto a = lookup(dir, "a");
+  auto c = lookup(dir, "c");
+  auto sub = lookup(dir, "sub");
+  auto b = lookup(sub, "b");
+  ASSERT_NE(b, 0u);
+  file_system_->reference(dir);
+  file_system_->reference(a);
+  write(b, "data", 0);
+  file_system_->forget(dir, 1);
+  EXPECT_FALSE(listed(dir));
+  EXPECT_FALSE(in_shards(c));
+  EXPECT_FALSE(indexed(c));
+  for (auto inode : {a, sub, b}) {
+    EXPECT_TRUE(in_shards(inode));
+    EXPECT_TRUE(indexed(inode));
+  }
+  EXPECT_EQ(read(b, 0, 4), "data");
+}
+
+TEST_F(FileSystemTest, KeepsPinnedNodesWhenEvicting) {
+  provider_->add("file", "content");
+  mount();
+  auto file = lookup(ROOT, "file");
+  ASSERT_NE(file, 0u);
+  file_system_->reference(ROOT);
+  file_system_->forget(ROOT, 1);
+  EXPECT_TRUE(in_shards(ROOT));
+  EXPECT_TRUE(listed(ROOT));
+  EXPECT_TRUE(in_shards(file));
+  EXPECT_TRUE(indexed(file));
+}
+
+TEST_F(FileSystemTest, MarksChangedDirectoriesStale) {
+  provider_->add("a/");
+  provider_->add("a/x", "x");
+  provider_->add("b/");
+  provider_->add("c/");
+  provider_->add("c/z", "z");
+  mount();
+  auto a = lookup(ROOT, "a");
+  auto b = lookup(ROOT, "b");
+  auto c = lookup(ROOT, "c");
+  ASSERT_NE(lookup(a, "x"), 0u);
+  ASSERT_NE(lookup(c, "z"), 0u);
+  EXPECT_EQ(lookup(b, "missing"), 0u);
+  EXPECT_TRUE(known_missing(b, "missing"));
+  apply("root_alias", {{"new", {"root_alias"}, nullptr},
+                       {"unknown", {"unknown_parent/"}, nullptr}});
+  EXPECT_EQ(changed(), std::set<FileId>{ROOT});
+  auto moved = std::make_shared<Item>("x", "a/x", 1, IItem::UnknownTimeStamp,
+                                      IItem::FileType::Unknown);
+  apply("root_alias", {{"a/x", {"b/"}, moved}});
+  EXPECT_EQ(changed(), (std::set<FileId>{ROOT, a, b}));
+  EXPECT_FALSE(known_missing(b, "missing"));
+  EXPECT_EQ(changed().count(c), 0u);
+  apply("root_alias", {{"c/z", {}, nullptr}});
+  EXPECT_EQ(changed(), (std::set<FileId>{ROOT, a, b, c}));
+}
@@ -0,0 +1,145 @@
+/*****************************************************************************
+ * MetadataCacheTest.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "gtest/gtest.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#include "MetadataCache.h"
+#include "Utility/Item.h"
+#include "Utility/Utility.h"
+
+using namespace cloudstorage;
+
+namespace {
+
+class MetadataCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = util::temporary_directory() + "cloudstorage-metadata-test";
+    cleanup();
+    mkdir(directory_.c_str(), 0700);
+  }
+
+  void TearDown() override { cleanup(); }
+
+  void cleanup() {
+    std::remove((directory_ + "/metadata.log").c_str());
+    std::remove((directory_ + "/metadata.log.tmp").c_str());
+    rmdir(directory_.c_str());
+  }
+
+  std::string directory_;
+};
+
+MetadataCache::Listing listing(const std::vector<std::string>& names) {
+  MetadataCache::Listing result;
+  result.timestamp_ = std::chrono::system_clock::from_time_t(1000);
+  for (auto&& name : names)
+    result.items_.push_back(std::make_shared<Item>(
+        name, "id-" + name, 10, IItem::UnknownTimeStamp,
+        IItem::FileType::Unknown));
+  return result;
+}
+
+std::vector<std::string> names(const MetadataCache::Listing& listing) {
+  std::vector<std::string> result;
+  for (auto&& item : listing.items_) result.push_back(item->filename());
+  return result;
+}
+
+}  // namespace
+
+TEST_F(MetadataCacheTest, PersistsLatestListing) {
+  {
+    auto cache = MetadataCache::create(directory_);
+    cache->put("a", listing({"x", "y"}));
+    cache->put("b", listing({"z"}));
+    cache->put("a", listing({"w"}));
+  }
+  auto cache = MetadataCache::create(directory_);
+  MetadataCache::Listing result;
+  ASSERT_TRUE(cache->get("a", result));
+  EXPECT_EQ(names(result), std::vector<std::string>{"w"});
+  EXPECT_EQ(result.items_[0]->id(), "id-w");
+  EXPECT_EQ(result.timestamp_, std::chrono::system_clock::from_time_t(1000));
+  ASSERT_TRUE(cache->get("b", result));
+  EXPECT_EQ(names(result), std::vector<std::string>{"z"});
+  EXPECT_FALSE(cache->get("c", result));
+}
+
+TEST_F(MetadataCacheTest, CompactsSupersededListings) {
+  {
+    auto cache = MetadataCache::create(directory_);
+    for (int i = 0; i < 10; i++)
+      cache->put("a", listing({"file" + std::to_string(i)}));
+  }
+  std::ifstream file(directory_ + "/metadata.log");
+  std::string line;
+  int count = 0;
+  while (std::getline(file, line)) count++;
+  EXPECT_EQ(count, 1);
+  MetadataCache::Listing result;
+  ASSERT_TRUE(MetadataCache::create(directory_)->get("a", result));
+  EXPECT_EQ(names(result), std::vector<std::string>{"file9"});
+}
+
+TEST_F(MetadataCacheTest, CompactsWhileOpen) {
+  std::vector<std::string> files;
+  for (int i = 0; i < 1000; i++) files.push_back("file" + std::to_string(i));
+  auto cache = MetadataCache::create(directory_);
+  auto path = directory_ + "/metadata.log";
+  cache->put("a", listing(files));
+  auto line = std::ifstream(path, std::ios::ate).tellg();
+  std::streamoff largest = 0;
+  for (int i = 0; i < 4 * 1024 * 1024 / line; i++) {
+    cache->put("b", listing({"x"}));
+    cache->put("a", listing(files));
+    largest = std::max<std::streamoff>(
+        largest, std::ifstream(path, std::ios::ate).tellg());
+  }
+  EXPECT_LT(largest, 1024 * 1024 + 3 * line);
+  MetadataCache::Listing result;
+  ASSERT_TRUE(cache->get("a", result));
+  EXPECT_EQ(result.items_.size(), files.size());
+  ASSERT_TRUE(cache->get("b", result));
+  EXPECT_EQ(names(result), std::vector<std::string>{"x"});
+  cache->put("c", listing({"y"}));
+  ASSERT_TRUE(cache->get("c", result));
+  EXPECT_EQ(names(result), std::vector<std::string>{"y"});
+}
+
+TEST_F(MetadataCacheTest, IgnoresTruncatedListing) {
+  MetadataCache::create(directory_)->put("a", listing({"x"}));
+  std::ofstream(directory_ + "/metadata.log", std::ios::app) << "b\t1000\t[";
+  auto cache = MetadataCache::create(directory_);
+  MetadataCache::Listing result;
+  EXPECT_TRUE(cache->get("a", result));
+  EXPECT_FALSE(cache->get("b", result));
+  cache->put("b", listing({"y"}));
+  ASSERT_TRUE(cache->get("b", result));
+  EXPECT_EQ(names(result), std::vector<std::string>{"y"});
+}
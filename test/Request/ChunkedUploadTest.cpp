@@ -0,0 +1,221 @@
+/*****************************************************************************
+ * ChunkedUploadTest.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <iterator>
+#include <map>
+#include <thread>
+
+#include "Request/ChunkedUpload.h"
+#include "Utility/HttpMock.h"
+#include "Utility/MemoryProvider.h"
+
+using namespace cloudstorage;
+using ::testing::_;
+using ::testing::AtLeast;
+using ::testing::Invoke;
+
+namespace {
+
+const uint64_t CHUNK_SIZE = 100000;
+const uint64_t FILE_SIZE = 5 * CHUNK_SIZE + 1234;
+const int PARALLELISM = 3;
+
+class UploadCallback : public IUploadFileCallback {
+ public:
+  UploadCallback() : content_(FILE_SIZE, 0), max_read_(), progress_() {
+    for (size_t i = 0; i < content_.size(); i++)
+      content_[i] = static_cast<char>(i % 251);
+  }
+
+  uint32_t putData(char* data, uint32_t maxlength, uint64_t offset) override {
+    auto length = std::min<uint64_t>(maxlength, content_.size() - offset);
+    memcpy(data, content_.data() + offset, length);
+    max_read_ = std::max<uint64_t>(max_read_, length);
+    return static_cast<uint32_t>(length);
+  }
+
+  uint64_t size() override { return content_.size(); }
+
+  void progress(uint64_t, uint64_t now) override { progress_ = now; }
+
+  void done(EitherError<IItem>) override {}
+
+  std::string content_;
+  uint64_t max_read_;
+  std::atomic<uint64_t> progress_;
+};
+
+/**
+ * Stores chunks PUT at urls holding their offsets, on separate threads after
+ * a while, keeping track of how many of them were in progress at once.
+ */
+class ChunkServer {
+ public:
+  ChunkServer() : running_(), max_running_() {}
+
+  ~ChunkServer() { join(); }
+
+  void join() {
+    while (true) {
+      std::vector<std::thread> threads;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (threads_.empty()) return;
+        std::swap(threads, threads_);
+      }
+      for (auto&& thread : threads) thread.join();
+    }
+  }
+
+  IHttpRequest::Pointer create(const std::string& url, const std::string&,
+                               bool) {
+    auto request = std::make_shared<HttpRequestMock>();
+    EXPECT_CALL(*request, setParameter(_, _)).Times(AtLeast(0));
+    EXPECT_CALL(*request, setHeaderParameter(_, _)).Times(AtLeast(0));
+    EXPECT_CALL(*request, send(_, _, _, _, _))
+        .WillOnce(Invoke([=](IHttpRequest::CompleteCallback complete,
+                             std::shared_ptr<std::istream> data,
+                             std::shared_ptr<std::ostream> response,
+                             std::shared_ptr<std::ostream> error,
+                             IHttpRequest::ICallback::Pointer) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          threads_.emplace_back([=] {
+            int running = ++running_;
+            for (int m = max_running_; running > m &&
+                                       !max_running_.compare_exchange_weak(
+                                           m, running);) {
+            }
+            std::string body(std::istreambuf_iterator<char>(*data), {});
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            auto offset = std::stoull(url);
+            {
+              std::lock_guard<std::mutex> lock(mutex_);
+              chunk_[offset] = body;
+            }
+            running_--;
+            complete({offset == failing_ ? IHttpRequest::NotFound
+                                         : IHttpRequest::Ok,
+                      {},
+                      response,
+                      error});
+          });
+        }));
+    return request;
+  }
+
+  std::string content() const {
+    std::string result;
+    for (auto&& chunk : chunk_) result += chunk.second;
+    return result;
+  }
+
+  uint64_t failing_ = FILE_SIZE;
+  std::atomic_int running_;
+  std::atomic_int max_running_;
+  std::mutex mutex_;
+  std::map<uint64_t, std::string> chunk_;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace
+
+class ChunkedUploadTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    ICloudProvider::InitData data;
+    data.http_engine_ = util::make_unique<HttpMock>();
+    data.http_server_ = util::make_unique<MemoryServerFactory>();
+    http_ = static_cast<HttpMock*>(data.http_engine_.get());
+    provider_ = std::make_shared<MemoryProvider>(0);
+    provider_->initialize(std::move(data));
+    EXPECT_CALL(*http_, create(_, "PUT", _))
+        .WillRepeatedly(Invoke(&server_, &ChunkServer::create));
+  }
+
+  void TearDown() { provider_->destroy(); }
+
+  EitherError<void> upload(uint64_t offset = 0) {
+    using Request = cloudstorage::Request<EitherError<IItem>>;
+    auto result = std::make_shared<EitherError<void>>(nullptr);
+    auto request =
+        std::make_shared<Request>(
+            provider_, [](EitherError<IItem>) {},
+            [=](Request::Pointer r) {
+              auto upload = std::make_shared<ChunkedUpload>(
+                  r, callback_, CHUNK_SIZE, PARALLELISM);
+              upload->run(offset,
+                          [=](uint64_t offset, uint64_t) {
+                            return r->provider()->http()->create(
+                                std::to_string(offset), "PUT");
+                          },
+                          [](uint64_t, Response&) {
+                            return EitherError<void>(nullptr);
+                          },
+                          [=](EitherError<void> e) {
+                            *result = e;
+                            if (e.left()) return r->done(e.left());
+                            r->done(IItem::Pointer());
+                          });
+            })
+            ->run();
+    request->result();
+    server_.join();
+    return *result;
+  }
+
+  ChunkServer server_;
+  HttpMock* http_;
+  std::shared_ptr<MemoryProvider> provider_;
+  std::shared_ptr<UploadCallback> callback_ =
+      std::make_shared<UploadCallback>();
+};
+
+TEST_F(ChunkedUploadTest, SendsChunksInParallel) {
+  auto e = upload();
+  EXPECT_FALSE(e.left());
+  EXPECT_EQ(server_.chunk_.size(), 6u);
+  EXPECT_TRUE(server_.content() == callback_->content_);
+  EXPECT_GT(server_.max_running_, 1);
+  EXPECT_LE(server_.max_running_, PARALLELISM);
+  EXPECT_LE(callback_->max_read_, ChunkedUpload::BufferSize);
+  EXPECT_EQ(callback_->progress_, FILE_SIZE);
+}
+
+TEST_F(ChunkedUploadTest, StartsAtOffset) {
+  auto e = upload(3 * CHUNK_SIZE);
+  EXPECT_FALSE(e.left());
+  ASSERT_EQ(server_.chunk_.size(), 3u);
+  EXPECT_EQ(server_.chunk_.begin()->first, 3 * CHUNK_SIZE);
+  EXPECT_TRUE(server_.content() ==
+              callback_->content_.substr(3 * CHUNK_SIZE));
+}
+
+TEST_F(ChunkedUploadTest, StopsAtFirstError) {
+  server_.failing_ = 0;
+  auto e = upload();
+  ASSERT_TRUE(e.left());
+  EXPECT_TRUE(e.left()->code_ == IHttpRequest::NotFound);
+  EXPECT_LT(server_.chunk_.size(), 6u);
+}
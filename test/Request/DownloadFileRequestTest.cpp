@@ -0,0 +1,183 @@
+/*****************************************************************************
+ * DownloadFileRequestTest.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "gtest/gtest.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+
+#include "Request/DownloadFileRequest.h"
+#include "Utility/BlockCache.h"
+#include "Utility/Item.h"
+#include "Utility/LocalHttpServer.h"
+#include "Utility/MemoryProvider.h"
+
+#if defined(WITH_CURL) && defined(__unix__)
+
+using namespace cloudstorage;
+
+namespace {
+
+const uint64_t FILE_SIZE = 3 * BlockCache::BlockSize;
+
+class DownloadCallback : public IDownloadFileCallback {
+ public:
+  void receivedData(const char* data, uint32_t length) override {
+    data_.append(data, length);
+  }
+
+  void done(EitherError<void>) override {}
+
+  void progress(uint64_t, uint64_t) override {}
+
+  std::string data_;
+};
+
+/**
+ * Gives out url of the file on a fixed server.
+ */
+class UrlProvider : public MemoryProvider {
+ public:
+  UrlProvider(const std::string& url) : MemoryProvider(FILE_SIZE), url_(url) {}
+
+  GetItemUrlRequest::Pointer getItemUrlAsync(
+      IItem::Pointer, GetItemUrlCallback callback) override {
+    using Request = cloudstorage::Request<EitherError<std::string>>;
+    auto url = url_;
+    return std::make_shared<Request>(shared_from_this(), callback,
+                                     [=](Request::Pointer r) { r->done(url); })
+        ->run();
+  }
+
+ private:
+  std::string url_;
+};
+
+}  // namespace
+
+class DownloadFileRequestTest : public ::testing::Test {
+ public:
+  void SetUp() override {
+    for (size_t i = 0; i < content_.size(); i++)
+      content_[i] = static_cast<char>('a' + i % 26);
+    directory_ = util::temporary_directory() + "cloudstorage-download-test";
+    cleanup();
+    mkdir(directory_.c_str(), 0700);
+    IHttp::Options options;
+    options.max_range_skip_ = 2 * BlockCache::BlockSize;
+    ICloudProvider::InitData data;
+    data.http_engine_ = IHttp::create(options);
+    data.http_server_ = util::make_unique<MemoryServerFactory>();
+    data.cache_directory_ = directory_;
+    data.cache_size_ = FILE_SIZE;
+    provider_ = std::make_shared<UrlProvider>(server_.url() + "/file");
+    provider_->initialize(std::move(data));
+    file_ = std::make_shared<Item>("file", "file", FILE_SIZE,
+                                   IItem::UnknownTimeStamp,
+                                   IItem::FileType::Unknown);
+    file_->set_url(server_.url() + "/file");
+    cached_file_ = std::make_shared<Item>("file", "file", FILE_SIZE,
+                                          std::chrono::system_clock::now(),
+                                          IItem::FileType::Unknown);
+    cached_file_->set_url(server_.url() + "/file");
+  }
+
+  void TearDown() override {
+    provider_->destroy();
+    provider_ = nullptr;
+    cleanup();
+  }
+
+  void cleanup() {
+    std::remove((directory_ + "/blocks.bin").c_str());
+    std::remove((directory_ + "/blocks.json").c_str());
+    rmdir(directory_.c_str());
+  }
+
+  std::string download(Range range) { return download(file_, range); }
+
+  std::string download(std::shared_ptr<Item> file, Range range) {
+    auto callback = std::make_shared<DownloadCallback>();
+    auto e = std::make_shared<DownloadFileFromUrlRequest>(provider_, file,
+                                                          callback, range)
+                 ->run()
+                 ->result();
+    EXPECT_FALSE(e.left());
+    return callback->data_;
+  }
+
+  std::atomic_int hits_{0};
+  std::string content_ = std::string(FILE_SIZE, 0);
+  LocalHttpServer server_{[=](const std::string&, const std::string& path) {
+    hits_++;
+    return LocalHttpServer::Response{IHttpRequest::Ok, content_,
+                                     path == "/stale"};
+  }};
+  std::string directory_;
+  std::shared_ptr<UrlProvider> provider_;
+  std::shared_ptr<Item> file_;
+  std::shared_ptr<Item> cached_file_;
+};
+
+TEST_F(DownloadFileRequestTest, FailsRangeFarIntoFileOfIgnoringServer) {
+  EXPECT_EQ(download(Range{50, 10}), content_.substr(50, 10));
+  EXPECT_EQ(hits_, 1);
+  auto callback = std::make_shared<DownloadCallback>();
+  auto e = std::make_shared<DownloadFileFromUrlRequest>(
+               provider_, file_, callback, Range{FILE_SIZE - 10, 10})
+               ->run()
+               ->result();
+  ASSERT_NE(e.left(), nullptr);
+  EXPECT_TRUE(e.left()->code_ == IHttpRequest::RangeUnsupported);
+  EXPECT_TRUE(callback->data_.empty());
+  EXPECT_EQ(hits_, 1);
+}
+
+TEST_F(DownloadFileRequestTest, RetryDoesNotRepeatOrMisplaceData) {
+  cached_file_->set_url(server_.url() + "/stale");
+  auto range = Range{0, 2 * BlockCache::BlockSize};
+  EXPECT_EQ(download(cached_file_, range), content_.substr(0, range.size_));
+  EXPECT_EQ(hits_, 2);
+  EXPECT_EQ(download(cached_file_, range), content_.substr(0, range.size_));
+  EXPECT_EQ(download(cached_file_, Range{BlockCache::BlockSize + 10, 10}),
+            content_.substr(BlockCache::BlockSize + 10, 10));
+  EXPECT_EQ(hits_, 2);
+}
+
+TEST_F(DownloadFileRequestTest, DoesNotExtendSmallRangesToBlocks) {
+  auto small = Range{BlockCache::BlockSize + 10, 4096};
+  EXPECT_EQ(download(cached_file_, small),
+            content_.substr(small.start_, small.size_));
+  EXPECT_EQ(provider_->cacheStatistics().size_, 0u);
+  auto large = Range{BlockCache::BlockSize / 2, BlockCache::BlockSize};
+  EXPECT_EQ(download(cached_file_, large),
+            content_.substr(large.start_, large.size_));
+  EXPECT_EQ(provider_->cacheStatistics().size_, 2 * BlockCache::BlockSize);
+  auto hits = hits_.load();
+  EXPECT_EQ(download(cached_file_, small),
+            content_.substr(small.start_, small.size_));
+  EXPECT_EQ(hits_, hits);
+}
+
+#endif  // WITH_CURL && __unix__
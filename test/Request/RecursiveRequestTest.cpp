@@ -0,0 +1,233 @@
+/*****************************************************************************
+ * RecursiveRequestTest.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "Request/RecursiveRequest.h"
+#include "Utility/HttpMock.h"
+#include "Utility/MemoryProvider.h"
+
+using namespace cloudstorage;
+using ::testing::_;
+using ::testing::AtLeast;
+using ::testing::Invoke;
+
+namespace {
+
+const int DIRECTORY_COUNT = 4;
+const int FILE_COUNT = 10;
+const int PARALLELISM = 3;
+
+IItem::Pointer item(const std::string& id, IItem::FileType type) {
+  return std::make_shared<Item>(id, id, IItem::UnknownSize,
+                                IItem::UnknownTimeStamp, type);
+}
+
+/**
+ * Provider whose root holds DIRECTORY_COUNT directories with FILE_COUNT files
+ * each.
+ */
+class TreeProvider : public MemoryProvider {
+ public:
+  TreeProvider() : MemoryProvider(0) {}
+
+  ListDirectoryRequest::Pointer listDirectorySimpleAsync(
+      IItem::Pointer directory, ListDirectoryCallback callback) override {
+    using Request = cloudstorage::Request<EitherError<IItem::List>>;
+    return std::make_shared<Request>(
+               shared_from_this(), callback,
+               [=](Request::Pointer r) {
+                 IItem::List list;
+                 if (directory->id() == "root") {
+                   for (int i = 0; i < DIRECTORY_COUNT; i++)
+                     list.push_back(item("d" + std::to_string(i),
+                                         IItem::FileType::Directory));
+                 } else {
+                   for (int i = 0; i < FILE_COUNT; i++)
+                     list.push_back(
+                         item(directory->id() + "/f" + std::to_string(i),
+                              IItem::FileType::Unknown));
+                 }
+                 r->done(list);
+               })
+        ->run();
+  }
+};
+
+/**
+ * Answers DELETE requests on separate threads after a while, keeping track
+ * of how many of them were in progress at once.
+ */
+class DeleteServer {
+ public:
+  DeleteServer() : running_(), max_running_() {}
+
+  ~DeleteServer() { join(); }
+
+  void join() {
+    while (true) {
+      std::vector<std::thread> threads;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (threads_.empty()) return;
+        std::swap(threads, threads_);
+      }
+      for (auto&& thread : threads) thread.join();
+    }
+  }
+
+  IHttpRequest::Pointer create(const std::string& url, const std::string&,
+                               bool) {
+    auto request = std::make_shared<HttpRequestMock>();
+    EXPECT_CALL(*request, setParameter(_, _)).Times(AtLeast(0));
+    EXPECT_CALL(*request, setHeaderParameter(_, _)).Times(AtLeast(0));
+    EXPECT_CALL(*request, send(_, _, _, _, _))
+        .WillOnce(Invoke([=](IHttpRequest::CompleteCallback complete,
+                             std::shared_ptr<std::istream>,
+                             std::shared_ptr<std::ostream> response,
+                             std::shared_ptr<std::ostream> error,
+                             IHttpRequest::ICallback::Pointer) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          threads_.emplace_back([=] {
+            int running = ++running_;
+            for (int m = max_running_; running > m &&
+                                       !max_running_.compare_exchange_weak(
+                                           m, running);) {
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            {
+              std::lock_guard<std::mutex> lock(mutex_);
+              deleted_.push_back(url);
+            }
+            running_--;
+            complete({url == failing_ ? IHttpRequest::NotFound
+                                      : IHttpRequest::Ok,
+                      {},
+                      response,
+                      error});
+          });
+        }));
+    return request;
+  }
+
+  std::string failing_;
+  std::atomic_int running_;
+  std::atomic_int max_running_;
+  std::mutex mutex_;
+  std::vector<std::string> deleted_;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace
+
+class RecursiveRequestTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    ICloudProvider::InitData data;
+    data.http_engine_ = util::make_unique<HttpMock>();
+    data.http_server_ = util::make_unique<MemoryServerFactory>();
+    http_ = static_cast<HttpMock*>(data.http_engine_.get());
+    provider_ = std::make_shared<TreeProvider>();
+    provider_->initialize(std::move(data));
+    EXPECT_CALL(*http_, create(_, "DELETE", _))
+        .WillRepeatedly(Invoke(&server_, &DeleteServer::create));
+  }
+
+  void TearDown() { provider_->destroy(); }
+
+  EitherError<void> remove(bool cancel = false) {
+    using Request = RecursiveRequest<EitherError<void>>;
+    auto visitor = [](Request::Pointer r, IItem::Pointer item,
+                      Request::CompleteCallback complete) {
+      r->request(
+          [=](util::Output) {
+            return r->provider()->http()->create(item->id(), "DELETE");
+          },
+          [=](EitherError<Response> e) {
+            if (e.left())
+              complete(e.left());
+            else
+              complete(nullptr);
+          });
+    };
+    auto request = std::make_shared<Request>(
+                       provider_, item("root", IItem::FileType::Directory),
+                       [](EitherError<void>) {}, visitor, PARALLELISM)
+                       ->run();
+    if (cancel) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(25));
+      request->cancel();
+    }
+    auto result = request->result();
+    server_.join();
+    return result;
+  }
+
+  DeleteServer server_;
+  HttpMock* http_;
+  std::shared_ptr<TreeProvider> provider_;
+};
+
+TEST_F(RecursiveRequestTest, LimitsConcurrency) {
+  auto e = remove();
+  EXPECT_FALSE(e.left());
+  EXPECT_EQ(server_.deleted_.size(),
+            static_cast<size_t>(DIRECTORY_COUNT * (FILE_COUNT + 1) + 1));
+  EXPECT_GT(server_.max_running_, 1);
+  EXPECT_LE(server_.max_running_, PARALLELISM);
+}
+
+TEST_F(RecursiveRequestTest, VisitsChildrenFirst) {
+  remove();
+  std::unordered_map<std::string, size_t> position;
+  for (size_t i = 0; i < server_.deleted_.size(); i++)
+    position[server_.deleted_[i]] = i;
+  for (int i = 0; i < DIRECTORY_COUNT; i++) {
+    auto directory = "d" + std::to_string(i);
+    for (int j = 0; j < FILE_COUNT; j++)
+      EXPECT_LT(position[directory + "/f" + std::to_string(j)],
+                position[directory]);
+    EXPECT_LT(position[directory], position["root"]);
+  }
+}
+
+TEST_F(RecursiveRequestTest, StopsAtFirstError) {
+  server_.failing_ = "d0/f0";
+  auto e = remove();
+  ASSERT_TRUE(e.left());
+  EXPECT_TRUE(e.left()->code_ == IHttpRequest::NotFound);
+  EXPECT_EQ(std::count(server_.deleted_.begin(), server_.deleted_.end(),
+                       std::string("root")),
+            0);
+}
+
+TEST_F(RecursiveRequestTest, Cancels) {
+  auto e = remove(true);
+  ASSERT_TRUE(e.left());
+  EXPECT_TRUE(e.left()->code_ == IHttpRequest::Aborted);
+  EXPECT_LT(server_.deleted_.size(),
+            static_cast<size_t>(DIRECTORY_COUNT * (FILE_COUNT + 1) + 1));
+}
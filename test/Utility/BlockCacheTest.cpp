@@ -0,0 +1,110 @@
+/*****************************************************************************
+ * BlockCacheTest.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "gtest/gtest.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <fstream>
+
+#include "Utility/BlockCache.h"
+#include "Utility/Item.h"
+#include "Utility/Utility.h"
+
+using namespace cloudstorage;
+
+namespace {
+
+class BlockCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    directory_ = util::temporary_directory() + "cloudstorage-test-blocks";
+    cleanup();
+    mkdir(directory_.c_str(), 0700);
+  }
+
+  void TearDown() override { cleanup(); }
+
+  void cleanup() {
+    std::remove((directory_ + "/blocks.bin").c_str());
+    std::remove((directory_ + "/blocks.json").c_str());
+    rmdir(directory_.c_str());
+  }
+
+  std::string directory_;
+};
+
+std::string block(char c) { return std::string(BlockCache::BlockSize, c); }
+
+}  // namespace
+
+TEST_F(BlockCacheTest, EvictsLeastRecentlyUsedBlocks) {
+  BlockCache cache(directory_, 2 * BlockCache::BlockSize);
+  std::string data;
+  cache.put("file", 0, block('a'));
+  cache.put("file", 1, block('b'));
+  EXPECT_TRUE(cache.get("file", 0, data));
+  cache.put("file", 2, block('c'));
+  EXPECT_FALSE(cache.get("file", 1, data));
+  ASSERT_TRUE(cache.get("file", 0, data));
+  EXPECT_EQ(data, block('a'));
+  ASSERT_TRUE(cache.get("file", 2, data));
+  EXPECT_EQ(data, block('c'));
+
+  auto statistics = cache.statistics();
+  EXPECT_EQ(statistics.hits_, 3u);
+  EXPECT_EQ(statistics.misses_, 1u);
+  EXPECT_EQ(statistics.size_, 2 * BlockCache::BlockSize);
+}
+
+TEST_F(BlockCacheTest, PersistsAcrossInstances) {
+  BlockCache(directory_, 4 * BlockCache::BlockSize).put("file", 3, "tail");
+  EXPECT_TRUE(std::ifstream(directory_ + "/blocks.bin").good());
+  EXPECT_TRUE(std::ifstream(directory_ + "/blocks.json").good());
+  {
+    BlockCache cache(directory_, 4 * BlockCache::BlockSize);
+    std::string data;
+    ASSERT_TRUE(cache.get("file", 3, data));
+    EXPECT_EQ(data, "tail");
+    EXPECT_EQ(cache.statistics().size_, 4u);
+  }
+  {
+    BlockCache cache(directory_, 4 * BlockCache::BlockSize);
+    std::string data;
+    EXPECT_TRUE(cache.get("file", 3, data));
+  }
+}
+
+TEST_F(BlockCacheTest, KeyDependsOnItemVersion) {
+  auto now = std::chrono::system_clock::now();
+  Item item("file", "id", 10, now, IItem::FileType::Unknown);
+  Item modified("file", "id", 10, now + std::chrono::seconds(1),
+                IItem::FileType::Unknown);
+  auto key = BlockCache::key("provider", item);
+  EXPECT_FALSE(key.empty());
+  EXPECT_NE(BlockCache::key("provider", modified), key);
+  EXPECT_NE(BlockCache::key("other", item), key);
+  Item unknown("file", "id", IItem::UnknownSize, now,
+               IItem::FileType::Unknown);
+  EXPECT_EQ(BlockCache::key("provider", unknown), "");
+}
@@ -0,0 +1,243 @@
+/*****************************************************************************
+ * CurlHttpTest.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <sstream>
+#include <thread>
+
+#include "IHttp.h"
+#include "Utility/LocalHttpServer.h"
+
+#if defined(WITH_CURL) && defined(__unix__)
+
+using namespace cloudstorage;
+
+namespace {
+
+IHttpRequest::Response get(
+    IHttp& http, const std::string& url, const std::string& range = "",
+    IHttpRequest::Priority priority = IHttpRequest::Priority::Metadata) {
+  std::promise<IHttpRequest::Response> result;
+  auto request = http.create(url);
+  request->setPriority(priority);
+  if (!range.empty()) request->setHeaderParameter("Range", range);
+  request->send(
+      [&](IHttpRequest::Response response) { result.set_value(response); },
+      std::make_shared<std::stringstream>(),
+      std::make_shared<std::stringstream>(),
+      std::make_shared<std::stringstream>());
+  return result.get_future().get();
+}
+
+std::string body(const IHttpRequest::Response& response) {
+  return static_cast<std::stringstream&>(*response.output_stream_).str();
+}
+
+void send(IHttp& http, const std::string& url, IHttpRequest::Priority priority,
+          const std::string& group, std::function<void()> done) {
+  auto request = http.create(url);
+  request->setPriority(priority);
+  request->setGroup(group);
+  request->send([=](IHttpRequest::Response) { done(); },
+                std::make_shared<std::stringstream>(),
+                std::make_shared<std::stringstream>(),
+                std::make_shared<std::stringstream>());
+}
+
+class ConcurrencyCounter {
+ public:
+  void enter() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    peak_ = std::max(peak_, ++current_);
+  }
+
+  void leave() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    current_--;
+  }
+
+  int peak() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return peak_;
+  }
+
+ private:
+  std::mutex mutex_;
+  int current_ = 0;
+  int peak_ = 0;
+};
+
+}  // namespace
+
+TEST(CurlHttpTest, EmulatesRangeIgnoredByServer) {
+  std::string content(1000, 0);
+  for (size_t i = 0; i < content.size(); i++) content[i] = 'a' + i % 26;
+  LocalHttpServer server([&](const std::string&, const std::string&) {
+    return LocalHttpServer::Response{IHttpRequest::Ok, content};
+  });
+  std::vector<std::string> hosts;
+  IHttp::Options options;
+  options.max_range_skip_ = 100;
+  options.range_unsupported_ = [&](const std::string& host, Range) {
+    hosts.push_back(host);
+  };
+  auto http = IHttp::create(options);
+
+  auto response = get(*http, server.url() + "/file", "bytes=10-19");
+  EXPECT_EQ(response.http_code_, 206);
+  EXPECT_EQ(body(response), content.substr(10, 10));
+  auto content_range = response.headers_.find("content-range");
+  ASSERT_NE(content_range, response.headers_.end());
+  EXPECT_EQ(content_range->second, "bytes 10-19/1000");
+  EXPECT_EQ(hosts, std::vector<std::string>{server.url()});
+
+  auto statistics = http->statistics();
+  EXPECT_EQ(statistics.ranges_unsupported_, 1u);
+  EXPECT_GE(statistics.bytes_discarded_, 10u);
+}
+
+TEST(CurlHttpTest, FailsRangeTooFarIntoIgnoringServer) {
+  std::atomic_int hits(0);
+  LocalHttpServer server([&](const std::string&, const std::string&) {
+    hits++;
+    return LocalHttpServer::Response{IHttpRequest::Ok, std::string(1000, 'x')};
+  });
+  IHttp::Options options;
+  options.max_range_skip_ = 100;
+  auto http = IHttp::create(options);
+
+  auto response = get(*http, server.url() + "/file", "bytes=500-509");
+  EXPECT_TRUE(response.http_code_ == IHttpRequest::RangeUnsupported);
+  EXPECT_EQ(hits, 1);
+
+  response = get(*http, server.url() + "/file?signature=2", "bytes=500-509");
+  EXPECT_TRUE(response.http_code_ == IHttpRequest::RangeUnsupported);
+  EXPECT_EQ(hits, 1);
+
+  response = get(*http, server.url() + "/file", "bytes=50-59");
+  EXPECT_EQ(response.http_code_, 206);
+  EXPECT_EQ(body(response), std::string(10, 'x'));
+  EXPECT_EQ(hits, 2);
+
+  response = get(*http, server.url() + "/other", "bytes=500-509");
+  EXPECT_TRUE(response.http_code_ == IHttpRequest::RangeUnsupported);
+  EXPECT_EQ(hits, 3);
+}
+
+TEST(CurlHttpTest, ForgetsRangeIgnoringResource) {
+  std::atomic_int hits(0);
+  LocalHttpServer server([&](const std::string&, const std::string&) {
+    hits++;
+    return LocalHttpServer::Response{IHttpRequest::Ok, std::string(1000, 'x')};
+  });
+  IHttp::Options options;
+  options.max_range_skip_ = 100;
+  options.range_unsupported_expiry_ = 0;
+  auto http = IHttp::create(options);
+
+  get(*http, server.url() + "/file", "bytes=500-509");
+  get(*http, server.url() + "/file", "bytes=500-509");
+  EXPECT_EQ(hits, 2);
+}
+
+TEST(CurlHttpTest, DoesNotTakeRedirectForIgnoredRange) {
+  LocalHttpServer server([&](const std::string&, const std::string&) {
+    return LocalHttpServer::Response{302, std::string(1000, 'x')};
+  });
+  IHttp::Options options;
+  options.max_range_skip_ = 100;
+  auto http = IHttp::create(options);
+  std::promise<IHttpRequest::Response> result;
+  auto request = http->create(server.url() + "/file", "GET", false);
+  request->setHeaderParameter("Range", "bytes=500-509");
+  request->send(
+      [&](IHttpRequest::Response response) { result.set_value(response); },
+      std::make_shared<std::stringstream>(),
+      std::make_shared<std::stringstream>(),
+      std::make_shared<std::stringstream>());
+  EXPECT_EQ(result.get_future().get().http_code_, 302);
+  EXPECT_EQ(http->statistics().ranges_unsupported_, 0u);
+}
+
+TEST(CurlHttpTest, InteractiveLatencyBoundedUnderBulkLoad) {
+  const auto bulk_duration = std::chrono::milliseconds(200);
+  const int bulk_count = 16;
+  LocalHttpServer server([&](const std::string&, const std::string& path) {
+    if (path == "/bulk") std::this_thread::sleep_for(bulk_duration);
+    return LocalHttpServer::Response{IHttpRequest::Ok, "ok"};
+  });
+  auto http = IHttp::create();
+  std::atomic_bool done(false);
+  std::atomic_int bulk_finished(0);
+  std::function<void()> bulk = [&] {
+    bulk_finished++;
+    if (!done)
+      send(*http, server.url() + "/bulk", IHttpRequest::Priority::Bulk, "",
+           bulk);
+  };
+  for (int i = 0; i < bulk_count; i++)
+    send(*http, server.url() + "/bulk", IHttpRequest::Priority::Bulk, "",
+         bulk);
+  std::this_thread::sleep_for(bulk_duration / 2);
+  auto worst = std::chrono::steady_clock::duration::zero();
+  for (int i = 0; i < 10; i++) {
+    auto start = std::chrono::steady_clock::now();
+    auto response = get(*http, server.url() + "/interactive", "",
+                        IHttpRequest::Priority::Interactive);
+    EXPECT_EQ(response.http_code_, 200);
+    worst = std::max(worst, std::chrono::steady_clock::now() - start);
+  }
+  EXPECT_LT(worst, bulk_duration / 2);
+  done = true;
+  while (bulk_finished < bulk_count)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+}
+
+TEST(CurlHttpTest, LimitsRequestsInFlightPerGroup) {
+  ConcurrencyCounter counter;
+  LocalHttpServer server([&](const std::string&, const std::string&) {
+    counter.enter();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    counter.leave();
+    return LocalHttpServer::Response{IHttpRequest::Ok, "ok"};
+  });
+  IHttp::Options options;
+  options.max_group_requests_ = 3;
+  auto http = IHttp::create(options);
+  std::promise<void> finished;
+  std::atomic_int count(0);
+  const int request_count = 30;
+  for (int i = 0; i < request_count; i++)
+    send(*http, server.url() + "/item", IHttpRequest::Priority::Metadata,
+         "provider", [&] {
+           if (++count == request_count) finished.set_value();
+         });
+  finished.get_future().wait();
+  EXPECT_EQ(counter.peak(), 3);
+}
+
+#endif  // WITH_CURL && __unix__
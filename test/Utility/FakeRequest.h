@@ -0,0 +1,124 @@
+/*****************************************************************************
+ * FakeRequest.h
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#ifndef FAKEREQUEST_H
+#define FAKEREQUEST_H
+
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "IHttp.h"
+#include "Utility/Utility.h"
+
+/**
+ * Request passing what was sent to a handler, which writes the response and
+ * returns the http code. Handler is run by the given function. Like curl,
+ * it delivers body of an unsuccessful response to the error stream.
+ */
+class FakeRequest : public cloudstorage::IHttpRequest {
+ public:
+  using Handler = std::function<int(const FakeRequest&, const std::string& body,
+                                    std::ostream& response,
+                                    HeaderParameters& headers)>;
+  using Run = std::function<void(const FakeRequest&, std::function<void()>)>;
+
+  FakeRequest(const std::string& url, const std::string& method,
+              Handler handler, Run run)
+      : url_(url), method_(method), handler_(handler), run_(run) {}
+
+  void setParameter(const std::string& parameter,
+                    const std::string& value) override {
+    parameters_[parameter] = value;
+  }
+
+  void setHeaderParameter(const std::string& parameter,
+                          const std::string& value) override {
+    headers_.erase(parameter);
+    headers_.insert({parameter, value});
+  }
+
+  const GetParameters& parameters() const override { return parameters_; }
+  const HeaderParameters& headerParameters() const override {
+    return headers_;
+  }
+  const std::string& url() const override { return url_; }
+  const std::string& method() const override { return method_; }
+  bool follow_redirect() const override { return true; }
+
+  std::string parameter(const std::string& name) const {
+    auto it = parameters_.find(name);
+    return it == parameters_.end() ? ""
+                                   : cloudstorage::util::Url::unescape(
+                                         it->second);
+  }
+
+  std::string header(const std::string& name) const {
+    auto it = headers_.find(name);
+    return it == headers_.end() ? "" : it->second;
+  }
+
+  void send(CompleteCallback complete, std::shared_ptr<std::istream> data,
+            std::shared_ptr<std::ostream> response,
+            std::shared_ptr<std::ostream> error,
+            ICallback::Pointer) const override {
+    auto request = *this;
+    run_(*this, [=] {
+      std::stringstream body, output;
+      if (data) body << data->rdbuf();
+      HeaderParameters headers;
+      auto code = request.handler_(request, body.str(), output, headers);
+      *(isSuccess(code) ? response : error) << output.str();
+      complete({code, headers, response, error});
+    });
+  }
+
+ private:
+  std::string url_;
+  std::string method_;
+  Handler handler_;
+  Run run_;
+  GetParameters parameters_;
+  HeaderParameters headers_;
+};
+
+/**
+ * Creates FakeRequests handled right away by the given handler.
+ */
+class FakeHttp : public cloudstorage::IHttp {
+ public:
+  FakeHttp(FakeRequest::Handler handler) : handler_(handler) {}
+
+  cloudstorage::IHttpRequest::Pointer create(const std::string& url,
+                                             const std::string& method,
+                                             bool) const override {
+    return std::make_shared<FakeRequest>(
+        url, method, handler_,
+        [](const FakeRequest&, std::function<void()> task) { task(); });
+  }
+
+ private:
+  FakeRequest::Handler handler_;
+};
+
+#endif  // FAKEREQUEST_H
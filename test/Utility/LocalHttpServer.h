@@ -0,0 +1,176 @@
+/*****************************************************************************
+ * LocalHttpServer.h
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#ifndef LOCALHTTPSERVER_H
+#define LOCALHTTPSERVER_H
+
+#ifdef __unix__
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Minimal keep-alive http/1.1 server listening on a random loopback port, used
+ * as a stand-in for cloud providers' endpoints in tests and benchmarks.
+ */
+class LocalHttpServer {
+ public:
+  struct Response {
+    int code_;
+    std::string body_;
+    // Only the first half of the body is sent before the connection is
+    // closed.
+    bool truncated_ = false;
+  };
+
+  using Handler = std::function<Response(const std::string& method,
+                                         const std::string& path)>;
+
+  LocalHttpServer(Handler handler = nullptr)
+      : handler_(handler ? handler
+                         : [](const std::string&, const std::string&) {
+                             return Response{200, "ok"};
+                           }),
+        done_(),
+        socket_(::socket(AF_INET, SOCK_STREAM, 0)),
+        port_() {
+    int value = 1;
+    setsockopt(socket_, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    socklen_t length = sizeof(address);
+    bind(socket_, reinterpret_cast<sockaddr*>(&address), length);
+    listen(socket_, SOMAXCONN);
+    getsockname(socket_, reinterpret_cast<sockaddr*>(&address), &length);
+    port_ = ntohs(address.sin_port);
+    thread_ = std::thread(&LocalHttpServer::accept, this);
+  }
+
+  ~LocalHttpServer() {
+    done_ = true;
+    thread_.join();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto&& t : connections_) t.join();
+    close(socket_);
+  }
+
+  std::string url() const {
+    return "http://127.0.0.1:" + std::to_string(port_);
+  }
+
+ private:
+  static bool wait(int fd) {
+    pollfd descriptor = {fd, POLLIN, 0};
+    return poll(&descriptor, 1, POLL_INTERVAL) > 0;
+  }
+
+  void accept() {
+    while (!done_) {
+      if (!wait(socket_)) continue;
+      int connection = ::accept(socket_, nullptr, nullptr);
+      if (connection < 0) continue;
+      int value = 1;
+      setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+      std::lock_guard<std::mutex> lock(mutex_);
+      connections_.emplace_back(&LocalHttpServer::serve, this, connection);
+    }
+  }
+
+  static bool receive(int connection, std::string& buffer) {
+    char data[4096];
+    if (!wait(connection)) return true;
+    auto length = recv(connection, data, sizeof(data), 0);
+    if (length <= 0) return false;
+    buffer.append(data, static_cast<size_t>(length));
+    return true;
+  }
+
+  void serve(int connection) {
+    std::string buffer;
+    while (!done_) {
+      auto header_end = buffer.find("\r\n\r\n");
+      if (header_end == std::string::npos) {
+        if (!receive(connection, buffer)) break;
+        continue;
+      }
+      auto header = buffer.substr(0, header_end);
+      size_t content_length = 0;
+      auto length_it = lower(header).find("content-length:");
+      if (length_it != std::string::npos)
+        content_length = std::stoul(header.substr(length_it + 15));
+      bool valid = true;
+      while (valid && !done_ &&
+             buffer.size() < header_end + 4 + content_length)
+        valid = receive(connection, buffer);
+      if (!valid || done_) break;
+      buffer.erase(0, header_end + 4 + content_length);
+      auto method_end = header.find(' ');
+      auto path_end = header.find(' ', method_end + 1);
+      auto response =
+          handler_(header.substr(0, method_end),
+                   header.substr(method_end + 1, path_end - method_end - 1));
+      auto message = "HTTP/1.1 " + std::to_string(response.code_) +
+                     " Status\r\nContent-Length: " +
+                     std::to_string(response.body_.size()) + "\r\n\r\n" +
+                     response.body_;
+      if (response.truncated_)
+        message.resize(message.size() - response.body_.size() / 2);
+      if (send(connection, message.c_str(), message.size(), MSG_NOSIGNAL) < 0 ||
+          response.truncated_)
+        break;
+    }
+    close(connection);
+  }
+
+  static std::string lower(std::string str) {
+    for (auto&& c : str) c = static_cast<char>(std::tolower(c));
+    return str;
+  }
+
+  static constexpr int POLL_INTERVAL = 50;
+
+  Handler handler_;
+  std::atomic_bool done_;
+  int socket_;
+  uint16_t port_;
+  std::mutex mutex_;
+  std::vector<std::thread> connections_;
+  std::thread thread_;
+};
+
+#endif  // __unix__
+#endif  // LOCALHTTPSERVER_H
@@ -0,0 +1,248 @@
+/*****************************************************************************
+ * MemoryProvider.h
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#ifndef MEMORYPROVIDER_H
+#define MEMORYPROVIDER_H
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CloudProvider/CloudProvider.h"
+#include "Utility/Auth.h"
+#include "Utility/Item.h"
+#include "Utility/Utility.h"
+
+/**
+ * Serves ranges of a file whose byte at offset i is i % Period, after a fixed
+ * latency, delivering the data in the same slices as curl would, on a
+ * separate thread.
+ */
+class MemoryHttpRequest : public cloudstorage::IHttpRequest {
+ public:
+  enum : uint32_t { WriteSize = 16 * 1024, Period = 251 };
+
+  MemoryHttpRequest(const std::string& url, uint64_t file_size,
+                    std::chrono::milliseconds latency,
+                    std::function<void(std::function<void()>)> run)
+      : url_(url),
+        method_("GET"),
+        file_size_(file_size),
+        latency_(latency),
+        run_(run) {}
+
+  void setParameter(const std::string& parameter,
+                    const std::string& value) override {
+    parameters_[parameter] = value;
+  }
+
+  void setHeaderParameter(const std::string& parameter,
+                          const std::string& value) override {
+    headers_.insert({parameter, value});
+  }
+
+  const GetParameters& parameters() const override { return parameters_; }
+  const HeaderParameters& headerParameters() const override {
+    return headers_;
+  }
+  const std::string& url() const override { return url_; }
+  const std::string& method() const override { return method_; }
+  bool follow_redirect() const override { return true; }
+
+  void send(CompleteCallback complete, std::shared_ptr<std::istream>,
+            std::shared_ptr<std::ostream> response,
+            std::shared_ptr<std::ostream> error,
+            ICallback::Pointer) const override {
+    complete({IHttpRequest::Bad, {}, response, error});
+  }
+
+  void sendToSink(CompleteCallback complete, std::shared_ptr<std::istream>,
+                  cloudstorage::IDataSink::Pointer sink,
+                  std::shared_ptr<std::ostream> error,
+                  ICallback::Pointer) const override {
+    auto it = headers_.find("Range");
+    auto range = cloudstorage::util::parse_range(it->second);
+    auto file_size = file_size_;
+    auto latency = latency_;
+    run_([=] {
+      static const std::string data = [] {
+        std::string result(WriteSize + Period, 0);
+        for (size_t i = 0; i < result.size(); i++)
+          result[i] = static_cast<char>(i % Period);
+        return result;
+      }();
+      std::this_thread::sleep_for(latency);
+      for (uint64_t sent = 0; sent < range.size_;) {
+        auto length = std::min<uint64_t>(WriteSize, range.size_ - sent);
+        sink->write(data.data() + (range.start_ + sent) % Period,
+                    static_cast<uint32_t>(length));
+        sent += length;
+      }
+      std::stringstream content_range;
+      content_range << "bytes " << range.start_ << "-"
+                    << range.start_ + range.size_ - 1 << "/" << file_size;
+      complete({IHttpRequest::Partial,
+                {{"content-range", content_range.str()}},
+                nullptr,
+                error});
+    });
+  }
+
+ private:
+  std::string url_;
+  std::string method_;
+  uint64_t file_size_;
+  std::chrono::milliseconds latency_;
+  GetParameters parameters_;
+  HeaderParameters headers_;
+  std::function<void(std::function<void()>)> run_;
+};
+
+class MemoryHttp : public cloudstorage::IHttp {
+ public:
+  MemoryHttp(uint64_t file_size, std::chrono::milliseconds latency)
+      : file_size_(file_size), latency_(latency) {}
+
+  ~MemoryHttp() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto&& thread : threads_) thread.join();
+  }
+
+  cloudstorage::IHttpRequest::Pointer create(const std::string& url,
+                                             const std::string&,
+                                             bool) const override {
+    return std::make_shared<MemoryHttpRequest>(
+        url, file_size_, latency_, [this](std::function<void()> task) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          threads_.emplace_back(task);
+        });
+  }
+
+ private:
+  uint64_t file_size_;
+  std::chrono::milliseconds latency_;
+  mutable std::mutex mutex_;
+  mutable std::vector<std::thread> threads_;
+};
+
+/**
+ * Captures callback of the server created by CloudProvider, so that requests
+ * can be passed to it directly.
+ */
+class MemoryServerFactory : public cloudstorage::IHttpServerFactory {
+ public:
+  class Server : public cloudstorage::IHttpServer {
+   public:
+    Server(ICallback::Pointer callback) : callback_(callback) {}
+    ICallback::Pointer callback() const override { return callback_; }
+
+   private:
+    ICallback::Pointer callback_;
+  };
+
+  cloudstorage::IHttpServer::Pointer create(
+      cloudstorage::IHttpServer::ICallback::Pointer callback,
+      const std::string&, cloudstorage::IHttpServer::Type) override {
+    callback_ = callback;
+    return cloudstorage::util::make_unique<Server>(callback);
+  }
+
+  cloudstorage::IHttpServer::ICallback::Pointer callback_;
+};
+
+/**
+ * Provider with a single file "file.mp4" in its root directory, downloaded
+ * through MemoryHttp.
+ */
+class MemoryProvider : public cloudstorage::CloudProvider {
+ public:
+  class Auth : public cloudstorage::Auth {
+    std::string authorizeLibraryUrl() const override { return ""; }
+    cloudstorage::IHttpRequest::Pointer exchangeAuthorizationCodeRequest(
+        std::ostream&) const override {
+      return nullptr;
+    }
+    cloudstorage::IHttpRequest::Pointer refreshTokenRequest(
+        std::ostream&) const override {
+      return nullptr;
+    }
+    Token::Pointer exchangeAuthorizationCodeResponse(
+        std::istream&) const override {
+      return nullptr;
+    }
+    Token::Pointer refreshTokenResponse(std::istream&) const override {
+      return nullptr;
+    }
+  };
+
+  MemoryProvider(uint64_t file_size)
+      : CloudProvider(cloudstorage::util::make_unique<Auth>()),
+        file_size_(file_size) {}
+
+  std::string name() const override { return "memory"; }
+  std::string endpoint() const override { return "memory://"; }
+
+  cloudstorage::IItem::Pointer file(const std::string& id) const {
+    return std::make_shared<cloudstorage::Item>(
+        "file.mp4", id, file_size_, cloudstorage::IItem::UnknownTimeStamp,
+        cloudstorage::IItem::FileType::Video);
+  }
+
+  GetItemDataRequest::Pointer getItemDataAsync(
+      const std::string& id,
+      cloudstorage::GetItemDataCallback callback) override {
+    using Request = cloudstorage::Request<
+        cloudstorage::EitherError<cloudstorage::IItem>>;
+    return std::make_shared<Request>(
+               shared_from_this(), callback,
+               [=](Request::Pointer r) { r->done(file(id)); })
+        ->run();
+  }
+
+  ListDirectoryRequest::Pointer listDirectorySimpleAsync(
+      cloudstorage::IItem::Pointer,
+      cloudstorage::ListDirectoryCallback callback) override {
+    using Request = cloudstorage::Request<
+        cloudstorage::EitherError<cloudstorage::IItem::List>>;
+    return std::make_shared<Request>(shared_from_this(), callback,
+                                     [=](Request::Pointer r) {
+                                       r->done(cloudstorage::IItem::List{
+                                           file("file")});
+                                     })
+        ->run();
+  }
+
+  cloudstorage::IHttpRequest::Pointer downloadFileRequest(
+      const cloudstorage::IItem& item, std::ostream&) const override {
+    return http()->create(endpoint() + item.id());
+  }
+
+ private:
+  uint64_t file_size_;
+};
+
+#endif  // MEMORYPROVIDER_H
@@ -0,0 +1,69 @@
+/*****************************************************************************
+ * PathCacheTest.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "gtest/gtest.h"
+
+#include "Utility/Item.h"
+#include "Utility/PathCache.h"
+
+using namespace cloudstorage;
+
+namespace {
+
+IItem::Pointer item(const std::string& id) {
+  return std::make_shared<Item>(id, id, IItem::UnknownSize,
+                                IItem::UnknownTimeStamp,
+                                IItem::FileType::Directory);
+}
+
+}  // namespace
+
+TEST(PathCacheTest, FindsDeepestCachedPrefix) {
+  PathCache cache("root");
+  cache.put("/a", item("a"));
+  cache.put("/a/b", item("b"));
+  std::string prefix;
+  auto result = cache.find("/a/b/c/d", prefix);
+  ASSERT_TRUE(result);
+  EXPECT_EQ(result->id(), "b");
+  EXPECT_EQ(prefix, "/a/b");
+  EXPECT_FALSE(cache.find("/ab", prefix));
+  EXPECT_EQ(prefix, "");
+}
+
+TEST(PathCacheTest, InvalidatesSubtree) {
+  PathCache cache("root");
+  cache.put("/a", item("a"));
+  cache.put("/a/b", item("b"));
+  cache.put("/a/b/c", item("c"));
+  cache.put("/ab", item("ab"));
+  cache.invalidate("b");
+  std::string prefix;
+  EXPECT_EQ(cache.find("/a/b/c", prefix)->id(), "a");
+  EXPECT_EQ(cache.find("/ab", prefix)->id(), "ab");
+  cache.invalidate("a", "ab");
+  EXPECT_TRUE(cache.find("/ab", prefix));
+  cache.invalidate("root", "ab");
+  EXPECT_FALSE(cache.find("/ab", prefix));
+  cache.invalidate("root");
+  EXPECT_FALSE(cache.find("/a", prefix));
+}
@@ -0,0 +1,127 @@
+/*****************************************************************************
+ * RateLimiterTest.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <future>
+
+#include "Request/Request.h"
+#include "Utility/HttpMock.h"
+#include "Utility/MemoryProvider.h"
+#include "Utility/RateLimiter.h"
+
+using namespace cloudstorage;
+using namespace std::chrono;
+using ::testing::_;
+using ::testing::AtLeast;
+using ::testing::Invoke;
+
+TEST(RateLimiterTest, ParsesRetryAfter) {
+  EXPECT_EQ(RateLimiter::parseRetryAfter("120"), seconds(120));
+  EXPECT_EQ(RateLimiter::parseRetryAfter("Wed, 21 Oct 2015 07:28:00 GMT"),
+            RateLimiter::Clock::duration::zero());
+  EXPECT_EQ(RateLimiter::parseRetryAfter("soon"),
+            RateLimiter::Clock::duration::zero());
+  EXPECT_EQ(RateLimiter::parseRetryAfter(""),
+            RateLimiter::Clock::duration::zero());
+}
+
+TEST(RateLimiterTest, BackoffGrowsWithAttempts) {
+  RateLimiter limiter;
+  for (int attempt = 0; attempt < 4; attempt++) {
+    auto limit = milliseconds(500) * (1 << attempt);
+    auto delay = limiter.throttled(attempt, seconds(0));
+    EXPECT_GE(delay, limit / 2);
+    EXPECT_LE(delay, limit);
+  }
+  EXPECT_EQ(limiter.throttled(0, seconds(3)), seconds(3));
+  EXPECT_EQ(limiter.statistics().throttled_, 5u);
+}
+
+TEST(RateLimiterTest, DelaysRequestsAfterRetryAfter) {
+  RateLimiter limiter;
+  limiter.throttled(0, milliseconds(200));
+  std::promise<RateLimiter::Clock::time_point> run;
+  auto start = RateLimiter::Clock::now();
+  limiter.acquire([&] { run.set_value(RateLimiter::Clock::now()); },
+                  [] { return false; });
+  EXPECT_GE(run.get_future().get() - start, milliseconds(150));
+  EXPECT_EQ(limiter.statistics().delayed_, 1u);
+}
+
+TEST(RateLimiterTest, AbortedTaskRunsEarly) {
+  RateLimiter limiter;
+  std::promise<void> run;
+  auto start = RateLimiter::Clock::now();
+  limiter.schedule(minutes(1), [&] { run.set_value(); }, [] { return true; });
+  run.get_future().wait();
+  EXPECT_LT(RateLimiter::Clock::now() - start, seconds(1));
+}
+
+TEST(RateLimiterTest, SpeedsUpOnlyAfterSuccessfulResponses) {
+  int code = IHttpRequest::InternalServerError;
+  ICloudProvider::InitData data;
+  data.http_engine_ = util::make_unique<HttpMock>();
+  data.http_server_ = util::make_unique<MemoryServerFactory>();
+  EXPECT_CALL(static_cast<HttpMock&>(*data.http_engine_), create(_, _, _))
+      .WillRepeatedly(Invoke([&](const std::string&, const std::string&, bool) {
+        auto request = std::make_shared<HttpRequestMock>();
+        EXPECT_CALL(*request, setHeaderParameter(_, _)).Times(AtLeast(0));
+        EXPECT_CALL(*request, send(_, _, _, _, _))
+            .WillOnce(Invoke([&](IHttpRequest::CompleteCallback complete,
+                                 std::shared_ptr<std::istream>,
+                                 std::shared_ptr<std::ostream> response,
+                                 std::shared_ptr<std::ostream> error,
+                                 IHttpRequest::ICallback::Pointer) {
+              complete({code, {}, response, error});
+            }));
+        return request;
+      }));
+  auto provider = std::make_shared<MemoryProvider>(0);
+  provider->initialize(std::move(data));
+  auto send = [&] {
+    using Request = cloudstorage::Request<EitherError<void>>;
+    std::make_shared<Request>(provider, [](EitherError<void>) {},
+                              [](Request::Pointer r) {
+                                r->request(
+                                    [=](util::Output) {
+                                      return r->provider()->http()->create(
+                                          "url", "GET");
+                                    },
+                                    [=](EitherError<Response> e) {
+                                      if (e.left()) return r->done(e.left());
+                                      r->done(nullptr);
+                                    });
+                              })
+        ->run()
+        ->result();
+    return provider->requestStatistics().request_rate_;
+  };
+  provider->rate_limiter()->throttled(0, seconds(0));
+  auto rate = provider->requestStatistics().request_rate_;
+  EXPECT_GT(rate, 0);
+  EXPECT_EQ(send(), rate);
+  code = IHttpRequest::Ok;
+  EXPECT_GT(send(), rate);
+  provider->destroy();
+}
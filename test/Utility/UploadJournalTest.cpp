@@ -0,0 +1,112 @@
+/*****************************************************************************
+ * UploadJournalTest.cpp
+ *
+ *****************************************************************************
+ * Copyright (C) 2016-2016 VideoLAN
+ *
+ * Authors: Paweł Wegner <pawel.wegner95@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+#include "gtest/gtest.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+
+#include "Utility/UploadJournal.h"
+#include "Utility/Utility.h"
+
+using namespace cloudstorage;
+
+namespace {
+
+class UploadJournalTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    path_ = util::temporary_directory() + "cloudstorage-test-uploads.json";
+    cleanup();
+  }
+
+  void TearDown() override { cleanup(); }
+
+  void cleanup() {
+    std::remove(path_.c_str());
+    std::remove((path_ + ".tmp").c_str());
+  }
+
+  std::string path_;
+};
+
+Json::Value session(const std::string& id) {
+  Json::Value json;
+  json["session_id"] = id;
+  return json;
+}
+
+}  // namespace
+
+TEST_F(UploadJournalTest, PersistsAcrossInstances) {
+  auto key = UploadJournal::key("provider", "account", "parent", "file", 10);
+  UploadJournal(path_).put(key, session("session"));
+  EXPECT_EQ(UploadJournal(path_).get(key)["session_id"], "session");
+  EXPECT_FALSE(std::ifstream(path_ + ".tmp"));
+  UploadJournal(path_).remove(key);
+  EXPECT_TRUE(UploadJournal(path_).get(key).isNull());
+}
+
+TEST_F(UploadJournalTest, KeyDependsOnUpload) {
+  auto key = UploadJournal::key("provider", "account", "parent", "file", 10);
+  EXPECT_NE(UploadJournal::key("other", "account", "parent", "file", 10), key);
+  EXPECT_NE(UploadJournal::key("provider", "other", "parent", "file", 10), key);
+  EXPECT_NE(UploadJournal::key("provider", "account", "other", "file", 10),
+            key);
+  EXPECT_NE(UploadJournal::key("provider", "account", "parent", "other", 10),
+            key);
+  EXPECT_NE(UploadJournal::key("provider", "account", "parent", "file", 11),
+            key);
+}
+
+TEST_F(UploadJournalTest, SharesJournalOfFile) {
+  EXPECT_EQ(UploadJournal::create(""), nullptr);
+  auto journal = UploadJournal::create(path_);
+  EXPECT_EQ(UploadJournal::create(path_), journal);
+  journal->put("key", session("session"));
+  EXPECT_EQ(UploadJournal::create(path_)->get("key")["session_id"],
+            "session");
+}
+
+TEST_F(UploadJournalTest, DropsOldSessions) {
+  auto now = std::chrono::duration_cast<std::chrono::seconds>(
+                 std::chrono::system_clock::now().time_since_epoch())
+                 .count();
+  Json::Value json;
+  json["sessions"]["old"]["session"] = session("old");
+  json["sessions"]["old"]["time"] = Json::Int64(now - 8 * 24 * 60 * 60);
+  json["sessions"]["new"]["session"] = session("new");
+  json["sessions"]["new"]["time"] = Json::Int64(now - 60);
+  std::ofstream(path_) << util::json::to_string(json);
+  UploadJournal journal(path_);
+  EXPECT_TRUE(journal.get("old").isNull());
+  EXPECT_EQ(journal.get("new")["session_id"], "new");
+}
+
+TEST_F(UploadJournalTest, IgnoresInvalidFile) {
+  std::ofstream(path_) << "{\"sessions\": ";
+  UploadJournal journal(path_);
+  EXPECT_TRUE(journal.get("key").isNull());
+  journal.put("key", session("session"));
+  EXPECT_EQ(UploadJournal(path_).get("key")["session_id"], "session");
+}